@@ -0,0 +1,1107 @@
+//
+//  CSVFile.cpp
+//  Jon Edwards Code Sample
+//
+//  Zero-copy reading of CSV files
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <zlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(LDB_USE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "CSVFile.h"
+
+BEGIN_NAMESPACE(LDB)
+
+namespace
+{
+	const uint64_t kEvenBits = 0x5555555555555555;
+	const uint8_t kGzipMagic[] = { 0x1f, 0x8b };
+	const uint8_t kZstdMagic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+	//------------------------------------------------------------------------
+	// FindEscaped : Given the escape characters of a block, returns the
+	// characters they escape. An escape character escapes the next
+	// character, so in a run of escape characters every other one is
+	// escaped, and the character after the run is escaped if the run has
+	// odd length. Adding the start of a run to the run carries through it,
+	// giving the run's range, and which characters in the range are escaped
+	// depends on whether the run starts on an even or an odd bit.
+	// escapedCarry is 1 if the first character of the block is escaped, and
+	// is set for the next block.
+	//------------------------------------------------------------------------
+	inline uint64_t FindEscaped(uint64_t escapes, uint64_t &escapedCarry)
+	{
+		escapes &= ~escapedCarry;
+		uint64_t runStarts = escapes & ~(escapes << 1);
+		uint64_t evenRuns = (escapes + (runStarts & kEvenBits)) ^ escapes;
+		uint64_t oddRuns = (escapes + (runStarts & ~kEvenBits)) ^ escapes;
+
+		uint64_t escaped = ((escapes << 1) & ((evenRuns & ~kEvenBits) | (oddRuns & kEvenBits))) | escapedCarry;
+		escapedCarry = (escapes & ~escaped) >> 63;
+		return escaped;
+	}
+
+	//------------------------------------------------------------------------
+	// PrefixXor : Bit i of the result is the XOR of bits 0 to i, so given
+	// quote bits it sets the bits from each opening quote up to, but not
+	// including, its closing quote
+	//------------------------------------------------------------------------
+	inline uint64_t PrefixXor(uint64_t bits)
+	{
+		bits ^= bits << 1;
+		bits ^= bits << 2;
+		bits ^= bits << 4;
+		bits ^= bits << 8;
+		bits ^= bits << 16;
+		bits ^= bits << 32;
+		return bits;
+	}
+}
+
+//============================================================================
+//
+//							MappedCSVFile
+//
+//============================================================================
+
+MappedCSVFile::MappedCSVFile()
+	: m_mapping(NULL), m_data(NULL), m_size(0), m_pos(0)
+{
+
+}
+
+MappedCSVFile::~MappedCSVFile()
+{
+	Close();
+}
+
+//----------------------------------------------------------------------------
+// MappedCSVFile::Open : Maps a regular file. Empty files aren't mapped and
+// have no lines.
+//----------------------------------------------------------------------------
+bool MappedCSVFile::Open(const char *fileName)
+{
+	Close();
+
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+	{
+		close(fd);
+		return false;
+	}
+
+	if (fileStat.st_size > 0)
+	{
+		void *mapping = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+
+		// Lines are read front to back, so read ahead aggressively
+		madvise(mapping, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+
+		m_mapping = mapping;
+		m_data = (const char *)mapping;
+		m_size = (size_t)fileStat.st_size;
+	}
+
+	close(fd);
+	return true;
+}
+
+void MappedCSVFile::Close()
+{
+	if (m_mapping != NULL)
+	{
+		munmap(m_mapping, m_size);
+	}
+
+	m_mapping = NULL;
+	m_data = NULL;
+	m_size = 0;
+	m_pos = 0;
+}
+
+bool MappedCSVFile::ReadLine(string_view &line)
+{
+	string_view data(m_data + m_pos, m_size - m_pos);
+	if (!SplitLine(data, line))
+	{
+		return false;
+	}
+
+	m_pos = m_size - data.size();
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// MappedCSVFile::ReadChunk : Records are single lines, so a chunk can end
+// after any line ending, even inside a quote
+//----------------------------------------------------------------------------
+bool MappedCSVFile::ReadChunk(size_t chunkSize, string_view &chunk)
+{
+	if (m_pos >= m_size)
+	{
+		return false;
+	}
+
+	// Extend the chunk to the end of the line holding its last byte
+	size_t end = min(m_pos + max(chunkSize, (size_t)1), m_size);
+	const char *lineEnd = (const char *)memchr(m_data + end - 1, '\n', m_size - (end - 1));
+	end = lineEnd != NULL ? lineEnd - m_data + 1 : m_size;
+
+	chunk = string_view(m_data + m_pos, end - m_pos);
+	m_pos = end;
+	return true;
+}
+
+bool MappedCSVFile::SplitLine(string_view &data, string_view &line)
+{
+	if (data.empty())
+	{
+		return false;
+	}
+
+	const char *end = (const char *)memchr(data.data(), '\n', data.size());
+	if (end == NULL)
+	{
+		// Last line has no line ending
+		line = data;
+		data = string_view();
+	}
+	else
+	{
+		line = data.substr(0, end - data.data());
+		data.remove_prefix(line.size() + 1);
+	}
+
+	return true;
+}
+
+uint32_t MappedCSVFile::CountLines(string_view data)
+{
+	uint32_t lineCount = 0;
+	const char *pos = data.data();
+	const char *end = data.data() + data.size();
+	while (pos < end)
+	{
+		const char *lineEnd = (const char *)memchr(pos, '\n', end - pos);
+		pos = lineEnd != NULL ? lineEnd + 1 : end;
+		lineCount++;
+	}
+	return lineCount;
+}
+
+//============================================================================
+//
+//							CSVDecompressor
+//
+//============================================================================
+
+CSVDecompressor::CSVDecompressor()
+	: m_format(Format_None), m_gzipStream(NULL), m_zstdStream(NULL), m_streamComplete(true), m_outputPending(false)
+{
+
+}
+
+CSVDecompressor::~CSVDecompressor()
+{
+	Stop();
+}
+
+CSVDecompressor::Format CSVDecompressor::DetectFormat(const char *data, size_t size)
+{
+	if (size >= sizeof(kGzipMagic) && memcmp(data, kGzipMagic, sizeof(kGzipMagic)) == 0)
+	{
+		return Format_Gzip;
+	}
+	if (size >= sizeof(kZstdMagic) && memcmp(data, kZstdMagic, sizeof(kZstdMagic)) == 0)
+	{
+		return Format_Zstd;
+	}
+	return Format_None;
+}
+
+CSVDecompressor::Format CSVDecompressor::DetectFileFormat(const char *fileName)
+{
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+	{
+		return Format_None;
+	}
+
+	char magic[kCompressionMagicSize];
+	ssize_t readSize = read(fd, magic, sizeof(magic));
+	close(fd);
+	return DetectFormat(magic, readSize > 0 ? readSize : 0);
+}
+
+bool CSVDecompressor::Start(Format format)
+{
+	Stop();
+
+	m_format = format;
+	switch (format)
+	{
+	case Format_None:
+		break;
+
+	case Format_Gzip:
+		// Adding 16 to the window bits reads a gzip header and trailer
+		m_gzipStream = new z_stream();
+		if (inflateInit2(m_gzipStream, 16 + MAX_WBITS) != Z_OK)
+		{
+			LogError("Error: CSVDecompressor - couldn't start gzip decompression\n");
+			delete m_gzipStream;
+			m_gzipStream = NULL;
+			return false;
+		}
+		break;
+
+	case Format_Zstd:
+#if defined(LDB_USE_ZSTD)
+		m_zstdStream = ZSTD_createDCtx();
+		if (m_zstdStream == NULL)
+		{
+			LogError("Error: CSVDecompressor - couldn't start zstd decompression\n");
+			return false;
+		}
+		break;
+#else
+		LogError("Error: CSVDecompressor - zstd input isn't supported by this build\n");
+		return false;
+#endif
+	}
+
+	m_streamComplete = format == Format_None;
+	m_outputPending = false;
+	return true;
+}
+
+void CSVDecompressor::Stop()
+{
+	if (m_gzipStream != NULL)
+	{
+		inflateEnd(m_gzipStream);
+		delete m_gzipStream;
+		m_gzipStream = NULL;
+	}
+
+#if defined(LDB_USE_ZSTD)
+	if (m_zstdStream != NULL)
+	{
+		ZSTD_freeDCtx(m_zstdStream);
+		m_zstdStream = NULL;
+	}
+#endif
+
+	m_format = Format_None;
+	m_streamComplete = true;
+	m_outputPending = false;
+}
+
+bool CSVDecompressor::Decompress(const char *input, size_t inputSize, size_t &inputUsed, char *output,
+	size_t outputSize, size_t &outputUsed)
+{
+	inputUsed = 0;
+	outputUsed = 0;
+	if (m_format == Format_None)
+	{
+		outputUsed = min(inputSize, outputSize);
+		memcpy(output, input, outputUsed);
+		inputUsed = outputUsed;
+		return true;
+	}
+
+	if (m_format == Format_Gzip)
+	{
+		m_gzipStream->next_in = (Bytef *)input;
+		m_gzipStream->avail_in = (uInt)min(inputSize, (size_t)UINT_MAX);
+		m_gzipStream->next_out = (Bytef *)output;
+		m_gzipStream->avail_out = (uInt)min(outputSize, (size_t)UINT_MAX);
+		int result = inflate(m_gzipStream, Z_NO_FLUSH);
+		inputUsed = (const char *)m_gzipStream->next_in - input;
+		outputUsed = (char *)m_gzipStream->next_out - output;
+
+		if (result == Z_STREAM_END)
+		{
+			// Another member may follow
+			m_streamComplete = true;
+			inflateReset(m_gzipStream);
+		}
+		else if (result == Z_OK || result == Z_BUF_ERROR)
+		{
+			m_streamComplete = m_streamComplete && inputUsed == 0 && outputUsed == 0;
+		}
+		else
+		{
+			LogError("Error: CSVDecompressor - corrupt gzip input: %s\n",
+				m_gzipStream->msg != NULL ? m_gzipStream->msg : "unknown error");
+			return false;
+		}
+	}
+#if defined(LDB_USE_ZSTD)
+	else
+	{
+		ZSTD_inBuffer inBuffer = { input, inputSize, 0 };
+		ZSTD_outBuffer outBuffer = { output, outputSize, 0 };
+		size_t result = ZSTD_decompressStream(m_zstdStream, &outBuffer, &inBuffer);
+		if (ZSTD_isError(result))
+		{
+			LogError("Error: CSVDecompressor - corrupt zstd input: %s\n", ZSTD_getErrorName(result));
+			return false;
+		}
+		inputUsed = inBuffer.pos;
+		outputUsed = outBuffer.pos;
+
+		// Zero once a frame is decompressed and flushed
+		m_streamComplete = result == 0;
+	}
+#endif
+
+	m_outputPending = outputUsed == outputSize;
+	return true;
+}
+
+//============================================================================
+//
+//							StreamCSVFile
+//
+//============================================================================
+
+StreamCSVFile::StreamCSVFile()
+	: m_fd(-1), m_ownsFd(false), m_inputPos(0), m_inputSize(0), m_decompressionStarted(false), m_endOfInput(false),
+	m_error(false), m_closing(false)
+{
+
+}
+
+StreamCSVFile::~StreamCSVFile()
+{
+	Close();
+}
+
+bool StreamCSVFile::IsStream(const char *fileName)
+{
+	if (strcmp(fileName, "-") == 0)
+	{
+		return true;
+	}
+
+	struct stat fileStat;
+	return stat(fileName, &fileStat) == 0 && (S_ISFIFO(fileStat.st_mode) || S_ISCHR(fileStat.st_mode));
+}
+
+bool StreamCSVFile::Open(const char *fileName, size_t bufferSize, uint32_t bufferCount)
+{
+	Close();
+
+	if (strcmp(fileName, "-") == 0)
+	{
+		m_fd = STDIN_FILENO;
+		m_ownsFd = false;
+	}
+	else
+	{
+		// Opening a pipe waits for its writer
+		m_fd = open(fileName, O_RDONLY);
+		if (m_fd < 0)
+		{
+			return false;
+		}
+		m_ownsFd = true;
+	}
+
+	m_buffers.resize(max(bufferCount, 1u));
+	for (uint32_t i = 0; i < m_buffers.size(); i++)
+	{
+		m_buffers[i].data.resize(max(bufferSize, (size_t)1));
+		m_buffers[i].size = 0;
+		m_freeBuffers.push_back(i);
+	}
+
+	m_thread = thread(&StreamCSVFile::ReadMain, this);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// StreamCSVFile::Close : The reader thread checks for Close between reads
+// and while waiting for input, so closing before the end of the input
+// doesn't wait for the writer.
+//----------------------------------------------------------------------------
+void StreamCSVFile::Close()
+{
+	if (m_thread.joinable())
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_closing = true;
+		}
+		m_bufferReleased.notify_all();
+		m_thread.join();
+	}
+
+	if (m_ownsFd)
+	{
+		close(m_fd);
+	}
+
+	m_fd = -1;
+	m_ownsFd = false;
+	m_decompressor.Stop();
+	m_input.clear();
+	m_inputPos = 0;
+	m_inputSize = 0;
+	m_decompressionStarted = false;
+	m_buffers.clear();
+	m_freeBuffers.clear();
+	m_filledBuffers.clear();
+	m_heldBuffers.clear();
+	m_endOfInput = false;
+	m_error = false;
+	m_closing = false;
+}
+
+bool StreamCSVFile::ReadChunk(string_view &chunk)
+{
+	unique_lock<mutex> lock(m_mutex);
+
+	// No buffer can be filled while the caller holds them all
+	if (m_filledBuffers.empty() && m_heldBuffers.size() == m_buffers.size())
+	{
+		ASSERT(m_buffers.empty(), "StreamCSVFile::ReadChunk - every buffer is held");
+		return false;
+	}
+
+	m_bufferFilled.wait(lock, [this]() { return !m_filledBuffers.empty() || m_endOfInput; });
+	if (m_filledBuffers.empty())
+	{
+		return false;
+	}
+
+	uint32_t bufferIndex = m_filledBuffers.front();
+	m_filledBuffers.pop_front();
+	m_heldBuffers.push_back(bufferIndex);
+
+	const Buffer &buffer = m_buffers[bufferIndex];
+	chunk = string_view(buffer.data.data(), buffer.size);
+	return true;
+}
+
+void StreamCSVFile::ReleaseChunks()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_freeBuffers.insert(m_freeBuffers.end(), m_heldBuffers.begin(), m_heldBuffers.end());
+		m_heldBuffers.clear();
+	}
+	m_bufferReleased.notify_all();
+}
+
+bool StreamCSVFile::IsChunkReady()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return !m_filledBuffers.empty() || m_endOfInput;
+}
+
+bool StreamCSVFile::HasError()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_error;
+}
+
+//----------------------------------------------------------------------------
+// StreamCSVFile::ReadMain : Fills free buffers in turn. The partial line at
+// the end of a buffer is moved to the start of the next, and a buffer that
+// fills without a line ending is grown. At the end of the input the last
+// line is kept even without a line ending, unless reading failed.
+//----------------------------------------------------------------------------
+void StreamCSVFile::ReadMain()
+{
+	string partialLine;
+	bool endOfInput = false;
+	bool error = false;
+	while (!endOfInput)
+	{
+		uint32_t bufferIndex;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_bufferReleased.wait(lock, [this]() { return !m_freeBuffers.empty() || m_closing; });
+			if (m_closing)
+			{
+				return;
+			}
+			bufferIndex = m_freeBuffers.front();
+			m_freeBuffers.pop_front();
+		}
+
+		vector<char> &data = m_buffers[bufferIndex].data;
+		if (data.size() < partialLine.size())
+		{
+			data.resize(partialLine.size());
+		}
+		memcpy(data.data(), partialLine.data(), partialLine.size());
+		size_t size = partialLine.size();
+		size_t linesSize = 0;		// Bytes up to the last line ending
+		partialLine.clear();
+
+		for (;;)
+		{
+			if (size == data.size())
+			{
+				if (linesSize > 0)
+				{
+					break;
+				}
+				data.resize(data.size() * 2);
+			}
+			else if (linesSize > 0 && !IsInputWaiting())
+			{
+				break;
+			}
+
+			ssize_t readSize = ReadDecompressed(data.data() + size, data.size() - size);
+			if (readSize <= 0)
+			{
+				endOfInput = true;
+				error = readSize < 0;
+				break;
+			}
+
+			for (size_t pos = size + readSize; pos > size; pos--)
+			{
+				if (data[pos - 1] == '\n')
+				{
+					linesSize = pos;
+					break;
+				}
+			}
+			size += readSize;
+		}
+
+		// A line cut off by a read error is dropped
+		if (!endOfInput || error)
+		{
+			partialLine.assign(data.data() + linesSize, size - linesSize);
+			size = linesSize;
+		}
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_buffers[bufferIndex].size = size;
+			if (size > 0)
+			{
+				m_filledBuffers.push_back(bufferIndex);
+			}
+			else
+			{
+				m_freeBuffers.push_back(bufferIndex);
+			}
+			m_endOfInput = endOfInput;
+			m_error = error;
+		}
+		m_bufferFilled.notify_all();
+	}
+}
+
+//----------------------------------------------------------------------------
+// StreamCSVFile::ReadInput : Reads what's available, up to size bytes.
+// Returns 0 at the end of the input or once the file is closed, and -1 if
+// reading fails.
+//----------------------------------------------------------------------------
+ssize_t StreamCSVFile::ReadInput(char *data, size_t size)
+{
+	for (;;)
+	{
+		struct pollfd pollFd = { m_fd, POLLIN, 0 };
+		int ready = poll(&pollFd, 1, kStreamPollTimeout);
+		{
+			lock_guard<mutex> lock(m_mutex);
+			if (m_closing)
+			{
+				return 0;
+			}
+		}
+
+		if (ready == 0 || (ready < 0 && errno == EINTR))
+		{
+			continue;
+		}
+
+		ssize_t readSize = read(m_fd, data, size);
+		if (readSize < 0 && (errno == EINTR || errno == EAGAIN))
+		{
+			continue;
+		}
+		return readSize;
+	}
+}
+
+//----------------------------------------------------------------------------
+// StreamCSVFile::ReadDecompressed : Reads like ReadInput, decompressing
+// compressed input. Input that ends part way through a compressed stream
+// is an error, unless the file is being closed.
+//----------------------------------------------------------------------------
+ssize_t StreamCSVFile::ReadDecompressed(char *data, size_t size)
+{
+	if (!m_decompressionStarted)
+	{
+		if (!StartDecompression())
+		{
+			return -1;
+		}
+		m_decompressionStarted = true;
+	}
+
+	for (;;)
+	{
+		if (m_inputPos == m_inputSize && !m_decompressor.IsOutputPending())
+		{
+			// Uncompressed input is read straight into the buffer once the
+			// bytes read to detect its format are used
+			if (m_decompressor.GetFormat() == CSVDecompressor::Format_None)
+			{
+				return ReadInput(data, size);
+			}
+
+			ssize_t readSize = ReadInput(m_input.data(), m_input.size());
+			if (readSize < 0)
+			{
+				return -1;
+			}
+			if (readSize == 0)
+			{
+				if (!m_decompressor.IsStreamComplete() && !IsClosing())
+				{
+					LogError("Error: StreamCSVFile - compressed input is truncated\n");
+					return -1;
+				}
+				return 0;
+			}
+			m_inputPos = 0;
+			m_inputSize = readSize;
+		}
+
+		size_t inputUsed;
+		size_t outputUsed;
+		if (!m_decompressor.Decompress(m_input.data() + m_inputPos, m_inputSize - m_inputPos, inputUsed, data, size,
+			outputUsed))
+		{
+			return -1;
+		}
+		m_inputPos += inputUsed;
+		if (outputUsed > 0)
+		{
+			return outputUsed;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// StreamCSVFile::StartDecompression : Reads enough input to detect its
+// format from the magic number, and starts decompressing it
+//----------------------------------------------------------------------------
+bool StreamCSVFile::StartDecompression()
+{
+	m_input.resize(kCompressedInputSize);
+	m_inputPos = 0;
+	m_inputSize = 0;
+	while (m_inputSize < kCompressionMagicSize)
+	{
+		ssize_t readSize = ReadInput(m_input.data() + m_inputSize, m_input.size() - m_inputSize);
+		if (readSize < 0)
+		{
+			return false;
+		}
+		if (readSize == 0)
+		{
+			break;
+		}
+		m_inputSize += readSize;
+	}
+
+	return m_decompressor.Start(CSVDecompressor::DetectFormat(m_input.data(), m_inputSize));
+}
+
+bool StreamCSVFile::IsInputWaiting() const
+{
+	if (m_inputPos < m_inputSize || m_decompressor.IsOutputPending())
+	{
+		return true;
+	}
+
+	struct pollfd pollFd = { m_fd, POLLIN, 0 };
+	return poll(&pollFd, 1, 0) > 0;
+}
+
+bool StreamCSVFile::IsClosing()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_closing;
+}
+
+//============================================================================
+//
+//							CSVInputFile
+//
+//============================================================================
+
+bool CSVInputFile::Open(const char *fileName, size_t chunkSize, uint32_t heldChunkCount)
+{
+	Close();
+
+	m_chunkSize = chunkSize;
+	m_streamed = StreamCSVFile::IsStream(fileName)
+		|| CSVDecompressor::DetectFileFormat(fileName) != CSVDecompressor::Format_None;
+	return m_streamed ? m_streamFile.Open(fileName, chunkSize, heldChunkCount + kStreamReadAheadBuffers)
+		: m_mappedFile.Open(fileName);
+}
+
+void CSVInputFile::Close()
+{
+	m_mappedFile.Close();
+	m_streamFile.Close();
+	m_streamed = false;
+}
+
+bool CSVInputFile::ReadChunk(string_view &chunk)
+{
+	return m_streamed ? m_streamFile.ReadChunk(chunk) : m_mappedFile.ReadChunk(m_chunkSize, chunk);
+}
+
+void CSVInputFile::ReleaseChunks()
+{
+	if (m_streamed)
+	{
+		m_streamFile.ReleaseChunks();
+	}
+}
+
+bool CSVInputFile::IsChunkReady()
+{
+	return !m_streamed || m_streamFile.IsChunkReady();
+}
+
+bool CSVInputFile::HasError()
+{
+	return m_streamed && m_streamFile.HasError();
+}
+
+//============================================================================
+//
+//							CSVTokenizer
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// CSVTokenizer::CSVTokenizer : Characters are classified with a table.
+// Where a character is in more than one set, escapes take precedence over
+// quotes, and quotes over delimiters, as in Util::TokenizeString.
+//----------------------------------------------------------------------------
+CSVTokenizer::CSVTokenizer(const char *delimiterChars, const char *delimiterTokenChars,
+	const char *quoteChars, const char *escapeChars)
+{
+	memset(m_charTypes, Char_Normal, sizeof(m_charTypes));
+	for (const char *c = delimiterChars; *c != '\0'; c++)
+	{
+		m_charTypes[(uint8_t)*c] = strchr(delimiterTokenChars, *c) != NULL ? Char_DelimiterToken : Char_Delimiter;
+	}
+	for (const char *c = quoteChars; *c != '\0'; c++)
+	{
+		m_charTypes[(uint8_t)*c] = Char_Quote;
+	}
+	for (const char *c = escapeChars; *c != '\0'; c++)
+	{
+		m_charTypes[(uint8_t)*c] = Char_Escape;
+	}
+
+	for (uint32_t c = 1; c < 256; c++)
+	{
+		if (m_charTypes[c] != Char_Normal)
+		{
+			m_classChars[m_charTypes[c]].push_back((char)c);
+		}
+	}
+	m_blockTokenizing = m_classChars[Char_Quote].size() <= 1;
+}
+
+const vector<string_view> &CSVTokenizer::Tokenize(string_view str)
+{
+	return m_blockTokenizing ? TokenizeBlocks(str) : TokenizeScalar(str);
+}
+
+//----------------------------------------------------------------------------
+// CSVTokenizer::TokenizeScalar : A token is a contiguous range of str until an
+// escape character is found in it, since the escape character is dropped.
+// The token is then copied to the unescaped buffer and built there. The
+// buffer is reserved to the length of str first so it never reallocates
+// while tokens refer to it.
+//----------------------------------------------------------------------------
+const vector<string_view> &CSVTokenizer::TokenizeScalar(string_view str)
+{
+	m_tokens.clear();
+	m_unescaped.clear();
+	if (m_unescaped.capacity() < str.size())
+	{
+		m_unescaped.reserve(str.size());
+	}
+
+	bool inToken = false;
+	bool unescaping = false;		// Token is being built in m_unescaped
+	size_t tokenStart = 0;			// Token range in str or m_unescaped
+	size_t tokenEnd = 0;
+	bool escaped = false;
+	char currentQuoteChar = 0;
+
+	auto endToken = [&]()
+	{
+		if (inToken)
+		{
+			m_tokens.push_back(unescaping ? string_view(m_unescaped.data() + tokenStart, m_unescaped.size() - tokenStart)
+				: str.substr(tokenStart, tokenEnd - tokenStart));
+		}
+		inToken = false;
+		unescaping = false;
+	};
+
+	for (size_t pos = 0; pos < str.size(); pos++)
+	{
+		char c = str[pos];
+		uint8_t charType = m_charTypes[(uint8_t)c];
+
+		if (escaped)											// Previous was escape char - add to token
+		{
+			escaped = false;
+		}
+		else if (charType == Char_Escape)						// Escape char - add next char to token
+		{
+			if (!unescaping)
+			{
+				size_t unescapedStart = m_unescaped.size();
+				if (inToken)
+				{
+					m_unescaped.append(str.data() + tokenStart, tokenEnd - tokenStart);
+				}
+				tokenStart = unescapedStart;
+				unescaping = true;
+			}
+			escaped = true;
+			continue;
+		}
+		else if (currentQuoteChar)								// We're in a quote
+		{
+			if (c == currentQuoteChar)
+			{
+				currentQuoteChar = 0;
+			}
+		}
+		else if (charType == Char_Quote)						// Start of quote
+		{
+			currentQuoteChar = c;
+		}
+		else if (charType != Char_Normal)						// Reached a delimiter
+		{
+			endToken();
+			if (charType == Char_DelimiterToken)
+			{
+				m_tokens.push_back(str.substr(pos, 1));
+			}
+			continue;
+		}
+
+		// Add character to token
+		if (unescaping)
+		{
+			m_unescaped.push_back(c);
+		}
+		else if (!inToken)
+		{
+			tokenStart = pos;
+		}
+		inToken = true;
+		tokenEnd = pos + 1;
+	}
+
+	endToken();
+
+	return m_tokens;
+}
+
+//----------------------------------------------------------------------------
+// CSVTokenizer::TokenizeBlocks : Tokens are the ranges between delimiters
+// outside quotes, skipping empty ranges. Escape characters don't end
+// tokens, so a range holding one is unescaped with a scalar pass. The
+// escape state at the start of a range is always clear, since a range
+// starts at the start of str or after an unescaped delimiter.
+//----------------------------------------------------------------------------
+const vector<string_view> &CSVTokenizer::TokenizeBlocks(string_view str)
+{
+	m_tokens.clear();
+	m_unescaped.clear();
+	if (m_unescaped.capacity() < str.size())
+	{
+		m_unescaped.reserve(str.size());
+	}
+
+	uint64_t escapedCarry = 0;		// First character of block is escaped
+	uint64_t quoteCarry = 0;		// All ones if block starts in a quote
+	size_t tokenStart = 0;
+	bool tokenHasEscapes = false;
+
+	for (size_t blockStart = 0; blockStart < str.size(); blockStart += kTokenizeBlockSize)
+	{
+		// The last block is copied so it can be read whole. NUL is never
+		// a special character, so the padding is never classified.
+		const char *block = str.data() + blockStart;
+		char lastBlock[kTokenizeBlockSize];
+		if (str.size() - blockStart < kTokenizeBlockSize)
+		{
+			memset(lastBlock, 0, sizeof(lastBlock));
+			memcpy(lastBlock, block, str.size() - blockStart);
+			block = lastBlock;
+		}
+
+		BlockMasks masks;
+		ClassifyBlock(block, masks);
+
+		uint64_t escaped = FindEscaped(masks.escapes, escapedCarry);
+		uint64_t escapes = masks.escapes & ~escaped;
+		uint64_t inQuote = PrefixXor(masks.quotes & ~escaped) ^ quoteCarry;
+		quoteCarry = (uint64_t)((int64_t)inQuote >> 63);
+
+		uint64_t delimiters = masks.delimiters & ~inQuote & ~escaped;
+		while (delimiters != 0)
+		{
+			uint32_t bit = (uint32_t)__builtin_ctzll(delimiters);
+			uint64_t tokenBits = (1ULL << bit) - 1;
+			tokenHasEscapes |= (escapes & tokenBits) != 0;
+			escapes &= ~tokenBits;
+
+			size_t pos = blockStart + bit;
+			AddToken(str, tokenStart, pos, tokenHasEscapes);
+			if (masks.delimiterTokens & (1ULL << bit))
+			{
+				m_tokens.push_back(str.substr(pos, 1));
+			}
+
+			tokenStart = pos + 1;
+			tokenHasEscapes = false;
+			delimiters &= delimiters - 1;
+		}
+		tokenHasEscapes |= escapes != 0;
+	}
+
+	AddToken(str, tokenStart, str.size(), tokenHasEscapes);
+
+	return m_tokens;
+}
+
+//----------------------------------------------------------------------------
+// CSVTokenizer::ClassifyBlock : Sets the mask bits for the
+// kTokenizeBlockSize characters at block
+//----------------------------------------------------------------------------
+void CSVTokenizer::ClassifyBlock(const char *block, BlockMasks &masks) const
+{
+#if defined(__SSE2__)
+	__m128i bytes[kTokenizeBlockSize / 16];
+	for (uint32_t i = 0; i < kTokenizeBlockSize / 16; i++)
+	{
+		bytes[i] = _mm_loadu_si128((const __m128i *)(block + i * 16));
+	}
+
+	auto matchChars = [&bytes](const string &chars)
+	{
+		uint64_t mask = 0;
+		for (uint32_t i = 0; i < kTokenizeBlockSize / 16; i++)
+		{
+			__m128i matches = _mm_setzero_si128();
+			for (size_t c = 0; c < chars.size(); c++)
+			{
+				matches = _mm_or_si128(matches, _mm_cmpeq_epi8(bytes[i], _mm_set1_epi8(chars[c])));
+			}
+			mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(matches) << (i * 16);
+		}
+		return mask;
+	};
+
+	masks.delimiterTokens = matchChars(m_classChars[Char_DelimiterToken]);
+	masks.delimiters = matchChars(m_classChars[Char_Delimiter]) | masks.delimiterTokens;
+	masks.quotes = matchChars(m_classChars[Char_Quote]);
+	masks.escapes = matchChars(m_classChars[Char_Escape]);
+#else
+	uint64_t typeMasks[Char_Escape + 1] = { 0 };
+	for (uint32_t i = 0; i < kTokenizeBlockSize; i++)
+	{
+		typeMasks[m_charTypes[(uint8_t)block[i]]] |= 1ULL << i;
+	}
+
+	masks.delimiterTokens = typeMasks[Char_DelimiterToken];
+	masks.delimiters = typeMasks[Char_Delimiter] | typeMasks[Char_DelimiterToken];
+	masks.quotes = typeMasks[Char_Quote];
+	masks.escapes = typeMasks[Char_Escape];
+#endif
+}
+
+//----------------------------------------------------------------------------
+// CSVTokenizer::AddToken : Adds the range of str as a token unless it's
+// empty. Escape characters in the range are dropped, keeping the
+// characters they escape.
+//----------------------------------------------------------------------------
+void CSVTokenizer::AddToken(string_view str, size_t start, size_t end, bool hasEscapes)
+{
+	if (!hasEscapes)
+	{
+		if (start < end)
+		{
+			m_tokens.push_back(str.substr(start, end - start));
+		}
+		return;
+	}
+
+	size_t unescapedStart = m_unescaped.size();
+	bool escaped = false;
+	for (size_t pos = start; pos < end; pos++)
+	{
+		if (!escaped && m_charTypes[(uint8_t)str[pos]] == Char_Escape)
+		{
+			escaped = true;
+			continue;
+		}
+		escaped = false;
+		m_unescaped.push_back(str[pos]);
+	}
+
+	if (m_unescaped.size() > unescapedStart)
+	{
+		m_tokens.push_back(string_view(m_unescaped.data() + unescapedStart, m_unescaped.size() - unescapedStart));
+	}
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,300 @@
+//
+//  CSVFile.h
+//  Jon Edwards Code Sample
+//
+//  Zero-copy reading of CSV files. MappedCSVFile maps a file and hands out
+//  its lines in place, and CSVTokenizer splits a line into string_view
+//  tokens, so loading a file doesn't allocate per line or per token and
+//  lines can be any length. Input that can't be mapped, such as stdin and
+//  pipes, is read by StreamCSVFile into a bounded set of buffers, which
+//  also decompresses gzip and zstd input.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_CSVFILE_H
+#define LDB_CSVFILE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+// Decompression stream state, from zlib.h and zstd.h
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+BEGIN_NAMESPACE(LDB)
+
+//----------------------------------------------------------------------------
+// MappedCSVFile : Read-only memory mapping of a CSV file, read a line at a
+// time. Lines are views into the mapping and stay valid until the file is
+// closed.
+//----------------------------------------------------------------------------
+class MappedCSVFile
+{
+public:
+	MappedCSVFile();
+	~MappedCSVFile();
+
+	bool Open(const char *fileName);
+	void Close();
+
+	// Gets the next line, without its '\n'. Returns false at the end of
+	// the file.
+	bool ReadLine(string_view &line);
+
+	// Gets the next chunk of whole lines, about chunkSize bytes long unless
+	// a line is longer. Returns false at the end of the file.
+	bool ReadChunk(size_t chunkSize, string_view &chunk);
+
+	// Removes the first line from data, as ReadLine does for the file.
+	// Returns false if data is empty.
+	static bool SplitLine(string_view &data, string_view &line);
+	static uint32_t CountLines(string_view data);
+
+	size_t GetSize() const { return m_size; }
+
+private:
+	MappedCSVFile(const MappedCSVFile &);				// Not copyable
+	MappedCSVFile &operator=(const MappedCSVFile &);
+
+	void *m_mapping;
+	const char *m_data;
+	size_t m_size;
+	size_t m_pos;			// Start of next line
+};
+
+const size_t kTokenizeBlockSize = 64;
+
+const uint32_t kStreamReadAheadBuffers = 2;		// Buffers filled while the
+													// caller holds others
+const int kStreamPollTimeout = 100;					// Milliseconds between
+													// checks for Close
+const size_t kCompressedInputSize = 256 * 1024;		// Compressed bytes read
+													// at a time
+const size_t kCompressionMagicSize = 4;				// Bytes needed to detect
+													// the input's format
+
+//----------------------------------------------------------------------------
+// CSVDecompressor : Incremental gzip or zstd decompression, detecting the
+// format from the magic number at the start of the input. Concatenated
+// gzip members and zstd frames are decompressed in turn. zstd needs
+// libzstd, so it's only supported when built with LDB_USE_ZSTD defined.
+//----------------------------------------------------------------------------
+class CSVDecompressor
+{
+public:
+	enum Format
+	{
+		Format_None = 0,			// Not compressed
+		Format_Gzip,
+		Format_Zstd
+	};
+
+	CSVDecompressor();
+	~CSVDecompressor();
+
+	static Format DetectFormat(const char *data, size_t size);
+	static Format DetectFileFormat(const char *fileName);
+
+	bool Start(Format format);
+	void Stop();
+
+	// Decompresses as much of input as fits in output, returning the bytes
+	// used of each. Returns false if the input is corrupt.
+	bool Decompress(const char *input, size_t inputSize, size_t &inputUsed, char *output, size_t outputSize,
+		size_t &outputUsed);
+
+	// True if the input so far ends with a whole member or frame, so the
+	// input can end there
+	bool IsStreamComplete() const { return m_streamComplete; }
+
+	// True if the last call filled output, so more may be waiting even
+	// without more input
+	bool IsOutputPending() const { return m_outputPending; }
+
+	Format GetFormat() const { return m_format; }
+
+private:
+	CSVDecompressor(const CSVDecompressor &);				// Not copyable
+	CSVDecompressor &operator=(const CSVDecompressor &);
+
+	Format m_format;
+	z_stream_s *m_gzipStream;
+	ZSTD_DCtx_s *m_zstdStream;
+	bool m_streamComplete;
+	bool m_outputPending;
+};
+
+//----------------------------------------------------------------------------
+// StreamCSVFile : Reads a file that can't be mapped, such as stdin or a
+// pipe, on a reader thread into a fixed number of buffers of whole lines.
+// The reader waits for the caller to release buffers before filling them,
+// so a fast producer is held back rather than growing memory. A buffer is
+// handed over once it's full or no more input is waiting, so lines are
+// processed as they arrive. Buffers only grow to hold a longer line.
+// Compressed input is decompressed on the reader thread, so the caller
+// only sees the lines.
+//----------------------------------------------------------------------------
+class StreamCSVFile
+{
+public:
+	StreamCSVFile();
+	~StreamCSVFile();
+
+	// Opens the file, or stdin if fileName is "-", and starts reading it
+	bool Open(const char *fileName, size_t bufferSize, uint32_t bufferCount);
+	void Close();
+
+	// Gets the next buffer of whole lines. Returns false at the end of the
+	// input, or if the caller holds every buffer. Chunks stay valid until
+	// ReleaseChunks is called.
+	bool ReadChunk(string_view &chunk);
+	void ReleaseChunks();
+
+	// True if ReadChunk won't wait for input
+	bool IsChunkReady();
+
+	// True if reading failed before the end of the input
+	bool HasError();
+
+	// True if fileName is stdin ("-"), a pipe or a device
+	static bool IsStream(const char *fileName);
+
+private:
+	StreamCSVFile(const StreamCSVFile &);				// Not copyable
+	StreamCSVFile &operator=(const StreamCSVFile &);
+
+	struct Buffer
+	{
+		vector<char> data;
+		size_t size;				// Bytes of whole lines in data
+	};
+
+	void ReadMain();
+	ssize_t ReadInput(char *data, size_t size);
+	ssize_t ReadDecompressed(char *data, size_t size);
+	bool StartDecompression();
+	bool IsInputWaiting() const;
+	bool IsClosing();
+
+	int m_fd;
+	bool m_ownsFd;					// False for stdin
+	CSVDecompressor m_decompressor;
+	vector<char> m_input;			// Input read but not yet decompressed
+	size_t m_inputPos;
+	size_t m_inputSize;
+	bool m_decompressionStarted;
+	vector<Buffer> m_buffers;
+	thread m_thread;
+
+	mutex m_mutex;
+	condition_variable m_bufferFilled;
+	condition_variable m_bufferReleased;
+	deque<uint32_t> m_freeBuffers;
+	deque<uint32_t> m_filledBuffers;
+	vector<uint32_t> m_heldBuffers;	// Handed to the caller
+	bool m_endOfInput;
+	bool m_error;
+	bool m_closing;
+};
+
+//----------------------------------------------------------------------------
+// CSVInputFile : Reads a CSV file in chunks of whole lines, mapping regular
+// files and streaming stdin, pipes, devices and compressed files
+//----------------------------------------------------------------------------
+class CSVInputFile
+{
+public:
+	CSVInputFile() : m_chunkSize(0), m_streamed(false) { }
+
+	// heldChunkCount is the number of chunks the caller reads before
+	// releasing them
+	bool Open(const char *fileName, size_t chunkSize, uint32_t heldChunkCount);
+	void Close();
+
+	bool ReadChunk(string_view &chunk);
+	void ReleaseChunks();
+	bool IsChunkReady();
+	bool HasError();
+
+	bool IsStreamed() const { return m_streamed; }
+
+private:
+	CSVInputFile(const CSVInputFile &);				// Not copyable
+	CSVInputFile &operator=(const CSVInputFile &);
+
+	MappedCSVFile m_mappedFile;
+	StreamCSVFile m_streamFile;
+	size_t m_chunkSize;
+	bool m_streamed;
+};
+
+//----------------------------------------------------------------------------
+// CSVTokenizer : Breaks a string into tokens the same way as
+// Util::TokenizeString. Tokens are views into the string, except tokens
+// containing escape characters, which are unescaped into a buffer owned by
+// the tokenizer. Tokens stay valid until the next call to Tokenize.
+//
+// TokenizeBlocks classifies kTokenizeBlockSize bytes at a time into bit
+// masks of delimiters, quotes and escapes (with SSE2 where available),
+// resolves escapes and quoted ranges with bit arithmetic, and only visits
+// the delimiters one by one. Quoted ranges are found with a prefix XOR of
+// the quote bits, which needs a single quote character, so Tokenize falls
+// back to TokenizeScalar for tokenizers with several.
+//----------------------------------------------------------------------------
+class CSVTokenizer
+{
+public:
+	CSVTokenizer(const char *delimiterChars = " ,\t\n", const char *delimiterTokenChars = "",
+		const char *quoteChars = "\"", const char *escapeChars = "\\");
+
+	const vector<string_view> &Tokenize(string_view str);
+
+	// Tokenize using a specific implementation
+	const vector<string_view> &TokenizeScalar(string_view str);
+	const vector<string_view> &TokenizeBlocks(string_view str);
+
+	// True if Tokenize uses TokenizeBlocks
+	bool IsBlockTokenizing() const { return m_blockTokenizing; }
+
+private:
+	enum CharType
+	{
+		Char_Normal = 0,
+		Char_Delimiter,
+		Char_DelimiterToken,		// Delimiter that's also a token
+		Char_Quote,
+		Char_Escape
+	};
+
+	// Bit i is set for character i of a block
+	struct BlockMasks
+	{
+		uint64_t delimiters;		// Includes delimiter tokens
+		uint64_t delimiterTokens;
+		uint64_t quotes;
+		uint64_t escapes;
+	};
+
+	void ClassifyBlock(const char *block, BlockMasks &masks) const;
+	void AddToken(string_view str, size_t start, size_t end, bool hasEscapes);
+
+	uint8_t m_charTypes[256];
+	string m_classChars[Char_Escape + 1];	// Characters of each type
+	bool m_blockTokenizing;
+	vector<string_view> m_tokens;
+	string m_unescaped;				// Tokens that contained escape characters
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_CSVFILE_H
@@ -0,0 +1,267 @@
+//
+//  ConcurrentHashManager.cpp
+//  Jon Edwards Code Sample
+//
+//  Thread-safe string hash manager
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <mutex>
+
+#include "ConcurrentHashManager.h"
+#include "FrontCodedDictionary.h"
+#include "Snapshot.h"
+#include "StringHash.h"
+
+BEGIN_NAMESPACE(LDB)
+
+ConcurrentHashManager::~ConcurrentHashManager()
+{
+	// Nothing to do
+}
+
+//----------------------------------------------------------------------------
+// ConcurrentHashManager::GenerateHash : Most strings registered during a
+// load (genders, likes) are already registered, so the shard is first
+// checked under a shared lock. Otherwise it's checked again under an
+// exclusive lock in case another thread registered the string in between.
+//----------------------------------------------------------------------------
+HashKey ConcurrentHashManager::GenerateHash(string_view str)
+{
+	HashKey key = ComputeHash(str);
+	if (key == kInvalidHashKey)
+	{
+		if (!str.empty())
+		{
+			LogError("Error: String '%.*s' generated invalid hash value\n", (int)str.size(), str.data());
+		}
+		return kInvalidHashKey;
+	}
+
+	Shard &shard = GetShard(key);
+	string_view registeredString;
+	bool found;
+	{
+		shared_lock<shared_mutex> lock(shard.mutex);
+		found = LookupShardString(shard, key, registeredString);
+	}
+
+	if (!found)
+	{
+		unique_lock<shared_mutex> lock(shard.mutex);
+		found = LookupShardString(shard, key, registeredString);
+		if (!found)
+		{
+			shard.stringHashTable[key] = shard.stringArena.Add(str);
+		}
+	}
+
+	// Registered strings never move, so the string can be compared without
+	// the lock
+	if (found && str != registeredString)
+	{
+		LogError("Error: Discovered hash conflict for strings '%.*s' and '%.*s'\n",
+			(int)str.size(), str.data(), (int)registeredString.size(), registeredString.data());
+		return kInvalidHashKey;
+	}
+
+	return key;
+}
+
+HashKey ConcurrentHashManager::ComputeHash(string_view str) const
+{
+	if (str.empty())
+	{
+		return kInvalidHashKey;
+	}
+
+	return StringHash::Hash64(str.data(), str.size());
+}
+
+HashKey ConcurrentHashManager::FindHash(string_view str) const
+{
+	HashKey key = ComputeHash(str);
+	string_view registeredString;
+	if (key == kInvalidHashKey || !LookupHashString(key, registeredString) || registeredString != str)
+	{
+		return kInvalidHashKey;
+	}
+
+	return key;
+}
+
+bool ConcurrentHashManager::LookupHashString(HashKey key, string_view &str) const
+{
+	const Shard &shard = GetShard(key);
+	shared_lock<shared_mutex> lock(shard.mutex);
+	return LookupShardString(shard, key, str);
+}
+
+bool ConcurrentHashManager::LookupShardString(const Shard &shard, HashKey key, string_view &str)
+{
+	FlatHashMap<const char *>::const_iterator itr = shard.stringHashTable.find(key);
+	if (itr == shard.stringHashTable.end())
+	{
+		str = kInvalidString;
+		return false;
+	}
+
+	str = StringArena::GetString((*itr).second);
+	return true;
+}
+
+void ConcurrentHashManager::GetHashKeys(vector<HashKey> &keys) const
+{
+	for (uint32_t i = 0; i < kHashManagerShardCount; i++)
+	{
+		const Shard &shard = m_shards[i];
+		shared_lock<shared_mutex> lock(shard.mutex);
+
+		keys.reserve(keys.size() + shard.stringHashTable.size());
+		FlatHashMap<const char *>::const_iterator itr;
+		for (itr = shard.stringHashTable.begin(); itr != shard.stringHashTable.end(); ++itr)
+		{
+			keys.push_back((*itr).first);
+		}
+	}
+}
+
+uint32_t ConcurrentHashManager::GetStringCount() const
+{
+	size_t count = 0;
+	for (uint32_t i = 0; i < kHashManagerShardCount; i++)
+	{
+		const Shard &shard = m_shards[i];
+		shared_lock<shared_mutex> lock(shard.mutex);
+		count += shard.stringHashTable.size();
+	}
+
+	return (uint32_t)count;
+}
+
+//---------------------------------------------------------------------------
+// ConcurrentHashManager::GenerateSymbolId : Symbols refer to strings in the
+// arenas, so the string must already be registered
+//---------------------------------------------------------------------------
+SymbolId ConcurrentHashManager::GenerateSymbolId(SymbolNamespace symbolNamespace, HashKey key)
+{
+	SymbolId id = LookupSymbolId(symbolNamespace, key);
+	if (id != kInvalidSymbolId)
+	{
+		return id;
+	}
+
+	string_view str;
+	if (!LookupHashString(key, str))
+	{
+		return kInvalidSymbolId;
+	}
+
+	unique_lock<shared_mutex> lock(m_symbolMutexes[symbolNamespace]);
+	return m_symbolTables[symbolNamespace].Add(key, str);
+}
+
+SymbolId ConcurrentHashManager::LookupSymbolId(SymbolNamespace symbolNamespace, HashKey key) const
+{
+	shared_lock<shared_mutex> lock(m_symbolMutexes[symbolNamespace]);
+	return m_symbolTables[symbolNamespace].Find(key);
+}
+
+HashKey ConcurrentHashManager::GetSymbolHash(SymbolNamespace symbolNamespace, SymbolId id) const
+{
+	shared_lock<shared_mutex> lock(m_symbolMutexes[symbolNamespace]);
+	return m_symbolTables[symbolNamespace].GetHash(id);
+}
+
+bool ConcurrentHashManager::LookupSymbolString(SymbolNamespace symbolNamespace, SymbolId id,
+	string_view &str) const
+{
+	shared_lock<shared_mutex> lock(m_symbolMutexes[symbolNamespace]);
+	return m_symbolTables[symbolNamespace].GetString(id, str);
+}
+
+uint32_t ConcurrentHashManager::GetSymbolCount(SymbolNamespace symbolNamespace) const
+{
+	shared_lock<shared_mutex> lock(m_symbolMutexes[symbolNamespace]);
+	return m_symbolTables[symbolNamespace].GetCount();
+}
+
+//---------------------------------------------------------------------------
+// ConcurrentHashManager::WriteSnapshot : Writes the same format as
+// HashManager. Strings are gathered one shard at a time; registered
+// strings never move, so they can be encoded after the shard's lock is
+// released.
+//---------------------------------------------------------------------------
+void ConcurrentHashManager::WriteSnapshot(SnapshotWriter &writer)
+{
+	vector<FrontCodedDictionary::Entry> entries;
+	for (uint32_t i = 0; i < kHashManagerShardCount; i++)
+	{
+		const Shard &shard = m_shards[i];
+		shared_lock<shared_mutex> lock(shard.mutex);
+
+		FlatHashMap<const char *>::const_iterator itr;
+		for (itr = shard.stringHashTable.begin(); itr != shard.stringHashTable.end(); ++itr)
+		{
+			entries.push_back(make_pair((*itr).first, StringArena::GetString((*itr).second)));
+		}
+	}
+
+	vector<char> image;
+	FrontCodedDictionary::Build(entries, image);
+	writer.WriteVector(image);
+
+	for (int i = 0; i < Symbol_NamespaceCount; i++)
+	{
+		shared_lock<shared_mutex> lock(m_symbolMutexes[i]);
+		writer.WriteVector(m_symbolTables[i].GetHashes());
+	}
+}
+
+bool ConcurrentHashManager::ReadSnapshot(SnapshotReader &reader)
+{
+	for (uint32_t i = 0; i < kHashManagerShardCount; i++)
+	{
+		unique_lock<shared_mutex> lock(m_shards[i].mutex);
+		m_shards[i].stringHashTable.clear();
+		m_shards[i].stringArena.Clear();
+	}
+	for (int i = 0; i < Symbol_NamespaceCount; i++)
+	{
+		unique_lock<shared_mutex> lock(m_symbolMutexes[i]);
+		m_symbolTables[i].Clear();
+	}
+
+	vector<char> image;
+	reader.ReadVector(image);
+
+	FrontCodedDictionary dictionary;
+	if (reader.HasFailed() || !dictionary.Open(image.data(), image.size()) ||
+		!dictionary.ForEachString([this](HashKey key, string_view str)
+		{
+			Shard &shard = GetShard(key);
+			unique_lock<shared_mutex> lock(shard.mutex);
+			shard.stringHashTable[key] = shard.stringArena.Add(str);
+		}))
+	{
+		return false;
+	}
+
+	vector<HashKey> symbolHashes;
+	for (int i = 0; i < Symbol_NamespaceCount && !reader.HasFailed(); i++)
+	{
+		reader.ReadVector(symbolHashes);
+		for (size_t j = 0; j < symbolHashes.size(); j++)
+		{
+			if (GenerateSymbolId((SymbolNamespace)i, symbolHashes[j]) != (SymbolId)j)
+			{
+				return false;
+			}
+		}
+	}
+
+	return !reader.HasFailed();
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,89 @@
+//
+//  ConcurrentHashManager.h
+//  Jon Edwards Code Sample
+//
+//  HashManager that can be used by several threads at once, so CSV lines
+//  can be parsed and their strings registered in parallel. Strings are
+//  split into shards by the top bits of their hash, each with its own
+//  string arena, table and reader/writer lock. Registering a string that's
+//  already registered only takes its shard's lock for reading. Each symbol
+//  namespace has its own reader/writer lock.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_CONCURRENTHASHMANAGER_H
+#define LDB_CONCURRENTHASHMANAGER_H
+
+#include <shared_mutex>
+
+#include "fruit/fruit.h"
+#include "FlatHashMap.h"
+#include "HashManagerInterface.h"
+#include "StringArena.h"
+#include "SymbolTable.h"
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const uint32_t kHashManagerShardBits = 6;
+const uint32_t kHashManagerShardCount = 1 << kHashManagerShardBits;
+
+//----------------------------------------------------------------------------
+// ConcurrentHashManager class : Thread-safe HashManager. Detects hash
+// collisions the same way as HashManager and writes the same snapshot
+// format. Snapshots shouldn't be read while other threads use the manager.
+//----------------------------------------------------------------------------
+class ConcurrentHashManager : public HashManagerInterface
+{
+public:
+	INJECT(ConcurrentHashManager()) = default;
+	~ConcurrentHashManager();
+
+	bool IsThreadSafe() const { return true; }
+
+	HashKey GenerateHash(string_view str);
+	HashKey ComputeHash(string_view str) const;
+	HashKey FindHash(string_view str) const;
+	bool LookupHashString(HashKey key, string_view &str) const;
+	void GetHashKeys(vector<HashKey> &keys) const;
+	uint32_t GetStringCount() const;
+
+	SymbolId GenerateSymbolId(SymbolNamespace symbolNamespace, HashKey key);
+	SymbolId LookupSymbolId(SymbolNamespace symbolNamespace, HashKey key) const;
+	HashKey GetSymbolHash(SymbolNamespace symbolNamespace, SymbolId id) const;
+	bool LookupSymbolString(SymbolNamespace symbolNamespace, SymbolId id, string_view &str) const;
+	uint32_t GetSymbolCount(SymbolNamespace symbolNamespace) const;
+
+	void WriteSnapshot(SnapshotWriter &writer);
+	bool ReadSnapshot(SnapshotReader &reader);
+
+private:
+	// Shards are aligned to cache lines so threads locking neighbouring
+	// shards don't contend. FlatHashMap picks slots with the low bits of the
+	// hash, so the top bits are used to pick the shard.
+	struct alignas(64) Shard
+	{
+		mutable shared_mutex mutex;
+		StringArena stringArena;
+		FlatHashMap<const char *> stringHashTable;	// String hash -> arena entry
+	};
+
+	Shard &GetShard(HashKey key) { return m_shards[key >> (64 - kHashManagerShardBits)]; }
+	const Shard &GetShard(HashKey key) const { return m_shards[key >> (64 - kHashManagerShardBits)]; }
+
+	static bool LookupShardString(const Shard &shard, HashKey key, string_view &str);
+
+	Shard m_shards[kHashManagerShardCount];
+
+	// Symbols are added much less often than they're looked up, so each
+	// namespace has one lock
+	mutable shared_mutex m_symbolMutexes[Symbol_NamespaceCount];
+	SymbolTable m_symbolTables[Symbol_NamespaceCount];
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_CONCURRENTHASHMANAGER_H
@@ -10,8 +10,12 @@
 
 #include "Util.h"
 #include "HashManager.h"
+#include "CSVFile.h"
 #include "Database.h"
+#include "MappedDatabase.h"
+#include "RecordSchema.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -36,208 +40,1760 @@ Database::~Database()
 //----------------------------------------------------------------------------
 // Database::Initialize : Needs to be called before database is used.
 //----------------------------------------------------------------------------
-void Database::Initialize()
+void Database::Initialize(uint32_t loadThreadCount)
 {
+	// The calling thread waits while load tasks run, so it isn't counted.
+	// Without worker threads tasks run on the calling thread.
+	m_loadThreadPool.Initialize(loadThreadCount > 1 && m_hashManager->IsThreadSafe() ? loadThreadCount : 0);
+
     
     // Initialize R-tree extents to the full from of LocCoord values
     LocCoord locCoordMin = numeric_limits<LocCoord>::min();
     LocCoord locCoordMax = numeric_limits<LocCoord>::max();
     m_rTree.Initialize((float)locCoordMin, (float)locCoordMax);
+
+    // Register secondary indexes. Indexes are kept up to date as records
+    // are added and updated.
+    RegisterUserRecordIndex(UserIndex_PhoneNumber, new UserRecordHashIndex(&UserRecord::phoneNumberHash));
+    RegisterUserRecordIndex(UserIndex_Gender, new UserRecordHashIndex(&UserRecord::genderHash));
+    if (m_likeIndexEnabled)
+    {
+        RegisterUserRecordIndex(UserIndex_Like, new UserRecordMultiValueIndex());
+    }
     
 	m_initialized = true;
 }
 
-//----------------------------------------------------------------------------
-// Database::Shutdown : Frees database memory and goes back to 
-// uninitialized state.
-//----------------------------------------------------------------------------
-void Database::Shutdown()
+//----------------------------------------------------------------------------
+// Database::EnableLikeIndex : Registers the like index, indexing the users
+// already in the database. Likes are compacted first since only compacted
+// likes of existing records are indexed.
+//----------------------------------------------------------------------------
+void Database::EnableLikeIndex()
+{
+	if (m_likeIndexEnabled)
+	{
+		return;
+	}
+
+	m_likeIndexEnabled = true;
+	if (m_initialized && m_mappedFile == NULL)
+	{
+		Compact();
+		RegisterUserRecordIndex(UserIndex_Like, new UserRecordMultiValueIndex());
+	}
+}
+
+//----------------------------------------------------------------------------
+// Database::Shutdown : Frees database memory and goes back to 
+// uninitialized state.
+//----------------------------------------------------------------------------
+void Database::Shutdown()
+{
+	m_initialized = false;
+	m_rTree.Shutdown();
+	m_loadThreadPool.Shutdown();
+
+	delete m_mappedFile;
+	m_mappedFile = NULL;
+
+	// Versions already acquired by readers stay valid
+	{
+		lock_guard<mutex> lock(m_versionMutex);
+		m_publishedVersion.reset();
+	}
+
+	if (m_log != NULL)
+	{
+		m_log->Commit();
+		delete m_log;
+		m_log = NULL;
+	}
+	m_checkpointFileName.clear();
+	m_logSequence = 0;
+	m_logRecordsSinceCheckpoint = 0;
+
+	m_userRecords.clear();
+	m_compactLikes.clear();
+	m_uncompactedLikes.clear();
+	m_unusedCompactLikes = 0;
+
+	for (RTreePartitionList::iterator itr = m_genderRTrees.begin(); itr != m_genderRTrees.end(); ++itr)
+	{
+		delete (*itr).second;
+	}
+	m_genderRTrees.clear();
+
+	for (int i = 0; i < UserIndex_Count; i++)
+	{
+		delete m_userRecordIndexes[i];
+		m_userRecordIndexes[i] = NULL;
+	}
+}
+
+//----------------------------------------------------------------------------
+// Database::RegisterUserRecordIndex : Registers a secondary index. Database
+// takes ownership of the index.
+//----------------------------------------------------------------------------
+void Database::RegisterUserRecordIndex(UserRecordIndexType indexType, UserRecordIndex *index)
+{
+	ASSERT(indexType >= 0 && indexType < UserIndex_Count, "Invalid user record index type");
+	ASSERT(m_userRecordIndexes[indexType] == NULL, "User record index registered twice");
+
+	delete m_userRecordIndexes[indexType];
+	m_userRecordIndexes[indexType] = index;
+	MarkChanged(DatabasePart_Indexes);
+
+	// Index any records already in the database
+	for (UserRecordList::const_iterator itr = m_userRecords.begin(); itr != m_userRecords.end(); ++itr)
+	{
+		IndexUserRecord(index, (*itr).second);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Database::IndexUserRecord : Adds an existing record to an index,
+// including its compacted likes
+//----------------------------------------------------------------------------
+void Database::IndexUserRecord(UserRecordIndex *index, const UserRecord &record)
+{
+	index->Insert(record);
+
+	for (uint32_t i = 0; i < record.likesCount; i++)
+	{
+		index->AppendValue(record, GetLikeHash(m_compactLikes[record.likesOffset + i]));
+	}
+}
+
+//----------------------------------------------------------------------------
+// Database::LookupUserRecordByName : Looks up user record by user name.
+// Returns pointer to user record if found, otherwise return sNullUserRecord
+//----------------------------------------------------------------------------
+const UserRecord &Database::LookupUserRecordByName(const string &userName) const
+{
+	HashKey key = FindHash(userName);
+	if (key == kInvalidHashKey)
+	{
+		return sNullUserRecord;
+	}
+
+	return LookupUserRecordByKey(key);
+}
+
+//----------------------------------------------------------------------------
+// Database::LookupUserRecordByName : Looks up user record by key, which
+// should be a hash of the user name hash. Returns pointer to user record if
+// found, otherwise NULL.
+//----------------------------------------------------------------------------
+const UserRecord &Database::LookupUserRecordByKey(HashKey key) const
+{
+	ASSERT(key != kInvalidHashKey, "Invalid hash key encountered");
+	if (key == kInvalidHashKey)
+	{
+		return sNullUserRecord;
+	}
+
+	if (m_mappedFile != NULL)
+	{
+		const UserRecord *record = m_mappedFile->LookupUserRecord(key);
+		return record != NULL ? *record : sNullUserRecord;
+	}
+
+	UserRecordList::const_iterator itr = m_userRecords.find(key);
+	if (itr == m_userRecords.end())
+	{
+		return sNullUserRecord;
+	}
+
+	const UserRecord &record = (*itr).second;
+	return record;
+}	
+
+//----------------------------------------------------------------------------
+// Database::LookupUsersBy... : Look up users using secondary indexes. Keys
+// of matching users are added to userKeys. Returns number of users found.
+//----------------------------------------------------------------------------
+uint32_t Database::LookupUsersByPhoneNumber(const string &phoneNumber, vector<HashKey> &userKeys) const
+{
+	return LookupUsersByIndex(UserIndex_PhoneNumber, FindHash(phoneNumber), userKeys);
+}
+
+uint32_t Database::LookupUsersByGender(const string &gender, vector<HashKey> &userKeys) const
+{
+	return LookupUsersByIndex(UserIndex_Gender, FindHash(gender), userKeys);
+}
+
+uint32_t Database::LookupUsersByLike(const string &like, vector<HashKey> &userKeys) const
+{
+	return LookupUsersByIndex(UserIndex_Like, FindHash(like), userKeys);
+}
+
+uint32_t Database::LookupUsersByIndex(UserRecordIndexType indexType, HashKey value, vector<HashKey> &userKeys) const
+{
+	ASSERT(indexType >= 0 && indexType < UserIndex_Count, "Invalid user record index type");
+	bool registered = (m_mappedFile != NULL) ? m_mappedFile->HasUserIndex(indexType)
+		: m_userRecordIndexes[indexType] != NULL;
+	if (!registered)
+	{
+		LogError("Error: Database::LookupUsersByIndex - index %d isn't registered\n", indexType);
+		return 0;
+	}
+
+	if (value == kInvalidHashKey)
+	{
+		return 0;
+	}
+
+	if (m_mappedFile != NULL)
+	{
+		return m_mappedFile->LookupUsersByIndex(indexType, value, userKeys);
+	}
+
+	return m_userRecordIndexes[indexType]->Lookup(value, userKeys);
+}
+
+//----------------------------------------------------------------------------
+// Database::AddnewUserRecord : A new user record to the database.
+//----------------------------------------------------------------------------
+void Database::AddNewUserRecord(UserRecord &record)
+{
+	// Add to list of records
+	m_userRecords[record.userNameHash] = record;
+	MarkChanged(DatabasePart_Users);
+
+	// Add to secondary indexes
+	for (int i = 0; i < UserIndex_Count; i++)
+	{
+		if (m_userRecordIndexes[i] != NULL)
+		{
+			m_userRecordIndexes[i]->Insert(record);
+		}
+	}
+	MarkChanged(DatabasePart_Indexes);
+
+	if (m_deferSpatialIndexing)
+	{
+		m_deferredSpatialUsers.push_back(record);
+		return;
+	}
+
+	AddToSpatialIndexes(record);
+}
+
+void Database::AddToSpatialIndexes(const UserRecord &record)
+{
+	// Add to Rtree	
+	BoundBox bbox;
+	GetUserBoundBox(record, bbox);
+	m_rTree.Insert(bbox, ElemType_UserRecord, record.userNameHash);
+
+	// Add to the spatial partition for the user's gender
+	RTree *genderRTree = GetSpatialPartition(m_genderRTrees, record.genderHash, true);
+	genderRTree->Insert(bbox, ElemType_UserRecord, record.userNameHash);
+	MarkChanged(DatabasePart_Spatial);
+}
+
+void Database::RemoveFromSpatialIndexes(const UserRecord &record)
+{
+	BoundBox bbox;
+	GetUserBoundBox(record, bbox);
+	m_rTree.Remove(bbox, ElemType_UserRecord, record.userNameHash);
+
+	RTree *genderRTree = GetSpatialPartition(m_genderRTrees, record.genderHash, false);
+	if (genderRTree != NULL)
+	{
+		genderRTree->Remove(bbox, ElemType_UserRecord, record.userNameHash);
+	}
+	MarkChanged(DatabasePart_Spatial);
+}
+
+void Database::GetUserBoundBox(const UserRecord &record, BoundBox &bbox)
+{
+	bbox.min.x = record.xLoc;
+	bbox.min.y = record.yLoc;
+	bbox.min.z = 0.0f;
+	bbox.max.x = record.xLoc;
+	bbox.max.y = record.yLoc;
+	bbox.max.z = 0.0f;
+}
+
+//----------------------------------------------------------------------------
+// Database::GetSpatialPartition : Returns the R-tree holding the users whose
+// partitioning attribute (e.g., gender) has the specified hash. Partitions
+// are created on demand if 'create' is set, otherwise returns NULL if no
+// user with that attribute value has been added.
+//----------------------------------------------------------------------------
+RTree *Database::GetSpatialPartition(RTreePartitionList &partitions, HashKey partitionKey, bool create)
+{
+	RTreePartitionList::iterator itr = partitions.find(partitionKey);
+	if (itr != partitions.end())
+	{
+		return (*itr).second;
+	}
+
+	if (!create)
+	{
+		return NULL;
+	}
+
+	LocCoord locCoordMin = numeric_limits<LocCoord>::min();
+	LocCoord locCoordMax = numeric_limits<LocCoord>::max();
+	RTree *rTree = new RTree();
+	rTree->Initialize((float)locCoordMin, (float)locCoordMax);
+	partitions[partitionKey] = rTree;
+
+	return rTree;
+}
+
+//----------------------------------------------------------------------------
+// Database::UpdateUserRecord : Update the contents of a user record
+// in database. A user whose location or gender changed is moved between
+// the spatial indexes as by MoveUser.
+//----------------------------------------------------------------------------
+bool Database::UpdateUserRecord(const UserRecord &record)
+{
+	if (!IsWritable("UpdateUserRecord"))
+	{
+		return false;
+	}
+
+	UserRecordList::iterator itr = m_userRecords.find(record.userNameHash);
+	if (itr == m_userRecords.end())
+	{
+		return false;
+	}
+
+	UserRecord &existingRecord = (*itr).second;
+
+	// Update secondary indexes with any values that changed
+	for (int i = 0; i < UserIndex_Count; i++)
+	{
+		if (m_userRecordIndexes[i] != NULL)
+		{
+			m_userRecordIndexes[i]->Update(existingRecord, record);
+		}
+	}
+	MarkChanged(DatabasePart_Indexes);
+
+	// Remove from the spatial indexes before the location and gender change
+	bool moved = existingRecord.xLoc != record.xLoc || existingRecord.yLoc != record.yLoc
+		|| existingRecord.genderHash != record.genderHash;
+	if (moved)
+	{
+		RemoveFromSpatialIndexes(existingRecord);
+	}
+
+	// Likes are owned by the database - keep the existing record's range
+	uint32_t likesOffset = existingRecord.likesOffset;
+	uint32_t likesCount = existingRecord.likesCount;
+	existingRecord = record;
+	existingRecord.likesOffset = likesOffset;
+	existingRecord.likesCount = likesCount;
+	MarkChanged(DatabasePart_Users);
+
+	if (moved)
+	{
+		AddToSpatialIndexes(existingRecord);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::AppendUserLike : Add a like to a user's record in place,
+// avoiding a copy of the record
+//----------------------------------------------------------------------------
+bool Database::AppendUserLike(HashKey userKey, HashKey likeHash)
+{
+	return AppendUserLikes(userKey, &likeHash, 1);
+}
+
+//----------------------------------------------------------------------------
+// Database::AppendUserLikes : Add a group of likes to a user's record in
+// place. Capacity for the whole group is reserved up front.
+//----------------------------------------------------------------------------
+bool Database::AppendUserLikes(HashKey userKey, const HashKey *likeHashes, uint32_t count)
+{
+	if (!IsWritable("AppendUserLikes"))
+	{
+		return false;
+	}
+
+	UserRecordList::iterator itr = m_userRecords.find(userKey);
+	if (itr == m_userRecords.end())
+	{
+		return false;
+	}
+
+	UserRecord &record = (*itr).second;
+	UserLikeList &userLikes = m_uncompactedLikes[userKey];
+
+	// Grow geometrically so users appended to across many batches don't
+	// reallocate on every batch
+	size_t requiredCapacity = userLikes.size() + count;
+	if (requiredCapacity > userLikes.capacity())
+	{
+		userLikes.reserve(max(requiredCapacity, userLikes.capacity() * 2));
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (likeHashes[i] == kInvalidHashKey)
+		{
+			continue;
+		}
+
+		userLikes.push_back(likeHashes[i]);
+
+		for (int indexNum = 0; indexNum < UserIndex_Count; indexNum++)
+		{
+			if (m_userRecordIndexes[indexNum] != NULL)
+			{
+				m_userRecordIndexes[indexNum]->AppendValue(record, likeHashes[i]);
+			}
+		}
+	}
+
+	if (m_userRecordIndexes[UserIndex_Like] != NULL)
+	{
+		MarkChanged(DatabasePart_Indexes);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::GetUserLikes : Get the likes of a user. The compacted likes are
+// ids that can be converted with GetLikeHash. The pointers are valid until
+// the database is next modified.
+//----------------------------------------------------------------------------
+void Database::GetUserLikes(const UserRecord &record, UserLikes &userLikes) const
+{
+	if (record.likesCount == 0)
+	{
+		userLikes.compactLikes = NULL;
+	}
+	else if (m_mappedFile != NULL)
+	{
+		userLikes.compactLikes = m_mappedFile->GetCompactLikes() + record.likesOffset;
+	}
+	else
+	{
+		userLikes.compactLikes = &m_compactLikes[record.likesOffset];
+	}
+	userLikes.compactCount = record.likesCount;
+	userLikes.likes = NULL;
+	userLikes.count = 0;
+
+	// Once loading is done and likes have been compacted there are no
+	// uncompacted likes to look up
+	if (!m_uncompactedLikes.empty())
+	{
+		UserLikeListMap::const_iterator itr = m_uncompactedLikes.find(record.userNameHash);
+		if (itr != m_uncompactedLikes.end() && !(*itr).second.empty())
+		{
+			userLikes.likes = &(*itr).second[0];
+			userLikes.count = (uint32_t)(*itr).second.size();
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Database::GetUserLikes : Adds hashes of all of a user's likes to
+// likeHashes. Returns number of likes added.
+//----------------------------------------------------------------------------
+uint32_t Database::GetUserLikes(const UserRecord &record, vector<HashKey> &likeHashes) const
+{
+	UserLikes userLikes;
+	GetUserLikes(record, userLikes);
+
+	for (uint32_t i = 0; i < userLikes.compactCount; i++)
+	{
+		likeHashes.push_back(GetLikeHash(userLikes.compactLikes[i]));
+	}
+	likeHashes.insert(likeHashes.end(), userLikes.likes, userLikes.likes + userLikes.count);
+
+	return userLikes.compactCount + userLikes.count;
+}
+
+LikeId Database::LookupLikeId(HashKey likeHash) const
+{
+	if (m_mappedFile != NULL)
+	{
+		return m_mappedFile->LookupLikeId(likeHash);
+	}
+
+	return m_hashManager->LookupSymbolId(Symbol_Like, likeHash);
+}
+
+HashKey Database::GetLikeHash(LikeId likeId) const
+{
+	if (m_mappedFile != NULL)
+	{
+		return m_mappedFile->GetLikeHash(likeId);
+	}
+
+	return m_hashManager->GetSymbolHash(Symbol_Like, likeId);
+}
+
+bool Database::LookupHashString(HashKey key, string &buffer, string_view &str) const
+{
+	if (m_mappedFile != NULL)
+	{
+		return m_mappedFile->LookupHashString(key, buffer, str);
+	}
+
+	return m_hashManager->LookupHashString(key, str);
+}
+
+//----------------------------------------------------------------------------
+// Database::FindHash : Hashes a string without registering it. Strings of
+// mapped databases are in the mapped file rather than the HashManager.
+//----------------------------------------------------------------------------
+HashKey Database::FindHash(string_view str) const
+{
+	if (m_mappedFile == NULL)
+	{
+		return m_hashManager->FindHash(str);
+	}
+
+	HashKey key = m_hashManager->ComputeHash(str);
+	string buffer;
+	string_view registeredString;
+	if (key == kInvalidHashKey || !m_mappedFile->LookupHashString(key, buffer, registeredString)
+		|| registeredString != str)
+	{
+		return kInvalidHashKey;
+	}
+
+	return key;
+}
+
+//----------------------------------------------------------------------------
+// Database::Compact : Rebuilds the compacted like array. Each user's existing
+// range of compacted likes is copied followed by its uncompacted likes,
+// which are interned to LikeIds. Uncompacted like lists are freed. The set
+// of likes of each user is unchanged so secondary indexes aren't touched.
+// Does nothing if no likes were added or removed since the last Compact.
+//----------------------------------------------------------------------------
+void Database::Compact()
+{
+	// Mapped databases are always compact
+	if (m_mappedFile != NULL || (m_uncompactedLikes.empty() && m_unusedCompactLikes == 0))
+	{
+		return;
+	}
+
+	vector<LikeId> compactLikes;
+	size_t likesCount = m_compactLikes.size();
+	for (UserLikeListMap::const_iterator itr = m_uncompactedLikes.begin(); itr != m_uncompactedLikes.end(); ++itr)
+	{
+		likesCount += (*itr).second.size();
+	}
+	compactLikes.reserve(likesCount);
+
+	for (UserRecordList::iterator itr = m_userRecords.begin(); itr != m_userRecords.end(); ++itr)
+	{
+		UserRecord &record = (*itr).second;
+		uint32_t likesOffset = (uint32_t)compactLikes.size();
+
+		compactLikes.insert(compactLikes.end(), m_compactLikes.begin() + record.likesOffset,
+			m_compactLikes.begin() + record.likesOffset + record.likesCount);
+
+		UserLikeListMap::const_iterator likesItr = m_uncompactedLikes.find(record.userNameHash);
+		if (likesItr != m_uncompactedLikes.end())
+		{
+			const UserLikeList &userLikes = (*likesItr).second;
+			for (size_t i = 0; i < userLikes.size(); i++)
+			{
+				LikeId likeId = m_hashManager->GenerateSymbolId(Symbol_Like, userLikes[i]);
+				ASSERT(likeId != kInvalidLikeId, "Like string not found in HashManager");
+				if (likeId != kInvalidLikeId)
+				{
+					compactLikes.push_back(likeId);
+				}
+			}
+		}
+
+		record.likesOffset = likesOffset;
+		record.likesCount = (uint32_t)(compactLikes.size() - likesOffset);
+	}
+
+	m_compactLikes.swap(compactLikes);
+	UserLikeListMap().swap(m_uncompactedLikes);
+	m_unusedCompactLikes = 0;
+	MarkChanged(DatabasePart_Users);
+	MarkChanged(DatabasePart_Likes);
+}
+
+//----------------------------------------------------------------------------
+// Database::IsNullUserRecord : Check if valid user record
+//----------------------------------------------------------------------------
+bool Database::IsNullUserRecord(const UserRecord &record) const
+{
+	return record == sNullUserRecord;
+}
+
+//----------------------------------------------------------------------------
+// Database::QueryUsersInRange : Finds all users within range distance of
+// (x, y). Returns the number of users added to userList.
+//----------------------------------------------------------------------------
+uint32_t Database::QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, vector<HashKey> &userList) const
+{
+	if (m_mappedFile != NULL)
+	{
+		return QueryMappedUsersInRange(kInvalidHashKey, x, y, range, userList);
+	}
+
+	return QueryRTreeUsersInRange(m_rTree, x, y, range, userList);
+}
+
+//----------------------------------------------------------------------------
+// Database::QueryUsersInRange : Finds all users of the specified gender
+// within range distance of (x, y). Only the gender's spatial partition
+// is searched so users of other genders are never visited.
+//----------------------------------------------------------------------------
+uint32_t Database::QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, HashKey genderHash,
+	vector<HashKey> &userList) const
+{
+	if (m_mappedFile != NULL)
+	{
+		return QueryMappedUsersInRange(genderHash, x, y, range, userList);
+	}
+
+	RTreePartitionList::const_iterator itr = m_genderRTrees.find(genderHash);
+	if (itr == m_genderRTrees.end())
+	{
+		return 0;
+	}
+
+	return QueryRTreeUsersInRange(*(*itr).second, x, y, range, userList);
+}
+
+//----------------------------------------------------------------------------
+// Database::QueryUsersInPartition : Searches the partition with a bounding
+// box covering all LocCoord values, so no users are filtered out
+//----------------------------------------------------------------------------
+uint32_t Database::QueryUsersInPartition(HashKey genderHash, vector<HashKey> &userList) const
+{
+	BoundBox bbox;
+	bbox.min.x = bbox.min.y = (float)numeric_limits<LocCoord>::min();
+	bbox.max.x = bbox.max.y = (float)numeric_limits<LocCoord>::max();
+	bbox.min.z = bbox.max.z = 0.0f;
+
+	size_t startCount = userList.size();
+	if (m_mappedFile != NULL)
+	{
+		m_mappedFile->IntersectsQuery(genderHash, bbox, userList);
+	}
+	else
+	{
+		RTreePartitionList::const_iterator itr = m_genderRTrees.find(genderHash);
+		if (itr != m_genderRTrees.end())
+		{
+			vector<RTreeObjectCategoryType_t> categories;
+			(*itr).second->IntersectsQuery(bbox, categories, userList);
+		}
+	}
+
+	return (uint32_t)(userList.size() - startCount);
+}
+
+uint32_t Database::QueryRTreeUsersInRange(const RTree &rTree, LocCoord x, LocCoord y, uint32_t range,
+	vector<HashKey> &userList) const
+{
+	// Find candidates in bounding box encompassing the point and radius
+	BoundBox bbox;
+	GetRangeBoundBox(x, y, range, bbox);
+
+	vector<HashKey> candidateUsers;
+    vector<RTreeObjectCategoryType_t> categories;
+	rTree.IntersectsQuery(bbox, categories, candidateUsers);
+
+	return FilterUsersInRange(x, y, range, candidateUsers, userList);
+}
+
+uint32_t Database::QueryMappedUsersInRange(HashKey partitionKey, LocCoord x, LocCoord y, uint32_t range,
+	vector<HashKey> &userList) const
+{
+	BoundBox bbox;
+	GetRangeBoundBox(x, y, range, bbox);
+
+	vector<HashKey> candidateUsers;
+	m_mappedFile->IntersectsQuery(partitionKey, bbox, candidateUsers);
+
+	return FilterUsersInRange(x, y, range, candidateUsers, userList);
+}
+
+void Database::GetRangeBoundBox(LocCoord x, LocCoord y, uint32_t range, BoundBox &bbox) const
+{
+	bbox.min.x = (float)x - (float)range;
+	bbox.min.y = (float)y - (float)range;
+	bbox.min.z = 0.0f;
+	bbox.max.x = (float)x + (float)range;
+	bbox.max.y = (float)y + (float)range;
+	bbox.max.z = 0.0f;
+}
+
+//----------------------------------------------------------------------------
+// Database::FilterUsersInRange : Adds the candidates (from a bounding box
+// search) that are actually within range distance of (x, y) to userList.
+//----------------------------------------------------------------------------
+uint32_t Database::FilterUsersInRange(LocCoord x, LocCoord y, uint32_t range, const vector<HashKey> &candidateUsers,
+	vector<HashKey> &userList) const
+{
+	uint32_t rangeSquared = range * range;
+    uint32_t inRangeCount = 0;
+	for (int i = 0; i < candidateUsers.size(); i++)
+	{
+		const UserRecord &candidate = LookupUserRecordByKey(candidateUsers[i]);
+
+		int32_t distSquared = ((x - candidate.xLoc) * (x - candidate.xLoc))
+			+ ((y - candidate.yLoc) * (y - candidate.yLoc));
+		if (distSquared <= rangeSquared)
+		{
+			userList.push_back(candidateUsers[i]);
+            inRangeCount++;
+		}
+	}
+
+	return inRangeCount;
+}
+
+//============================================================================
+//
+//							Database Loading
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// Database::LoadUserDataFromCSVFile : Load and and process a file adding
+// new users to the database. Chunks of the file are parsed in parallel and
+// their records added in file order, so the first record for a user name
+// is kept as when reading line by line.
+//----------------------------------------------------------------------------
+bool Database::LoadUserDataFromCSVFile(const char *fileName)
+{
+	if (!m_initialized)
+	{
+		LogError("Error: Database::LoadUserDataFromCSVFile -  database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("LoadUserDataFromCSVFile"))
+	{
+		return false;
+	}
+
+	CSVLoadStats &stats = m_loadStats.GetUserStats();
+	stats.Start(fileName);
+
+	uint32_t chunkCount = max(m_loadThreadPool.GetThreadCount(), 1u);
+	CSVInputFile file;
+	if (!file.Open(fileName, kCSVChunkSize, chunkCount))
+	{
+		LogError("Error: Database::LoadUserDataFromCSVFile -  could not open file '%s'\n", fileName);
+		return false;
+	}
+
+	vector< vector<UserRecord> > chunkRecords(chunkCount);
+
+	bool result = LoadCSVFileChunks(m_loadThreadPool, file, chunkCount, stats,
+		[this, fileName, &chunkRecords](uint32_t chunkIndex, string_view chunk, uint32_t lineNum)
+		{
+			CSVTokenizer tokenizer;
+			UserRecord newRecord;
+			string_view inputLine;
+			while (MappedCSVFile::SplitLine(chunk, inputLine))
+			{
+				if (ParseUserDataRecordCSV(fileName, lineNum, inputLine, tokenizer, newRecord))
+				{
+					chunkRecords[chunkIndex].push_back(newRecord);
+				}
+				lineNum++;
+			}
+		},
+		[this, &chunkRecords](uint32_t chunkIndex)
+		{
+			vector<UserRecord> &records = chunkRecords[chunkIndex];
+			for (size_t i = 0; i < records.size(); i++)
+			{
+				AddParsedUserRecord(records[i]);
+			}
+			records.clear();
+		});
+	if (!result)
+	{
+		LogError("Error: Database::LoadUserDataFromCSVFile -  could not read file '%s'\n", fileName);
+	}
+	stats.Finish();
+
+    return result;
+}
+
+//----------------------------------------------------------------------------
+// Database::LoadLikesDataFromCSVFile : Load and process a multiple line
+// CSV file that contains data about user likes. Users should already be
+// registered in the system. Database is updated with the like information.
+//----------------------------------------------------------------------------
+bool Database::LoadLikesDataFromCSVFile(const char *fileName)
+{
+	if (!m_initialized)
+	{
+		LogError("Error: Database::LoadLikeDataFromCSVFile -  database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("LoadLikesDataFromCSVFile"))
+	{
+		return false;
+	}
+
+	CSVLoadStats &stats = m_loadStats.GetLikeStats();
+	stats.Start(fileName);
+
+	uint32_t chunkCount = max(m_loadThreadPool.GetThreadCount(), 1u);
+	CSVInputFile file;
+	if (!file.Open(fileName, kCSVChunkSize, chunkCount))
+	{
+		LogError("Error: Database::LoadLikeDataFromCSVFile -  could not open file '%s'\n", fileName);
+		return false;
+	}
+
+	// Likes are parsed a chunk at a time and grouped by user so each user
+	// record is looked up and grown once per chunk rather than once per line
+	vector< vector<PendingUserLike> > chunkLikes(chunkCount);
+
+	bool result = LoadCSVFileChunks(m_loadThreadPool, file, chunkCount, stats,
+		[this, fileName, &chunkLikes](uint32_t chunkIndex, string_view chunk, uint32_t lineNum)
+		{
+			CSVTokenizer tokenizer;
+			string_view inputLine;
+			while (MappedCSVFile::SplitLine(chunk, inputLine))
+			{
+				ProcessLikesDataRecordCSV(fileName, lineNum, inputLine, tokenizer, chunkLikes[chunkIndex]);
+				lineNum++;
+			}
+		},
+		[this, fileName, &chunkLikes](uint32_t chunkIndex)
+		{
+			IngestPendingUserLikes(fileName, chunkLikes[chunkIndex]);
+		});
+	if (!result)
+	{
+		LogError("Error: Database::LoadLikeDataFromCSVFile -  could not read file '%s'\n", fileName);
+	}
+	stats.Finish();
+
+	// Loading is done - move likes into compact storage
+	LoadPhaseTimer compactTimer(m_loadStats, LoadPhase_Compact);
+	Compact();
+
+    return result;
+}
+
+//----------------------------------------------------------------------------
+// Database::LoadCSVFiles : Likes are parsed and their strings registered
+// on a separate thread while users load, then added in one batch grouped
+// by user. Meanwhile another thread adds the users to the R-trees, which
+// nothing else touches until it finishes. Parsing on another thread needs
+// a thread-safe HashManager, so otherwise the files are loaded in turn.
+//----------------------------------------------------------------------------
+bool Database::LoadCSVFiles(const char *usersFileName, const char *likesFileName)
+{
+	m_loadStats.Reset();
+	LoadPhaseTimer totalTimer(m_loadStats, LoadPhase_Total);
+
+	if (!m_hashManager->IsThreadSafe())
+	{
+		return LoadUserDataFromCSVFile(usersFileName) && LoadLikesDataFromCSVFile(likesFileName);
+	}
+
+	if (!m_initialized)
+	{
+		LogError("Error: Database::LoadCSVFiles -  database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("LoadCSVFiles"))
+	{
+		return false;
+	}
+
+	vector<PendingUserLike> pendingLikes;
+	bool likesResult = false;
+	thread likesThread([this, likesFileName, &pendingLikes, &likesResult]()
+	{
+		likesResult = ReadLikesDataFromCSVFile(likesFileName, pendingLikes);
+	});
+
+	m_deferSpatialIndexing = true;
+	bool usersResult = LoadUserDataFromCSVFile(usersFileName);
+	m_deferSpatialIndexing = false;
+
+	thread spatialIndexThread([this]()
+	{
+		LoadPhaseTimer spatialIndexTimer(m_loadStats, LoadPhase_SpatialIndex);
+		for (size_t i = 0; i < m_deferredSpatialUsers.size(); i++)
+		{
+			AddToSpatialIndexes(m_deferredSpatialUsers[i]);
+		}
+		vector<UserRecord>().swap(m_deferredSpatialUsers);
+	});
+
+	likesThread.join();
+	if (usersResult && likesResult)
+	{
+		{
+			LoadPhaseTimer ingestTimer(m_loadStats, LoadPhase_IngestLikes);
+			IngestPendingUserLikes(likesFileName, pendingLikes);
+		}
+		LoadPhaseTimer compactTimer(m_loadStats, LoadPhase_Compact);
+		Compact();
+	}
+
+	spatialIndexThread.join();
+
+	return usersResult && likesResult;
+}
+
+//----------------------------------------------------------------------------
+// Database::ReadLikesDataFromCSVFile : Parses a likes file into
+// pendingLikes on the calling thread without touching user records
+//----------------------------------------------------------------------------
+bool Database::ReadLikesDataFromCSVFile(const char *fileName, vector<PendingUserLike> &pendingLikes)
+{
+	CSVLoadStats &stats = m_loadStats.GetLikeStats();
+	stats.Start(fileName);
+
+	CSVInputFile file;
+	if (!file.Open(fileName, kCSVChunkSize, 1))
+	{
+		LogError("Error: Database::ReadLikesDataFromCSVFile -  could not open file '%s'\n", fileName);
+		return false;
+	}
+
+	CSVTokenizer tokenizer;
+	string_view chunk;
+	string_view inputLine;
+	uint32_t lineNum = 0;
+	while (file.ReadChunk(chunk))
+	{
+		stats.AddLines(MappedCSVFile::CountLines(chunk), chunk.size());
+		while (MappedCSVFile::SplitLine(chunk, inputLine))
+		{
+			ProcessLikesDataRecordCSV(fileName, lineNum, inputLine, tokenizer, pendingLikes);
+			lineNum++;
+		}
+		file.ReleaseChunks();
+	}
+
+	if (file.HasError())
+	{
+		LogError("Error: Database::ReadLikesDataFromCSVFile -  could not read file '%s'\n", fileName);
+		return false;
+	}
+
+	stats.Finish();
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::LoadCSVFileChunks : Reads the file in rounds of chunkCount
+// chunks. The lines of each round's chunks are counted in parallel to find
+// each chunk's first line number, then the chunks are parsed in parallel,
+// then merged on the calling thread in file order. Rounds bound the memory
+// used by parsed records, and by a streamed file's buffers, which are
+// released after each round. A round only waits for its first chunk, so
+// streamed lines are loaded as they arrive.
+//----------------------------------------------------------------------------
+bool Database::LoadCSVFileChunks(ThreadPool &threadPool, CSVInputFile &file, uint32_t chunkCount,
+	CSVLoadStats &stats, const ParseCSVChunkFunction &parseChunk, const MergeCSVChunkFunction &mergeChunk)
+{
+	vector<string_view> chunks(chunkCount);
+	vector<uint32_t> lineCounts(chunkCount);
+	uint32_t lineNum = 0;
+	for (;;)
+	{
+		uint32_t readCount = 0;
+		while (readCount < chunkCount && (readCount == 0 || file.IsChunkReady()) && file.ReadChunk(chunks[readCount]))
+		{
+			readCount++;
+		}
+
+		if (readCount == 0)
+		{
+			break;
+		}
+
+		for (uint32_t i = 0; i < readCount; i++)
+		{
+			threadPool.Submit([i, &chunks, &lineCounts]() { lineCounts[i] = MappedCSVFile::CountLines(chunks[i]); });
+		}
+		threadPool.Wait();
+
+		for (uint32_t i = 0; i < readCount; i++)
+		{
+			uint32_t firstLineNum = lineNum;
+			lineNum += lineCounts[i];
+			stats.AddLines(lineCounts[i], chunks[i].size());
+			threadPool.Submit([i, firstLineNum, &chunks, &parseChunk]() { parseChunk(i, chunks[i], firstLineNum); });
+		}
+		threadPool.Wait();
+
+		for (uint32_t i = 0; i < readCount; i++)
+		{
+			mergeChunk(i);
+		}
+		file.ReleaseChunks();
+	}
+
+	return !file.HasError();
+}
+
+//----------------------------------------------------------------------------
+// Database::AddUserFields : Registers the strings of parsed user lines and
+// adds them in order, keeping the first record for a user name
+//----------------------------------------------------------------------------
+bool Database::AddUserFields(const vector<CSVUserFields> &users, vector<bool> &accepted)
+{
+	accepted.assign(users.size(), false);
+
+	if (!m_initialized)
+	{
+		LogError("Error: Database::AddUserFields -  database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("AddUserFields"))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < users.size(); i++)
+	{
+		const CSVUserFields &fields = users[i];
+
+		UserRecord newRecord;
+		newRecord.userNameHash = m_hashManager->GenerateHash(fields.userName);
+		newRecord.phoneNumberHash = m_hashManager->GenerateHash(fields.phoneNumber);
+		newRecord.xLoc = fields.xLoc;
+		newRecord.yLoc = fields.yLoc;
+		newRecord.genderHash = m_hashManager->GenerateHash(fields.gender);
+		accepted[i] = AddParsedUserRecord(newRecord);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::AddLikeFields : Registers the strings of parsed likes lines and
+// adds them to their users in batches
+//----------------------------------------------------------------------------
+bool Database::AddLikeFields(const char *fileName, const vector<CSVLikeFields> &likes)
+{
+	if (!m_initialized)
+	{
+		LogError("Error: Database::AddLikeFields -  database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("AddLikeFields"))
+	{
+		return false;
+	}
+
+	vector<PendingUserLike> pendingLikes;
+	pendingLikes.reserve(min((size_t)kLikesIngestBatchSize, likes.size()));
+
+	for (size_t i = 0; i < likes.size(); i++)
+	{
+		PendingUserLike pendingLike;
+		pendingLike.userNameHash = m_hashManager->GenerateHash(likes[i].userName);
+		pendingLike.likeHash = m_hashManager->GenerateHash(likes[i].like);
+		pendingLike.lineNum = likes[i].lineNum;
+		if (pendingLike.userNameHash == kInvalidHashKey || pendingLike.likeHash == kInvalidHashKey)
+		{
+			continue;
+		}
+		pendingLikes.push_back(pendingLike);
+
+		if (pendingLikes.size() >= kLikesIngestBatchSize)
+		{
+			IngestPendingUserLikes(fileName, pendingLikes);
+		}
+	}
+
+	IngestPendingUserLikes(fileName, pendingLikes);
+
+	return true;
+}
+
+//============================================================================
+//
+//							Database Snapshots
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// Database::SaveSnapshot : Writes the database to a snapshot file. Likes are
+// compacted first so all likes are in the shared like array. Sections are
+//
+//		HashManager strings and symbols, which include LikeIds
+//		sequence number of the last logged mutation
+//		user records
+//		compacted likes
+//		R-tree, then number of gender partitions and each (gender, R-tree)
+//----------------------------------------------------------------------------
+bool Database::SaveSnapshot(const char *fileName)
+{
+	if (!m_initialized)
+	{
+		LogError("Error: Database::SaveSnapshot - database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("SaveSnapshot"))
+	{
+		return false;
+	}
+
+	Compact();
+
+	SnapshotWriter writer;
+	if (!writer.Open(fileName))
+	{
+		return false;
+	}
+
+	m_hashManager->WriteSnapshot(writer);
+	writer.WriteUint64(m_logSequence);
+
+	writer.WriteUint64(m_userRecords.size());
+	for (UserRecordList::const_iterator itr = m_userRecords.begin(); itr != m_userRecords.end(); ++itr)
+	{
+		const UserRecord &record = (*itr).second;
+		writer.WriteUint64(record.userNameHash);
+		writer.WriteUint64(record.phoneNumberHash);
+		writer.WriteUint64(record.genderHash);
+		writer.WriteInt32(record.xLoc);
+		writer.WriteInt32(record.yLoc);
+		writer.WriteUint32(record.likesOffset);
+		writer.WriteUint32(record.likesCount);
+	}
+
+	writer.WriteVector(m_compactLikes);
+
+	m_rTree.WriteSnapshot(writer);
+	writer.WriteUint64(m_genderRTrees.size());
+	for (RTreePartitionList::iterator itr = m_genderRTrees.begin(); itr != m_genderRTrees.end(); ++itr)
+	{
+		writer.WriteUint64((*itr).first);
+		(*itr).second->WriteSnapshot(writer);
+	}
+
+	return writer.Close();
+}
+
+//----------------------------------------------------------------------------
+// Database::LoadSnapshot : Replaces contents of the database with a
+// snapshot written by SaveSnapshot. Secondary indexes are rebuilt from the
+// records. If the snapshot can't be read the database is left empty.
+//----------------------------------------------------------------------------
+bool Database::LoadSnapshot(const char *fileName)
+{
+	if (!m_initialized)
+	{
+		LogError("Error: Database::LoadSnapshot - database not initialized\n");
+		return false;
+	}
+
+	SnapshotReader reader;
+	if (!reader.Open(fileName))
+	{
+		return false;
+	}
+
+	// Start from an empty database with the same load threads. Shutdown
+	// closes the log, which the caller opens again after loading.
+	uint32_t loadThreadCount = GetLoadThreadCount();
+	Shutdown();
+	Initialize(loadThreadCount);
+
+	bool result = ReadSnapshotSections(reader);
+	if (!result)
+	{
+		LogError("Error: Database::LoadSnapshot - snapshot '%s' is invalid\n", fileName);
+		Shutdown();
+		Initialize(loadThreadCount);
+		return false;
+	}
+
+	for (int i = 0; i < UserIndex_Count; i++)
+	{
+		if (m_userRecordIndexes[i] == NULL)
+		{
+			continue;
+		}
+
+		for (UserRecordList::const_iterator itr = m_userRecords.begin(); itr != m_userRecords.end(); ++itr)
+		{
+			IndexUserRecord(m_userRecordIndexes[i], (*itr).second);
+		}
+	}
+
+	return true;
+}
+
+bool Database::ReadSnapshotSections(SnapshotReader &reader)
+{
+	if (!m_hashManager->ReadSnapshot(reader))
+	{
+		return false;
+	}
+
+	m_logSequence = reader.ReadUint64();
+
+	uint64_t userCount = reader.ReadUint64();
+	if (reader.HasFailed())
+	{
+		return false;
+	}
+	m_userRecords.reserve((size_t)userCount);
+	for (uint64_t i = 0; i < userCount && !reader.HasFailed(); i++)
+	{
+		UserRecord record;
+		record.userNameHash = reader.ReadUint64();
+		record.phoneNumberHash = reader.ReadUint64();
+		record.genderHash = reader.ReadUint64();
+		record.xLoc = reader.ReadInt32();
+		record.yLoc = reader.ReadInt32();
+		record.likesOffset = reader.ReadUint32();
+		record.likesCount = reader.ReadUint32();
+		m_userRecords[record.userNameHash] = record;
+	}
+
+	reader.ReadVector(m_compactLikes);
+	if (reader.HasFailed())
+	{
+		return false;
+	}
+
+	// Check likes reference valid entries
+	for (UserRecordList::const_iterator itr = m_userRecords.begin(); itr != m_userRecords.end(); ++itr)
+	{
+		const UserRecord &record = (*itr).second;
+		if ((uint64_t)record.likesOffset + record.likesCount > m_compactLikes.size())
+		{
+			return false;
+		}
+	}
+	uint32_t likeCount = m_hashManager->GetSymbolCount(Symbol_Like);
+	for (size_t i = 0; i < m_compactLikes.size(); i++)
+	{
+		if (m_compactLikes[i] >= likeCount)
+		{
+			return false;
+		}
+	}
+
+	if (!m_rTree.ReadSnapshot(reader))
+	{
+		return false;
+	}
+
+	uint64_t partitionCount = reader.ReadUint64();
+	for (uint64_t i = 0; i < partitionCount && !reader.HasFailed(); i++)
+	{
+		HashKey genderHash = reader.ReadUint64();
+		RTree *genderRTree = GetSpatialPartition(m_genderRTrees, genderHash, true);
+		if (!genderRTree->ReadSnapshot(reader))
+		{
+			return false;
+		}
+	}
+
+	return !reader.HasFailed() && reader.IsDone();
+}
+
+//============================================================================
+//
+//							Write-Ahead Log
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// Database::OpenLog : Opens the log and replays records newer than the
+// database, which are the ones after the last checkpoint. Records are
+// applied in sequence number order.
+//----------------------------------------------------------------------------
+bool Database::OpenLog(const char *logFileName, const char *checkpointFileName)
+{
+	if (!m_initialized)
+	{
+		LogError("Error: Database::OpenLog - database not initialized\n");
+		return false;
+	}
+
+	if (!IsWritable("OpenLog"))
+	{
+		return false;
+	}
+
+	WriteAheadLog *log = new WriteAheadLog();
+	if (!log->Open(logFileName))
+	{
+		delete log;
+		return false;
+	}
+
+	LogRecord record;
+	uint32_t replayedCount = 0;
+	while (log->ReadRecord(record))
+	{
+		// Already in the database (checkpointed before the log was emptied)
+		if (record.sequence <= m_logSequence)
+		{
+			continue;
+		}
+
+		if (record.sequence != m_logSequence + 1)
+		{
+			LogError("Warning: Database::OpenLog - log '%s' is missing records %llu to %llu\n", logFileName,
+				(unsigned long long)(m_logSequence + 1), (unsigned long long)(record.sequence - 1));
+		}
+
+		if (!ApplyLogRecord(record))
+		{
+			LogError("Warning: Database::OpenLog - could not apply record %llu in log '%s'\n",
+				(unsigned long long)record.sequence, logFileName);
+		}
+
+		m_logSequence = record.sequence;
+		replayedCount++;
+	}
+
+	delete m_log;
+	m_log = log;
+	m_checkpointFileName = checkpointFileName != NULL ? checkpointFileName : "";
+	m_logRecordsSinceCheckpoint = replayedCount;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::CommitLog : Writes all logged mutations with a single sync and
+// checkpoints if enough records have been logged
+//----------------------------------------------------------------------------
+bool Database::CommitLog()
+{
+	if (m_log == NULL)
+	{
+		LogError("Error: Database::CommitLog - no log is open\n");
+		return false;
+	}
+
+	if (!m_log->Commit())
+	{
+		return false;
+	}
+
+	if (m_logRecordsSinceCheckpoint >= kLogCheckpointInterval && !m_checkpointFileName.empty())
+	{
+		return Checkpoint();
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::Checkpoint : Saves the database to the checkpoint snapshot and
+// empties the log. The snapshot records the sequence number of the last
+// logged mutation, so if there's a crash before the log is emptied the
+// records are skipped when the log is replayed. SaveSnapshot only returns
+// once the snapshot and its directory entry are synced, so the log is never
+// emptied while the only durable copy of its records is in the log.
+//----------------------------------------------------------------------------
+bool Database::Checkpoint()
+{
+	if (m_log == NULL || m_checkpointFileName.empty())
+	{
+		LogError("Error: Database::Checkpoint - no log or checkpoint file\n");
+		return false;
+	}
+
+	if (!m_log->Commit() || !SaveSnapshot(m_checkpointFileName.c_str()) || !m_log->Truncate())
+	{
+		return false;
+	}
+
+	m_logRecordsSinceCheckpoint = 0;
+	return true;
+}
+
+bool Database::AddUser(const string &userName, const string &phoneNumber, LocCoord x, LocCoord y,
+	const string &gender)
 {
-	m_initialized = false;
-	m_rTree.Shutdown();
+	LogRecord record;
+	record.type = LogRecord_AddUser;
+	record.userName = userName;
+	record.phoneNumber = phoneNumber;
+	record.xLoc = x;
+	record.yLoc = y;
+	record.gender = gender;
+	return ApplyLogRecordAndLog(record);
 }
 
-//----------------------------------------------------------------------------
-// Database::LookupUserRecordByName : Looks up user record by user name.
-// Returns pointer to user record if found, otherwise return sNullUserRecord
-//----------------------------------------------------------------------------
-const UserRecord &Database::LookupUserRecordByName(const string &userName)
+bool Database::MoveUser(HashKey userKey, LocCoord x, LocCoord y)
 {
-	HashKey key = m_hashManager->GenerateHash(userName);
-	return LookupUserRecordByKey(key);
+	LogRecord record;
+	record.type = LogRecord_MoveUser;
+	record.userKey = userKey;
+	record.xLoc = x;
+	record.yLoc = y;
+	return ApplyLogRecordAndLog(record);
+}
+
+bool Database::AddUserLike(HashKey userKey, const string &like)
+{
+	LogRecord record;
+	record.type = LogRecord_AddLike;
+	record.userKey = userKey;
+	record.like = like;
+	return ApplyLogRecordAndLog(record);
+}
+
+bool Database::RemoveUserLike(HashKey userKey, HashKey likeHash)
+{
+	LogRecord record;
+	record.type = LogRecord_RemoveLike;
+	record.userKey = userKey;
+	record.likeHash = likeHash;
+	return ApplyLogRecordAndLog(record);
 }
 
 //----------------------------------------------------------------------------
-// Database::LookupUserRecordByName : Looks up user record by key, which
-// should be a hash of the user name hash. Returns pointer to user record if
-// found, otherwise NULL.
+// Database::ApplyLogRecordAndLog : Applies a mutation and, if a log is open,
+// appends it to the log. Mutations that fail aren't logged.
 //----------------------------------------------------------------------------
-const UserRecord &Database::LookupUserRecordByKey(HashKey key)
+bool Database::ApplyLogRecordAndLog(LogRecord &record)
 {
-	ASSERT(key != kInvalidHashKey, "Invalid hash key encountered");
-	if (key == kInvalidHashKey)
+	if (!ApplyLogRecord(record))
 	{
-		return sNullUserRecord;
+		return false;
 	}
 
-	UserRecordList::iterator itr = m_userRecords.find(key);
-	if (itr == m_userRecords.end())
+	if (m_log == NULL)
 	{
-		return sNullUserRecord;
+		return true;
 	}
 
-	UserRecord &record = (*itr).second;
-	return record;
-}	
+	record.sequence = ++m_logSequence;
+	m_log->Append(record);
+	m_logRecordsSinceCheckpoint++;
 
-//----------------------------------------------------------------------------
-// Database::AddnewUserRecord : A new user record to the database.
-//----------------------------------------------------------------------------
-void Database::AddNewUserRecord(UserRecord &record)
-{
-	// Add to list of records
-	m_userRecords[record.userNameHash] = record;
+	if (m_log->GetPendingSize() >= kLogGroupCommitSize)
+	{
+		return CommitLog();
+	}
 
-	// Add to Rtree	
-	BoundBox bbox;
-	bbox.min.x = record.xLoc;
-	bbox.min.y = record.yLoc;
-	bbox.min.z = 0.0f;
-	bbox.max.x = record.xLoc;
-	bbox.max.y = record.yLoc;
-	bbox.max.z = 0.0f;
-	m_rTree.Insert(bbox, ElemType_UserRecord, record.userNameHash);
+	return true;
 }
 
-//----------------------------------------------------------------------------
-// Database::AddnewUserRecord : Update the contents of a user record
-// in database.
-//----------------------------------------------------------------------------
-bool Database::UpdateUserRecord(const UserRecord &record)
+bool Database::ApplyLogRecord(const LogRecord &record)
 {
-	UserRecordList::iterator itr = m_userRecords.find(record.userNameHash);
-	if (itr == m_userRecords.end())
+	if (!m_initialized || !IsWritable("ApplyLogRecord"))
 	{
 		return false;
 	}
 
-	UserRecord &existingRecord = (*itr).second;
-	existingRecord = record;
+	switch (record.type)
+	{
+	case LogRecord_AddUser:
+		{
+			UserRecord newRecord;
+			newRecord.userNameHash = m_hashManager->GenerateHash(record.userName);
+			if (newRecord.userNameHash == kInvalidHashKey
+				|| !IsNullUserRecord(LookupUserRecordByKey(newRecord.userNameHash)))
+			{
+				LogError("Error: Cannot add new user '%s', already exists.\n", record.userName.c_str());
+				return false;
+			}
+
+			newRecord.phoneNumberHash = m_hashManager->GenerateHash(record.phoneNumber);
+			newRecord.xLoc = record.xLoc;
+			newRecord.yLoc = record.yLoc;
+			newRecord.genderHash = m_hashManager->GenerateHash(record.gender);
+			AddNewUserRecord(newRecord);
+			return true;
+		}
 
-	return true;
+	case LogRecord_MoveUser:
+		{
+			UserRecordList::iterator itr = m_userRecords.find(record.userKey);
+			if (itr == m_userRecords.end())
+			{
+				return false;
+			}
+
+			UserRecord &user = (*itr).second;
+			RemoveFromSpatialIndexes(user);
+			user.xLoc = record.xLoc;
+			user.yLoc = record.yLoc;
+			AddToSpatialIndexes(user);
+			MarkChanged(DatabasePart_Users);
+			return true;
+		}
+
+	case LogRecord_AddLike:
+		return AppendUserLike(record.userKey, m_hashManager->GenerateHash(record.like));
+
+	case LogRecord_RemoveLike:
+		return DeleteUserLike(record.userKey, record.likeHash);
+
+	default:
+		return false;
+	}
 }
 
 //----------------------------------------------------------------------------
-// Database::IsNullUserRecord : Check if valid user record
+// Database::DeleteUserLike : Removes the most recently added of a user's
+// likes with the specified hash. A compacted like is removed by shifting
+// the rest of the user's range down; the unused slot is reclaimed by the
+// next Compact.
 //----------------------------------------------------------------------------
-bool Database::IsNullUserRecord(const UserRecord &record)
+bool Database::DeleteUserLike(HashKey userKey, HashKey likeHash)
 {
-	return record == sNullUserRecord;
-}
+	UserRecordList::iterator itr = m_userRecords.find(userKey);
+	if (itr == m_userRecords.end())
+	{
+		return false;
+	}
 
-uint32_t Database::QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, vector<HashKey> &userList)
-{
-	// Find candidates in bounding box encompassing the point and radius
-	BoundBox bbox;
-	bbox.min.x = (float)x - (float)range;
-	bbox.min.y = (float)y - (float)range;
-	bbox.min.z = 0.0f;
-	bbox.max.x = (float)x + (float)range;
-	bbox.max.y = (float)y + (float)range;
-	bbox.max.z = 0.0f;
+	UserRecord &user = (*itr).second;
+	bool found = false;
 
-	vector<HashKey> candidateUsers;
-    vector<RTreeObjectCategoryType_t> categories;
-	uint32_t count = m_rTree.IntersectsQuery(bbox, categories, candidateUsers);
+	UserLikeListMap::iterator likesItr = m_uncompactedLikes.find(userKey);
+	if (likesItr != m_uncompactedLikes.end())
+	{
+		UserLikeList &userLikes = (*likesItr).second;
+		UserLikeList::reverse_iterator likeItr = find(userLikes.rbegin(), userLikes.rend(), likeHash);
+		if (likeItr != userLikes.rend())
+		{
+			userLikes.erase(--likeItr.base());
+			found = true;
+		}
+	}
 
-	// Find candidates actually within range distance
-	uint32_t rangeSquared = range * range;
-    uint32_t inRangeCount = 0;
-	for (int i = 0; i < count; i++)
+	LikeId likeId = LookupLikeId(likeHash);
+	for (uint32_t i = user.likesCount; i > 0 && !found && likeId != kInvalidLikeId; i--)
 	{
-		const UserRecord &candidate = LookupUserRecordByKey(candidateUsers[i]);
+		vector<LikeId>::iterator likesBegin = m_compactLikes.begin() + user.likesOffset;
+		if (likesBegin[i - 1] == likeId)
+		{
+			copy(likesBegin + i, likesBegin + user.likesCount, likesBegin + i - 1);
+			user.likesCount--;
+			m_unusedCompactLikes++;
+			MarkChanged(DatabasePart_Users);
+			MarkChanged(DatabasePart_Likes);
+			found = true;
+		}
+	}
 
-		int32_t distSquared = ((x - candidate.xLoc) * (x - candidate.xLoc))
-			+ ((y - candidate.yLoc) * (y - candidate.yLoc));
-		if (distSquared <= rangeSquared)
+	if (!found)
+	{
+		return false;
+	}
+
+	// Update indexes if the user no longer has the like at all
+	vector<HashKey> likeHashes;
+	GetUserLikes(user, likeHashes);
+	if (find(likeHashes.begin(), likeHashes.end(), likeHash) == likeHashes.end())
+	{
+		for (int i = 0; i < UserIndex_Count; i++)
 		{
-			userList.push_back(candidateUsers[i]);
-            inRangeCount++;
+			if (m_userRecordIndexes[i] != NULL)
+			{
+				m_userRecordIndexes[i]->RemoveAppendedValue(user, likeHash);
+			}
 		}
+		MarkChanged(DatabasePart_Indexes);
 	}
 
-	return inRangeCount;
+	return true;
 }
 
 //============================================================================
 //
-//							Database Loading
+//							Mapped Databases
 //
 //============================================================================
 
 //----------------------------------------------------------------------------
-// Database::LoadUserDataFromCSVFile : Load and and process a file adding
-// new users to the database.
+// Database::SaveMapped : Writes the database to a file for OpenMapped
 //----------------------------------------------------------------------------
-bool Database::LoadUserDataFromCSVFile(const char *fileName)
+bool Database::SaveMapped(const char *fileName)
 {
 	if (!m_initialized)
 	{
-		LogError("Error: Database::LoadUserDataFromCSVFile -  database not initialized\n");
+		LogError("Error: Database::SaveMapped - database not initialized\n");
 		return false;
 	}
 
-	FILE *file = fopen(fileName, "r");
-	if (file == NULL)
+	if (!IsWritable("SaveMapped"))
 	{
-		LogError("Error: Database::LoadUserDataFromCSVFile -  could not open file '%s'\n", fileName);
 		return false;
 	}
 
-	char inputLine[kMaxInputLineLen];
-	uint32_t lineNum = 0;
-	while (fgets(inputLine, kMaxInputLineLen, file))
+	return MappedDatabaseFile::Write(*this, *m_hashManager, fileName);
+}
+
+//----------------------------------------------------------------------------
+// Database::OpenMapped : Replaces contents of the database with a mapped
+// database file. Records, likes, strings and spatial indexes are used in
+// place from the mapping. If the file can't be opened the database is
+// left unchanged.
+//----------------------------------------------------------------------------
+bool Database::OpenMapped(const char *fileName)
+{
+	MappedDatabaseFile *mappedFile = new MappedDatabaseFile();
+	if (!mappedFile->Open(fileName))
 	{
-		ProcessUserDataRecordCSV(fileName, lineNum, inputLine);
-		lineNum++;
+		delete mappedFile;
+		return false;
 	}
 
-	fclose(file);
+	AttachMappedFile(mappedFile);
+	return true;
+}
 
-    return true;
+//----------------------------------------------------------------------------
+// Database::AttachMappedFile : Replaces contents of the database with an
+// opened mapped file, which the database then owns
+//----------------------------------------------------------------------------
+void Database::AttachMappedFile(MappedDatabaseFile *mappedFile)
+{
+	Shutdown();
+	m_mappedFile = mappedFile;
+	m_initialized = true;
 }
 
+//============================================================================
+//
+//							Database Versions
+//
+//============================================================================
+
 //----------------------------------------------------------------------------
-// Database::LoadLikesDataFromCSVFile : Load and process a multiple line
-// CSV file that contains data about user likes. Users should already be
-// registered in the system. Database is updated with the like information.
+// Database::PublishSnapshot : Builds a new version from the current contents
+// of the database and replaces the published version with it. Parts that
+// haven't changed since the published version was built are shared with
+// it. Readers holding the previous version keep using it until they
+// release it.
 //----------------------------------------------------------------------------
-bool Database::LoadLikesDataFromCSVFile(const char *fileName)
+bool Database::PublishSnapshot()
 {
 	if (!m_initialized)
 	{
-		LogError("Error: Database::LoadLikeDataFromCSVFile -  database not initialized\n");
+		LogError("Error: Database::PublishSnapshot - database not initialized\n");
 		return false;
 	}
 
-	FILE *file = fopen(fileName, "r");
-	if (file == NULL)
+	if (!IsWritable("PublishSnapshot"))
+	{
+		return false;
+	}
+
+	// Only this thread replaces the published version
+	Compact();
+	DatabaseSnapshot previousVersion = AcquireSnapshot();
+
+	uint64_t changeCounts[DatabasePart_Count];
+	GetChangeCounts(changeCounts);
+
+	MappedDatabaseImage image;
+	for (int i = 0; i < DatabasePart_Count; i++)
+	{
+		DatabasePart part = (DatabasePart)i;
+		if (previousVersion && previousVersion->GetChangeCount(part) == changeCounts[part])
+		{
+			MappedDatabaseFile::CopyPart(previousVersion->GetImage(), part, image);
+		}
+		else
+		{
+			MappedDatabaseFile::BuildPart(*this, *m_hashManager, part, image);
+		}
+	}
+
+	DatabaseSnapshot version(new DatabaseVersion(m_versionNumber + 1));
+	if (!version->Open(image, changeCounts))
 	{
-		LogError("Error: Database::LoadLikeDataFromCSVFile -  could not open file '%s'\n", fileName);
 		return false;
 	}
+	m_versionNumber++;
 
-	char inputLine[kMaxInputLineLen];
-	unsigned int lineNum = 0;
-	while (fgets(inputLine, kMaxInputLineLen, file))
+	// Previous version is released outside the lock, in case this was the
+	// last handle to it
 	{
-		ProcessLikesDataRecordCSV(fileName, lineNum, inputLine);
-		lineNum++;
+		lock_guard<mutex> lock(m_versionMutex);
+		m_publishedVersion.swap(version);
 	}
 
-	fclose(file);
+	return true;
+}
+
+DatabaseSnapshot Database::AcquireSnapshot()
+{
+	lock_guard<mutex> lock(m_versionMutex);
+	return m_publishedVersion;
+}
+
+//----------------------------------------------------------------------------
+// Database::GetChangeCounts : Gets the change count of each part. Strings
+// are registered with the HashManager rather than the database, and are
+// never unregistered, so their count is used.
+//----------------------------------------------------------------------------
+void Database::GetChangeCounts(uint64_t *changeCounts) const
+{
+	for (int i = 0; i < DatabasePart_Count; i++)
+	{
+		changeCounts[i] = m_changeCounts[i];
+	}
+	changeCounts[DatabasePart_Strings] = m_hashManager->GetStringCount();
+}
+
+bool DatabaseVersion::Open(const MappedDatabaseImage &image, const uint64_t *changeCounts)
+{
+	MappedDatabaseFile *mappedFile = new MappedDatabaseFile();
+	if (!mappedFile->OpenImage(image))
+	{
+		delete mappedFile;
+		return false;
+	}
+
+	m_database.AttachMappedFile(mappedFile);
+	memcpy(m_changeCounts, changeCounts, sizeof(m_changeCounts));
+	return true;
+}
+
+const MappedDatabaseImage &DatabaseVersion::GetImage() const
+{
+	return m_database.m_mappedFile->GetImage();
+}
+
+//----------------------------------------------------------------------------
+// Database::IsWritable : Returns false, logging an error, if the database
+// can't be modified because it's mapped
+//----------------------------------------------------------------------------
+bool Database::IsWritable(const char *functionName)
+{
+	if (m_mappedFile != NULL)
+	{
+		LogError("Error: Database::%s - database is mapped read-only\n", functionName);
+		return false;
+	}
 
-    return true;
+	return true;
 }
 
 //----------------------------------------------------------------------------
@@ -245,173 +1801,220 @@ bool Database::LoadLikesDataFromCSVFile(const char *fileName)
 // expected to be of the format
 //
 //		"User Name", "Phone number", xloc(int), yloc(int), "gender"
-//
-// TODO Can generalize this more elegantly than these macros, e.g.,
-//		automate reading of data using a schema and filling a data structure,
-//		create a template algorithm
-//----------------------------------------------------------------------------
-#define PARSE_STRING_TOKEN(TOKEN_LIST, TOKENS_ITR, VARIABLE, VARIABLENAME, FILENAME, LINENUM, INPUTLINE) \
-	{ \
-		if (TOKENS_ITR == TOKEN_LIST.end()) \
-		{ \
-			LogError("Error reading data file '%s' (line: %d) could not find expected string variable '%s' in input line '%s'\n", \
-				FILENAME, LINENUM, VARIABLENAME, INPUTLINE); \
-			return;	\
-		} \
-		VARIABLE = m_hashManager->GenerateHash(*TOKENS_ITR); \
-	}
-
-#define PARSE_COORD_TOKEN(TOKEN_LIST, TOKENS_ITR, VARIABLE, VARIABLENAME, FILENAME, LINENUM, INPUTLINE) \
-	{ \
-		if (TOKENS_ITR == TOKEN_LIST.end()) \
-		{ \
-			LogError("Error reading data file '%s' (line: %d) could not find expected integer variable '%s' in input line '%s'\n", \
-				FILENAME, LINENUM, VARIABLENAME, INPUTLINE); \
-			return;	\
-		} \
-		bool result = Util::GetLocCoordFromString(*TOKENS_ITR, VARIABLE); \
-		if (!result) \
-		{ \
-			LogError("Error reading data file '%s' (line: %d): found a value for variable <%s> that was not valid integer in input line '%s'\n", \
-				FILENAME, LINENUM, VARIABLENAME, INPUTLINE); \
-			return; \
-		} \
-	}
-
-void Database::ProcessUserDataRecordCSV(const char *fileName, uint32_t lineNum, const char *str)
-{
-	//* DEBUG */ LogMessage("ProcessUserDataRecordCSV: line read '%s'\n", str);
-
-	string inputLine(str);
-	vector<string> tokens;
-
-    Util::TokenizeString(inputLine, tokens, " ,\t\n", "");
+//----------------------------------------------------------------------------
+void Database::ProcessUserDataRecordCSV(const char *fileName, uint32_t lineNum, string_view inputLine,
+	CSVTokenizer &tokenizer)
+{
+	UserRecord newRecord;
+	if (ParseUserDataRecordCSV(fileName, lineNum, inputLine, tokenizer, newRecord))
+	{
+		AddParsedUserRecord(newRecord);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Database::ParseUserDataRecordCSV : Parses a user record without adding
+// it, so lines can be parsed on several threads. Returns false for blank
+// lines and lines that couldn't be parsed.
+//----------------------------------------------------------------------------
+bool Database::ParseUserDataRecordCSV(const char *fileName, uint32_t lineNum, string_view inputLine,
+	CSVTokenizer &tokenizer, UserRecord &newRecord)
+{
+	//* DEBUG */ LogMessage("ProcessUserDataRecordCSV: line read '%.*s'\n", (int)inputLine.size(), inputLine.data());
+
+	static constexpr RecordSchema sUserRecordSchema(
+		HashedField<&UserRecord::userNameHash>{ "<user name>" },
+		HashedField<&UserRecord::phoneNumberHash>{ "<phone number>" },
+		IntegerField<&UserRecord::xLoc>{ "<xLoc>" },
+		IntegerField<&UserRecord::yLoc>{ "<yLoc>" },
+		HashedField<&UserRecord::genderHash>{ "<gender>" });
+
+	const vector<string_view> &tokens = tokenizer.Tokenize(inputLine);
 
 	// Blank line - return
 	if (tokens.size() == 0)
 	{
-		return;	
+		return false;
 	}
 
-	vector<string>::const_iterator tokensItr = tokens.begin();
-	UserRecord newRecord;
-	bzero(&newRecord, sizeof (newRecord));
+	newRecord = UserRecord();
+
+	RecordParseError error;
+	if (!sUserRecordSchema.Parse(*m_hashManager, tokens, newRecord, error))
+	{
+		if (m_loadStats.GetUserStats().AddParseError(error.fieldName))
+		{
+			error.Log(fileName, lineNum, inputLine);
+		}
+		return false;
+	}
 
-	PARSE_STRING_TOKEN(tokens, tokensItr, newRecord.userNameHash, "<user name>", fileName, lineNum, inputLine.c_str());
+	return true;
+}
 
-	// Check to see if there's already a user record with the same user name.
-	// If there is then skip this input line.
+//----------------------------------------------------------------------------
+// Database::AddParsedUserRecord : Adds a parsed user record unless there's
+// already a user record with the same user name. Returns true if it was
+// added.
+//----------------------------------------------------------------------------
+bool Database::AddParsedUserRecord(UserRecord &newRecord)
+{
     const UserRecord &existingRecord = LookupUserRecordByKey(newRecord.userNameHash);
     if (!IsNullUserRecord(existingRecord))
 	{
-		LogError("Error: Cannot add new user '%s', already exists.\n", (*tokensItr).c_str());
-		return;
+		if (m_loadStats.GetUserStats().AddError(LoadError_Duplicate))
+		{
+			string buffer;
+			string_view userName;
+			LookupHashString(newRecord.userNameHash, buffer, userName);
+			LogError("Error: Cannot add new user '%.*s', already exists.\n", (int)userName.size(), userName.data());
+		}
+		return false;
     }
-	tokensItr++;
-
-	PARSE_STRING_TOKEN(tokens, tokensItr, newRecord.phoneNumberHash, "<phone number>", fileName, lineNum, inputLine.c_str());
-	tokensItr++;
-	PARSE_COORD_TOKEN(tokens, tokensItr, newRecord.xLoc, "<xLoc>", fileName, lineNum, inputLine.c_str());
-	tokensItr++;
-	PARSE_COORD_TOKEN(tokens, tokensItr, newRecord.yLoc, "<yLoc>", fileName, lineNum, inputLine.c_str());
-	tokensItr++;
-	PARSE_STRING_TOKEN(tokens, tokensItr, newRecord.genderHash, "<gender>", fileName, lineNum, inputLine.c_str());
-	tokensItr++;
 
 	// Add to database
 	AddNewUserRecord(newRecord);
+	m_loadStats.GetUserStats().AddAccepted(1);
 
 	//* DEBUG */ LogUserRecord(newRecord);
+	return true;
 }
 
 //----------------------------------------------------------------------------
-// Database::ProcessLikesDataRecordCSV : Read likes.csv and add user likes
-// to users in database.
-// 
-// Note: An error message is generated when an entry is encountered that isn't
-// for a registered user.
+// Database::ProcessLikesDataRecordCSV : Parse a line of likes.csv, which is
+// expected to be of the format
+//
+//		"User Name", "Like"
+//
+// The like is added to pendingLikes to be applied to the user's record
+// by IngestPendingUserLikes. Returns false for blank lines and lines that
+// couldn't be parsed.
 //----------------------------------------------------------------------------
-void Database::ProcessLikesDataRecordCSV(const char *fileName, uint32_t lineNum, const char *str)
+bool Database::ProcessLikesDataRecordCSV(const char *fileName, uint32_t lineNum, string_view inputLine,
+	CSVTokenizer &tokenizer, vector<PendingUserLike> &pendingLikes)
 {
-	//* DEBUG */ LogMessage("LoadLikesDataFromCSVFile: line read '%s'\n", str);
+	//* DEBUG */ LogMessage("LoadLikesDataFromCSVFile: line read '%.*s'\n", (int)inputLine.size(), inputLine.data());
 
-	string inputLine(str);
-	vector<string> tokens;
+	static constexpr RecordSchema sPendingUserLikeSchema(
+		HashedField<&PendingUserLike::userNameHash>{ "<user name>" },
+		HashedField<&PendingUserLike::likeHash>{ "<user like>" });
 
-	Util::TokenizeString(inputLine, tokens, " ,\t\n", "");
+	const vector<string_view> &tokens = tokenizer.Tokenize(inputLine);
     
 	// Blank line - return
 	if (tokens.size() == 0)
 	{
-		return;	
+		return false;
 	}
 
-	vector<string>::const_iterator tokensItr = tokens.begin();
+	PendingUserLike pendingLike;
+	pendingLike.lineNum = lineNum;
 
-	// Read user name 
-	HashKey userNameHash; 
-	PARSE_STRING_TOKEN(tokens, tokensItr, userNameHash, "<user name>", fileName, lineNum, inputLine.c_str());
-
-	// Make sure user is registered in system
-	const string userName = (*tokensItr);
-	tokensItr++;
+	RecordParseError error;
+	if (!sPendingUserLikeSchema.Parse(*m_hashManager, tokens, pendingLike, error))
+	{
+		if (m_loadStats.GetLikeStats().AddParseError(error.fieldName))
+		{
+			error.Log(fileName, lineNum, inputLine);
+		}
+		return false;
+	}
 
-	const UserRecord &existingRecord = LookupUserRecordByName(userName);
-    if (IsNullUserRecord(existingRecord))
+	if (pendingLike.userNameHash == kInvalidHashKey || pendingLike.likeHash == kInvalidHashKey)
 	{
-		LogError("Error reading file '%s' (line: %d) : Cannot find user '%s' in database. Skipping input line: '%s'\n",
-			fileName, lineNum, userName.c_str(), inputLine.c_str());
-		return;
-    }
+		return false;
+	}
+
+	pendingLikes.push_back(pendingLike);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Database::IngestPendingUserLikes : Add a batch of parsed likes to user
+// records. Likes are grouped by user (preserving file order within a user)
+// and each group is appended with a single record lookup.
+// 
+// Note: Entries that aren't for a registered user are counted as errors, and
+// a sample of them is logged.
+//----------------------------------------------------------------------------
+void Database::IngestPendingUserLikes(const char *fileName, vector<PendingUserLike> &pendingLikes)
+{
+	stable_sort(pendingLikes.begin(), pendingLikes.end());
 
-    HashKey userLikeHash;
-	PARSE_STRING_TOKEN(tokens, tokensItr, userLikeHash, "<user like>", fileName, lineNum, inputLine.c_str());
-	if (userLikeHash != kInvalidHashKey)
+	vector<HashKey> likeHashes;
+	size_t groupStart = 0;
+	while (groupStart < pendingLikes.size())
 	{
-		// Copy existing record, make modifications, and update record in database
-		UserRecord updatedRecord = existingRecord;
-		updatedRecord.userLikes.push_back(userLikeHash);
+		HashKey userNameHash = pendingLikes[groupStart].userNameHash;
+
+		likeHashes.clear();
+		size_t groupEnd = groupStart;
+		while (groupEnd < pendingLikes.size() && pendingLikes[groupEnd].userNameHash == userNameHash)
+		{
+			likeHashes.push_back(pendingLikes[groupEnd].likeHash);
+			groupEnd++;
+		}
 
-		bool result = UpdateUserRecord(updatedRecord);
-		ASSERT(result, "Update to user record failed\n")
+		bool result = AppendUserLikes(userNameHash, &likeHashes[0], (uint32_t)likeHashes.size());
+		if (result)
+		{
+			m_loadStats.GetLikeStats().AddAccepted(likeHashes.size());
+		}
+		else
+		{
+			string buffer;
+			string_view userName;
+			LookupHashString(userNameHash, buffer, userName);
+			for (size_t i = groupStart; i < groupEnd; i++)
+			{
+				if (m_loadStats.GetLikeStats().AddError(LoadError_UnknownUser))
+				{
+					LogError("Error reading file '%s' (line: %d) : Cannot find user '%.*s' in database. Skipping input line.\n",
+						fileName, pendingLikes[i].lineNum, (int)userName.size(), userName.data());
+				}
+			}
+		}
 
-	//* DEBUG */ const UserRecord &recordAfterUpdate = LookupUserRecordByKey(existingRecord.userNameHash);
-	//* DEBUG */ ASSERT(!IsNullUserRecord(recordAfterUpdate), "Failed to retrieve record after update\n");
-	//* DEBUG */ LogUserRecord(recordAfterUpdate);
+		groupStart = groupEnd;
 	}
+
+	pendingLikes.clear();
 }
 
 //----------------------------------------------------------------------------
 // Database::LogUserRecord : Print out database user record to log
 //----------------------------------------------------------------------------
-void Database::LogUserRecord(const UserRecord &record)
+void Database::LogUserRecord(const UserRecord &record) const
 {
 	LogMessage("User record:\n");
 	bool found = false;
-	string userName;
-	string phoneNumber;
-	string gender;
+	string buffers[3];
+	string_view userName;
+	string_view phoneNumber;
+	string_view gender;
 
-	found = LookupHashString(record.userNameHash, userName);
+	found = LookupHashString(record.userNameHash, buffers[0], userName);
 	ASSERT(found, "User name string not found in HashManager");
-	found = LookupHashString(record.phoneNumberHash, phoneNumber);
+	found = LookupHashString(record.phoneNumberHash, buffers[1], phoneNumber);
 	ASSERT(found, "Phone number string not found in HashManager");
-	found = LookupHashString(record.genderHash, gender);
+	found = LookupHashString(record.genderHash, buffers[2], gender);
  	ASSERT(found, "Gender string not found in HashManager");
 
-	LogMessage("\tkey='%llu', userName='%s', phoneNumber='%s', xLoc='%d', yLoc='%d', gender='%s'\n",
-		record.userNameHash, userName.c_str(), phoneNumber.c_str(), record.xLoc, record.yLoc, gender.c_str());
+	LogMessage("\tkey='%llu', userName='%.*s', phoneNumber='%.*s', xLoc='%d', yLoc='%d', gender='%.*s'\n",
+		record.userNameHash, (int)userName.size(), userName.data(), (int)phoneNumber.size(), phoneNumber.data(),
+		record.xLoc, record.yLoc, (int)gender.size(), gender.data());
 
-	UserRecord::UserLikeList::const_iterator itr = record.userLikes.begin();
-	if (itr != record.userLikes.end())
+	vector<HashKey> userLikes;
+	GetUserLikes(record, userLikes);
+	if (!userLikes.empty())
 	{
 		LogMessage("\tLikes: ");
-		for (int i = 0; i < record.userLikes.size(); i++)
+		for (int i = 0; i < userLikes.size(); i++)
 		{
-			string like;
-			found = LookupHashString(record.userLikes[i], like);
+			string_view like;
+			found = LookupHashString(userLikes[i], buffers[0], like);
 			ASSERT(found, "Like string not found in HashManager");
-			LogMessage("%s ", like.c_str());
+			LogMessage("%.*s ", (int)like.size(), like.data());
 		}
 		LogMessage("\n");
 	}
@@ -436,6 +2039,9 @@ Database::UserRecordIterator::UserRecordIterator(const Database &database)
 
 bool Database::UserRecordIterator::IsDone() const
 {
+	if (m_database.m_mappedFile != NULL)
+		return m_mappedIndex >= m_database.m_mappedFile->GetUserRecordCount();
+
 	if (m_itr == m_database.m_userRecords.end())
 		return true;
 	else
@@ -445,6 +2051,7 @@ bool Database::UserRecordIterator::IsDone() const
 void  Database::UserRecordIterator::Reset()
 {
 	m_itr = m_database.m_userRecords.begin();
+	m_mappedIndex = 0;
 }
 
 Database::UserRecordIterator&
@@ -452,7 +2059,10 @@ Database::UserRecordIterator::operator++()
 {
     if (!IsDone())
     {
-         ++m_itr;
+         if (m_database.m_mappedFile != NULL)
+             m_mappedIndex++;
+         else
+             ++m_itr;
     }
 	return *this;
 }
@@ -470,6 +2080,9 @@ HashKey Database::UserRecordIterator::GetHashKey() const
 	if (IsDone())
 		return kInvalidHashKey;
 
+	if (m_database.m_mappedFile != NULL)
+		return m_database.m_mappedFile->GetUserRecord(m_mappedIndex).userNameHash;
+
 	HashKey hashKey = (*m_itr).first;
 	return hashKey;
 }
@@ -11,39 +11,119 @@
 #ifndef LDB_DATABASE_H
 #define LDB_DATABASE_H
 
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
+#include "FlatHashMap.h"
 #include "HashManager.h"
+#include "LoadStats.h"
 #include "RTree.h"
+#include "UserRecordIndex.h"
+#include "Snapshot.h"
+#include "ThreadPool.h"
+#include "WriteAheadLog.h"
 
 using namespace std;
 
 BEGIN_NAMESPACE(LDB)
 
 // Constants
-const int kMaxInputLineLen = 256;	// Maximum line length that will be 
-									// processed in input files
+const uint32_t kLikesIngestBatchSize = 64 * 1024;	// Number of likes lines
+													// grouped by user at a time
+const size_t kCSVChunkSize = 1024 * 1024;			// Bytes of a CSV file parsed
+													// by one load task
+const size_t kLogGroupCommitSize = 64 * 1024;		// Bytes of log records that
+													// force a commit
+const uint32_t kLogCheckpointInterval = 100000;		// Log records between
+													// checkpoints
+
+class CSVTokenizer;
+class CSVInputFile;
+class MappedDatabaseFile;
+struct MappedDatabaseImage;
+class DatabaseVersion;
+
+// Reference counted handle to an immutable version of a Database. A
+// version is freed when the last handle to it is released.
+typedef shared_ptr<DatabaseVersion> DatabaseSnapshot;
+
+// Dense id for a like, its symbol id in the HashManager's like namespace.
+// Likes get ids when they're compacted.
+typedef SymbolId LikeId;
+const LikeId kInvalidLikeId = kInvalidSymbolId;
 
 //----------------------------------------------------------------------------
 // UserRecord: Contains data for a user in the database. 
+//
+// UserRecord is a fixed-size plain struct so records can be used directly
+// from a memory-mapped database file. A user's likes are stored by
+// Database: compacted likes are the range [likesOffset, likesOffset +
+// likesCount) of a contiguous array of LikeIds shared by all users, and
+// likes added since the last Database::Compact are kept in a separate
+// per-user list.
 //---------------------------------------------------------------------------
 struct UserRecord
 {
-	typedef vector<HashKey> UserLikeList;		
-
-	UserRecord() : userNameHash(0), phoneNumberHash(0), genderHash(0), xLoc(0), yLoc(0) { }
+	UserRecord() : userNameHash(0), phoneNumberHash(0), genderHash(0), xLoc(0), yLoc(0),
+		likesOffset(0), likesCount(0) { }
     
 	HashKey userNameHash;       // 64-bit hash of user name
 	HashKey phoneNumberHash;    // 64-bit hash of phone number string
 	HashKey genderHash;         // 64-bit hash of gender name
  	LocCoord	xLoc;
 	LocCoord	yLoc;
-	UserLikeList userLikes;
+	uint32_t	likesOffset;	// Range of compacted likes in Database
+	uint32_t	likesCount;
 };
 
 extern const UserRecord sNullUserRecord;
 
+// Fields of a CSV user line whose strings haven't been registered with a
+// HashManager, e.g. parsed by a ShardedDatabase before it knows which
+// shard stores the user. The views must stay valid until they're added.
+struct CSVUserFields
+{
+	string_view userName;
+	string_view phoneNumber;
+	LocCoord xLoc;
+	LocCoord yLoc;
+	string_view gender;
+	uint32_t lineNum;
+};
+
+// Fields of a CSV likes line, as above
+struct CSVLikeFields
+{
+	string_view userName;
+	string_view like;
+	uint32_t lineNum;
+};
+
+// Secondary indexes registered by Database::Initialize
+enum UserRecordIndexType
+{
+	UserIndex_PhoneNumber = 0,
+	UserIndex_Gender,
+	UserIndex_Like,
+	UserIndex_Count
+};
+
+// Parts of a database whose changes are counted separately, so a published
+// version can share the parts that haven't changed since the version
+// before it. Parts are laid out in this order in mapped database files.
+enum DatabasePart
+{
+	DatabasePart_Users = 0,		// User records
+	DatabasePart_Likes,			// Compacted likes and like ids
+	DatabasePart_Strings,		// Registered strings
+	DatabasePart_Spatial,		// Global and per-gender R-trees
+	DatabasePart_Indexes,		// Secondary indexes
+	DatabasePart_Count
+};
+
 inline bool operator==(const UserRecord &lhs, const UserRecord &rhs) 
 {
 	return lhs.userNameHash == rhs.userNameHash;
@@ -66,39 +146,215 @@ inline bool operator==(const UserRecord &lhs, const UserRecord &rhs)
 //----------------------------------------------------------------------------
 class Database
 {
-    typedef unordered_map<HashKey, UserRecord> UserRecordList;
-	typedef unordered_map<HashKey, UserRecord>::const_iterator UserRecordListIterator;
+    typedef FlatHashMap<UserRecord> UserRecordList;
+	typedef vector<HashKey> UserLikeList;
+	typedef unordered_map<HashKey, UserLikeList> UserLikeListMap;
+	typedef UserRecordList::const_iterator UserRecordListIterator;
+	typedef unordered_map<HashKey, RTree *> RTreePartitionList;
     
 public:
-	INJECT(Database(HashManagerInterface *hashManager)) : m_hashManager(hashManager), m_initialized(false) { }
+	INJECT(Database(HashManagerInterface *hashManager)) : m_hashManager(hashManager), m_initialized(false),
+		m_unusedCompactLikes(0), m_likeIndexEnabled(false), m_mappedFile(NULL), m_versionNumber(0), m_log(NULL), m_logSequence(0), m_logRecordsSinceCheckpoint(0),
+		m_deferSpatialIndexing(false)
+	{
+		memset(m_userRecordIndexes, 0, sizeof(m_userRecordIndexes));
+		memset(m_changeCounts, 0, sizeof(m_changeCounts));
+	}
 	~Database();
 
-	void Initialize();	
+	// CSV files are parsed on loadThreadCount threads when the HashManager
+	// is thread-safe
+	void Initialize(uint32_t loadThreadCount = 1);
 	void Shutdown();	
+	uint32_t GetLoadThreadCount() const { return m_loadThreadPool.GetThreadCount(); }
 
+	// The like index holds a hash set node per (like, user) pair, several
+	// times the memory of the likes themselves, so it's only registered
+	// once enabled. It stays enabled when the database is shut down or
+	// loads a snapshot.
+	void EnableLikeIndex();
+
+	// Regular files are mapped. Stdin ("-"), pipes and devices are streamed
+	// through bounded buffers and loaded as lines arrive.
     bool LoadUserDataFromCSVFile(const char *fileName);
     bool LoadLikesDataFromCSVFile(const char *fileName);
 
-    // Returns UserRecord for user name, otherwise kNullUserRecord
-    const UserRecord& LookupUserRecordByName(const string &userName);
-    const UserRecord& LookupUserRecordByKey(HashKey key);
+	// Loads a users file and its likes file as a pipeline when the
+	// HashManager is thread-safe. Likes are parsed on another thread while
+	// users load, and users are added to the spatial indexes on another
+	// thread while their likes are added. Gives the same database as
+	// loading the users file and then the likes file.
+	bool LoadCSVFiles(const char *usersFileName, const char *likesFileName);
+
+	// Lines read, accepted and rejected by the last CSV file loads, and
+	// how long they took. Only a sample of rejected lines is logged.
+	const LoadStats &GetLoadStats() const { return m_loadStats; }
+
+	// Adds users and likes parsed elsewhere, e.g. the lines of a file
+	// belonging to one shard of a ShardedDatabase, registering their
+	// strings. accepted is set to whether each user was added; duplicates
+	// are rejected as when loading the file. Likes aren't compacted.
+	bool AddUserFields(const vector<CSVUserFields> &users, vector<bool> &accepted);
+	bool AddLikeFields(const char *fileName, const vector<CSVLikeFields> &likes);
+
+	// Chunks of a CSV file are parsed in parallel on threadPool into
+	// per-chunk results, which are then merged in file order on the calling
+	// thread. Returns false if the file couldn't be read to the end.
+	typedef function<void(uint32_t chunkIndex, string_view chunk, uint32_t firstLineNum)> ParseCSVChunkFunction;
+	typedef function<void(uint32_t chunkIndex)> MergeCSVChunkFunction;
+	static bool LoadCSVFileChunks(ThreadPool &threadPool, CSVInputFile &file, uint32_t chunkCount,
+		CSVLoadStats &stats, const ParseCSVChunkFunction &parseChunk, const MergeCSVChunkFunction &mergeChunk);
+
+    // Save or restore the complete database (user records, likes, strings
+    // and spatial indexes) to a binary snapshot file. Loading replaces the
+    // contents of the database and keeps its load threads, but commits and
+    // closes the write-ahead log: call OpenLog after loading to replay the
+    // records newer than the snapshot and log later changes.
+    bool SaveSnapshot(const char *fileName);
+    bool LoadSnapshot(const char *fileName);
+
+    // Write the database to a file that can be memory-mapped, or replace
+    // the contents of the database with a mapped file. A mapped database
+    // is read-only: loading, updating records and appending likes fail.
+    // The secondary indexes registered when the file is written are stored
+    // in it as sorted arrays, so the same lookups work on the mapped
+    // database.
+    bool SaveMapped(const char *fileName);
+    bool OpenMapped(const char *fileName);
+    bool IsMapped() const { return m_mappedFile != NULL; }
+
+    //------------------------------------------------------------------------
+    // Versions (multi-version concurrency)
+    //
+    // PublishSnapshot builds an immutable copy of the current contents of
+    // the database and makes it the version returned by AcquireSnapshot.
+    // Queries execute against an acquired version while the database keeps
+    // being loaded and updated; changes are seen by versions published
+    // after them. Only the thread writing to the database may publish, but
+    // any thread may acquire. AcquireSnapshot returns an empty handle if no
+    // version has been published.
+    //
+    // A version is an in-memory mapped database image. Each of its parts
+    // (see DatabasePart) is shared with the previous version unless the
+    // part changed, so publishing costs time and memory proportional to the
+    // parts that changed: moving users rebuilds the users and spatial
+    // parts, adding likes the users, likes and strings parts (and the
+    // indexes part if the like index is enabled).
+    bool PublishSnapshot();
+    DatabaseSnapshot AcquireSnapshot();
+
+    //------------------------------------------------------------------------
+    // Write-ahead log
+
+    // Replays the log on top of the current contents of the database, which
+    // should have been loaded from checkpointFileName if it exists, then
+    // logs all later mutations. Every kLogCheckpointInterval records the
+    // database is saved to checkpointFileName (a snapshot) and the log is
+    // emptied. Pass NULL for checkpointFileName to never checkpoint.
+    // LoadSnapshot closes the log, so open it after loading the checkpoint.
+    bool OpenLog(const char *logFileName, const char *checkpointFileName);
+
+    // Writes logged mutations to disk. Mutations are durable once this
+    // returns true. Also called automatically every kLogGroupCommitSize
+    // bytes of log records.
+    bool CommitLog();
+    bool Checkpoint();
+
+    // Logged mutations. Strings are expected in the same form they're
+    // stored, i.e., quoted. RemoveUserLike removes one of a user's likes
+    // with the specified hash.
+    bool AddUser(const string &userName, const string &phoneNumber, LocCoord x, LocCoord y,
+    	const string &gender);
+    bool MoveUser(HashKey userKey, LocCoord x, LocCoord y);
+    bool AddUserLike(HashKey userKey, const string &like);
+    bool RemoveUserLike(HashKey userKey, HashKey likeHash);
+
+    // Returns UserRecord for user name, otherwise kNullUserRecord. Records
+    // may move when users are added, invalidating returned references.
+    const UserRecord& LookupUserRecordByName(const string &userName) const;
+    const UserRecord& LookupUserRecordByKey(HashKey key) const;
+
+    // Secondary index lookups. Add keys of all users with the specified
+    // phone number, gender or like to userKeys and return number added.
+    // Strings are expected in the same form they're stored, i.e., quoted.
+    // Looking up an index that isn't registered logs an error and finds
+    // no users.
+    uint32_t LookupUsersByPhoneNumber(const string &phoneNumber, vector<HashKey> &userKeys) const;
+    uint32_t LookupUsersByGender(const string &gender, vector<HashKey> &userKeys) const;
+    uint32_t LookupUsersByLike(const string &like, vector<HashKey> &userKeys) const;
+    uint32_t LookupUsersByIndex(UserRecordIndexType indexType, HashKey value, vector<HashKey> &userKeys) const;
 
     // Checks is user record returned by Lookup function is valid
-    bool IsNullUserRecord(const UserRecord &record);
+    bool IsNullUserRecord(const UserRecord &record) const;
 
-    // Update contents of a user record using values in the specified record
+    // Update contents of a user record using values in the specified record.
+    // The user's likes are not changed, use AppendUserLike to add likes.
+    // Secondary and spatial indexes follow the new values.
     bool UpdateUserRecord(const UserRecord &record);
 
+    // Append likes to a user's list of likes in place. Returns false if
+    // there's no user with the specified key.
+    bool AppendUserLike(HashKey userKey, HashKey likeHash);
+    bool AppendUserLikes(HashKey userKey, const HashKey *likeHashes, uint32_t count);
+
+    //------------------------------------------------------------------------
+    // Like storage
+
+    // Likes of a user: the user's range of compacted likes followed by any
+    // likes added since the last compaction
+    struct UserLikes
+    {
+    	const LikeId *compactLikes;
+    	uint32_t compactCount;
+    	const HashKey *likes;
+    	uint32_t count;
+    };
+
+    void GetUserLikes(const UserRecord &record, UserLikes &userLikes) const;
+    uint32_t GetUserLikes(const UserRecord &record, vector<HashKey> &likeHashes) const;
+
+    // Moves likes added since last compaction into the shared like array,
+    // releasing the per-user lists. Called after likes are loaded.
+    void Compact();
+
+    // Maps between like hashes and dense ids. Returns kInvalidLikeId if like
+    // isn't in the compacted like array.
+    LikeId LookupLikeId(HashKey likeHash) const;
+    HashKey GetLikeHash(LikeId likeId) const;
+
     //------------------------------------------------------------------------
     // Query support
-    uint32_t QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, vector<HashKey> &userList);
+    //
+    // Lookups and queries don't modify the database, so several threads can
+    // query a database that isn't being changed, e.g., a published version.
+    uint32_t QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, vector<HashKey> &userList) const;
+
+    // Same as above, but only searches the spatial partition holding users
+    // of the specified gender
+    uint32_t QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, HashKey genderHash,
+    	vector<HashKey> &userList) const;
+
+    // Adds every user in the spatial partition of the specified gender
+    uint32_t QueryUsersInPartition(HashKey genderHash, vector<HashKey> &userList) const;
 
     //------------------------------------------------------------------------
     // String hash support
-	HashKey GenerateHash(const string &str) { return m_hashManager->GenerateHash(str); }
-   	bool LookupHashString(HashKey key, string &str) { return m_hashManager->LookupHashString(key, str); }
 
-   	void LogUserRecord(const UserRecord &record);
+    // Hashes a string, registering it so its hash can be looked up. Used
+    // when adding data.
+	HashKey GenerateHash(string_view str) { return m_hashManager->GenerateHash(str); }
+
+	// Returns hash of a string that's already registered, otherwise
+	// kInvalidHashKey. No data can refer to a string that isn't registered,
+	// so queries use this to hash their parameters.
+	HashKey FindHash(string_view str) const;
+
+	// Gets the string with the hash. The strings of a mapped database may be
+	// decoded into buffer, so str is only valid until buffer is changed or
+	// the database is next modified.
+   	bool LookupHashString(HashKey key, string &buffer, string_view &str) const;
+
+   	void LogUserRecord(const UserRecord &record) const;
 
     //----------------------------------------------------------------------------
 	// Iterator for iterating through user records in databsae
@@ -116,19 +372,129 @@ public:
 	private:
 		const Database &m_database;			// TODONOW Something like auto_ptr would be useful here
 		UserRecordListIterator m_itr;
+		uint32_t m_mappedIndex;			// Position when iterating a mapped database
 	};
 
 private:
+	friend class MappedDatabaseFile;
+	friend class DatabaseVersion;
+
+	bool IsWritable(const char *functionName);
+	void AttachMappedFile(MappedDatabaseFile *mappedFile);
+	void MarkChanged(DatabasePart part) { m_changeCounts[part]++; }
+	void GetChangeCounts(uint64_t *changeCounts) const;
+
 	void AddNewUserRecord(UserRecord &record);
+	void AddToSpatialIndexes(const UserRecord &record);
+	void RemoveFromSpatialIndexes(const UserRecord &record);
+	void GetUserBoundBox(const UserRecord &record, BoundBox &bbox);
+	bool ApplyLogRecord(const LogRecord &record);
+	bool ApplyLogRecordAndLog(LogRecord &record);
+	bool DeleteUserLike(HashKey userKey, HashKey likeHash);
+	void RegisterUserRecordIndex(UserRecordIndexType indexType, UserRecordIndex *index);
+	void IndexUserRecord(UserRecordIndex *index, const UserRecord &record);
+
+	bool ReadSnapshotSections(SnapshotReader &reader);
 
-	void ProcessUserDataRecordCSV(const char *fileName, uint32_t lineNum, const char *str);
-	void ProcessLikesDataRecordCSV(const char *fileName, uint32_t lineNum, const char *str);
+	RTree *GetSpatialPartition(RTreePartitionList &partitions, HashKey partitionKey, bool create);
+	uint32_t QueryRTreeUsersInRange(const RTree &rTree, LocCoord x, LocCoord y, uint32_t range,
+		vector<HashKey> &userList) const;
+	uint32_t QueryMappedUsersInRange(HashKey partitionKey, LocCoord x, LocCoord y, uint32_t range,
+		vector<HashKey> &userList) const;
+	void GetRangeBoundBox(LocCoord x, LocCoord y, uint32_t range, BoundBox &bbox) const;
+	uint32_t FilterUsersInRange(LocCoord x, LocCoord y, uint32_t range, const vector<HashKey> &candidateUsers,
+		vector<HashKey> &userList) const;
+
+	void ProcessUserDataRecordCSV(const char *fileName, uint32_t lineNum, string_view line,
+		CSVTokenizer &tokenizer);
+	bool ParseUserDataRecordCSV(const char *fileName, uint32_t lineNum, string_view line,
+		CSVTokenizer &tokenizer, UserRecord &newRecord);
+	bool AddParsedUserRecord(UserRecord &newRecord);
+	// Like read from likes data that hasn't been added to its user yet
+	struct PendingUserLike
+	{
+		HashKey userNameHash;
+		HashKey likeHash;
+		uint32_t lineNum;
+
+		// Orders by user so likes can be grouped by user
+		bool operator<(const PendingUserLike &rhs) const { return userNameHash < rhs.userNameHash; }
+	};
+
+	bool ProcessLikesDataRecordCSV(const char *fileName, uint32_t lineNum, string_view line,
+		CSVTokenizer &tokenizer, vector<PendingUserLike> &pendingLikes);
+	void IngestPendingUserLikes(const char *fileName, vector<PendingUserLike> &pendingLikes);
+	bool ReadLikesDataFromCSVFile(const char *fileName, vector<PendingUserLike> &pendingLikes);
 
 	bool m_initialized;
 
 	HashManagerInterface *m_hashManager;
 	UserRecordList m_userRecords;
 	RTree m_rTree;
+	RTreePartitionList m_genderRTrees;	// Spatial index per gender, alongside m_rTree
+	UserRecordIndex *m_userRecordIndexes[UserIndex_Count];
+
+	// Compacted likes (CSR): every user's likes are a range in m_compactLikes
+	vector<LikeId> m_compactLikes;
+	UserLikeListMap m_uncompactedLikes;			// Likes added since last Compact()
+	uint32_t m_unusedCompactLikes;				// Compacted likes removed since last Compact()
+	bool m_likeIndexEnabled;
+
+	// Number of changes to each part, so published versions can reuse the
+	// parts of the previous version that haven't changed
+	uint64_t m_changeCounts[DatabasePart_Count];
+
+	MappedDatabaseFile *m_mappedFile;			// Set when opened with OpenMapped
+
+	mutex m_versionMutex;						// Guards m_publishedVersion
+	DatabaseSnapshot m_publishedVersion;
+	uint64_t m_versionNumber;					// Number of last published version
+
+	WriteAheadLog *m_log;						// Set when opened with OpenLog
+	string m_checkpointFileName;
+	uint64_t m_logSequence;						// Sequence number of last logged mutation
+	uint32_t m_logRecordsSinceCheckpoint;
+
+	ThreadPool m_loadThreadPool;				// Parses CSV file chunks
+	LoadStats m_loadStats;
+
+	// Set while LoadCSVFiles loads users, which are added to the spatial
+	// indexes afterwards
+	bool m_deferSpatialIndexing;
+	vector<UserRecord> m_deferredSpatialUsers;
+};
+
+//----------------------------------------------------------------------------
+// DatabaseVersion: Immutable version of a Database published by
+// Database::PublishSnapshot. Its database holds an in-memory image in the
+// mapped database format, so it's read-only.
+// Any number of threads can query a version at once.
+//----------------------------------------------------------------------------
+class DatabaseVersion
+{
+public:
+	DatabaseVersion(uint64_t versionNumber) : m_database(&m_hashManager), m_versionNumber(versionNumber)
+	{
+		memset(m_changeCounts, 0, sizeof(m_changeCounts));
+	}
+
+	// Keeps a reference to each part of the image. changeCounts are the
+	// database's change counts when the parts were built.
+	bool Open(const MappedDatabaseImage &image, const uint64_t *changeCounts);
+	const MappedDatabaseImage &GetImage() const;
+	uint64_t GetChangeCount(DatabasePart part) const { return m_changeCounts[part]; }
+
+	const Database &GetDatabase() const { return m_database; }
+	uint64_t GetVersionNumber() const { return m_versionNumber; }
+
+private:
+	DatabaseVersion(const DatabaseVersion &);				// Not copyable
+	DatabaseVersion &operator=(const DatabaseVersion &);
+
+	HashManager m_hashManager;
+	Database m_database;
+	uint64_t m_versionNumber;
+	uint64_t m_changeCounts[DatabasePart_Count];
 };
 
 END_NAMESPACE(LDB)
@@ -0,0 +1,306 @@
+//
+//  FlatHashMap.h
+//  Jon Edwards Code Sample
+//
+//  Open addressing hash map keyed by HashKeys. Keys are already well mixed
+//  64-bit hashes, so they're used as their own hash without rehashing.
+//
+//  Entries are stored in one array with a parallel array of control bytes,
+//  one per slot. A control byte is kEmptySlot or the low 7 bits of the key
+//  of the entry in the slot. Lookups start at the slot picked by the high
+//  bits of the key and probe linearly a group of kGroupSize slots at a time:
+//  the group's control bytes are compared with the key's low bits at once
+//  (using SSE2 where available) and only matching slots are examined. The
+//  first kGroupSize control bytes are mirrored after the last slot so a
+//  group can be loaded at any slot without wrapping.
+//
+//  The interface is the subset of unordered_map used by Database and
+//  HashManager. Entries can't be erased. Unlike unordered_map, inserting an
+//  entry can move the others, so it invalidates references and iterators.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_FLATHASHMAP_H
+#define LDB_FLATHASHMAP_H
+
+#include <string.h>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+namespace FlatHashMapUtil
+{
+	const uint32_t kGroupSize = 16;
+	const int8_t kEmptySlot = -128;
+
+	//------------------------------------------------------------------------
+	// MatchGroup : Returns a bit mask of the control bytes in the group of
+	// kGroupSize bytes starting at control that equal value
+	//------------------------------------------------------------------------
+	inline uint32_t MatchGroup(const int8_t *control, int8_t value)
+	{
+#if defined(__SSE2__)
+		__m128i group = _mm_loadu_si128((const __m128i *)control);
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+		uint32_t mask = 0;
+		for (uint32_t i = 0; i < kGroupSize; i++)
+		{
+			if (control[i] == value)
+			{
+				mask |= 1 << i;
+			}
+		}
+		return mask;
+#endif
+	}
+
+	inline uint32_t LowestBit(uint32_t mask)
+	{
+		return (uint32_t)__builtin_ctz(mask);
+	}
+}
+
+template <class Value> class FlatHashMap
+{
+public:
+	// Members are named like std::pair so entries are used the same way as
+	// unordered_map's
+	struct Entry
+	{
+		HashKey first;
+		Value second;
+	};
+
+	//------------------------------------------------------------------------
+	// Iterators visit entries in slot order
+	template <class EntryType> class IteratorType
+	{
+	public:
+		IteratorType() : m_control(NULL), m_entries(NULL), m_index(0), m_capacity(0) { }
+		IteratorType(const int8_t *control, EntryType *entries, size_t index, size_t capacity)
+			: m_control(control), m_entries(entries), m_index(index), m_capacity(capacity)
+		{
+			SkipEmptySlots();
+		}
+
+		// Allows conversion from iterator to const_iterator
+		template <class OtherEntryType> IteratorType(const IteratorType<OtherEntryType> &other)
+			: m_control(other.GetControl()), m_entries(other.GetEntries()), m_index(other.GetIndex()),
+			m_capacity(other.GetCapacity()) { }
+
+		EntryType &operator*() const { return m_entries[m_index]; }
+		EntryType *operator->() const { return &m_entries[m_index]; }
+
+		IteratorType &operator++()
+		{
+			m_index++;
+			SkipEmptySlots();
+			return *this;
+		}
+
+		bool operator==(const IteratorType &rhs) const { return m_index == rhs.m_index; }
+		bool operator!=(const IteratorType &rhs) const { return m_index != rhs.m_index; }
+
+		const int8_t *GetControl() const { return m_control; }
+		EntryType *GetEntries() const { return m_entries; }
+		size_t GetIndex() const { return m_index; }
+		size_t GetCapacity() const { return m_capacity; }
+
+	private:
+		void SkipEmptySlots()
+		{
+			while (m_index < m_capacity && m_control[m_index] == FlatHashMapUtil::kEmptySlot)
+			{
+				m_index++;
+			}
+		}
+
+		const int8_t *m_control;
+		EntryType *m_entries;
+		size_t m_index;
+		size_t m_capacity;
+	};
+
+	typedef IteratorType<Entry> iterator;
+	typedef IteratorType<const Entry> const_iterator;
+
+	FlatHashMap() : m_control(NULL), m_entries(NULL), m_capacity(0), m_size(0) { }
+	~FlatHashMap() { clear(); }
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	iterator begin() { return iterator(m_control, m_entries, 0, m_capacity); }
+	iterator end() { return iterator(m_control, m_entries, m_capacity, m_capacity); }
+	const_iterator begin() const { return const_iterator(m_control, m_entries, 0, m_capacity); }
+	const_iterator end() const { return const_iterator(m_control, m_entries, m_capacity, m_capacity); }
+
+	iterator find(HashKey key)
+	{
+		size_t index = FindIndex(key);
+		return iterator(m_control, m_entries, index, m_capacity);
+	}
+
+	const_iterator find(HashKey key) const
+	{
+		size_t index = FindIndex(key);
+		return const_iterator(m_control, m_entries, index, m_capacity);
+	}
+
+	// Returns the value for key, adding a default constructed value if key
+	// isn't in the map
+	Value &operator[](HashKey key)
+	{
+		size_t index = FindIndex(key);
+		if (index == m_capacity)
+		{
+			if ((m_size + 1) * 8 > m_capacity * 7)
+			{
+				Rehash(m_capacity == 0 ? FlatHashMapUtil::kGroupSize : m_capacity * 2);
+			}
+
+			index = FindEmptySlot(key);
+			SetControl(index, GetControlByte(key));
+			m_entries[index].first = key;
+			m_size++;
+		}
+
+		return m_entries[index].second;
+	}
+
+	// Makes room for count entries without rehashing
+	void reserve(size_t count)
+	{
+		size_t capacity = m_capacity == 0 ? FlatHashMapUtil::kGroupSize : m_capacity;
+		while (count * 8 > capacity * 7)
+		{
+			capacity *= 2;
+		}
+
+		if (capacity != m_capacity)
+		{
+			Rehash(capacity);
+		}
+	}
+
+	// Removes all entries and frees the map's memory
+	void clear()
+	{
+		delete [] m_control;
+		delete [] m_entries;
+		m_control = NULL;
+		m_entries = NULL;
+		m_capacity = 0;
+		m_size = 0;
+	}
+
+private:
+	FlatHashMap(const FlatHashMap &);				// Not copyable
+	FlatHashMap &operator=(const FlatHashMap &);
+
+	// Low 7 bits of the key are stored in the control byte, the rest pick
+	// the first slot probed
+	static int8_t GetControlByte(HashKey key) { return (int8_t)(key & 0x7f); }
+	size_t GetFirstSlot(HashKey key) const { return (size_t)(key >> 7) & (m_capacity - 1); }
+
+	//------------------------------------------------------------------------
+	// FlatHashMap::FindIndex : Returns slot holding key, or m_capacity if
+	// key isn't in the map. Probing stops at the first group with an empty
+	// slot since entries are never erased.
+	//------------------------------------------------------------------------
+	size_t FindIndex(HashKey key) const
+	{
+		if (m_capacity == 0)
+		{
+			return 0;
+		}
+
+		size_t mask = m_capacity - 1;
+		int8_t controlByte = GetControlByte(key);
+		for (size_t slot = GetFirstSlot(key); ; slot = (slot + FlatHashMapUtil::kGroupSize) & mask)
+		{
+			const int8_t *group = m_control + slot;
+			for (uint32_t match = FlatHashMapUtil::MatchGroup(group, controlByte); match != 0; match &= match - 1)
+			{
+				size_t index = (slot + FlatHashMapUtil::LowestBit(match)) & mask;
+				if (m_entries[index].first == key)
+				{
+					return index;
+				}
+			}
+
+			if (FlatHashMapUtil::MatchGroup(group, FlatHashMapUtil::kEmptySlot) != 0)
+			{
+				return m_capacity;
+			}
+		}
+	}
+
+	size_t FindEmptySlot(HashKey key) const
+	{
+		size_t mask = m_capacity - 1;
+		for (size_t slot = GetFirstSlot(key); ; slot = (slot + FlatHashMapUtil::kGroupSize) & mask)
+		{
+			uint32_t empty = FlatHashMapUtil::MatchGroup(m_control + slot, FlatHashMapUtil::kEmptySlot);
+			if (empty != 0)
+			{
+				return (slot + FlatHashMapUtil::LowestBit(empty)) & mask;
+			}
+		}
+	}
+
+	void SetControl(size_t index, int8_t controlByte)
+	{
+		m_control[index] = controlByte;
+		if (index < FlatHashMapUtil::kGroupSize)
+		{
+			m_control[m_capacity + index] = controlByte;
+		}
+	}
+
+	void Rehash(size_t capacity)
+	{
+		int8_t *oldControl = m_control;
+		Entry *oldEntries = m_entries;
+		size_t oldCapacity = m_capacity;
+
+		m_control = new int8_t[capacity + FlatHashMapUtil::kGroupSize];
+		memset(m_control, FlatHashMapUtil::kEmptySlot, capacity + FlatHashMapUtil::kGroupSize);
+		m_entries = new Entry[capacity];
+		m_capacity = capacity;
+
+		for (size_t i = 0; i < oldCapacity; i++)
+		{
+			if (oldControl[i] != FlatHashMapUtil::kEmptySlot)
+			{
+				HashKey key = oldEntries[i].first;
+				size_t index = FindEmptySlot(key);
+				SetControl(index, GetControlByte(key));
+				m_entries[index].first = key;
+				m_entries[index].second = move(oldEntries[i].second);
+			}
+		}
+
+		delete [] oldControl;
+		delete [] oldEntries;
+	}
+
+	int8_t *m_control;			// m_capacity + kGroupSize control bytes
+	Entry *m_entries;
+	size_t m_capacity;			// Number of slots, a power of two
+	size_t m_size;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_FLATHASHMAP_H
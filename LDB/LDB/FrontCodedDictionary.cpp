@@ -0,0 +1,363 @@
+//
+//  FrontCodedDictionary.cpp
+//  Jon Edwards Code Sample
+//
+//  Compressed, read-only form of a string table
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <string.h>
+#include <algorithm>
+
+#include "FrontCodedDictionary.h"
+
+BEGIN_NAMESPACE(LDB)
+
+namespace
+{
+	const uint64_t kSectionAlignment = 8;
+
+	uint64_t AlignOffset(uint64_t offset)
+	{
+		return (offset + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+	}
+
+	struct SectionOffsets
+	{
+		uint64_t blockOffsets;
+		uint64_t slotKeys;
+		uint64_t slotIndexes;
+		uint64_t data;
+	};
+
+	void GetSectionOffsets(const FrontCodedHeader &header, SectionOffsets &offsets)
+	{
+		offsets.blockOffsets = AlignOffset(sizeof(FrontCodedHeader));
+		offsets.slotKeys = AlignOffset(offsets.blockOffsets + header.blockCount * sizeof(uint64_t));
+		offsets.slotIndexes = AlignOffset(offsets.slotKeys + header.slotCount * sizeof(HashKey));
+		offsets.data = AlignOffset(offsets.slotIndexes + header.slotCount * sizeof(uint32_t));
+	}
+
+	void WriteVarint(vector<char> &data, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			data.push_back((char)(value | 0x80));
+			value >>= 7;
+		}
+		data.push_back((char)value);
+	}
+
+	bool ReadVarint(const char *&pos, const char *end, uint64_t &value)
+	{
+		value = 0;
+		for (uint32_t shift = 0; pos < end && shift < 64; shift += 7)
+		{
+			uint8_t byte = (uint8_t)*pos++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	size_t GetSharedPrefixLength(string_view lhs, string_view rhs)
+	{
+		size_t length = min(lhs.size(), rhs.size());
+		size_t i = 0;
+		while (i < length && lhs[i] == rhs[i])
+		{
+			i++;
+		}
+		return i;
+	}
+}
+
+FrontCodedDictionary::FrontCodedDictionary()
+	: m_header(NULL), m_blockOffsets(NULL), m_slotKeys(NULL), m_slotIndexes(NULL), m_data(NULL)
+{
+
+}
+
+//----------------------------------------------------------------------------
+// FrontCodedDictionary::Build : Front codes the sorted strings, then builds
+// the hash table and lays out the sections
+//----------------------------------------------------------------------------
+void FrontCodedDictionary::Build(vector<Entry> &entries, vector<char> &image)
+{
+	sort(entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs)
+	{
+		return lhs.second < rhs.second;
+	});
+
+	FrontCodedHeader header;
+	memset(&header, 0, sizeof(header));
+	header.stringCount = (uint32_t)entries.size();
+	header.blockCount = (uint32_t)((entries.size() + kFrontCodingBlockSize - 1) / kFrontCodingBlockSize);
+
+	vector<uint64_t> blockOffsets(header.blockCount);
+	vector<char> data;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		string_view str = entries[i].second;
+		size_t prefixLength = 0;
+		if (i % kFrontCodingBlockSize == 0)
+		{
+			blockOffsets[i / kFrontCodingBlockSize] = data.size();
+		}
+		else
+		{
+			prefixLength = GetSharedPrefixLength(entries[i - 1].second, str);
+			WriteVarint(data, prefixLength);
+		}
+		WriteVarint(data, str.size() - prefixLength);
+		data.insert(data.end(), str.begin() + prefixLength, str.end());
+	}
+	header.dataSize = data.size();
+
+	// Hash table is kept at most half full
+	header.slotCount = 16;
+	while (header.slotCount < entries.size() * 2)
+	{
+		header.slotCount *= 2;
+	}
+
+	vector<HashKey> slotKeys((size_t)header.slotCount, kInvalidHashKey);
+	vector<uint32_t> slotIndexes((size_t)header.slotCount, 0);
+	uint64_t mask = header.slotCount - 1;
+	for (uint32_t i = 0; i < entries.size(); i++)
+	{
+		uint64_t slot = entries[i].first & mask;
+		while (slotIndexes[slot] != 0)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slotKeys[slot] = entries[i].first;
+		slotIndexes[slot] = i + 1;
+	}
+
+	SectionOffsets offsets;
+	GetSectionOffsets(header, offsets);
+
+	image.assign((size_t)(offsets.data + data.size()), 0);
+	memcpy(&image[0], &header, sizeof(header));
+	if (!blockOffsets.empty())
+	{
+		memcpy(&image[(size_t)offsets.blockOffsets], &blockOffsets[0], blockOffsets.size() * sizeof(uint64_t));
+	}
+	memcpy(&image[(size_t)offsets.slotKeys], &slotKeys[0], slotKeys.size() * sizeof(HashKey));
+	memcpy(&image[(size_t)offsets.slotIndexes], &slotIndexes[0], slotIndexes.size() * sizeof(uint32_t));
+	if (!data.empty())
+	{
+		memcpy(&image[(size_t)offsets.data], &data[0], data.size());
+	}
+}
+
+bool FrontCodedDictionary::Open(const char *image, size_t size)
+{
+	Close();
+
+	if (image == NULL || size < sizeof(FrontCodedHeader) || (uintptr_t)image % kSectionAlignment != 0)
+	{
+		return false;
+	}
+
+	// Counts are checked against the size before computing offsets so the
+	// offsets can't overflow
+	const FrontCodedHeader *header = (const FrontCodedHeader *)image;
+	if (header->blockCount > size / sizeof(uint64_t) || header->slotCount > size / sizeof(HashKey)
+		|| header->slotCount == 0 || (header->slotCount & (header->slotCount - 1)) != 0
+		|| header->stringCount >= header->slotCount
+		|| header->blockCount != (header->stringCount + kFrontCodingBlockSize - 1) / kFrontCodingBlockSize)
+	{
+		return false;
+	}
+
+	SectionOffsets offsets;
+	GetSectionOffsets(*header, offsets);
+	if (offsets.data > size || header->dataSize > size - offsets.data)
+	{
+		return false;
+	}
+
+	m_header = header;
+	m_blockOffsets = (const uint64_t *)(image + offsets.blockOffsets);
+	m_slotKeys = (const HashKey *)(image + offsets.slotKeys);
+	m_slotIndexes = (const uint32_t *)(image + offsets.slotIndexes);
+	m_data = image + offsets.data;
+
+	return true;
+}
+
+void FrontCodedDictionary::Close()
+{
+	m_header = NULL;
+	m_blockOffsets = NULL;
+	m_slotKeys = NULL;
+	m_slotIndexes = NULL;
+	m_data = NULL;
+}
+
+//----------------------------------------------------------------------------
+// FrontCodedDictionary::Lookup : Finds the string's index in the hash
+// table, then decodes its block up to the string. Nothing is decoded if the
+// string shares no prefix with the one before it.
+//----------------------------------------------------------------------------
+bool FrontCodedDictionary::Lookup(HashKey key, string &buffer, string_view &str) const
+{
+	if (m_header == NULL)
+	{
+		return false;
+	}
+
+	uint64_t mask = m_header->slotCount - 1;
+	uint64_t slot = key & mask;
+	for (uint64_t probes = 0; probes < m_header->slotCount && m_slotIndexes[slot] != 0; probes++)
+	{
+		if (m_slotKeys[slot] == key)
+		{
+			uint32_t index = m_slotIndexes[slot] - 1;
+			const char *pos;
+			const char *end;
+			if (index >= m_header->stringCount || !GetBlock(index / kFrontCodingBlockSize, pos, end))
+			{
+				return false;
+			}
+
+			uint32_t position = index % kFrontCodingBlockSize;
+			for (uint32_t i = 0; i < position; i++)
+			{
+				if (!DecodeString(pos, end, i == 0, buffer))
+				{
+					return false;
+				}
+			}
+
+			uint64_t prefixLength;
+			string_view suffix;
+			if (!ReadString(pos, end, position == 0, buffer.size(), prefixLength, suffix))
+			{
+				return false;
+			}
+
+			if (prefixLength == 0)
+			{
+				str = suffix;
+				return true;
+			}
+
+			buffer.resize((size_t)prefixLength);
+			buffer.append(suffix);
+			str = buffer;
+			return true;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return false;
+}
+
+bool FrontCodedDictionary::ForEachString(const StringFunction &function) const
+{
+	if (m_header == NULL)
+	{
+		return true;
+	}
+
+	// Hash of each string by index
+	vector<HashKey> keys(m_header->stringCount, kInvalidHashKey);
+	for (uint64_t slot = 0; slot < m_header->slotCount; slot++)
+	{
+		uint32_t index = m_slotIndexes[slot] - 1;
+		if (m_slotIndexes[slot] != 0 && index < m_header->stringCount)
+		{
+			keys[index] = m_slotKeys[slot];
+		}
+	}
+
+	string str;
+	for (uint32_t block = 0; block < m_header->blockCount; block++)
+	{
+		const char *pos;
+		const char *end;
+		if (!GetBlock(block, pos, end))
+		{
+			return false;
+		}
+
+		uint32_t index = block * kFrontCodingBlockSize;
+		for (uint32_t i = 0; i < kFrontCodingBlockSize && index < m_header->stringCount; i++, index++)
+		{
+			if (keys[index] == kInvalidHashKey || !DecodeString(pos, end, i == 0, str))
+			{
+				return false;
+			}
+			function(keys[index], str);
+		}
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// FrontCodedDictionary::DecodeString : Decodes the string at pos, which
+// shares a prefix with str unless it's the first string in its block
+//----------------------------------------------------------------------------
+bool FrontCodedDictionary::DecodeString(const char *&pos, const char *end, bool firstInBlock, string &str) const
+{
+	uint64_t prefixLength;
+	string_view suffix;
+	if (!ReadString(pos, end, firstInBlock, str.size(), prefixLength, suffix))
+	{
+		return false;
+	}
+
+	str.resize((size_t)prefixLength);
+	str.append(suffix);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// FrontCodedDictionary::ReadString : Reads the string at pos as the length
+// of the prefix it shares with the previous string, which is previousLength
+// long, and a view of the rest of its characters in the image
+//----------------------------------------------------------------------------
+bool FrontCodedDictionary::ReadString(const char *&pos, const char *end, bool firstInBlock, size_t previousLength,
+	uint64_t &prefixLength, string_view &suffix) const
+{
+	prefixLength = 0;
+	if (!firstInBlock && (!ReadVarint(pos, end, prefixLength) || prefixLength > previousLength))
+	{
+		return false;
+	}
+
+	uint64_t suffixLength;
+	if (!ReadVarint(pos, end, suffixLength) || suffixLength > (uint64_t)(end - pos))
+	{
+		return false;
+	}
+
+	suffix = string_view(pos, (size_t)suffixLength);
+	pos += suffixLength;
+	return true;
+}
+
+bool FrontCodedDictionary::GetBlock(uint32_t block, const char *&begin, const char *&end) const
+{
+	uint64_t blockBegin = m_blockOffsets[block];
+	uint64_t blockEnd = block + 1 < m_header->blockCount ? m_blockOffsets[block + 1] : m_header->dataSize;
+	if (blockBegin > blockEnd || blockEnd > m_header->dataSize)
+	{
+		return false;
+	}
+
+	begin = m_data + blockBegin;
+	end = m_data + blockEnd;
+	return true;
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,101 @@
+//
+//  FrontCodedDictionary.h
+//  Jon Edwards Code Sample
+//
+//  Compressed, read-only form of a string table. Strings are sorted and
+//  split into blocks of kFrontCodingBlockSize. The first string of a block
+//  is stored whole and each following string as the length of the prefix
+//  it shares with the previous string and the rest of its characters, so
+//  strings with common prefixes (user names, phone numbers) take little
+//  more space than their differences. Lengths are stored as varints.
+//
+//  An image is one contiguous block of memory, used in place, so it can be
+//  part of a snapshot or a memory-mapped file:
+//
+//		header			FrontCodedHeader
+//		blockOffsets	uint64_t[]		block -> offset of block in data
+//		slotKeys		HashKey[]		hash table: string hash
+//		slotIndexes		uint32_t[]		hash table: (block, position) of string
+//		data			char[]			front-coded blocks
+//
+//  The hash table uses linear probing over a power of two number of slots.
+//  Slots hold the string's index in sorted order + 1, with 0 marking an
+//  empty slot; the string is at position (index % kFrontCodingBlockSize)
+//  of block (index / kFrontCodingBlockSize). Sections are aligned to 8
+//  bytes and values are in host byte order.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_FRONTCODEDDICTIONARY_H
+#define LDB_FRONTCODEDDICTIONARY_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "HashManagerInterface.h"
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const uint32_t kFrontCodingBlockSize = 16;
+
+struct FrontCodedHeader
+{
+	uint32_t stringCount;
+	uint32_t blockCount;
+	uint64_t slotCount;
+	uint64_t dataSize;
+};
+
+class FrontCodedDictionary
+{
+public:
+	typedef pair<HashKey, string_view> Entry;
+	typedef function<void(HashKey key, string_view str)> StringFunction;
+
+	// Builds a dictionary image from (hash, string) entries. The entries
+	// are sorted by string.
+	static void Build(vector<Entry> &entries, vector<char> &image);
+
+	FrontCodedDictionary();
+
+	// Uses an image in place. The image must be aligned to 8 bytes and stay
+	// valid until the dictionary is closed. Open checks the image's layout;
+	// blocks are checked as they're decoded.
+	bool Open(const char *image, size_t size);
+	void Close();
+
+	uint32_t GetStringCount() const { return m_header != NULL ? m_header->stringCount : 0; }
+
+	// Finds the string with the hash. A string stored whole, such as the
+	// first string of a block, is returned as a view into the image;
+	// others are decoded into buffer. Returns false if no string has the
+	// hash.
+	bool Lookup(HashKey key, string &buffer, string_view &str) const;
+
+	// Calls function for every string in sorted order. The string is only
+	// valid during the call. Returns false if a block is corrupt.
+	bool ForEachString(const StringFunction &function) const;
+
+private:
+	bool DecodeString(const char *&pos, const char *end, bool firstInBlock, string &str) const;
+	bool ReadString(const char *&pos, const char *end, bool firstInBlock, size_t previousLength,
+		uint64_t &prefixLength, string_view &suffix) const;
+	bool GetBlock(uint32_t block, const char *&begin, const char *&end) const;
+
+	const FrontCodedHeader *m_header;
+	const uint64_t *m_blockOffsets;
+	const HashKey *m_slotKeys;
+	const uint32_t *m_slotIndexes;
+	const char *m_data;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_FRONTCODEDDICTIONARY_H
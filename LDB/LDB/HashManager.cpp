@@ -7,7 +7,10 @@
 //  Copyright (c) 2017 Jon Edwards. All rights reserved.
 //
 
+#include "FrontCodedDictionary.h"
 #include "HashManager.h"
+#include "Snapshot.h"
+#include "StringHash.h"
 
 BEGIN_NAMESPACE(LDB)
 	
@@ -16,46 +19,69 @@ HashManager::~HashManager()
 	// Nothing to do
 }
 
-HashKey HashManager::GenerateHash(const string &str)
+HashKey HashManager::GenerateHash(string_view str)
 {
 	if (str.empty())
 	{
 		return kInvalidHashKey;
 	}
 
-	HashKey key = HashString(str.c_str());
+	HashKey key = ComputeHash(str);
 	ASSERT(key != kInvalidHashKey, "Valid hash generated same value as kInvalidHashKey");
 	if (key == kInvalidHashKey)
 	{
-		LogError("Error: String '%s' generated invalid hash value\n", str.c_str());
+		LogError("Error: String '%.*s' generated invalid hash value\n", (int)str.size(), str.data());
 	}
 	else
 	{
-		string registeredString;
+		string_view registeredString;
 		bool found = LookupHashString(key, registeredString);
 		if (found)
 		{
 			// We've found key in string has table. Make sure we don't have a collision.
 			if (str != registeredString)
 			{
-				LogError("Error: Discovered hash conflict for strings '%s' and '%s'\n",
-					str.c_str(), registeredString.c_str());
+				LogError("Error: Discovered hash conflict for strings '%.*s' and '%.*s'\n",
+					(int)str.size(), str.data(), (int)registeredString.size(), registeredString.data());
 				key = kInvalidHashKey;
 			}
 		}
 		else
 		{
 			// Record string in table
-			m_stringHashTable[key] = str;
+			m_stringHashTable[key] = m_stringArena.Add(str);
 		}		
 	}
 
 	return key;
 }
 
-bool HashManager::LookupHashString(HashKey key, string &str)
+HashKey HashManager::ComputeHash(string_view str) const
 {
-	unordered_map<HashKey, string>::const_iterator itr;
+	if (str.empty())
+	{
+		return kInvalidHashKey;
+	}
+
+	return StringHash::Hash64(str.data(), str.size());
+}
+
+HashKey HashManager::FindHash(string_view str) const
+{
+	HashKey key = ComputeHash(str);
+
+	FlatHashMap<const char *>::const_iterator itr = m_stringHashTable.find(key);
+	if (itr == m_stringHashTable.end() || StringArena::GetString((*itr).second) != str)
+	{
+		return kInvalidHashKey;
+	}
+
+	return key;
+}
+
+bool HashManager::LookupHashString(HashKey key, string_view &str) const
+{
+	FlatHashMap<const char *>::const_iterator itr;
 	itr = m_stringHashTable.find(key);
 	if (itr == m_stringHashTable.end())
 	{
@@ -63,59 +89,129 @@ bool HashManager::LookupHashString(HashKey key, string &str)
 		return false;
 	}
 
-	str = (*itr).second;
+	str = StringArena::GetString((*itr).second);
 
 	return true;
 }
 
+void HashManager::GetHashKeys(vector<HashKey> &keys) const
+{
+	keys.reserve(keys.size() + m_stringHashTable.size());
+
+	FlatHashMap<const char *>::const_iterator itr;
+	for (itr = m_stringHashTable.begin(); itr != m_stringHashTable.end(); ++itr)
+	{
+		keys.push_back((*itr).first);
+	}
+}
+
 //---------------------------------------------------------------------------
-// HashString
-//
-// Uses 64-CRC Murmur public domain hash algorithm taken from
-// https://sites.google.com/site/murmurhash/
+// HashManager::GenerateSymbolId : Symbols refer to strings in the arena, so
+// the string must already be registered
+//---------------------------------------------------------------------------
+SymbolId HashManager::GenerateSymbolId(SymbolNamespace symbolNamespace, HashKey key)
+{
+	string_view str;
+	if (!LookupHashString(key, str))
+	{
+		return kInvalidSymbolId;
+	}
+
+	return m_symbolTables[symbolNamespace].Add(key, str);
+}
+
+SymbolId HashManager::LookupSymbolId(SymbolNamespace symbolNamespace, HashKey key) const
+{
+	return m_symbolTables[symbolNamespace].Find(key);
+}
+
+HashKey HashManager::GetSymbolHash(SymbolNamespace symbolNamespace, SymbolId id) const
+{
+	return m_symbolTables[symbolNamespace].GetHash(id);
+}
+
+bool HashManager::LookupSymbolString(SymbolNamespace symbolNamespace, SymbolId id, string_view &str) const
+{
+	return m_symbolTables[symbolNamespace].GetString(id, str);
+}
+
+uint32_t HashManager::GetStringCount() const
+{
+	return (uint32_t)m_stringHashTable.size();
+}
+
+uint32_t HashManager::GetSymbolCount(SymbolNamespace symbolNamespace) const
+{
+	return m_symbolTables[symbolNamespace].GetCount();
+}
+
+//---------------------------------------------------------------------------
+// HashManager::WriteSnapshot : Writes string table as a front-coded
+// dictionary image. Strings are restored without being rehashed. Each
+// symbol namespace follows as its hashes in id order.
 //---------------------------------------------------------------------------
-HashKey HashManager::HashString(const char *str, uint32_t seed /* = 0 */)
+void HashManager::WriteSnapshot(SnapshotWriter &writer)
 {
-	const uint64_t m = 0xc6a4a7935bd1e995;
-	const int r = 47;
-	const size_t len = strlen(str);
+	vector<FrontCodedDictionary::Entry> entries;
+	entries.reserve(m_stringHashTable.size());
 
-	uint64_t h = seed ^ (len * m);
+	FlatHashMap<const char *>::const_iterator itr;
+	for (itr = m_stringHashTable.begin(); itr != m_stringHashTable.end(); ++itr)
+	{
+		entries.push_back(make_pair((*itr).first, StringArena::GetString((*itr).second)));
+	}
 
-	const uint64_t * data = (const uint64_t *)str;
-	const uint64_t * end = data + (len / 8);
+	vector<char> image;
+	FrontCodedDictionary::Build(entries, image);
+	writer.WriteVector(image);
 
-	while (data != end)
+	for (int i = 0; i < Symbol_NamespaceCount; i++)
 	{
-		uint64_t k = *data++;
-
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m; 
+		writer.WriteVector(m_symbolTables[i].GetHashes());
 	}
+}
 
-	const unsigned char * data2 = (const unsigned char*)data;
+bool HashManager::ReadSnapshot(SnapshotReader &reader)
+{
+	m_stringHashTable.clear();
+	m_stringArena.Clear();
+	for (int i = 0; i < Symbol_NamespaceCount; i++)
+	{
+		m_symbolTables[i].Clear();
+	}
 
-	switch(len & 7)
+	vector<char> image;
+	reader.ReadVector(image);
+
+	FrontCodedDictionary dictionary;
+	if (reader.HasFailed() || !dictionary.Open(image.data(), image.size()))
 	{
-		case 7: h ^= uint64_t(data2[6]) << 48;
-		case 6: h ^= uint64_t(data2[5]) << 40;
-		case 5: h ^= uint64_t(data2[4]) << 32;
-		case 4: h ^= uint64_t(data2[3]) << 24;
-		case 3: h ^= uint64_t(data2[2]) << 16;
-		case 2: h ^= uint64_t(data2[1]) << 8;
-		case 1: h ^= uint64_t(data2[0]);
-		        h *= m;
-	};
- 
-	h ^= h >> r;
-	h *= m;
-	h ^= h >> r;
-
-	return h;
-} 
+		return false;
+	}
+	m_stringHashTable.reserve(dictionary.GetStringCount());
+
+	if (!dictionary.ForEachString([this](HashKey key, string_view str)
+		{
+			m_stringHashTable[key] = m_stringArena.Add(str);
+		}))
+	{
+		return false;
+	}
+
+	vector<HashKey> symbolHashes;
+	for (int i = 0; i < Symbol_NamespaceCount && !reader.HasFailed(); i++)
+	{
+		reader.ReadVector(symbolHashes);
+		for (size_t j = 0; j < symbolHashes.size(); j++)
+		{
+			if (GenerateSymbolId((SymbolNamespace)i, symbolHashes[j]) != (SymbolId)j)
+			{
+				return false;
+			}
+		}
+	}
+
+	return !reader.HasFailed();
+}
 
 END_NAMESPACE(LDB)
@@ -15,7 +15,10 @@
 #include <unordered_map>
 
 #include "fruit/fruit.h"
+#include "FlatHashMap.h"
 #include "HashManagerInterface.h"
+#include "StringArena.h"
+#include "SymbolTable.h"
 #include "Util.h"
 
 using namespace std;
@@ -25,7 +28,8 @@ BEGIN_NAMESPACE(LDB)
 //----------------------------------------------------------------------------
 // HashManger class : Manages string hashes for Database. Used for
 // tracking string hashes. Can look up string for hash and detect hash
-// collisions.
+// collisions. Registered strings are stored once in a string arena and
+// indexed by hash.
 //----------------------------------------------------------------------------
 class HashManager : public HashManagerInterface
 {
@@ -33,13 +37,28 @@ public:
 	INJECT(HashManager()) = default;
 	~HashManager();
 
-	HashKey GenerateHash(const std::string &str);
-	bool LookupHashString(HashKey key, string &str);
+	bool IsThreadSafe() const { return false; }
 
-private:
-	HashKey HashString(const char *str, uint32_t seed = 0);
+	HashKey GenerateHash(string_view str);
+	HashKey ComputeHash(string_view str) const;
+	HashKey FindHash(string_view str) const;
+	bool LookupHashString(HashKey key, string_view &str) const;
+	void GetHashKeys(vector<HashKey> &keys) const;
+	uint32_t GetStringCount() const;
+
+	SymbolId GenerateSymbolId(SymbolNamespace symbolNamespace, HashKey key);
+	SymbolId LookupSymbolId(SymbolNamespace symbolNamespace, HashKey key) const;
+	HashKey GetSymbolHash(SymbolNamespace symbolNamespace, SymbolId id) const;
+	bool LookupSymbolString(SymbolNamespace symbolNamespace, SymbolId id, string_view &str) const;
+	uint32_t GetSymbolCount(SymbolNamespace symbolNamespace) const;
 
-	unordered_map<HashKey, string> m_stringHashTable;
+	void WriteSnapshot(SnapshotWriter &writer);
+	bool ReadSnapshot(SnapshotReader &reader);
+
+private:
+	StringArena m_stringArena;
+	FlatHashMap<const char *> m_stringHashTable;	// String hash -> arena entry
+	SymbolTable m_symbolTables[Symbol_NamespaceCount];
 };
 
 END_NAMESPACE(LDB)
@@ -12,6 +12,7 @@
 #define LDB_HASHMANAGERINTERFACE_H
 
 #include <map>
+#include <string_view>
 #include <unordered_map>
 
 #include "Util.h"
@@ -20,9 +21,29 @@ using namespace std;
 
 BEGIN_NAMESPACE(LDB)
 
+class SnapshotReader;
+class SnapshotWriter;
+
 const HashKey kInvalidHashKey = 0;
 const string kInvalidString = "(invalid string)";
 
+// Dense id of a registered string within a symbol namespace
+typedef uint32_t SymbolId;
+const SymbolId kInvalidSymbolId = 0xffffffff;
+
+// Each namespace numbers its symbols separately, starting at 0. Database
+// only gives likes ids, for its compacted likes. User records keep 64-bit
+// hashes, so their namespaces stay empty rather than cost a table entry per
+// user that nothing reads.
+enum SymbolNamespace
+{
+	Symbol_UserName = 0,
+	Symbol_PhoneNumber,
+	Symbol_Gender,
+	Symbol_Like,
+	Symbol_NamespaceCount
+};
+
 //----------------------------------------------------------------------------
 // HashManger interface : Class for managing string hashes for Database.
 // Used for tracking string hashes. Can look up string for hash and detect 
@@ -33,8 +54,43 @@ class HashManagerInterface
 public:
     virtual ~HashManagerInterface() { };
 
-	virtual HashKey GenerateHash(const std::string &str) = 0;
-	virtual bool LookupHashString(HashKey key, string &str) = 0;
+	// True if every method can be called from several threads at once
+	virtual bool IsThreadSafe() const = 0;
+
+	// Hashes a string and registers it, reporting collisions with strings
+	// already registered
+	virtual HashKey GenerateHash(string_view str) = 0;
+
+	// Lookups that never register strings. ComputeHash only hashes the
+	// string. FindHash returns kInvalidHashKey if the string isn't
+	// registered.
+	virtual HashKey ComputeHash(string_view str) const = 0;
+	virtual HashKey FindHash(string_view str) const = 0;
+
+	// Gets the registered string with the hash. The string stays valid until
+	// the HashManager is destroyed or reads a snapshot.
+	virtual bool LookupHashString(HashKey key, string_view &str) const = 0;
+
+	// Adds the keys of all registered strings to keys. Strings are never
+	// unregistered, so the count only changes when strings are registered
+	// or a snapshot is read.
+	virtual void GetHashKeys(vector<HashKey> &keys) const = 0;
+	virtual uint32_t GetStringCount() const = 0;
+
+	// Dense symbol ids. GenerateSymbolId adds the registered string with the
+	// hash to the namespace if it isn't already in it, returning
+	// kInvalidSymbolId if no string has the hash. Lookups return
+	// kInvalidSymbolId, kInvalidHashKey or false for unknown symbols.
+	virtual SymbolId GenerateSymbolId(SymbolNamespace symbolNamespace, HashKey key) = 0;
+	virtual SymbolId LookupSymbolId(SymbolNamespace symbolNamespace, HashKey key) const = 0;
+	virtual HashKey GetSymbolHash(SymbolNamespace symbolNamespace, SymbolId id) const = 0;
+	virtual bool LookupSymbolString(SymbolNamespace symbolNamespace, SymbolId id, string_view &str) const = 0;
+	virtual uint32_t GetSymbolCount(SymbolNamespace symbolNamespace) const = 0;
+
+	// Save and restore the registered strings and symbols in a database
+	// snapshot. Reading replaces all registered strings and symbols.
+	virtual void WriteSnapshot(SnapshotWriter &writer) = 0;
+	virtual bool ReadSnapshot(SnapshotReader &reader) = 0;
 };
 
 END_NAMESPACE(LDB)
@@ -0,0 +1,178 @@
+//
+//  LoadStats.cpp
+//  Jon Edwards Code Sample
+//
+//  Statistics gathered while loading CSV files
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <string.h>
+
+#include "LoadStats.h"
+
+BEGIN_NAMESPACE(LDB)
+
+static const char *sLoadErrorNames[LoadError_Count] = { "parse errors", "duplicate users", "unknown users" };
+static const char *sLoadPhaseNames[LoadPhase_Count] = { "ingest likes", "spatial index", "compact", "total" };
+
+//============================================================================
+//
+//							CSVLoadStats
+//
+//============================================================================
+
+void CSVLoadStats::Start(const char *fileName)
+{
+	m_fileName = fileName;
+	m_lineCount = 0;
+	m_byteCount = 0;
+	m_acceptedCount = 0;
+	for (uint32_t i = 0; i < LoadError_Count; i++)
+	{
+		m_errorCounts[i] = 0;
+	}
+	m_totalErrorCount = 0;
+	m_loggedErrorCount = 0;
+	{
+		lock_guard<mutex> lock(m_fieldErrorMutex);
+		m_fieldErrorCounts.clear();
+	}
+	m_startTime = chrono::steady_clock::now();
+	m_seconds = 0.0;
+}
+
+void CSVLoadStats::Finish()
+{
+	m_seconds = chrono::duration<double>(chrono::steady_clock::now() - m_startTime).count();
+}
+
+void CSVLoadStats::AddLines(uint64_t lineCount, uint64_t byteCount)
+{
+	m_lineCount.fetch_add(lineCount, memory_order_relaxed);
+	m_byteCount.fetch_add(byteCount, memory_order_relaxed);
+}
+
+bool CSVLoadStats::AddError(LoadError error)
+{
+	m_errorCounts[error].fetch_add(1, memory_order_relaxed);
+	return CountError();
+}
+
+bool CSVLoadStats::AddParseError(const char *fieldName)
+{
+	{
+		lock_guard<mutex> lock(m_fieldErrorMutex);
+		size_t i = 0;
+		while (i < m_fieldErrorCounts.size() && strcmp(m_fieldErrorCounts[i].first, fieldName) != 0)
+		{
+			i++;
+		}
+		if (i == m_fieldErrorCounts.size())
+		{
+			m_fieldErrorCounts.push_back(make_pair(fieldName, 0));
+		}
+		m_fieldErrorCounts[i].second++;
+	}
+
+	return AddError(LoadError_Parse);
+}
+
+bool CSVLoadStats::IsErrorLogged(uint64_t errorIndex)
+{
+	return errorIndex <= kLoadErrorsLogged || errorIndex % kLoadErrorSampleInterval == 0;
+}
+
+bool CSVLoadStats::CountError()
+{
+	uint64_t errorIndex = m_totalErrorCount.fetch_add(1, memory_order_relaxed) + 1;
+	if (!IsErrorLogged(errorIndex))
+	{
+		return false;
+	}
+
+	m_loggedErrorCount.fetch_add(1, memory_order_relaxed);
+	return true;
+}
+
+uint64_t CSVLoadStats::GetFieldErrorCount(const char *fieldName) const
+{
+	lock_guard<mutex> lock(m_fieldErrorMutex);
+	for (size_t i = 0; i < m_fieldErrorCounts.size(); i++)
+	{
+		if (strcmp(m_fieldErrorCounts[i].first, fieldName) == 0)
+		{
+			return m_fieldErrorCounts[i].second;
+		}
+	}
+	return 0;
+}
+
+void CSVLoadStats::Log() const
+{
+	double megabytes = m_byteCount / (1024.0 * 1024.0);
+	LogError("\t'%s': %llu lines, %llu accepted, %.2f MB in %.3fs (%.1f MB/s)\n", m_fileName.c_str(),
+		(unsigned long long)m_lineCount, (unsigned long long)m_acceptedCount, megabytes, m_seconds,
+		m_seconds > 0.0 ? megabytes / m_seconds : 0.0);
+
+	if (m_totalErrorCount == 0)
+	{
+		return;
+	}
+
+	const char *separator = "";
+	LogError("\t\tRejected:");
+	for (uint32_t i = 0; i < LoadError_Count; i++)
+	{
+		if (m_errorCounts[i] > 0)
+		{
+			LogError("%s %llu %s", separator, (unsigned long long)m_errorCounts[i], sLoadErrorNames[i]);
+			separator = ",";
+		}
+	}
+	LogError(" (%llu logged)\n", (unsigned long long)m_loggedErrorCount);
+
+	lock_guard<mutex> lock(m_fieldErrorMutex);
+	for (size_t i = 0; i < m_fieldErrorCounts.size(); i++)
+	{
+		LogError("\t\tField %s: %llu parse errors\n", m_fieldErrorCounts[i].first,
+			(unsigned long long)m_fieldErrorCounts[i].second);
+	}
+}
+
+//============================================================================
+//
+//							LoadStats
+//
+//============================================================================
+
+void LoadStats::Reset()
+{
+	m_userStats.Start("");
+	m_likeStats.Start("");
+	for (uint32_t i = 0; i < LoadPhase_Count; i++)
+	{
+		m_phaseSeconds[i] = 0.0;
+	}
+}
+
+void LoadStats::Log() const
+{
+	LogError("Load summary:\n");
+	m_userStats.Log();
+	m_likeStats.Log();
+
+	const char *separator = "";
+	LogError("\tPhases:");
+	for (uint32_t i = 0; i < LoadPhase_Count; i++)
+	{
+		if (m_phaseSeconds[i] > 0.0)
+		{
+			LogError("%s %s %.3fs", separator, sLoadPhaseNames[i], m_phaseSeconds[i]);
+			separator = ",";
+		}
+	}
+	LogError("\n");
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,165 @@
+//
+//  LoadStats.h
+//  Jon Edwards Code Sample
+//
+//  Statistics gathered while loading CSV files: lines and bytes read,
+//  records accepted, lines rejected and why, and how long each phase of
+//  the load took. Counters are updated by the parallel parsers, so they're
+//  atomic. Rejected lines are counted rather than all logged; only the
+//  first few and a sample of the rest are formatted to the log, as on dirty
+//  data formatting every rejected line costs more than parsing it.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_LOADSTATS_H
+#define LDB_LOADSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const uint64_t kLoadErrorsLogged = 10;				// Rejected lines logged per
+													// file before sampling
+const uint64_t kLoadErrorSampleInterval = 1000;		// Then one in this many
+													// is logged
+
+enum LoadError
+{
+	LoadError_Parse = 0,			// Field missing or not a valid value
+	LoadError_Duplicate,			// User name already loaded
+	LoadError_UnknownUser,			// Like for a user that isn't loaded
+	LoadError_Count
+};
+
+enum LoadPhase
+{
+	LoadPhase_IngestLikes = 0,		// Adding likes parsed while users loaded
+	LoadPhase_SpatialIndex,			// Adding loaded users to the R-trees
+	LoadPhase_Compact,
+	LoadPhase_Total,
+	LoadPhase_Count
+};
+
+//----------------------------------------------------------------------------
+// CSVLoadStats : Statistics for loading one CSV file. Lines, records and
+// errors can be added from any thread between Start and Finish.
+//----------------------------------------------------------------------------
+class CSVLoadStats
+{
+public:
+	CSVLoadStats() { Start(""); }
+
+	// Clears the statistics and starts timing the load
+	void Start(const char *fileName);
+	void Finish();
+
+	void AddLines(uint64_t lineCount, uint64_t byteCount);
+	void AddAccepted(uint64_t recordCount) { m_acceptedCount.fetch_add(recordCount, memory_order_relaxed); }
+
+	// Counts a rejected line. Returns true if it should be logged.
+	bool AddError(LoadError error);
+	bool AddParseError(const char *fieldName);
+
+	// True for the errorIndex'th error (from 1) of a file if it's logged
+	static bool IsErrorLogged(uint64_t errorIndex);
+
+	const string &GetFileName() const { return m_fileName; }
+	uint64_t GetLineCount() const { return m_lineCount; }
+	uint64_t GetByteCount() const { return m_byteCount; }
+	uint64_t GetAcceptedCount() const { return m_acceptedCount; }
+	uint64_t GetErrorCount(LoadError error) const { return m_errorCounts[error]; }
+	uint64_t GetFieldErrorCount(const char *fieldName) const;
+	uint64_t GetLoggedErrorCount() const { return m_loggedErrorCount; }
+	double GetSeconds() const { return m_seconds; }
+
+	void Log() const;
+
+private:
+	CSVLoadStats(const CSVLoadStats &);				// Not copyable
+	CSVLoadStats &operator=(const CSVLoadStats &);
+
+	bool CountError();
+
+	string m_fileName;
+	atomic<uint64_t> m_lineCount;
+	atomic<uint64_t> m_byteCount;
+	atomic<uint64_t> m_acceptedCount;
+	atomic<uint64_t> m_errorCounts[LoadError_Count];
+	atomic<uint64_t> m_totalErrorCount;			// Decides which errors are logged
+	atomic<uint64_t> m_loggedErrorCount;
+
+	// Parse errors per field, keyed by the schema's field names, which are
+	// string literals so they outlive the statistics
+	mutable mutex m_fieldErrorMutex;
+	vector< pair<const char *, uint64_t> > m_fieldErrorCounts;
+
+	chrono::steady_clock::time_point m_startTime;
+	double m_seconds;
+};
+
+//----------------------------------------------------------------------------
+// LoadStats : Statistics for loading a users file and a likes file
+//----------------------------------------------------------------------------
+class LoadStats
+{
+public:
+	LoadStats() { Reset(); }
+
+	void Reset();
+
+	CSVLoadStats &GetUserStats() { return m_userStats; }
+	CSVLoadStats &GetLikeStats() { return m_likeStats; }
+	const CSVLoadStats &GetUserStats() const { return m_userStats; }
+	const CSVLoadStats &GetLikeStats() const { return m_likeStats; }
+
+	// Each phase is timed by one thread at a time
+	void AddPhaseTime(LoadPhase phase, double seconds) { m_phaseSeconds[phase] += seconds; }
+	double GetPhaseTime(LoadPhase phase) const { return m_phaseSeconds[phase]; }
+
+	// Logs a summary of both files and the phases that ran
+	void Log() const;
+
+private:
+	LoadStats(const LoadStats &);				// Not copyable
+	LoadStats &operator=(const LoadStats &);
+
+	CSVLoadStats m_userStats;
+	CSVLoadStats m_likeStats;
+	double m_phaseSeconds[LoadPhase_Count];
+};
+
+//----------------------------------------------------------------------------
+// LoadPhaseTimer : Adds the time until it's destroyed to a phase
+//----------------------------------------------------------------------------
+class LoadPhaseTimer
+{
+public:
+	LoadPhaseTimer(LoadStats &stats, LoadPhase phase)
+		: m_stats(stats), m_phase(phase), m_startTime(chrono::steady_clock::now()) { }
+	~LoadPhaseTimer()
+	{
+		m_stats.AddPhaseTime(m_phase, chrono::duration<double>(chrono::steady_clock::now() - m_startTime).count());
+	}
+
+private:
+	LoadPhaseTimer(const LoadPhaseTimer &);				// Not copyable
+	LoadPhaseTimer &operator=(const LoadPhaseTimer &);
+
+	LoadStats &m_stats;
+	LoadPhase m_phase;
+	chrono::steady_clock::time_point m_startTime;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_LOADSTATS_H
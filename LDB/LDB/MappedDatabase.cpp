@@ -0,0 +1,628 @@
+//
+//  MappedDatabase.cpp
+//  Jon Edwards Code Sample
+//
+//  Read-only database file that is used in place through a memory mapping
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "MappedDatabase.h"
+
+BEGIN_NAMESPACE(LDB)
+
+const uint64_t kMappedSectionAlignment = 8;
+
+namespace MappedDatabaseUtil
+{
+	//------------------------------------------------------------------------
+	// GetSlotCount : Number of hash table slots for a number of entries.
+	// Tables are kept at most half full.
+	//------------------------------------------------------------------------
+	uint64_t GetSlotCount(uint64_t entryCount)
+	{
+		uint64_t slotCount = 16;
+		while (slotCount < entryCount * 2)
+		{
+			slotCount *= 2;
+		}
+		return slotCount;
+	}
+
+	template <class T> void InsertSlot(vector<T> &slots, HashKey key, T value)
+	{
+		uint64_t mask = slots.size() - 1;
+		uint64_t slot = key & mask;
+		while (slots[slot] != 0)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = value;
+	}
+
+	uint64_t AlignOffset(uint64_t offset)
+	{
+		return (offset + kMappedSectionAlignment - 1) & ~(kMappedSectionAlignment - 1);
+	}
+
+	template <class T> void AddSection(MappedFileSection &section, const vector<T> &data, uint64_t &offset)
+	{
+		section.offset = AlignOffset(offset);
+		section.count = data.size();
+		offset = section.offset + data.size() * sizeof(T);
+	}
+
+	template <class T> void CopySection(vector<char> &image, const MappedFileSection &section, const vector<T> &data)
+	{
+		if (!data.empty())
+		{
+			memcpy(&image[(size_t)section.offset], &data[0], data.size() * sizeof(T));
+		}
+	}
+}
+
+using namespace MappedDatabaseUtil;
+
+// Sections of each part, in layout order
+const uint32_t kMaxPartSections = 3;
+static MappedFileSection MappedFileHeader::* const kPartSections[DatabasePart_Count][kMaxPartSections] =
+{
+	{ &MappedFileHeader::userRecords, &MappedFileHeader::userSlots, NULL },
+	{ &MappedFileHeader::compactLikes, &MappedFileHeader::likeHashes, &MappedFileHeader::likeSlots },
+	{ &MappedFileHeader::strings, NULL, NULL },
+	{ &MappedFileHeader::rTreeNodes, &MappedFileHeader::partitions, NULL },
+	{ &MappedFileHeader::phoneNumberIndex, &MappedFileHeader::genderIndex, &MappedFileHeader::likeIndex }
+};
+
+// Section of each secondary index, by UserRecordIndexType
+static MappedFileSection MappedFileHeader::* const kUserIndexSections[UserIndex_Count] =
+{
+	&MappedFileHeader::phoneNumberIndex, &MappedFileHeader::genderIndex, &MappedFileHeader::likeIndex
+};
+
+MappedDatabaseFile::MappedDatabaseFile()
+	: m_mapping(NULL), m_mappingSize(0), m_header(NULL), m_userRecords(NULL), m_userSlots(NULL),
+	m_compactLikes(NULL), m_likeHashes(NULL), m_likeSlots(NULL),
+	m_rTreeNodes(NULL), m_partitions(NULL)
+{
+	memset(m_partData, 0, sizeof(m_partData));
+	memset(m_userIndexes, 0, sizeof(m_userIndexes));
+}
+
+MappedDatabaseFile::~MappedDatabaseFile()
+{
+	Close();
+}
+
+//============================================================================
+//
+//							Writing mapped files
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::Write : Builds every part and writes the header and
+// parts to a temporary file that's renamed into place so processes with the
+// old file mapped are unaffected. Section offsets are moved from the start
+// of their part to the start of the file.
+//----------------------------------------------------------------------------
+bool MappedDatabaseFile::Write(Database &database, HashManagerInterface &hashManager, const char *fileName)
+{
+	database.Compact();
+
+	MappedDatabaseImage image;
+	uint64_t partOffsets[DatabasePart_Count];
+	uint64_t offset = sizeof(MappedFileHeader);
+	for (int part = 0; part < DatabasePart_Count; part++)
+	{
+		BuildPart(database, hashManager, (DatabasePart)part, image);
+
+		partOffsets[part] = AlignOffset(offset);
+		offset = partOffsets[part] + image.parts[part]->size();
+
+		for (uint32_t i = 0; i < kMaxPartSections && kPartSections[part][i] != NULL; i++)
+		{
+			(image.header.*kPartSections[part][i]).offset += partOffsets[part];
+		}
+	}
+	image.header.fileSize = offset;
+
+	string tempFileName = string(fileName) + ".tmp";
+	FILE *file = fopen(tempFileName.c_str(), "wb");
+	if (file == NULL)
+	{
+		LogError("Error: MappedDatabaseFile::Write - could not open file '%s'\n", tempFileName.c_str());
+		return false;
+	}
+
+	// Padding between parts is zeroed
+	const char padding[kMappedSectionAlignment] = { 0 };
+	bool result = fwrite(&image.header, sizeof(image.header), 1, file) == 1;
+	offset = sizeof(MappedFileHeader);
+	for (int part = 0; result && part < DatabasePart_Count; part++)
+	{
+		const vector<char> &data = *image.parts[part];
+		size_t paddingSize = (size_t)(partOffsets[part] - offset);
+		result = fwrite(padding, 1, paddingSize, file) == paddingSize
+			&& fwrite(data.data(), 1, data.size(), file) == data.size();
+		offset = partOffsets[part] + data.size();
+	}
+
+	if (fclose(file) != 0)
+	{
+		result = false;
+	}
+
+	if (!result || rename(tempFileName.c_str(), fileName) != 0)
+	{
+		LogError("Error: MappedDatabaseFile::Write - failed writing file '%s'\n", fileName);
+		remove(tempFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::BuildPart : Builds the sections of a part and lays
+// them out in the part's data. The database must be compacted so every like
+// is in the compacted like array.
+//----------------------------------------------------------------------------
+void MappedDatabaseFile::BuildPart(Database &database, HashManagerInterface &hashManager, DatabasePart part,
+	MappedDatabaseImage &image)
+{
+	MappedFileHeader &header = image.header;
+	shared_ptr<vector<char>> data = make_shared<vector<char>>();
+	uint64_t offset = 0;
+
+	switch (part)
+	{
+	case DatabasePart_Users:
+		{
+			// User records and user key hash table
+			vector<UserRecord> userRecords;
+			userRecords.reserve(database.m_userRecords.size());
+			for (Database::UserRecordList::const_iterator itr = database.m_userRecords.begin();
+				itr != database.m_userRecords.end(); ++itr)
+			{
+				userRecords.push_back((*itr).second);
+			}
+
+			vector<uint32_t> userSlots((size_t)GetSlotCount(userRecords.size()), 0);
+			for (uint32_t i = 0; i < userRecords.size(); i++)
+			{
+				InsertSlot(userSlots, userRecords[i].userNameHash, i + 1);
+			}
+
+			AddSection(header.userRecords, userRecords, offset);
+			AddSection(header.userSlots, userSlots, offset);
+			data->assign((size_t)offset, 0);
+			CopySection(*data, header.userRecords, userRecords);
+			CopySection(*data, header.userSlots, userSlots);
+			break;
+		}
+
+	case DatabasePart_Likes:
+		{
+			// Compacted likes, and likes and like hash table
+			vector<HashKey> likeHashes(hashManager.GetSymbolCount(Symbol_Like));
+			for (LikeId likeId = 0; likeId < likeHashes.size(); likeId++)
+			{
+				likeHashes[likeId] = hashManager.GetSymbolHash(Symbol_Like, likeId);
+			}
+			vector<uint32_t> likeSlots((size_t)GetSlotCount(likeHashes.size()), 0);
+			for (uint32_t i = 0; i < likeHashes.size(); i++)
+			{
+				InsertSlot(likeSlots, likeHashes[i], i + 1);
+			}
+
+			AddSection(header.compactLikes, database.m_compactLikes, offset);
+			AddSection(header.likeHashes, likeHashes, offset);
+			AddSection(header.likeSlots, likeSlots, offset);
+			data->assign((size_t)offset, 0);
+			CopySection(*data, header.compactLikes, database.m_compactLikes);
+			CopySection(*data, header.likeHashes, likeHashes);
+			CopySection(*data, header.likeSlots, likeSlots);
+			break;
+		}
+
+	case DatabasePart_Strings:
+		{
+			// Front-coded strings
+			vector<HashKey> stringKeys;
+			hashManager.GetHashKeys(stringKeys);
+
+			vector<FrontCodedDictionary::Entry> stringEntries(stringKeys.size());
+			for (size_t i = 0; i < stringKeys.size(); i++)
+			{
+				stringEntries[i].first = stringKeys[i];
+				hashManager.LookupHashString(stringKeys[i], stringEntries[i].second);
+			}
+
+			FrontCodedDictionary::Build(stringEntries, *data);
+			header.strings.offset = 0;
+			header.strings.count = data->size();
+			break;
+		}
+
+	case DatabasePart_Spatial:
+		{
+			// Packed R-trees
+			vector<RTreePackedNode> rTreeNodes;
+			header.rTreeRoot = database.m_rTree.Pack(rTreeNodes);
+
+			vector<MappedPartition> partitions;
+			for (Database::RTreePartitionList::iterator itr = database.m_genderRTrees.begin();
+				itr != database.m_genderRTrees.end(); ++itr)
+			{
+				MappedPartition partition;
+				memset(&partition, 0, sizeof(partition));
+				partition.partitionKey = (*itr).first;
+				partition.rTreeRoot = (*itr).second->Pack(rTreeNodes);
+				partitions.push_back(partition);
+			}
+
+			AddSection(header.rTreeNodes, rTreeNodes, offset);
+			AddSection(header.partitions, partitions, offset);
+			data->assign((size_t)offset, 0);
+			CopySection(*data, header.rTreeNodes, rTreeNodes);
+			CopySection(*data, header.partitions, partitions);
+			break;
+		}
+
+	case DatabasePart_Indexes:
+		{
+			// Entries of each registered secondary index sorted by value
+			vector<MappedIndexEntry> indexEntries[UserIndex_Count];
+			header.userIndexMask = 0;
+			for (int indexType = 0; indexType < UserIndex_Count; indexType++)
+			{
+				const UserRecordIndex *index = database.m_userRecordIndexes[indexType];
+				if (index == NULL)
+				{
+					continue;
+				}
+				header.userIndexMask |= 1 << indexType;
+
+				vector<UserRecordIndex::Entry> entries;
+				index->GetEntries(entries);
+				sort(entries.begin(), entries.end());
+
+				indexEntries[indexType].resize(entries.size());
+				for (size_t i = 0; i < entries.size(); i++)
+				{
+					indexEntries[indexType][i].value = entries[i].first;
+					indexEntries[indexType][i].userKey = entries[i].second;
+				}
+			}
+
+			for (int indexType = 0; indexType < UserIndex_Count; indexType++)
+			{
+				AddSection(header.*kUserIndexSections[indexType], indexEntries[indexType], offset);
+			}
+			data->assign((size_t)offset, 0);
+			for (int indexType = 0; indexType < UserIndex_Count; indexType++)
+			{
+				CopySection(*data, header.*kUserIndexSections[indexType], indexEntries[indexType]);
+			}
+			break;
+		}
+
+	default:
+		ASSERT(false, "Invalid database part");
+		break;
+	}
+
+	image.parts[part] = data;
+}
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::CopyPart : Uses the part of the source image in image.
+// The part's data is shared, not copied.
+//----------------------------------------------------------------------------
+void MappedDatabaseFile::CopyPart(const MappedDatabaseImage &source, DatabasePart part, MappedDatabaseImage &image)
+{
+	for (uint32_t i = 0; i < kMaxPartSections && kPartSections[part][i] != NULL; i++)
+	{
+		image.header.*kPartSections[part][i] = source.header.*kPartSections[part][i];
+	}
+
+	if (part == DatabasePart_Spatial)
+	{
+		image.header.rTreeRoot = source.header.rTreeRoot;
+	}
+	else if (part == DatabasePart_Indexes)
+	{
+		image.header.userIndexMask = source.header.userIndexMask;
+	}
+
+	image.parts[part] = source.parts[part];
+}
+
+//============================================================================
+//
+//							Reading mapped files
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::Open : Maps the file and checks the header and that
+// every section lies within the file. Section contents aren't examined so
+// opening doesn't touch the pages holding them.
+//----------------------------------------------------------------------------
+bool MappedDatabaseFile::Open(const char *fileName)
+{
+	Close();
+
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(MappedFileHeader))
+	{
+		LogError("Error: MappedDatabaseFile::Open - '%s' is not a mapped database file\n", fileName);
+		close(fd);
+		return false;
+	}
+
+	m_mappingSize = (size_t)fileStat.st_size;
+	m_mapping = mmap(NULL, m_mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m_mapping == MAP_FAILED)
+	{
+		LogError("Error: MappedDatabaseFile::Open - could not map file '%s'\n", fileName);
+		m_mapping = NULL;
+		m_mappingSize = 0;
+		return false;
+	}
+
+	return Attach(fileName);
+}
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::OpenImage : Uses an image whose parts were built by
+// BuildPart in place of a mapped file
+//----------------------------------------------------------------------------
+bool MappedDatabaseFile::OpenImage(const MappedDatabaseImage &image)
+{
+	Close();
+
+	m_image = image;
+	m_header = &m_image.header;
+
+	bool valid = true;
+	for (int part = 0; part < DatabasePart_Count; part++)
+	{
+		valid = valid && m_image.parts[part] != NULL;
+		m_partData[part] = valid ? m_image.parts[part]->data() : NULL;
+	}
+
+	if (!valid || !AttachSections())
+	{
+		LogError("Error: MappedDatabaseFile::OpenImage - image is incomplete\n");
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::Attach : Checks the header of the file at m_mapping
+// and sets up pointers to its sections
+//----------------------------------------------------------------------------
+bool MappedDatabaseFile::Attach(const char *fileName)
+{
+	m_header = (const MappedFileHeader *)m_mapping;
+	bool valid = m_header->magic == kMappedFileMagic
+		&& m_header->version == kMappedFileVersion
+		&& m_header->fileSize == m_mappingSize
+		&& IsSectionValid(m_header->userRecords, sizeof(UserRecord))
+		&& IsSectionValid(m_header->userSlots, sizeof(uint32_t))
+		&& IsSectionValid(m_header->compactLikes, sizeof(LikeId))
+		&& IsSectionValid(m_header->likeHashes, sizeof(HashKey))
+		&& IsSectionValid(m_header->likeSlots, sizeof(uint32_t))
+		&& IsSectionValid(m_header->strings, sizeof(char))
+		&& IsSectionValid(m_header->rTreeNodes, sizeof(RTreePackedNode))
+		&& IsSectionValid(m_header->partitions, sizeof(MappedPartition))
+		&& m_header->rTreeRoot < m_header->rTreeNodes.count;
+
+	for (int indexType = 0; valid && indexType < UserIndex_Count; indexType++)
+	{
+		valid = IsSectionValid(m_header->*kUserIndexSections[indexType], sizeof(MappedIndexEntry));
+	}
+
+	// Hash tables need a power of two number of slots
+	const MappedFileSection *slotSections[] = { &m_header->userSlots, &m_header->likeSlots };
+	for (size_t i = 0; valid && i < sizeof(slotSections) / sizeof(slotSections[0]); i++)
+	{
+		uint64_t count = slotSections[i]->count;
+		valid = count > 0 && (count & (count - 1)) == 0;
+	}
+
+	// Section offsets in files are from the start of the file
+	for (int part = 0; part < DatabasePart_Count; part++)
+	{
+		m_partData[part] = (const char *)m_mapping;
+	}
+
+	if (!valid || !AttachSections())
+	{
+		LogError("Error: MappedDatabaseFile::Open - '%s' is not a version %d mapped database file\n",
+			fileName, kMappedFileVersion);
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::AttachSections : Sets up pointers to the sections and
+// opens the string dictionary
+//----------------------------------------------------------------------------
+bool MappedDatabaseFile::AttachSections()
+{
+	if (!m_strings.Open((const char *)GetSection(DatabasePart_Strings, m_header->strings),
+		(size_t)m_header->strings.count))
+	{
+		return false;
+	}
+
+	m_userRecords = (const UserRecord *)GetSection(DatabasePart_Users, m_header->userRecords);
+	m_userSlots = (const uint32_t *)GetSection(DatabasePart_Users, m_header->userSlots);
+	m_compactLikes = (const LikeId *)GetSection(DatabasePart_Likes, m_header->compactLikes);
+	m_likeHashes = (const HashKey *)GetSection(DatabasePart_Likes, m_header->likeHashes);
+	m_likeSlots = (const uint32_t *)GetSection(DatabasePart_Likes, m_header->likeSlots);
+	m_rTreeNodes = (const RTreePackedNode *)GetSection(DatabasePart_Spatial, m_header->rTreeNodes);
+	m_partitions = (const MappedPartition *)GetSection(DatabasePart_Spatial, m_header->partitions);
+
+	for (int indexType = 0; indexType < UserIndex_Count; indexType++)
+	{
+		m_userIndexes[indexType] = (const MappedIndexEntry *)GetSection(DatabasePart_Indexes,
+			m_header->*kUserIndexSections[indexType]);
+	}
+
+	return true;
+}
+
+void MappedDatabaseFile::Close()
+{
+	if (m_mapping != NULL)
+	{
+		munmap(m_mapping, m_mappingSize);
+	}
+	m_image = MappedDatabaseImage();
+	memset(m_partData, 0, sizeof(m_partData));
+
+	m_mapping = NULL;
+	m_mappingSize = 0;
+	m_header = NULL;
+	m_userRecords = NULL;
+	m_userSlots = NULL;
+	m_compactLikes = NULL;
+	m_likeHashes = NULL;
+	m_likeSlots = NULL;
+	m_rTreeNodes = NULL;
+	m_partitions = NULL;
+	memset(m_userIndexes, 0, sizeof(m_userIndexes));
+
+	m_strings.Close();
+}
+
+const void *MappedDatabaseFile::GetSection(DatabasePart part, const MappedFileSection &section) const
+{
+	return m_partData[part] + section.offset;
+}
+
+bool MappedDatabaseFile::IsSectionValid(const MappedFileSection &section, size_t elementSize) const
+{
+	if (section.offset % kMappedSectionAlignment != 0 || section.offset > m_mappingSize)
+	{
+		return false;
+	}
+
+	return section.count <= (m_mappingSize - section.offset) / elementSize;
+}
+
+const UserRecord *MappedDatabaseFile::LookupUserRecord(HashKey key) const
+{
+	uint64_t mask = m_header->userSlots.count - 1;
+	for (uint64_t slot = key & mask; m_userSlots[slot] != 0; slot = (slot + 1) & mask)
+	{
+		uint32_t index = m_userSlots[slot] - 1;
+		if (index < m_header->userRecords.count && m_userRecords[index].userNameHash == key)
+		{
+			return &m_userRecords[index];
+		}
+	}
+
+	return NULL;
+}
+
+LikeId MappedDatabaseFile::LookupLikeId(HashKey likeHash) const
+{
+	uint64_t mask = m_header->likeSlots.count - 1;
+	for (uint64_t slot = likeHash & mask; m_likeSlots[slot] != 0; slot = (slot + 1) & mask)
+	{
+		uint32_t likeId = m_likeSlots[slot] - 1;
+		if (likeId < m_header->likeHashes.count && m_likeHashes[likeId] == likeHash)
+		{
+			return likeId;
+		}
+	}
+
+	return kInvalidLikeId;
+}
+
+bool MappedDatabaseFile::LookupHashString(HashKey key, string &buffer, string_view &str) const
+{
+	if (!m_strings.Lookup(key, buffer, str))
+	{
+		str = kInvalidString;
+		return false;
+	}
+
+	return true;
+}
+
+bool MappedDatabaseFile::HasUserIndex(UserRecordIndexType indexType) const
+{
+	return (m_header->userIndexMask & (1 << indexType)) != 0;
+}
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile::LookupUsersByIndex : Entries with the value are
+// adjacent since each index is sorted by value
+//----------------------------------------------------------------------------
+uint32_t MappedDatabaseFile::LookupUsersByIndex(UserRecordIndexType indexType, HashKey value,
+	vector<HashKey> &userKeys) const
+{
+	const MappedIndexEntry *begin = m_userIndexes[indexType];
+	const MappedIndexEntry *end = begin + (m_header->*kUserIndexSections[indexType]).count;
+	const MappedIndexEntry *itr = lower_bound(begin, end, value,
+		[](const MappedIndexEntry &entry, HashKey value) { return entry.value < value; });
+
+	size_t startCount = userKeys.size();
+	for (; itr != end && itr->value == value; ++itr)
+	{
+		userKeys.push_back(itr->userKey);
+	}
+
+	return (uint32_t)(userKeys.size() - startCount);
+}
+
+uint32_t MappedDatabaseFile::IntersectsQuery(HashKey partitionKey, const BoundBox &boundingBox,
+	vector<RTreeObjectIdType_t> &objectIds) const
+{
+	uint32_t rTreeRoot = m_header->rTreeRoot;
+	if (partitionKey != kInvalidHashKey)
+	{
+		// Few partitions (genders) so a linear search is used
+		uint64_t i = 0;
+		while (i < m_header->partitions.count && m_partitions[i].partitionKey != partitionKey)
+		{
+			i++;
+		}
+		if (i == m_header->partitions.count)
+		{
+			return 0;
+		}
+		rTreeRoot = m_partitions[i].rTreeRoot;
+	}
+
+	vector<RTreeObjectCategoryType_t> categories;
+	return RTree::PackedIntersectsQuery(m_rTreeNodes, rTreeRoot, boundingBox, categories, objectIds);
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,197 @@
+//
+//  MappedDatabase.h
+//  Jon Edwards Code Sample
+//
+//  Read-only database file that is used in place through a memory mapping.
+//  Many processes can map the same file and share one copy of it in the
+//  page cache. Opening the file only validates its header; nothing is
+//  copied to the heap.
+//
+//  File layout: a MappedFileHeader followed by sections, each aligned to
+//  8 bytes
+//
+//		userRecords		UserRecord[]		user records
+//		userSlots		uint32_t[]			hash table: user key -> record
+//		compactLikes	LikeId[]			compacted likes of all users
+//		likeHashes		HashKey[]			LikeId -> like hash
+//		likeSlots		uint32_t[]			hash table: like hash -> LikeId
+//		strings			char[]				FrontCodedDictionary image of strings
+//		rTreeNodes		RTreePackedNode[]	packed global and gender R-trees
+//		partitions		MappedPartition[]	gender hash -> packed R-tree root
+//		phoneNumberIndex MappedIndexEntry[]	secondary indexes: value -> user
+//		genderIndex		MappedIndexEntry[]	key, sorted by value
+//		likeIndex		MappedIndexEntry[]
+//
+//  Only the secondary indexes registered with the database are stored;
+//  userIndexMask has a bit set for each of them.
+//
+//  Hash tables use linear probing over a power of two number of slots.
+//  Keys are already well mixed hashes so the low bits pick the first slot.
+//  Slots hold (index + 1), with 0 marking an empty slot. Strings are front
+//  coded and decoded when looked up.
+//
+//  The sections are grouped into parts (see DatabasePart): users, likes,
+//  strings, spatial indexes and secondary indexes. Database publishes immutable versions for
+//  concurrent readers as in-memory images whose parts are built
+//  separately, so a version shares the parts that haven't changed with the
+//  version before it.
+//
+//  Records are stored as rows, not columns, because Database hands out
+//  references to UserRecords. Values are in host byte order. Open checks
+//  the header and section bounds; section contents are trusted.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_MAPPEDDATABASE_H
+#define LDB_MAPPEDDATABASE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Database.h"
+#include "FrontCodedDictionary.h"
+#include "RTree.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const uint32_t kMappedFileMagic = 0x4d42444c;		// "LDBM"
+const uint32_t kMappedFileVersion = 4;
+
+struct MappedFileSection
+{
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct MappedFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fileSize;
+
+	MappedFileSection userRecords;
+	MappedFileSection userSlots;
+	MappedFileSection compactLikes;
+	MappedFileSection likeHashes;
+	MappedFileSection likeSlots;
+	MappedFileSection strings;
+	MappedFileSection rTreeNodes;
+	MappedFileSection partitions;
+	MappedFileSection phoneNumberIndex;
+	MappedFileSection genderIndex;
+	MappedFileSection likeIndex;
+
+	uint32_t rTreeRoot;
+	uint32_t userIndexMask;		// Bit for each UserRecordIndexType stored
+};
+
+struct MappedPartition
+{
+	HashKey partitionKey;
+	uint32_t rTreeRoot;
+	uint32_t reserved;
+};
+
+struct MappedIndexEntry
+{
+	HashKey value;
+	HashKey userKey;
+};
+
+typedef shared_ptr<const vector<char>> MappedPartData;
+
+//----------------------------------------------------------------------------
+// MappedDatabaseImage : In-memory database image made of separately built
+// parts. Section offsets in the header are relative to the start of the
+// section's part. Images that reuse a part share its data.
+//----------------------------------------------------------------------------
+struct MappedDatabaseImage
+{
+	MappedDatabaseImage() : header()
+	{
+		header.magic = kMappedFileMagic;
+		header.version = kMappedFileVersion;
+	}
+
+	MappedFileHeader header;
+	MappedPartData parts[DatabasePart_Count];
+};
+
+//----------------------------------------------------------------------------
+// MappedDatabaseFile : Writes and reads mapped database files. Database
+// forwards its read-only operations here when opened with OpenMapped.
+//----------------------------------------------------------------------------
+class MappedDatabaseFile
+{
+public:
+	MappedDatabaseFile();
+	~MappedDatabaseFile();
+
+	// Writes the contents of a database to a mapped database file
+	static bool Write(Database &database, HashManagerInterface &hashManager, const char *fileName);
+
+	// Builds one part of an in-memory image from a compacted database, or
+	// copies a part from another image, sharing its data
+	static void BuildPart(Database &database, HashManagerInterface &hashManager, DatabasePart part,
+		MappedDatabaseImage &image);
+	static void CopyPart(const MappedDatabaseImage &source, DatabasePart part, MappedDatabaseImage &image);
+
+	// Opening an image keeps a reference to each of its parts
+	bool Open(const char *fileName);
+	bool OpenImage(const MappedDatabaseImage &image);
+	const MappedDatabaseImage &GetImage() const { return m_image; }
+	void Close();
+
+	// Returns NULL if there's no user with the key
+	const UserRecord *LookupUserRecord(HashKey key) const;
+	uint32_t GetUserRecordCount() const { return (uint32_t)m_header->userRecords.count; }
+	const UserRecord &GetUserRecord(uint32_t index) const { return m_userRecords[index]; }
+
+	const LikeId *GetCompactLikes() const { return m_compactLikes; }
+	LikeId LookupLikeId(HashKey likeHash) const;
+	HashKey GetLikeHash(LikeId likeId) const { return m_likeHashes[likeId]; }
+
+	// Strings stored whole are views into the file; others are decoded into
+	// buffer. See FrontCodedDictionary::Lookup.
+	bool LookupHashString(HashKey key, string &buffer, string_view &str) const;
+
+	// Secondary index lookups, as Database::LookupUsersByIndex. Only
+	// indexes for which HasUserIndex returns true were stored.
+	bool HasUserIndex(UserRecordIndexType indexType) const;
+	uint32_t LookupUsersByIndex(UserRecordIndexType indexType, HashKey value, vector<HashKey> &userKeys) const;
+
+	// Finds ids of users with bounding boxes intersecting boundingBox. If
+	// partitionKey isn't kInvalidHashKey only that gender's R-tree is searched.
+	uint32_t IntersectsQuery(HashKey partitionKey, const BoundBox &boundingBox,
+		vector<RTreeObjectIdType_t> &objectIds) const;
+
+private:
+	bool Attach(const char *fileName);
+	bool AttachSections();
+	const void *GetSection(DatabasePart part, const MappedFileSection &section) const;
+	bool IsSectionValid(const MappedFileSection &section, size_t elementSize) const;
+
+	void *m_mapping;
+	size_t m_mappingSize;
+	MappedDatabaseImage m_image;	// Owns the data when opened with OpenImage
+	const char *m_partData[DatabasePart_Count];	// Start of each part's sections
+
+	const MappedFileHeader *m_header;
+	const UserRecord *m_userRecords;
+	const uint32_t *m_userSlots;
+	const LikeId *m_compactLikes;
+	const HashKey *m_likeHashes;
+	const uint32_t *m_likeSlots;
+	FrontCodedDictionary m_strings;
+	const RTreePackedNode *m_rTreeNodes;
+	const MappedPartition *m_partitions;
+	const MappedIndexEntry *m_userIndexes[UserIndex_Count];
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_MAPPEDDATABASE_H
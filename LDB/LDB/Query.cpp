@@ -40,7 +40,7 @@ namespace QueryUtil
 		}
 	
 		const std::string &valueToken = (*tokensItr);
-		bool result = Util::GetLocCoordFromString(valueToken, parameterValue); \
+		bool result = Util::ParseInteger(valueToken, parameterValue);
 		if (!result)
 		{
 			LogError("Error: invalid numerical value '%s' for '%s' parameter of %s' query\n", 
@@ -15,6 +15,8 @@ using namespace std;
 
 BEGIN_NAMESPACE(LDB)
 
+class ShardedDatabase;
+
 //----------------------------------------------------------------------------
 // Query : Abstract base class for LDB database queries
 //----------------------------------------------------------------------------
@@ -26,8 +28,12 @@ public:
 
 	// Parses query parameters from a string and constructs query.
 	virtual bool Construct(const std::string &queryParameters) = 0;
-	virtual bool Execute(Database &database) = 0;
-	virtual bool WriteResultsToFile(Database &database, FILE *file) = 0;
+	virtual bool Execute(const Database &database) = 0;
+	virtual bool WriteResultsToFile(const Database &database, FILE *file) = 0;
+
+	// Same as above, for a database split into spatial shards
+	virtual bool Execute(const ShardedDatabase &database) = 0;
+	virtual bool WriteResultsToFile(const ShardedDatabase &database, FILE *file) = 0;
 
 	bool IsValid() const { return m_isValid; }
 
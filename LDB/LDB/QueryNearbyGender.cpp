@@ -9,6 +9,7 @@
 #include <math.h>
 
 #include "QueryNearbyGender.h"
+#include "ShardedDatabase.h"
 
 BEGIN_NAMESPACE(LDB)
 
@@ -106,7 +107,17 @@ bool QueryNearbyGender::Construct(uint32_t distance, const string &gender)
 // See TODO in class header for ideas other possible search approaches
 // and implementations
 //----------------------------------------------------------------------------
-bool QueryNearbyGender::Execute(Database &database)
+bool QueryNearbyGender::Execute(const Database &database)
+{
+	return ExecuteSearch(database);
+}
+
+bool QueryNearbyGender::Execute(const ShardedDatabase &database)
+{
+	return ExecuteSearch(database);
+}
+
+template <class DatabaseType> bool QueryNearbyGender::ExecuteSearch(const DatabaseType &database)
 {
 	m_results.clear();
 
@@ -116,28 +127,31 @@ bool QueryNearbyGender::Execute(Database &database)
 		return false;
 	}
     
-    // Cache hash to gender string used for comparison against records
-	m_genderHash = database.GenerateHash(m_gender);
-	if (m_genderHash == kInvalidHashKey)
+	if (m_gender.empty())
 	{
 		m_isValid = false;
 		return false;
 	}
 
+    // Cache hash to gender string used for comparison against records. If
+    // the gender string isn't registered no user has that gender.
+	m_genderHash = database.FindHash(m_gender);
+	if (m_genderHash == kInvalidHashKey)
+	{
+		return true;
+	}
+
 	// Start with clear list
 	m_searchVisitedList.clear();
 
-	// Iterate through all user records in the database
-	for (Database::UserRecordIterator itr(database); !itr.IsDone(); ++itr)
+	// Search roots are the users of the gender, taken from its spatial
+	// partition rather than by visiting every user
+	vector<HashKey> candidates;
+	database.QueryUsersInPartition(m_genderHash, candidates);
+	for (size_t i = 0; i < candidates.size(); i++)
 	{
-		HashKey candidateHashKey = itr.GetHashKey();
+		HashKey candidateHashKey = candidates[i];
 
-		// Check that meets criteria
-		bool meetsCriteria = UserMeetsSearchCriteria(database, candidateHashKey);	
-		if (!meetsCriteria)
-		{
-			continue;	
-		}
 		// Check to make sure this isn't a user we've visited before in the search
 		unordered_set<HashKey>::iterator visitedItr;
 		visitedItr = m_searchVisitedList.find(candidateHashKey);
@@ -162,7 +176,8 @@ bool QueryNearbyGender::Execute(Database &database)
     return true;
 }
 
-void QueryNearbyGender::ProcessDFSUserSearch(Database &database, HashKey rootCandidateHashKey)
+template <class DatabaseType>
+void QueryNearbyGender::ProcessDFSUserSearch(const DatabaseType &database, HashKey rootCandidateHashKey)
 {
 	// Push candidate onto top of stack
 	m_dfsSearchStack.push(rootCandidateHashKey);
@@ -175,14 +190,16 @@ void QueryNearbyGender::ProcessDFSUserSearch(Database &database, HashKey rootCan
 		// Mark as visited
 		m_searchVisitedList.insert(candidateHashKey);
 
-		// Find all neighbors in range
+		// Find all neighbors in range. Only the spatial partition for the
+		// gender being searched is queried so every neighbor returned
+		// already meets the search criteria.
 		const UserRecord &candidateRecord = database.LookupUserRecordByKey(candidateHashKey);
 		vector<HashKey> candidateNeighbors;
 	    int count = database.QueryUsersInRange(candidateRecord.xLoc, candidateRecord.yLoc,
-	    	m_distance, candidateNeighbors);
+	    	m_distance, m_genderHash, candidateNeighbors);
 
-	    // For neighbors in range we haven't already visited check to see if they
-	    // match the criteria and if they do add them to the DFS search stack
+	    // For neighbors in range we haven't already visited add them to the
+	    // DFS search stack
 	   	for (int i = 0; i < count; i++)
 	   	{
 	   		HashKey neighborHashKey = candidateNeighbors[i];
@@ -190,14 +207,12 @@ void QueryNearbyGender::ProcessDFSUserSearch(Database &database, HashKey rootCan
 	   		if (itr == m_searchVisitedList.end())
 	   		{
 				const UserRecord &neighborRecord = database.LookupUserRecordByKey(neighborHashKey);
-				bool meetsCriteria = UserMeetsSearchCriteria(database, neighborRecord);
-				if (meetsCriteria)
-				{
-					// We've found a matching result - add it to list of results
-					AddResult(candidateRecord, neighborRecord);
-					// Push the neighbor on the stack
-					m_dfsSearchStack.push(neighborHashKey);
-				}
+				ASSERT(UserMeetsSearchCriteria(neighborRecord), "Gender partition returned user of another gender");
+
+				// We've found a matching result - add it to list of results
+				AddResult(candidateRecord, neighborRecord);
+				// Push the neighbor on the stack
+				m_dfsSearchStack.push(neighborHashKey);
 			}
 	   	} 
 	}
@@ -227,15 +242,7 @@ void QueryNearbyGender::AddResult(const UserRecord &userRecord1, const UserRecor
 // to a templatized implementation of this query so it wouldn't be
 // specific to checking gender).
 //----------------------------------------------------------------------------
-bool QueryNearbyGender::UserMeetsSearchCriteria(Database &database,
-	HashKey userHashKey)
-{
-	const UserRecord &userRecord = database.LookupUserRecordByKey(userHashKey);
-	return UserMeetsSearchCriteria(database, userRecord);
-}
-
-bool QueryNearbyGender::UserMeetsSearchCriteria(Database &database,
-	const UserRecord &userRecord)
+bool QueryNearbyGender::UserMeetsSearchCriteria(const UserRecord &userRecord)
 {
 	if (userRecord.genderHash != m_genderHash)
 	{
@@ -249,7 +256,17 @@ bool QueryNearbyGender::UserMeetsSearchCriteria(Database &database,
 // QueryNearbyGender::WriteResultsToFile : Write result of query to file
 // in CSV format
 //----------------------------------------------------------------------------
-bool QueryNearbyGender::WriteResultsToFile(Database &database, FILE *file)
+bool QueryNearbyGender::WriteResultsToFile(const Database &database, FILE *file)
+{
+	return WriteResults(database, file);
+}
+
+bool QueryNearbyGender::WriteResultsToFile(const ShardedDatabase &database, FILE *file)
+{
+	return WriteResults(database, file);
+}
+
+template <class DatabaseType> bool QueryNearbyGender::WriteResults(const DatabaseType &database, FILE *file)
 {		
 	if (!m_isValid)
 	{
@@ -260,27 +277,31 @@ bool QueryNearbyGender::WriteResultsToFile(Database &database, FILE *file)
 		fprintf(file, "Query found no results.\n");
 		return true;
 	}
+
+	// Strings decoded from a mapped database, reused for every result
+	string buffers[2];
 	for (int i = 0; i < m_results.size(); i++)
 	{
 		const NearbyGenderResult &searchResult = m_results[i];
 		const UserRecord &userRecord1 = database.LookupUserRecordByKey(searchResult.user1);
 		const UserRecord &userRecord2 = database.LookupUserRecordByKey(searchResult.user2);
 
-		string user1Name;
-		bool result = database.LookupHashString(userRecord1.userNameHash, user1Name);
+		string_view user1Name;
+		bool result = database.LookupHashString(userRecord1.userNameHash, buffers[0], user1Name);
 		if (!result)
 		{
 			LogError("INTERNAL ERROR: Name string not found in HashManager\n");	
 		}
 
-		string user2Name;
-		result = database.LookupHashString(userRecord2.userNameHash, user2Name);
+		string_view user2Name;
+		result = database.LookupHashString(userRecord2.userNameHash, buffers[1], user2Name);
 		if (!result)
 		{
 			LogError("INTERNAL ERROR: Name string not found in HashManager\n");	
 		}
 
-		LogMessage("%s, %s, %f\n", user1Name.c_str(), user2Name.c_str(), searchResult.distance);
+		LogMessage("%.*s, %.*s, %f\n", (int)user1Name.size(), user1Name.data(),
+			(int)user2Name.size(), user2Name.data(), searchResult.distance);
 	}
     
     return true;
@@ -45,19 +45,24 @@ public:
 	~QueryNearbyGender() { }
 
 	virtual bool Construct(const string &queryParameters);
-	virtual bool Execute(Database &database);
-	virtual bool WriteResultsToFile(Database &database, FILE *file);
+	virtual bool Execute(const Database &database);
+	virtual bool WriteResultsToFile(const Database &database, FILE *file);
+	virtual bool Execute(const ShardedDatabase &database);
+	virtual bool WriteResultsToFile(const ShardedDatabase &database, FILE *file);
 
 	bool Construct(uint32_t distance, const string &gender);
 
-	const vector<NearbyGenderResult> &GetResults();
+	const vector<NearbyGenderResult> &GetResults() const { return m_results; }
 
 	static const string &GetQueryName() { return s_queryName; }
 
 private:
-	bool UserMeetsSearchCriteria(Database &database, HashKey userHashKey);
-	bool UserMeetsSearchCriteria(Database &database, const UserRecord &userRecord);
-	void ProcessDFSUserSearch(Database &database, HashKey userHashKey);
+	// Implementations shared by Database and ShardedDatabase
+	template <class DatabaseType> bool ExecuteSearch(const DatabaseType &database);
+	template <class DatabaseType> bool WriteResults(const DatabaseType &database, FILE *file);
+
+	bool UserMeetsSearchCriteria(const UserRecord &userRecord);
+	template <class DatabaseType> void ProcessDFSUserSearch(const DatabaseType &database, HashKey userHashKey);
 	void AddResult(const UserRecord &userRecord1, const UserRecord &userRecord2);
 
 	static const string s_queryName;
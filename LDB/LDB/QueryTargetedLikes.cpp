@@ -7,6 +7,7 @@
 //
 
 #include "QueryTargetedLikes.h"
+#include "ShardedDatabase.h"
 
 BEGIN_NAMESPACE(LDB)
 
@@ -116,7 +117,7 @@ bool QueryTargetedLikes::Construct(LocCoord x, LocCoord y, uint32_t distance, co
 // QueryTargetedLikes::Execute : Execute the query using the parameters
 // that have been set.
 //----------------------------------------------------------------------------
-bool QueryTargetedLikes::Execute(Database &database)
+bool QueryTargetedLikes::Execute(const Database &database)
 {
 	m_results.clear();
 
@@ -133,26 +134,35 @@ bool QueryTargetedLikes::Execute(Database &database)
     // Iterate through users and find those with the like being queried
     if (count > 0)
     {
-    	HashKey desireLikeHash = database.GenerateHash(m_like);
+    	// If the like string isn't registered no user has that like
+    	HashKey desireLikeHash = database.FindHash(m_like);
+    	if (desireLikeHash == kInvalidHashKey)
+    	{
+    		return true;
+    	}
+
+    	// Compacted likes are compared by dense id. If the like isn't in
+    	// the compacted likes no compacted entry can match.
+    	LikeId desiredLikeId = database.LookupLikeId(desireLikeHash);
 
     	for (int i = 0; i < count; i++)
    		{
     		// Iterate through the user's list of likes 
         	const UserRecord &userRecord = database.LookupUserRecordByKey(userKeys[i]);
-        	for (int likeNum = 0; likeNum < userRecord.userLikes.size(); likeNum++)
+        	Database::UserLikes userLikes;
+        	database.GetUserLikes(userRecord, userLikes);
+
+        	for (uint32_t likeNum = 0; likeNum < userLikes.compactCount; likeNum++)
         	{
-        		HashKey candidateLikeHash = userRecord.userLikes[likeNum];
-
-    			/*
-    			string desiredLikeString;
-    			string candidateLikeString;
-		    	database.LookupHashString(desireLikeHash, desiredLikeString);
-		    	database.LookupHashString(candidateLikeHash, candidateLikeString);
-		    	LogMessage("desireLikeHash string = '%s', candidateLikeHash string = '%s'\n",
-		    		desiredLikeString.c_str(), candidateLikeString.c_str());
-    			*/
-
-        		if (candidateLikeHash == desireLikeHash)
+        		if (userLikes.compactLikes[likeNum] == desiredLikeId)
+        		{
+        			m_results.push_back(userKeys[i]);
+        		}
+        	}
+
+        	for (uint32_t likeNum = 0; likeNum < userLikes.count; likeNum++)
+        	{
+        		if (userLikes.likes[likeNum] == desireLikeHash)
         		{
         			m_results.push_back(userKeys[i]);
         		}
@@ -163,11 +173,56 @@ bool QueryTargetedLikes::Execute(Database &database)
     return true;
 }
 
+//----------------------------------------------------------------------------
+// QueryTargetedLikes::Execute : Execute the query on a sharded database.
+// Every shard overlapping the query range runs the query on its own users,
+// which keeps like ids local to the shard. Results are gathered in shard
+// order.
+//----------------------------------------------------------------------------
+bool QueryTargetedLikes::Execute(const ShardedDatabase &database)
+{
+	m_results.clear();
+
+	if (!m_isValid)
+	{
+		return false;
+	}
+
+	vector<uint32_t> shardIndexes;
+	database.GetShardsInRange(m_xLoc, m_yLoc, m_distance, shardIndexes);
+
+	vector<QueryTargetedLikes> shardQueries(database.GetShardCount());
+	database.RunOnShards(shardIndexes, [this, &database, &shardQueries](uint32_t shardIndex)
+	{
+		QueryTargetedLikes &shardQuery = shardQueries[shardIndex];
+		shardQuery.Construct(m_xLoc, m_yLoc, m_distance, m_like);
+		shardQuery.Execute(database.GetShard(shardIndex));
+	});
+
+	for (size_t i = 0; i < shardIndexes.size(); i++)
+	{
+		const vector<HashKey> &results = shardQueries[shardIndexes[i]].m_results;
+		m_results.insert(m_results.end(), results.begin(), results.end());
+	}
+
+	return true;
+}
+
 //----------------------------------------------------------------------------
 // QueryTargetedLikes::WriteResultsToFile : Write result of query to file
 // in CSV format
 //----------------------------------------------------------------------------
-bool QueryTargetedLikes::WriteResultsToFile(Database &database, FILE *file)
+bool QueryTargetedLikes::WriteResultsToFile(const Database &database, FILE *file)
+{
+	return WriteResults(database, file);
+}
+
+bool QueryTargetedLikes::WriteResultsToFile(const ShardedDatabase &database, FILE *file)
+{
+	return WriteResults(database, file);
+}
+
+template <class DatabaseType> bool QueryTargetedLikes::WriteResults(const DatabaseType &database, FILE *file)
 {		
 	if (!m_isValid)
 	{
@@ -179,6 +234,8 @@ bool QueryTargetedLikes::WriteResultsToFile(Database &database, FILE *file)
 		return true;
 	}
 
+	// Strings decoded from a mapped database, reused for every result
+	string buffers[3];
 	for (int i = 0; i < m_results.size(); i++)
 	{
 		HashKey userNameHash = m_results[i];
@@ -192,19 +249,20 @@ bool QueryTargetedLikes::WriteResultsToFile(Database &database, FILE *file)
 
 		// Write out user data to file in csv format
 		bool found = false;
-		string userName;
-		string phoneNumber;
-		string gender;
+		string_view userName;
+		string_view phoneNumber;
+		string_view gender;
 
-		found = database.LookupHashString(userRecord.userNameHash, userName);
+		found = database.LookupHashString(userRecord.userNameHash, buffers[0], userName);
 		ASSERT(found, "User name string not found in HashManager");
-		found = database.LookupHashString(userRecord.phoneNumberHash, phoneNumber);
+		found = database.LookupHashString(userRecord.phoneNumberHash, buffers[1], phoneNumber);
 		ASSERT(found, "Phone number string not found in HashManager");
-		found = database.LookupHashString(userRecord.genderHash, gender);
+		found = database.LookupHashString(userRecord.genderHash, buffers[2], gender);
  		ASSERT(found, "Gender string not found in HashManager");
 
-		fprintf(file, "%s, %s, %d, %d, %s\n", userName.c_str(), phoneNumber.c_str(), userRecord.xLoc,
-			userRecord.yLoc, gender.c_str());
+		fprintf(file, "%.*s, %.*s, %d, %d, %.*s\n", (int)userName.size(), userName.data(),
+			(int)phoneNumber.size(), phoneNumber.data(), userRecord.xLoc, userRecord.yLoc,
+			(int)gender.size(), gender.data());
 	}
     
     return true;
@@ -28,16 +28,20 @@ public:
 	~QueryTargetedLikes() { }
 
 	virtual bool Construct(const string &queryParameters);
-	virtual bool Execute(Database &database);
-	virtual bool WriteResultsToFile(Database &database, FILE *file);
+	virtual bool Execute(const Database &database);
+	virtual bool WriteResultsToFile(const Database &database, FILE *file);
+	virtual bool Execute(const ShardedDatabase &database);
+	virtual bool WriteResultsToFile(const ShardedDatabase &database, FILE *file);
 
 	bool Construct(LocCoord x, LocCoord y, uint32_t distance, const string &like);
 
-	const vector<HashKey> &GetResults();
+	const vector<HashKey> &GetResults() const { return m_results; }
 
 	static const string &GetQueryName() { return s_queryName; }
 
 private:
+	template <class DatabaseType> bool WriteResults(const DatabaseType &database, FILE *file);
+
 	static const string s_queryName;
 
 	LocCoord m_xLoc;
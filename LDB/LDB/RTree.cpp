@@ -35,8 +35,10 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "RTree.h"
+#include "Snapshot.h"
 
 BEGIN_NAMESPACE(LDB)
 
@@ -152,36 +154,38 @@ void RTree::Shutdown()
 //
 //-------------------------------------------------------------------------------
 
-uint32_t RTree::IntersectsQuery(BoundBox &boundingBox, 
+uint32_t RTree::IntersectsQuery(const BoundBox &boundingBox, 
     vector<RTreeObjectCategoryType_t> &objectCategories,
-	vector<RTreeObjectIdType_t> &objectIds)
+	vector<RTreeObjectIdType_t> &objectIds) const
 {
 	return RangeQuery(kQueryType_Intersects, boundingBox, objectCategories, objectIds);
 }
 
-uint32_t RTree::RangeQuery(QueryType queryType, BoundBox &boundingBox,
+uint32_t RTree::RangeQuery(QueryType queryType, const BoundBox &boundingBox,
 	vector<RTreeObjectCategoryType_t> &objectCategories,
-	vector<RTreeObjectIdType_t> &objectIds)
+	vector<RTreeObjectIdType_t> &objectIds) const
 {
 	ASSERT(queryType == kQueryType_Intersects, "Only Intersects queries are currently supported by Rtree");
 
 	// Traverse the tree, examining branches that intersect/contain the/ bounding
 	// box. Add the data children to the types/ids arrays up to the specified
-	// maximum.
+	// maximum. The traversal uses a local stack rather than the path buffer
+	// so queries leave the tree unchanged.
 
 	uint32_t count = 0;
 
-	PathStackPopAll();
+	RTreeNode *stack[kPathBufferLimit * 8];
+	const uint32_t stackLimit = sizeof(stack) / sizeof(stack[0]);
+	uint32_t stackPtr = 0;
 
 	if (NodeGetNumChildren(m_root) > 0)
 	{
-		PathStackPush(m_root);
+		stack[stackPtr++] = m_root;
 	}
 
-	while (!PathStackIsEmpty())
+	while (stackPtr > 0)
 	{
-		RTreeNode *top = PathStackGetTop();
-		PathStackPop();
+		RTreeNode *top = stack[--stackPtr];
 	
 		if (!NodeIsData(top))
 		{
@@ -189,10 +193,14 @@ uint32_t RTree::RangeQuery(QueryType queryType, BoundBox &boundingBox,
 			RTreeNode *child = top->leftChild;
 			while (child != NULL)
 			{
-				bool inRange = inRange = Util::BBoxIntersectsBBox(child->boundingBox, boundingBox);
+				bool inRange = Util::BBoxIntersectsBBox(child->boundingBox, boundingBox);
 				if (inRange)
 				{
-					PathStackPush(child);
+					ASSERT(stackPtr < stackLimit, "Query stack overflow");
+					if (stackPtr < stackLimit)
+					{
+						stack[stackPtr++] = child;
+					}
 				}
 
 				child = child->rightSibling;
@@ -214,6 +222,95 @@ uint32_t RTree::RangeQuery(QueryType queryType, BoundBox &boundingBox,
 	return count;
 }
 
+//-------------------------- PACKED TREE ROUTINES -------------------------------
+//
+//-------------------------------------------------------------------------------
+
+uint32_t RTree::Pack(vector<RTreePackedNode> &nodes)
+{
+	// Nodes are appended in the same order they're visited so the node for
+	// visitOrder[i] is nodes[rootIndex + i]
+	uint32_t rootIndex = (uint32_t)nodes.size();
+	vector<RTreeNode *> visitOrder;
+	visitOrder.push_back(m_root);
+
+	RTreePackedNode packedNode;
+	memset(&packedNode, 0, sizeof(packedNode));
+	packedNode.boundingBox = m_root->boundingBox;
+	packedNode.category = m_root->category;
+	packedNode.id = m_root->id;
+	nodes.push_back(packedNode);
+
+	for (size_t i = 0; i < visitOrder.size(); i++)
+	{
+		RTreeNode *node = visitOrder[i];
+		uint32_t nodeIndex = rootIndex + (uint32_t)i;
+		nodes[nodeIndex].firstChild = (uint32_t)nodes.size();
+		nodes[nodeIndex].numChildren = NodeGetNumChildren(node);
+
+		for (RTreeNode *child = node->leftChild; child != NULL; child = child->rightSibling)
+		{
+			packedNode.boundingBox = child->boundingBox;
+			packedNode.category = child->category;
+			packedNode.id = child->id;
+			nodes.push_back(packedNode);
+			visitOrder.push_back(child);
+		}
+	}
+
+	return rootIndex;
+}
+
+uint32_t RTree::PackedIntersectsQuery(const RTreePackedNode *nodes, uint32_t rootIndex,
+	const BoundBox &boundingBox, vector<RTreeObjectCategoryType_t> &objectCategories,
+	vector<RTreeObjectIdType_t> &objectIds)
+{
+	uint32_t count = 0;
+
+	uint32_t stack[kPathBufferLimit * 8];
+	const uint32_t stackLimit = sizeof(stack) / sizeof(stack[0]);
+	uint32_t stackPtr = 0;
+
+	if (nodes[rootIndex].numChildren > 0)
+	{
+		stack[stackPtr++] = rootIndex;
+	}
+
+	while (stackPtr > 0)
+	{
+		const RTreePackedNode &top = nodes[stack[--stackPtr]];
+
+		if (top.numChildren > 0)
+		{
+			// Index nodes: push the children on
+			for (uint32_t i = 0; i < top.numChildren; i++)
+			{
+				uint32_t childIndex = top.firstChild + i;
+				if (Util::BBoxIntersectsBBox(nodes[childIndex].boundingBox, boundingBox))
+				{
+					ASSERT(stackPtr < stackLimit, "Packed query stack overflow");
+					if (stackPtr < stackLimit)
+					{
+						stack[stackPtr++] = childIndex;
+					}
+				}
+			}
+		}
+		else
+		{
+			// Data nodes
+			if (Util::BBoxIntersectsBBox(top.boundingBox, boundingBox))
+			{
+				objectCategories.push_back(top.category);
+				objectIds.push_back(top.id);
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
 //-------------------------- DEBUGGING ROUTINES ---------------------------------
 //
 //-------------------------------------------------------------------------------
@@ -305,6 +402,107 @@ uint32_t RTree::DebugGetNodeData(BoundBox *boundingBoxes,
 	return count;
 }
 
+//-------------------------- SNAPSHOT ROUTINES ----------------------------------
+//  Nodes are written depth first: bounding box, category, id and number of
+//  children followed by each child.
+//-------------------------------------------------------------------------------
+
+void RTree::WriteSnapshot(SnapshotWriter &writer)
+{
+	writer.WriteFloat(m_minBound);
+	writer.WriteFloat(m_maxBound);
+	writer.WriteFloat(m_fillFactor);
+	writer.WriteUint32(m_nodeCapacity);
+
+	WriteSnapshotNode(writer, m_root);
+}
+
+void RTree::WriteSnapshotNode(SnapshotWriter &writer, RTreeNode *node)
+{
+	writer.WriteBytes(&node->boundingBox, sizeof(node->boundingBox));
+	writer.WriteUint32(node->category);
+	writer.WriteUint64(node->id);
+	writer.WriteUint32(NodeGetNumChildren(node));
+
+	for (RTreeNode *child = node->leftChild; child != NULL; child = child->rightSibling)
+	{
+		WriteSnapshotNode(writer, child);
+	}
+}
+
+bool RTree::ReadSnapshot(SnapshotReader &reader)
+{
+	Shutdown();
+
+	float minBound = reader.ReadFloat();
+	float maxBound = reader.ReadFloat();
+	float fillFactor = reader.ReadFloat();
+	uint32_t nodeCapacity = reader.ReadUint32();
+	if (reader.HasFailed())
+	{
+		return false;
+	}
+
+	m_minBound = minBound;
+	m_maxBound = maxBound;
+	m_fillFactor = fillFactor;
+	m_nodeCapacity = nodeCapacity;
+	m_minNodeCount = (uint32_t)(nodeCapacity * fillFactor);
+	m_maxVolume = ((m_maxBound - m_minBound) * (m_maxBound - m_minBound) 
+		* (m_maxBound - m_minBound));
+
+	m_root = ReadSnapshotNode(reader, 0);
+	if (m_root == NULL)
+	{
+		// Leave an empty tree rather than no tree
+		Initialize(minBound, maxBound, fillFactor, nodeCapacity);
+		return false;
+	}
+
+	return true;
+}
+
+RTree::RTreeNode *RTree::ReadSnapshotNode(SnapshotReader &reader, uint32_t depth)
+{
+	if (depth >= kPathBufferLimit)
+	{
+		return NULL;
+	}
+
+	RTreeNode *node = NodeAllocate();
+	NodeInitialize(node);
+	reader.ReadBytes(&node->boundingBox, sizeof(node->boundingBox));
+	node->category = reader.ReadUint32();
+	node->id = reader.ReadUint64();
+	uint32_t numChildren = reader.ReadUint32();
+
+	RTreeNode *lastChild = NULL;
+	for (uint32_t i = 0; i < numChildren && !reader.HasFailed(); i++)
+	{
+		RTreeNode *child = ReadSnapshotNode(reader, depth + 1);
+		if (child == NULL)
+		{
+			break;
+		}
+
+		if (lastChild == NULL)
+			node->leftChild = child;
+		else
+			lastChild->rightSibling = child;
+		lastChild = child;
+	}
+
+	// Children read so far are linked to node, so freeing its subtree frees
+	// the partial tree
+	if (reader.HasFailed() || (numChildren > 0 && NodeGetNumChildren(node) != numChildren))
+	{
+		NodeDeallocateSubtree(node);
+		return NULL;
+	}
+
+	return node;
+}
+
 //-------------------------- INSERTION ROUTINES ---------------------------------
 //
 //-------------------------------------------------------------------------------
@@ -341,6 +539,125 @@ void RTree::Insert(const BoundBox &boundingBox, RTreeObjectCategoryType_t catego
 	CheckConsistency();
 }
 
+//----------------------------------------------------------------------------
+// RTree::Remove : Deletes a data node following Guttman's algorithm. Data
+// nodes of index nodes left with too few children are reinserted.
+//----------------------------------------------------------------------------
+bool RTree::Remove(const BoundBox &boundingBox, RTreeObjectCategoryType_t category, RTreeObjectIdType_t id)
+{
+	// The stack will have the leaf's ancestors on it after FindLeaf
+	PathStackPopAll();
+	RTreeNode *leaf = FindLeaf(m_root, boundingBox, category, id);
+	if (leaf == NULL)
+	{
+		PathStackPopAll();
+		return false;
+	}
+
+	NodeDeleteData(leaf, boundingBox, category, id);
+
+	vector<RTreeNode *> orphans;
+	CondenseTree(leaf, orphans);
+
+	for (size_t i = 0; i < orphans.size(); i++)
+	{
+		Insert(orphans[i]->boundingBox, orphans[i]->category, orphans[i]->id);
+		delete orphans[i];
+	}
+
+	return true;
+}
+
+RTree::RTreeNode *RTree::FindLeaf(RTreeNode *node, const BoundBox &boundingBox,
+	RTreeObjectCategoryType_t category, RTreeObjectIdType_t id)
+{
+	// Descend into every child that contains the bounding box until a
+	// leaf with the data node is found
+
+	if (NodeIsLeaf(node))
+	{
+		for (RTreeNode *child = node->leftChild; child != NULL; child = child->rightSibling)
+		{
+			if (child->category == category && child->id == id
+				&& Util::BBoxContainsBBox(child->boundingBox, boundingBox))
+			{
+				return node;
+			}
+		}
+		return NULL;
+	}
+
+	PathStackPush(node);
+	for (RTreeNode *child = node->leftChild; child != NULL; child = child->rightSibling)
+	{
+		if (Util::BBoxContainsBBox(child->boundingBox, boundingBox))
+		{
+			RTreeNode *leaf = FindLeaf(child, boundingBox, category, id);
+			if (leaf != NULL)
+			{
+				return leaf;
+			}
+		}
+	}
+	PathStackPop();
+
+	return NULL;
+}
+
+void RTree::CondenseTree(RTreeNode *leaf, vector<RTreeNode *> &orphans)
+{
+	// Walk up from the leaf. Nodes with too few children are removed from
+	// their parent and their data nodes collected for reinsertion, other
+	// nodes have their bounding boxes tightened. An index node with no
+	// children would look like a data node so those are always removed.
+	RTreeNode *node = leaf;
+	while (!PathStackIsEmpty())
+	{
+		RTreeNode *parent = PathStackGetTop();
+		PathStackPop();
+
+		uint32_t numChildren = NodeGetNumChildren(node);
+		if (numChildren == 0 || numChildren < m_minNodeCount)
+		{
+			NodeDeleteChild(parent, node);
+			NodeGetData(node->leftChild, orphans);
+			node->leftChild = NULL;
+			NodeDeallocate(node);
+		}
+		else
+		{
+			NodeCalculateBoundingBox(node);
+		}
+
+		node = parent;
+	}
+}
+
+//----------------------------------------------------------------------------
+// RTree::NodeGetData : Detaches the data nodes below a list of siblings,
+// adding them to dataNodes and freeing the index nodes
+//----------------------------------------------------------------------------
+void RTree::NodeGetData(RTreeNode *node, vector<RTreeNode *> &dataNodes)
+{
+	while (node != NULL)
+	{
+		RTreeNode *sibling = node->rightSibling;
+		node->rightSibling = NULL;
+
+		if (NodeIsData(node))
+		{
+			dataNodes.push_back(node);
+		}
+		else
+		{
+			NodeGetData(node->leftChild, dataNodes);
+			delete node;
+		}
+
+		node = sibling;
+	}
+}
+
 RTree::RTreeNode *RTree::ChooseLeaf(RTreeNode *node, const BoundBox &boundingBox)
 {
 	// Descend down the tree, picking an index node at each level that
@@ -675,6 +992,23 @@ void RTree::NodeDeallocate(RTreeNode *node)
 	delete node;
 }
 
+//----------------------------------------------------------------------------
+// RTree::NodeDeallocateSubtree : Frees a node and its descendants, but not
+// its siblings, unlike NodeDeallocate
+//----------------------------------------------------------------------------
+void RTree::NodeDeallocateSubtree(RTreeNode *node)
+{
+	RTreeNode *child = node->leftChild;
+	while (child != NULL)
+	{
+		RTreeNode *nextChild = child->rightSibling;
+		NodeDeallocateSubtree(child);
+		child = nextChild;
+	}
+
+	delete node;
+}
+
 void RTree::NodeInitialize(RTreeNode *node)
 {
 	NodeResetBoundingBox(node);
@@ -790,7 +1124,7 @@ RTree::RTreeNode *RTree::NodeGetNthChild(RTreeNode *node, uint32_t n)
 	return child;
 }
 
-uint32_t RTree::NodeGetNumChildren(RTreeNode *node)
+uint32_t RTree::NodeGetNumChildren(RTreeNode *node) const
 {
 	uint32_t count = 0;
 	RTreeNode *child = node->leftChild;
@@ -824,7 +1158,7 @@ void RTree::NodeResetBoundingBox(RTreeNode *node)
 	node->boundingBox.max.z = m_minBound;
 }
 
-bool RTree::NodeIsLeaf(RTreeNode *node)
+bool RTree::NodeIsLeaf(RTreeNode *node) const
 {
 	if ((node == m_root && node->leftChild == NULL)
 		|| NodeIsData(node->leftChild))
@@ -837,7 +1171,7 @@ bool RTree::NodeIsLeaf(RTreeNode *node)
 	}
 }
 
-bool RTree::NodeIsData(RTreeNode *node)
+bool RTree::NodeIsData(RTreeNode *node) const
 {
 	if (node->leftChild == NULL)
 	{
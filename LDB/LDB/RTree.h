@@ -39,10 +39,29 @@ using namespace std;
 
 BEGIN_NAMESPACE(LDB)
 
+class SnapshotReader;
+class SnapshotWriter;
+
 // TODO: Use templates to make more flexible
 typedef uint64_t RTreeObjectIdType_t;
 typedef uint32_t RTreeObjectCategoryType_t;
 
+//-----------------------------------------------------------------------------
+// RTreePackedNode : An R-tree node in a tree flattened into an array by
+// RTree::Pack. The children of a node are contiguous in the array. Data
+// nodes have no children. Packed trees can be queried in place, e.g., from
+// a memory-mapped file.
+//-----------------------------------------------------------------------------
+struct RTreePackedNode
+{
+	BoundBox boundingBox;
+	uint32_t firstChild;
+	uint32_t numChildren;
+	RTreeObjectCategoryType_t category;
+	uint32_t reserved;
+	RTreeObjectIdType_t id;
+};
+
 //-----------------------------------------------------------------------------
 // RTree
 //-----------------------------------------------------------------------------
@@ -62,11 +81,31 @@ public:
 	void Insert(const BoundBox &boundingBox, RTreeObjectCategoryType_t category,
 		RTreeObjectIdType_t id);
 
+	// Remove an element that was inserted with the specified bounding box,
+	// category and id. Returns false if the element isn't in the tree.
+	bool Remove(const BoundBox &boundingBox, RTreeObjectCategoryType_t category,
+		RTreeObjectIdType_t id);
+
 	// Generates a list of object ids for elements in Rtree within the specified bounding
 	// box Returns number of elements contained. Categories array specifies the
-	// category of each of the ids.
-	uint32_t IntersectsQuery(BoundBox &boundingBox,
-		vector<RTreeObjectCategoryType_t> &objectCategories, vector<RTreeObjectIdType_t> &objectIds);
+	// category of each of the ids. Queries don't modify the tree, so several
+	// threads can query a tree that isn't being changed.
+	uint32_t IntersectsQuery(const BoundBox &boundingBox,
+		vector<RTreeObjectCategoryType_t> &objectCategories, vector<RTreeObjectIdType_t> &objectIds) const;
+
+	// Save and restore the tree's parameters and nodes in a database snapshot.
+	// Reading replaces the contents of the tree.
+	void WriteSnapshot(SnapshotWriter &writer);
+	bool ReadSnapshot(SnapshotReader &reader);
+
+	// Appends the tree's nodes to an array in breadth-first order. Returns
+	// index of the root node in the array.
+	uint32_t Pack(vector<RTreePackedNode> &nodes);
+
+	// Same as IntersectsQuery, but for a tree flattened by Pack
+	static uint32_t PackedIntersectsQuery(const RTreePackedNode *nodes, uint32_t rootIndex,
+		const BoundBox &boundingBox, vector<RTreeObjectCategoryType_t> &objectCategories,
+		vector<RTreeObjectIdType_t> &objectIds);
 
 	//------------------------------------------------------------------------------
 	// Debug routines
@@ -110,13 +149,18 @@ private:
 		BoundBox &group1BoundingBox, BoundBox &group2BoundingBox);
 
 	RTreeNode *FindLeaf(RTreeNode *node, const BoundBox &boundingBox, RTreeObjectCategoryType_t category, RTreeObjectIdType_t id);
-	void CondenseTree(RTreeNode *leaf, RTreeNode *orphans);
+	void CondenseTree(RTreeNode *leaf, vector<RTreeNode *> &orphans);
+	void NodeGetData(RTreeNode *node, vector<RTreeNode *> &dataNodes);
+
+	uint32_t RangeQuery(QueryType queryType, const BoundBox &boundingBox,
+                      vector<RTreeObjectCategoryType_t> &categories, vector<RTreeObjectIdType_t> &objectIds) const;
 
-	uint32_t RangeQuery(QueryType queryType, BoundBox &boundingBox,
-                      vector<RTreeObjectCategoryType_t> &categories, vector<RTreeObjectIdType_t> &objectIds);
+	void WriteSnapshotNode(SnapshotWriter &writer, RTreeNode *node);
+	RTreeNode *ReadSnapshotNode(SnapshotReader &reader, uint32_t depth);
 
 	RTreeNode *NodeAllocate();
 	void NodeDeallocate(RTreeNode *node);
+	void NodeDeallocateSubtree(RTreeNode *node);
 	void NodeInitialize(RTreeNode *node);
 
 	RTreeNode *NodeInsertData(RTreeNode *node, const BoundBox &boundingBox, 
@@ -125,13 +169,13 @@ private:
 		RTreeObjectCategoryType_t category, RTreeObjectIdType_t id);
 
 	RTreeNode *NodeGetNthChild(RTreeNode *node, uint32_t n);		// Gets child 0,1,2,...
-	uint32_t NodeGetNumChildren(RTreeNode *node);
+	uint32_t NodeGetNumChildren(RTreeNode *node) const;
 	void NodeAddChild(RTreeNode *node, RTreeNode *child);
 	bool NodeDeleteChild(RTreeNode *node, RTreeNode *child);
 	void NodeCalculateBoundingBox(RTreeNode *node);
 	void NodeResetBoundingBox(RTreeNode *node);
-	bool NodeIsLeaf(RTreeNode *node);
-	bool NodeIsData(RTreeNode *node);
+	bool NodeIsLeaf(RTreeNode *node) const;
+	bool NodeIsData(RTreeNode *node) const;
 
 	RTreeNode *PathStackGetTop() const;
 	bool PathStackIsEmpty() const;
@@ -0,0 +1,171 @@
+//
+//  RecordSchema.h
+//  Jon Edwards Code Sample
+//
+//  Compile-time description of the CSV fields of a record. A schema lists
+//  its fields in column order, each with a name, a type and the record
+//  member it fills, e.g.
+//
+//		constexpr RecordSchema sSchema(
+//			HashedField<&UserRecord::userNameHash>{ "<user name>" },
+//			IntegerField<&UserRecord::xLoc>{ "<xLoc>" });
+//
+//  Field types and members are template arguments, so Parse compiles to a
+//  straight sequence of the field parsers with no per-field dispatch, and
+//  a new column costs only its own parsing.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_RECORDSCHEMA_H
+#define LDB_RECORDSCHEMA_H
+
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "HashManagerInterface.h"
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+// Record type and value type of a pointer to a member
+template <class MemberPointer> struct RecordMemberTraits;
+
+template <class Record, class Value> struct RecordMemberTraits<Value Record::*>
+{
+	typedef Record RecordType;
+	typedef Value ValueType;
+};
+
+//----------------------------------------------------------------------------
+// Field types. Each has the name used in error messages, the name of its
+// type, and a static Parse that fills its member from a token, returning
+// false if the token isn't a valid value.
+//----------------------------------------------------------------------------
+
+// String registered with the HashManager and stored as its hash
+template <auto Member> struct HashedField
+{
+	typedef typename RecordMemberTraits<decltype(Member)>::RecordType RecordType;
+	static constexpr const char *kTypeName = "string";
+
+	const char *name;
+
+	static bool Parse(HashManagerInterface &hashManager, string_view token, RecordType &record)
+	{
+		record.*Member = hashManager.GenerateHash(token);
+		return true;
+	}
+};
+
+// Decimal integer of the member's type, such as a LocCoord
+template <auto Member> struct IntegerField
+{
+	typedef typename RecordMemberTraits<decltype(Member)>::RecordType RecordType;
+	static constexpr const char *kTypeName = "integer";
+
+	const char *name;
+
+	static bool Parse(HashManagerInterface &, string_view token, RecordType &record)
+	{
+		return Util::ParseInteger(token, record.*Member);
+	}
+};
+
+// String kept as a view of its token, for records whose strings are
+// registered later, e.g. by the shard of a ShardedDatabase that stores
+// the record. The token must stay valid until then.
+template <auto Member> struct StringField
+{
+	typedef typename RecordMemberTraits<decltype(Member)>::RecordType RecordType;
+	static constexpr const char *kTypeName = "string";
+
+	const char *name;
+
+	static bool Parse(HashManagerInterface &, string_view token, RecordType &record)
+	{
+		record.*Member = token;
+		return true;
+	}
+};
+
+// Field that failed to parse
+struct RecordParseError
+{
+	const char *fieldName;
+	const char *typeName;
+	bool missing;			// Line has too few tokens, rather than a bad value
+
+	// Reports the field of a CSV line that couldn't be parsed
+	void Log(const char *fileName, uint32_t lineNum, string_view inputLine) const
+	{
+		if (missing)
+		{
+			LogError("Error reading data file '%s' (line: %d) could not find expected %s variable '%s' in input line '%.*s'\n",
+				fileName, lineNum, typeName, fieldName, (int)inputLine.size(), inputLine.data());
+		}
+		else
+		{
+			LogError("Error reading data file '%s' (line: %d): found a value for variable <%s> that was not valid %s in input line '%.*s'\n",
+				fileName, lineNum, fieldName, typeName, (int)inputLine.size(), inputLine.data());
+		}
+	}
+};
+
+//----------------------------------------------------------------------------
+// RecordSchema : Fields of a record in column order. Tokens after the last
+// field are ignored.
+//----------------------------------------------------------------------------
+template <class FirstField, class... Fields> class RecordSchema
+{
+public:
+	typedef typename FirstField::RecordType RecordType;
+
+	static constexpr size_t kFieldCount = 1 + sizeof...(Fields);
+
+	constexpr RecordSchema(FirstField firstField, Fields... fields) : m_fields(firstField, fields...) { }
+
+	// Fills the record's fields from tokens in order, stopping at the first
+	// field that can't be parsed, which is described by error
+	bool Parse(HashManagerInterface &hashManager, const vector<string_view> &tokens, RecordType &record,
+		RecordParseError &error) const
+	{
+		return ParseFields(hashManager, tokens, record, error, make_index_sequence<kFieldCount>());
+	}
+
+private:
+	template <size_t... Indexes> bool ParseFields(HashManagerInterface &hashManager,
+		const vector<string_view> &tokens, RecordType &record, RecordParseError &error,
+		index_sequence<Indexes...>) const
+	{
+		return (ParseField<Indexes>(hashManager, tokens, record, error) && ...);
+	}
+
+	template <size_t Index> bool ParseField(HashManagerInterface &hashManager, const vector<string_view> &tokens,
+		RecordType &record, RecordParseError &error) const
+	{
+		typedef typename tuple_element<Index, tuple<FirstField, Fields...> >::type Field;
+		static_assert(is_same<typename Field::RecordType, RecordType>::value, "Schema fields are for different records");
+
+		bool missing = Index >= tokens.size();
+		if (missing || !Field::Parse(hashManager, tokens[Index], record))
+		{
+			error.fieldName = get<Index>(m_fields).name;
+			error.typeName = Field::kTypeName;
+			error.missing = missing;
+			return false;
+		}
+		return true;
+	}
+
+	tuple<FirstField, Fields...> m_fields;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_RECORDSCHEMA_H
@@ -0,0 +1,675 @@
+//
+//  ShardedDatabase.cpp
+//  Jon Edwards Code Sample
+//
+//  Database split into spatial shards
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "CSVFile.h"
+#include "RecordSchema.h"
+#include "ShardedDatabase.h"
+
+BEGIN_NAMESPACE(LDB)
+
+ShardedDatabase::ShardedDatabase()
+	: m_tilesPerAxis(0), m_gridInitialized(false), m_gridMinX(0), m_gridMinY(0),
+	m_tileWidth(1), m_tileHeight(1)
+{
+
+}
+
+ShardedDatabase::~ShardedDatabase()
+{
+	Shutdown();
+}
+
+void ShardedDatabase::Initialize(uint32_t tilesPerAxis, uint32_t threadCount)
+{
+	Shutdown();
+
+	m_tilesPerAxis = max(tilesPerAxis, 1u);
+	uint32_t shardCount = m_tilesPerAxis * m_tilesPerAxis;
+	for (uint32_t i = 0; i < shardCount; i++)
+	{
+		HashManager *hashManager = new HashManager();
+		Database *shard = new Database(hashManager);
+		shard->Initialize();
+
+		m_shardHashManagers.push_back(hashManager);
+		m_shards.push_back(shard);
+	}
+
+	// The calling thread waits while tasks run, so it isn't counted
+	m_threadPool.Initialize(min(threadCount, shardCount));
+}
+
+void ShardedDatabase::Shutdown()
+{
+	m_threadPool.Shutdown();
+
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		delete m_shards[i];
+		delete m_shardHashManagers[i];
+	}
+	m_shards.clear();
+	m_shardHashManagers.clear();
+	m_userShards.clear();
+
+	m_tilesPerAxis = 0;
+	m_gridInitialized = false;
+}
+
+//============================================================================
+//
+//							Tiles
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::InitializeGrid : Divides the bounds of the users evenly
+// into tiles
+//----------------------------------------------------------------------------
+void ShardedDatabase::InitializeGrid(LocCoord minX, LocCoord minY, LocCoord maxX, LocCoord maxY)
+{
+	m_gridMinX = minX;
+	m_gridMinY = minY;
+	m_tileWidth = max(((int64_t)maxX - minX) / m_tilesPerAxis + 1, (int64_t)1);
+	m_tileHeight = max(((int64_t)maxY - minY) / m_tilesPerAxis + 1, (int64_t)1);
+	m_gridInitialized = true;
+}
+
+uint32_t ShardedDatabase::GetTileColumn(int64_t x) const
+{
+	int64_t column = (x - m_gridMinX) / m_tileWidth;
+	return (uint32_t)min(max(column, (int64_t)0), (int64_t)m_tilesPerAxis - 1);
+}
+
+uint32_t ShardedDatabase::GetTileRow(int64_t y) const
+{
+	int64_t row = (y - m_gridMinY) / m_tileHeight;
+	return (uint32_t)min(max(row, (int64_t)0), (int64_t)m_tilesPerAxis - 1);
+}
+
+void ShardedDatabase::GetShardsInRange(LocCoord x, LocCoord y, uint32_t range,
+	vector<uint32_t> &shardIndexes) const
+{
+	uint32_t minColumn = GetTileColumn((int64_t)x - range);
+	uint32_t maxColumn = GetTileColumn((int64_t)x + range);
+	uint32_t minRow = GetTileRow((int64_t)y - range);
+	uint32_t maxRow = GetTileRow((int64_t)y + range);
+
+	for (uint32_t row = minRow; row <= maxRow; row++)
+	{
+		for (uint32_t column = minColumn; column <= maxColumn; column++)
+		{
+			shardIndexes.push_back(row * m_tilesPerAxis + column);
+		}
+	}
+}
+
+uint32_t ShardedDatabase::GetUserShard(HashKey userKey) const
+{
+	unordered_map<HashKey, uint32_t>::const_iterator itr = m_userShards.find(userKey);
+	if (itr == m_userShards.end())
+	{
+		return kInvalidShard;
+	}
+
+	return (*itr).second;
+}
+
+void ShardedDatabase::RunOnShards(const vector<uint32_t> &shardIndexes, const ShardTask &task) const
+{
+	if (shardIndexes.size() == 1)
+	{
+		task(shardIndexes[0]);
+		return;
+	}
+
+	for (size_t i = 0; i < shardIndexes.size(); i++)
+	{
+		uint32_t shardIndex = shardIndexes[i];
+		m_threadPool.Submit([&task, shardIndex]() { task(shardIndex); });
+	}
+	m_threadPool.Wait();
+}
+
+//============================================================================
+//
+//							Loading
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// KeepToken : Returns a view of a token that stays valid for the rest of
+// the load. Tokens are views of the chunk, except unescaped tokens, which
+// are in the tokenizer's buffer until the next line. Chunks of a streamed
+// file are released after each round, so then every token is copied.
+//----------------------------------------------------------------------------
+static string_view KeepToken(string_view token, string_view chunk, bool copyToken, StringArena &strings)
+{
+	if (!copyToken && token.data() >= chunk.data() && token.data() + token.size() <= chunk.data() + chunk.size())
+	{
+		return token;
+	}
+
+	return StringArena::GetString(strings.Add(token));
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::ParseUserLine : Parses a users line into fields without
+// registering its strings, so it can run on any thread. Returns false for
+// blank lines and lines that couldn't be parsed.
+//----------------------------------------------------------------------------
+bool ShardedDatabase::ParseUserLine(const char *fileName, uint32_t lineNum, string_view inputLine,
+	string_view chunk, bool copyStrings, CSVTokenizer &tokenizer, StringArena &strings, ParsedUser &user)
+{
+	static constexpr RecordSchema sUserFieldsSchema(
+		StringField<&CSVUserFields::userName>{ "<user name>" },
+		StringField<&CSVUserFields::phoneNumber>{ "<phone number>" },
+		IntegerField<&CSVUserFields::xLoc>{ "<xLoc>" },
+		IntegerField<&CSVUserFields::yLoc>{ "<yLoc>" },
+		StringField<&CSVUserFields::gender>{ "<gender>" });
+
+	const vector<string_view> &tokens = tokenizer.Tokenize(inputLine);
+	if (tokens.size() == 0)
+	{
+		return false;
+	}
+
+	RecordParseError error;
+	if (!sUserFieldsSchema.Parse(m_hashManager, tokens, user.fields, error))
+	{
+		if (m_loadStats.GetUserStats().AddParseError(error.fieldName))
+		{
+			error.Log(fileName, lineNum, inputLine);
+		}
+		return false;
+	}
+
+	CSVUserFields &fields = user.fields;
+	fields.userName = KeepToken(fields.userName, chunk, copyStrings, strings);
+	fields.phoneNumber = KeepToken(fields.phoneNumber, chunk, copyStrings, strings);
+	fields.gender = KeepToken(fields.gender, chunk, copyStrings, strings);
+	fields.lineNum = lineNum;
+	user.userNameHash = m_hashManager.ComputeHash(fields.userName);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::ParseLikeLine : Parses a likes line into fields, as
+// above. Likes are added to their shards in the round they're read, so
+// only unescaped tokens are copied.
+//----------------------------------------------------------------------------
+bool ShardedDatabase::ParseLikeLine(const char *fileName, uint32_t lineNum, string_view inputLine,
+	string_view chunk, CSVTokenizer &tokenizer, StringArena &strings, ParsedLike &like)
+{
+	static constexpr RecordSchema sLikeFieldsSchema(
+		StringField<&CSVLikeFields::userName>{ "<user name>" },
+		StringField<&CSVLikeFields::like>{ "<user like>" });
+
+	const vector<string_view> &tokens = tokenizer.Tokenize(inputLine);
+	if (tokens.size() == 0)
+	{
+		return false;
+	}
+
+	RecordParseError error;
+	if (!sLikeFieldsSchema.Parse(m_hashManager, tokens, like.fields, error))
+	{
+		if (m_loadStats.GetLikeStats().AddParseError(error.fieldName))
+		{
+			error.Log(fileName, lineNum, inputLine);
+		}
+		return false;
+	}
+
+	// Empty strings have no hash, so they're skipped as by Database
+	CSVLikeFields &fields = like.fields;
+	if (fields.userName.empty() || fields.like.empty())
+	{
+		return false;
+	}
+
+	fields.userName = KeepToken(fields.userName, chunk, false, strings);
+	fields.like = KeepToken(fields.like, chunk, false, strings);
+	fields.lineNum = lineNum;
+	like.userNameHash = m_hashManager.ComputeHash(fields.userName);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::LoadUserDataFromCSVFile : Chunks of the file are parsed
+// in parallel. The grid is fitted to the bounds of the first file's users,
+// so the parsed users are kept until the whole file is read, then routed
+// to their shards in file order.
+//----------------------------------------------------------------------------
+bool ShardedDatabase::LoadUserDataFromCSVFile(const char *fileName)
+{
+	if (m_shards.empty())
+	{
+		LogError("Error: ShardedDatabase::LoadUserDataFromCSVFile -  database not initialized\n");
+		return false;
+	}
+
+	CSVLoadStats &stats = m_loadStats.GetUserStats();
+	stats.Start(fileName);
+
+	uint32_t chunkCount = max(m_threadPool.GetThreadCount(), 1u);
+	CSVInputFile file;
+	if (!file.Open(fileName, kCSVChunkSize, chunkCount))
+	{
+		LogError("Error: ShardedDatabase::LoadUserDataFromCSVFile -  could not open file '%s'\n", fileName);
+		return false;
+	}
+
+	bool copyStrings = file.IsStreamed();
+	vector<StringArena> chunkStrings(chunkCount);
+	vector< vector<ParsedUser> > chunkUsers(chunkCount);
+	vector<ParsedUser> users;
+
+	bool result = Database::LoadCSVFileChunks(m_threadPool, file, chunkCount, stats,
+		[this, fileName, copyStrings, &chunkStrings, &chunkUsers](uint32_t chunkIndex, string_view chunk,
+			uint32_t lineNum)
+		{
+			CSVTokenizer tokenizer;
+			ParsedUser user;
+			string_view lines = chunk;
+			string_view inputLine;
+			while (MappedCSVFile::SplitLine(lines, inputLine))
+			{
+				if (ParseUserLine(fileName, lineNum, inputLine, chunk, copyStrings, tokenizer,
+					chunkStrings[chunkIndex], user))
+				{
+					chunkUsers[chunkIndex].push_back(user);
+				}
+				lineNum++;
+			}
+		},
+		[&chunkUsers, &users](uint32_t chunkIndex)
+		{
+			users.insert(users.end(), chunkUsers[chunkIndex].begin(), chunkUsers[chunkIndex].end());
+			chunkUsers[chunkIndex].clear();
+		});
+	if (!result)
+	{
+		LogError("Error: ShardedDatabase::LoadUserDataFromCSVFile -  could not read file '%s'\n", fileName);
+	}
+
+	if (!m_gridInitialized && !users.empty())
+	{
+		LocCoord minX = numeric_limits<LocCoord>::max();
+		LocCoord minY = numeric_limits<LocCoord>::max();
+		LocCoord maxX = numeric_limits<LocCoord>::min();
+		LocCoord maxY = numeric_limits<LocCoord>::min();
+		for (size_t i = 0; i < users.size(); i++)
+		{
+			minX = min(minX, users[i].fields.xLoc);
+			minY = min(minY, users[i].fields.yLoc);
+			maxX = max(maxX, users[i].fields.xLoc);
+			maxY = max(maxY, users[i].fields.yLoc);
+		}
+		InitializeGrid(minX, minY, maxX, maxY);
+	}
+
+	// Users in different tiles never see each other, so duplicates are
+	// rejected here. Lines that didn't parse never get this far, so they
+	// can't take the user name of a later valid line.
+	vector< vector<CSVUserFields> > shardUsers(m_shards.size());
+	vector< vector<HashKey> > shardUserKeys(m_shards.size());
+	unordered_set<HashKey> routedUsers;
+	for (size_t i = 0; i < users.size(); i++)
+	{
+		const ParsedUser &user = users[i];
+		if (m_userShards.find(user.userNameHash) != m_userShards.end()
+			|| !routedUsers.insert(user.userNameHash).second)
+		{
+			if (stats.AddError(LoadError_Duplicate))
+			{
+				LogError("Error: Cannot add new user '%.*s', already exists.\n", (int)user.fields.userName.size(),
+					user.fields.userName.data());
+			}
+			continue;
+		}
+
+		uint32_t shardIndex = GetTileRow(user.fields.yLoc) * m_tilesPerAxis + GetTileColumn(user.fields.xLoc);
+		shardUsers[shardIndex].push_back(user.fields);
+		shardUserKeys[shardIndex].push_back(user.userNameHash);
+	}
+	vector<ParsedUser>().swap(users);
+
+	vector<uint32_t> shardIndexes;
+	for (uint32_t i = 0; i < m_shards.size(); i++)
+	{
+		shardIndexes.push_back(i);
+	}
+
+	vector< vector<bool> > shardAccepted(m_shards.size());
+	vector<uint8_t> shardResults(m_shards.size());
+	RunOnShards(shardIndexes, [this, &shardUsers, &shardAccepted, &shardResults](uint32_t shardIndex)
+	{
+		shardResults[shardIndex] = m_shards[shardIndex]->AddUserFields(shardUsers[shardIndex],
+			shardAccepted[shardIndex]);
+	});
+
+	// A user name is only taken once its shard has added the record
+	for (uint32_t i = 0; i < m_shards.size(); i++)
+	{
+		if (!shardResults[i])
+		{
+			result = false;
+		}
+
+		for (size_t j = 0; j < shardAccepted[i].size(); j++)
+		{
+			if (shardAccepted[i][j])
+			{
+				m_userShards[shardUserKeys[i][j]] = i;
+				stats.AddAccepted(1);
+			}
+		}
+	}
+	stats.Finish();
+
+	return result;
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::LoadLikesDataFromCSVFile : Chunks of the file are parsed
+// in parallel, then each chunk's likes are given to the shards holding
+// their users, which add them in parallel. Likes for unknown users are
+// rejected here.
+//----------------------------------------------------------------------------
+bool ShardedDatabase::LoadLikesDataFromCSVFile(const char *fileName)
+{
+	if (m_shards.empty())
+	{
+		LogError("Error: ShardedDatabase::LoadLikesDataFromCSVFile -  database not initialized\n");
+		return false;
+	}
+
+	CSVLoadStats &stats = m_loadStats.GetLikeStats();
+	stats.Start(fileName);
+
+	uint32_t chunkCount = max(m_threadPool.GetThreadCount(), 1u);
+	CSVInputFile file;
+	if (!file.Open(fileName, kCSVChunkSize, chunkCount))
+	{
+		LogError("Error: ShardedDatabase::LoadLikesDataFromCSVFile -  could not open file '%s'\n", fileName);
+		return false;
+	}
+
+	vector<uint32_t> shardIndexes;
+	for (uint32_t i = 0; i < m_shards.size(); i++)
+	{
+		shardIndexes.push_back(i);
+	}
+
+	vector<StringArena> chunkStrings(chunkCount);
+	vector< vector<ParsedLike> > chunkLikes(chunkCount);
+	vector< vector<CSVLikeFields> > shardLikes(m_shards.size());
+	vector<uint8_t> shardResults(m_shards.size(), true);
+
+	bool result = Database::LoadCSVFileChunks(m_threadPool, file, chunkCount, stats,
+		[this, fileName, &chunkStrings, &chunkLikes](uint32_t chunkIndex, string_view chunk, uint32_t lineNum)
+		{
+			CSVTokenizer tokenizer;
+			ParsedLike like;
+			string_view lines = chunk;
+			string_view inputLine;
+			while (MappedCSVFile::SplitLine(lines, inputLine))
+			{
+				if (ParseLikeLine(fileName, lineNum, inputLine, chunk, tokenizer, chunkStrings[chunkIndex], like))
+				{
+					chunkLikes[chunkIndex].push_back(like);
+				}
+				lineNum++;
+			}
+		},
+		[this, fileName, &stats, &shardIndexes, &chunkStrings, &chunkLikes, &shardLikes, &shardResults]
+			(uint32_t chunkIndex)
+		{
+			vector<ParsedLike> &likes = chunkLikes[chunkIndex];
+			for (size_t i = 0; i < likes.size(); i++)
+			{
+				const CSVLikeFields &fields = likes[i].fields;
+				uint32_t shardIndex = GetUserShard(likes[i].userNameHash);
+				if (shardIndex == kInvalidShard)
+				{
+					if (stats.AddError(LoadError_UnknownUser))
+					{
+						LogError("Error reading file '%s' (line: %d) : Cannot find user '%.*s' in database. Skipping input line.\n",
+							fileName, fields.lineNum, (int)fields.userName.size(), fields.userName.data());
+					}
+					continue;
+				}
+
+				shardLikes[shardIndex].push_back(fields);
+				stats.AddAccepted(1);
+			}
+
+			RunOnShards(shardIndexes, [this, fileName, &shardLikes, &shardResults](uint32_t shardIndex)
+			{
+				if (!m_shards[shardIndex]->AddLikeFields(fileName, shardLikes[shardIndex]))
+				{
+					shardResults[shardIndex] = false;
+				}
+				shardLikes[shardIndex].clear();
+			});
+
+			likes.clear();
+			chunkStrings[chunkIndex].Clear();
+		});
+	if (!result)
+	{
+		LogError("Error: ShardedDatabase::LoadLikesDataFromCSVFile -  could not read file '%s'\n", fileName);
+	}
+	stats.Finish();
+
+	// Loading is done - move likes into compact storage
+	{
+		LoadPhaseTimer compactTimer(m_loadStats, LoadPhase_Compact);
+		RunOnShards(shardIndexes, [this](uint32_t shardIndex) { m_shards[shardIndex]->Compact(); });
+	}
+
+	for (size_t i = 0; i < shardResults.size(); i++)
+	{
+		if (!shardResults[i])
+		{
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+//============================================================================
+//
+//							Queries
+//
+//============================================================================
+
+const UserRecord &ShardedDatabase::LookupUserRecordByKey(HashKey key) const
+{
+	uint32_t shardIndex = GetUserShard(key);
+	if (shardIndex == kInvalidShard)
+	{
+		return sNullUserRecord;
+	}
+
+	return m_shards[shardIndex]->LookupUserRecordByKey(key);
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::LookupHashString : Strings are registered with the
+// HashManager of the shard that loaded them, so every shard is checked
+//----------------------------------------------------------------------------
+bool ShardedDatabase::LookupHashString(HashKey key, string &buffer, string_view &str) const
+{
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		if (m_shards[i]->LookupHashString(key, buffer, str))
+		{
+			return true;
+		}
+	}
+
+	return m_hashManager.LookupHashString(key, str);
+}
+
+HashKey ShardedDatabase::FindHash(string_view str) const
+{
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		HashKey key = m_shards[i]->FindHash(str);
+		if (key != kInvalidHashKey)
+		{
+			return key;
+		}
+	}
+
+	return m_hashManager.FindHash(str);
+}
+
+uint32_t ShardedDatabase::QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, vector<HashKey> &userList) const
+{
+	return QueryShardsInRange(x, y, range, kInvalidHashKey, userList);
+}
+
+uint32_t ShardedDatabase::QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, HashKey genderHash,
+	vector<HashKey> &userList) const
+{
+	return QueryShardsInRange(x, y, range, genderHash, userList);
+}
+
+uint32_t ShardedDatabase::QueryUsersInPartition(HashKey genderHash, vector<HashKey> &userList) const
+{
+	uint32_t count = 0;
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		count += m_shards[i]->QueryUsersInPartition(genderHash, userList);
+	}
+
+	return count;
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::QueryShardsInRange : Scatter-gather range query. Each
+// overlapping shard adds its users to its own list and the lists are
+// appended in shard order. If genderHash isn't kInvalidHashKey only users
+// of that gender are found.
+//----------------------------------------------------------------------------
+uint32_t ShardedDatabase::QueryShardsInRange(LocCoord x, LocCoord y, uint32_t range, HashKey genderHash,
+	vector<HashKey> &userList) const
+{
+	vector<uint32_t> shardIndexes;
+	GetShardsInRange(x, y, range, shardIndexes);
+
+	// Most small ranges are within one tile
+	if (shardIndexes.size() == 1)
+	{
+		const Database &shard = *m_shards[shardIndexes[0]];
+		return genderHash == kInvalidHashKey ? shard.QueryUsersInRange(x, y, range, userList)
+			: shard.QueryUsersInRange(x, y, range, genderHash, userList);
+	}
+
+	vector< vector<HashKey> > shardUsers(m_shards.size());
+	RunOnShards(shardIndexes, [this, x, y, range, genderHash, &shardUsers](uint32_t shardIndex)
+	{
+		if (genderHash == kInvalidHashKey)
+		{
+			m_shards[shardIndex]->QueryUsersInRange(x, y, range, shardUsers[shardIndex]);
+		}
+		else
+		{
+			m_shards[shardIndex]->QueryUsersInRange(x, y, range, genderHash, shardUsers[shardIndex]);
+		}
+	});
+
+	uint32_t count = 0;
+	for (size_t i = 0; i < shardIndexes.size(); i++)
+	{
+		const vector<HashKey> &users = shardUsers[shardIndexes[i]];
+		userList.insert(userList.end(), users.begin(), users.end());
+		count += (uint32_t)users.size();
+	}
+
+	return count;
+}
+
+//----------------------------------------------------------------------------
+//					class ShardedDatabase::UserRecordIterator
+//----------------------------------------------------------------------------
+ShardedDatabase::UserRecordIterator::UserRecordIterator(const ShardedDatabase &database)
+	: m_database(database), m_shardIndex(0), m_shardItr(NULL)
+{
+	Reset();
+}
+
+ShardedDatabase::UserRecordIterator::~UserRecordIterator()
+{
+	delete m_shardItr;
+}
+
+void ShardedDatabase::UserRecordIterator::Reset()
+{
+	delete m_shardItr;
+	m_shardItr = NULL;
+	m_shardIndex = 0;
+	SkipEmptyShards();
+}
+
+//----------------------------------------------------------------------------
+// ShardedDatabase::UserRecordIterator::SkipEmptyShards : Moves to the next
+// shard with records left to iterate, starting with the current one
+//----------------------------------------------------------------------------
+void ShardedDatabase::UserRecordIterator::SkipEmptyShards()
+{
+	while (m_shardIndex < m_database.m_shards.size())
+	{
+		if (m_shardItr == NULL)
+		{
+			m_shardItr = new Database::UserRecordIterator(*m_database.m_shards[m_shardIndex]);
+		}
+
+		if (!m_shardItr->IsDone())
+		{
+			return;
+		}
+
+		delete m_shardItr;
+		m_shardItr = NULL;
+		m_shardIndex++;
+	}
+}
+
+bool ShardedDatabase::UserRecordIterator::IsDone() const
+{
+	return m_shardItr == NULL;
+}
+
+ShardedDatabase::UserRecordIterator &ShardedDatabase::UserRecordIterator::operator++()
+{
+	if (!IsDone())
+	{
+		++(*m_shardItr);
+		SkipEmptyShards();
+	}
+	return *this;
+}
+
+HashKey ShardedDatabase::UserRecordIterator::GetHashKey() const
+{
+	if (IsDone())
+		return kInvalidHashKey;
+
+	return m_shardItr->GetHashKey();
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,166 @@
+//
+//  ShardedDatabase.h
+//  Jon Edwards Code Sample
+//
+//  Database split into spatial shards. The coordinate space is divided
+//  into a grid of tiles, each holding the users located in it in its own
+//  Database (with its own HashManager and R-trees). The grid covers the
+//  bounds of the users in the first users file loaded and is then fixed:
+//  users of later files outside the bounds go to the nearest edge tile,
+//  and the grid isn't rebalanced, so later files covering a different area
+//  can leave most users in a few shards. Initialize again to start a new
+//  grid.
+//
+//  Lines are parsed once, in parallel, into fields that are routed to
+//  shards on the calling thread in file order. Shards are independent, so
+//  they add their fields in parallel and range queries covering several
+//  tiles search them in parallel on a thread pool. Queries that fall within
+//  one tile are run on the calling thread.
+//
+//  A ShardedDatabase must only be used by one thread at a time.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_SHARDEDDATABASE_H
+#define LDB_SHARDEDDATABASE_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Database.h"
+#include "HashManager.h"
+#include "LoadStats.h"
+#include "StringArena.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+class ShardedDatabase
+{
+public:
+	typedef function<void(uint32_t shardIndex)> ShardTask;
+
+	ShardedDatabase();
+	~ShardedDatabase();
+
+	// Creates tilesPerAxis * tilesPerAxis shards and threadCount worker
+	// threads
+	void Initialize(uint32_t tilesPerAxis, uint32_t threadCount);
+	void Shutdown();
+
+	// Files are read the same way as by Database, including stdin, pipes
+	// and compressed files. Users are assigned to shards by their location,
+	// then every shard adds its users in parallel. Duplicate users are
+	// rejected the same way as by Database: the first valid record for a
+	// user name is kept. Returns false if the file couldn't be read or a
+	// shard couldn't add its records.
+	bool LoadUserDataFromCSVFile(const char *fileName);
+	bool LoadLikesDataFromCSVFile(const char *fileName);
+
+	// Lines read, accepted and rejected by the last CSV file loads
+	const LoadStats &GetLoadStats() const { return m_loadStats; }
+
+	const UserRecord &LookupUserRecordByKey(HashKey key) const;
+	bool IsNullUserRecord(const UserRecord &record) const { return record == sNullUserRecord; }
+
+	// Range queries gather the results from every tile overlapping the range
+	uint32_t QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, vector<HashKey> &userList) const;
+	uint32_t QueryUsersInRange(LocCoord x, LocCoord y, uint32_t range, HashKey genderHash,
+		vector<HashKey> &userList) const;
+	uint32_t QueryUsersInPartition(HashKey genderHash, vector<HashKey> &userList) const;
+
+	// Same as Database::FindHash, for strings registered by any shard
+	HashKey FindHash(string_view str) const;
+	bool LookupHashString(HashKey key, string &buffer, string_view &str) const;
+
+	//------------------------------------------------------------------------
+	// Shard access
+
+	uint32_t GetShardCount() const { return (uint32_t)m_shards.size(); }
+	const Database &GetShard(uint32_t shardIndex) const { return *m_shards[shardIndex]; }
+
+	// Shard holding a user, or kInvalidShard if there's no such user
+	static const uint32_t kInvalidShard = 0xffffffff;
+	uint32_t GetUserShard(HashKey userKey) const;
+
+	// Adds indexes of the shards whose tiles overlap the square of side
+	// 2 * range centered on (x, y) to shardIndexes
+	void GetShardsInRange(LocCoord x, LocCoord y, uint32_t range, vector<uint32_t> &shardIndexes) const;
+
+	// Runs a task for each shard, in parallel if there's more than one, and
+	// waits for them to finish
+	void RunOnShards(const vector<uint32_t> &shardIndexes, const ShardTask &task) const;
+
+	//----------------------------------------------------------------------------
+	// Iterator for iterating through user records in all shards
+	class UserRecordIterator
+	{
+	public:
+		UserRecordIterator(const ShardedDatabase &database);
+		~UserRecordIterator();
+
+		UserRecordIterator& operator++();
+		HashKey GetHashKey() const;
+		bool IsDone() const;
+		void Reset();
+
+	private:
+		UserRecordIterator(const UserRecordIterator &);				// Not copyable
+		UserRecordIterator &operator=(const UserRecordIterator &);
+
+		void SkipEmptyShards();
+
+		const ShardedDatabase &m_database;
+		uint32_t m_shardIndex;
+		Database::UserRecordIterator *m_shardItr;
+	};
+
+private:
+	// Parsed line and the hash of its user name, which picks its shard
+	struct ParsedUser
+	{
+		CSVUserFields fields;
+		HashKey userNameHash;
+	};
+
+	struct ParsedLike
+	{
+		CSVLikeFields fields;
+		HashKey userNameHash;
+	};
+
+	uint32_t GetTileColumn(int64_t x) const;
+	uint32_t GetTileRow(int64_t y) const;
+	void InitializeGrid(LocCoord minX, LocCoord minY, LocCoord maxX, LocCoord maxY);
+	bool ParseUserLine(const char *fileName, uint32_t lineNum, string_view inputLine, string_view chunk,
+		bool copyStrings, CSVTokenizer &tokenizer, StringArena &strings, ParsedUser &user);
+	bool ParseLikeLine(const char *fileName, uint32_t lineNum, string_view inputLine, string_view chunk,
+		CSVTokenizer &tokenizer, StringArena &strings, ParsedLike &like);
+	uint32_t QueryShardsInRange(LocCoord x, LocCoord y, uint32_t range, HashKey genderHash,
+		vector<HashKey> &userList) const;
+
+	uint32_t m_tilesPerAxis;
+	bool m_gridInitialized;
+	int64_t m_gridMinX;
+	int64_t m_gridMinY;
+	int64_t m_tileWidth;
+	int64_t m_tileHeight;
+
+	vector<Database *> m_shards;
+	vector<HashManager *> m_shardHashManagers;
+
+	HashManager m_hashManager;					// Hashes user names to route lines; the
+												// shards register the strings
+	unordered_map<HashKey, uint32_t> m_userShards;	// User key -> shard
+	mutable ThreadPool m_threadPool;				// Used by const queries
+	LoadStats m_loadStats;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_SHARDEDDATABASE_H
@@ -0,0 +1,292 @@
+//
+//  Snapshot.cpp
+//  Jon Edwards Code Sample
+//
+//  Reading and writing of binary database snapshots
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Snapshot.h"
+
+BEGIN_NAMESPACE(LDB)
+
+const size_t kSnapshotWriteBufferSize = 1024 * 1024;
+
+//----------------------------------------------------------------------------
+// SyncParentDirectory : Flushes the directory entry for fileName so a rename
+// into it survives a crash
+//----------------------------------------------------------------------------
+static bool SyncParentDirectory(const string &fileName)
+{
+	size_t slash = fileName.rfind('/');
+	string directory = (slash == string::npos) ? "." : (slash == 0) ? "/" : fileName.substr(0, slash);
+
+	int fd = open(directory.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+}
+
+namespace SnapshotUtil
+{
+	//------------------------------------------------------------------------
+	// UpdateCRC32 : Table driven CRC-32 (IEEE 802.3 polynomial). Pass 0 as
+	// the initial crc.
+	//------------------------------------------------------------------------
+	uint32_t UpdateCRC32(uint32_t crc, const void *data, size_t size)
+	{
+		static uint32_t sTable[256];
+		static bool sTableInitialized = false;
+		if (!sTableInitialized)
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t c = i;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+				}
+				sTable[i] = c;
+			}
+			sTableInitialized = true;
+		}
+
+		const unsigned char *bytes = (const unsigned char *)data;
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+		{
+			crc = sTable[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+		}
+
+		return ~crc;
+	}
+}
+
+//============================================================================
+//
+//							class SnapshotWriter
+//
+//============================================================================
+
+SnapshotWriter::~SnapshotWriter()
+{
+	if (m_file != NULL)
+	{
+		fclose(m_file);
+		remove(m_tempFileName.c_str());
+	}
+}
+
+bool SnapshotWriter::Open(const char *fileName)
+{
+	m_fileName = fileName;
+	m_tempFileName = m_fileName + ".tmp";
+	m_crc = 0;
+	m_failed = false;
+
+	m_file = fopen(m_tempFileName.c_str(), "wb");
+	if (m_file == NULL)
+	{
+		LogError("Error: SnapshotWriter::Open - could not open file '%s'\n", m_tempFileName.c_str());
+		m_failed = true;
+		return false;
+	}
+	setvbuf(m_file, NULL, _IOFBF, kSnapshotWriteBufferSize);
+
+	WriteUint32(kSnapshotMagic);
+	WriteUint32(kSnapshotVersion);
+
+	return !m_failed;
+}
+
+//----------------------------------------------------------------------------
+// SnapshotWriter::Close : Writes the checksum trailer, syncs the temporary
+// file and moves the snapshot into place, then syncs the directory so the
+// rename is durable. Returns false if any write or sync failed.
+//----------------------------------------------------------------------------
+bool SnapshotWriter::Close()
+{
+	if (m_file == NULL)
+	{
+		return false;
+	}
+
+	uint32_t crc = m_crc;
+	if (fwrite(&crc, sizeof(crc), 1, m_file) != 1)
+	{
+		m_failed = true;
+	}
+
+	if (fflush(m_file) != 0 || fsync(fileno(m_file)) != 0)
+	{
+		m_failed = true;
+	}
+
+	if (fclose(m_file) != 0)
+	{
+		m_failed = true;
+	}
+	m_file = NULL;
+
+	if (m_failed || rename(m_tempFileName.c_str(), m_fileName.c_str()) != 0)
+	{
+		LogError("Error: SnapshotWriter::Close - failed writing snapshot '%s'\n", m_fileName.c_str());
+		remove(m_tempFileName.c_str());
+		m_failed = true;
+		return false;
+	}
+
+	if (!SyncParentDirectory(m_fileName))
+	{
+		LogError("Error: SnapshotWriter::Close - failed syncing directory of '%s'\n", m_fileName.c_str());
+		m_failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+void SnapshotWriter::WriteBytes(const void *data, size_t size)
+{
+	if (m_failed || m_file == NULL)
+	{
+		m_failed = true;
+		return;
+	}
+
+	if (fwrite(data, 1, size, m_file) != size)
+	{
+		m_failed = true;
+		return;
+	}
+
+	m_crc = SnapshotUtil::UpdateCRC32(m_crc, data, size);
+}
+
+void SnapshotWriter::WriteString(string_view str)
+{
+	WriteUint32((uint32_t)str.size());
+	WriteBytes(str.data(), str.size());
+}
+
+//============================================================================
+//
+//							class SnapshotReader
+//
+//============================================================================
+
+//----------------------------------------------------------------------------
+// SnapshotReader::Open : Reads the snapshot into memory and checks the
+// header and checksum
+//----------------------------------------------------------------------------
+bool SnapshotReader::Open(const char *fileName)
+{
+	m_data.clear();
+	m_pos = 0;
+	m_end = 0;
+	m_failed = true;
+
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	const size_t headerSize = 2 * sizeof(uint32_t);
+	const size_t trailerSize = sizeof(uint32_t);
+	if (fileSize < (long)(headerSize + trailerSize))
+	{
+		LogError("Error: SnapshotReader::Open - snapshot '%s' is truncated\n", fileName);
+		fclose(file);
+		return false;
+	}
+
+	m_data.resize((size_t)fileSize);
+	size_t bytesRead = fread(&m_data[0], 1, m_data.size(), file);
+	fclose(file);
+	if (bytesRead != m_data.size())
+	{
+		LogError("Error: SnapshotReader::Open - could not read snapshot '%s'\n", fileName);
+		return false;
+	}
+
+	m_end = m_data.size() - trailerSize;
+
+	uint32_t storedCRC;
+	memcpy(&storedCRC, &m_data[m_end], sizeof(storedCRC));
+	if (SnapshotUtil::UpdateCRC32(0, &m_data[0], m_end) != storedCRC)
+	{
+		LogError("Error: SnapshotReader::Open - checksum mismatch in snapshot '%s'\n", fileName);
+		return false;
+	}
+
+	m_failed = false;
+	uint32_t magic = ReadUint32();
+	uint32_t version = ReadUint32();
+	if (magic != kSnapshotMagic || version != kSnapshotVersion)
+	{
+		LogError("Error: SnapshotReader::Open - '%s' is not a version %d snapshot\n", fileName, kSnapshotVersion);
+		m_failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+void SnapshotReader::ReadBytes(void *data, size_t size)
+{
+	if (m_failed || size > m_end - m_pos)
+	{
+		m_failed = true;
+		memset(data, 0, size);
+		return;
+	}
+
+	memcpy(data, &m_data[m_pos], size);
+	m_pos += size;
+}
+
+void SnapshotReader::ReadString(string &str)
+{
+	uint32_t size = ReadUint32();
+	if (m_failed || size > m_end - m_pos)
+	{
+		m_failed = true;
+		str.clear();
+		return;
+	}
+
+	str.assign(&m_data[m_pos], size);
+	m_pos += size;
+}
+
+void SnapshotReader::ReadString(string_view &str)
+{
+	uint32_t size = ReadUint32();
+	if (m_failed || size > m_end - m_pos)
+	{
+		m_failed = true;
+		str = string_view();
+		return;
+	}
+
+	str = string_view(m_data.data() + m_pos, size);
+	m_pos += size;
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,131 @@
+//
+//  Snapshot.h
+//  Jon Edwards Code Sample
+//
+//  Reading and writing of binary database snapshots. A snapshot file is
+//
+//		header:		magic (uint32), version (uint32)
+//		sections:	written by Database, HashManager and RTree
+//		trailer:	CRC-32 of header and sections (uint32)
+//
+//  Values are written in host byte order. Readers reject files with the
+//  wrong magic, an unknown version or a bad checksum before any section
+//  is read.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_SNAPSHOT_H
+#define LDB_SNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const uint32_t kSnapshotMagic = 0x5342444c;		// "LDBS"
+const uint32_t kSnapshotVersion = 5;
+
+namespace SnapshotUtil
+{
+	uint32_t UpdateCRC32(uint32_t crc, const void *data, size_t size);
+}
+
+//----------------------------------------------------------------------------
+// SnapshotWriter : Writes a snapshot file. Data is written to a temporary
+// file which replaces the destination file when Close succeeds, so an
+// existing snapshot is never left partially written.
+//----------------------------------------------------------------------------
+class SnapshotWriter
+{
+public:
+	SnapshotWriter() : m_file(NULL), m_crc(0), m_failed(false) { }
+	~SnapshotWriter();
+
+	bool Open(const char *fileName);
+	bool Close();
+
+	void WriteBytes(const void *data, size_t size);
+	void WriteUint32(uint32_t value) { WriteBytes(&value, sizeof(value)); }
+	void WriteUint64(uint64_t value) { WriteBytes(&value, sizeof(value)); }
+	void WriteInt32(int32_t value) { WriteBytes(&value, sizeof(value)); }
+	void WriteFloat(float value) { WriteBytes(&value, sizeof(value)); }
+	void WriteString(string_view str);
+
+	template <class T> void WriteVector(const vector<T> &values)
+	{
+		WriteUint64(values.size());
+		if (!values.empty())
+		{
+			WriteBytes(&values[0], values.size() * sizeof(T));
+		}
+	}
+
+	bool HasFailed() const { return m_failed; }
+
+private:
+	FILE *m_file;
+	string m_fileName;
+	string m_tempFileName;
+	uint32_t m_crc;
+	bool m_failed;
+};
+
+//----------------------------------------------------------------------------
+// SnapshotReader : Reads a snapshot file. The whole file is read into
+// memory and validated by Open. Reads past the end of the data mark the
+// reader as failed and return zeroes.
+//----------------------------------------------------------------------------
+class SnapshotReader
+{
+public:
+	SnapshotReader() : m_pos(0), m_end(0), m_failed(false) { }
+
+	bool Open(const char *fileName);
+
+	void ReadBytes(void *data, size_t size);
+	uint32_t ReadUint32() { uint32_t value = 0; ReadBytes(&value, sizeof(value)); return value; }
+	uint64_t ReadUint64() { uint64_t value = 0; ReadBytes(&value, sizeof(value)); return value; }
+	int32_t ReadInt32() { int32_t value = 0; ReadBytes(&value, sizeof(value)); return value; }
+	float ReadFloat() { float value = 0.0f; ReadBytes(&value, sizeof(value)); return value; }
+	void ReadString(string &str);
+
+	// Same as above, but the string isn't copied. It stays valid while the
+	// reader exists.
+	void ReadString(string_view &str);
+
+	template <class T> void ReadVector(vector<T> &values)
+	{
+		uint64_t count = ReadUint64();
+		if (count > (m_end - m_pos) / sizeof(T))
+		{
+			m_failed = true;
+			values.clear();
+			return;
+		}
+		values.resize((size_t)count);
+		if (count > 0)
+		{
+			ReadBytes(&values[0], (size_t)count * sizeof(T));
+		}
+	}
+
+	// Returns true if every byte of section data has been read
+	bool IsDone() const { return m_pos == m_end; }
+	bool HasFailed() const { return m_failed; }
+
+private:
+	vector<char> m_data;
+	size_t m_pos;
+	size_t m_end;		// End of section data (start of trailer)
+	bool m_failed;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_SNAPSHOT_H
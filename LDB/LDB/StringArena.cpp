@@ -0,0 +1,54 @@
+//
+//  StringArena.cpp
+//  Jon Edwards Code Sample
+//
+//  Append-only storage for strings
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include "StringArena.h"
+
+BEGIN_NAMESPACE(LDB)
+
+//----------------------------------------------------------------------------
+// StringArena::Add : Appends the entry to the last block, starting a new
+// block if it doesn't fit
+//----------------------------------------------------------------------------
+const char *StringArena::Add(string_view str)
+{
+	uint32_t length = (uint32_t)str.size();
+	size_t entrySize = sizeof(length) + length;
+
+	if (m_blocks.empty() || m_blockUsed + entrySize > m_blockSize)
+	{
+		m_blockSize = entrySize > kStringArenaBlockSize ? entrySize : kStringArenaBlockSize;
+		m_blocks.push_back(new char[m_blockSize]);
+		m_allocatedSize += m_blockSize;
+		m_blockUsed = 0;
+	}
+
+	char *entry = m_blocks.back() + m_blockUsed;
+	memcpy(entry, &length, sizeof(length));
+	memcpy(entry + sizeof(length), str.data(), length);
+
+	m_blockUsed += entrySize;
+	m_stringsSize += entrySize;
+
+	return entry;
+}
+
+void StringArena::Clear()
+{
+	for (size_t i = 0; i < m_blocks.size(); i++)
+	{
+		delete [] m_blocks[i];
+	}
+	m_blocks.clear();
+	m_blockUsed = 0;
+	m_blockSize = 0;
+	m_allocatedSize = 0;
+	m_stringsSize = 0;
+}
+
+END_NAMESPACE(LDB)
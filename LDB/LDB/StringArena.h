@@ -0,0 +1,67 @@
+//
+//  StringArena.h
+//  Jon Edwards Code Sample
+//
+//  Append-only storage for strings. Strings are copied into large blocks,
+//  each stored as a uint32_t length followed by its characters, so adding
+//  a string doesn't allocate unless the current block is full. Blocks are
+//  never moved or freed until the arena is cleared, so string_views of
+//  stored strings stay valid.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_STRINGARENA_H
+#define LDB_STRINGARENA_H
+
+#include <string.h>
+#include <string_view>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const size_t kStringArenaBlockSize = 256 * 1024;	// Strings longer than a block
+													// get a block of their own
+
+class StringArena
+{
+public:
+	StringArena() : m_blockUsed(0), m_blockSize(0), m_allocatedSize(0), m_stringsSize(0) { }
+	~StringArena() { Clear(); }
+
+	// Copies a string into the arena. Returns the stored entry, which is
+	// passed to GetString.
+	const char *Add(string_view str);
+
+	static string_view GetString(const char *entry)
+	{
+		uint32_t length;
+		memcpy(&length, entry, sizeof(length));
+		return string_view(entry + sizeof(length), length);
+	}
+
+	// Frees all strings
+	void Clear();
+
+	// Bytes of blocks allocated and bytes used by stored entries
+	size_t GetAllocatedSize() const { return m_allocatedSize; }
+	size_t GetStringsSize() const { return m_stringsSize; }
+
+private:
+	StringArena(const StringArena &);				// Not copyable
+	StringArena &operator=(const StringArena &);
+
+	vector<char *> m_blocks;
+	size_t m_blockUsed;				// Bytes used in last block
+	size_t m_blockSize;				// Size of last block
+	size_t m_allocatedSize;
+	size_t m_stringsSize;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_STRINGARENA_H
@@ -0,0 +1,503 @@
+//
+//  StringHash.cpp
+//  Jon Edwards Code Sample
+//
+//  String hash functions
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LDB_STRINGHASH_AVX2
+#endif
+
+#include "StringHash.h"
+
+BEGIN_NAMESPACE(LDB)
+
+namespace
+{
+	const uint64_t kShortHashKeys[4] =
+	{
+		0xa0761d6478bd642f, 0xe7037ed1a0b428db, 0x8ebc6af09c88c6e3, 0x589965cc75374cc3
+	};
+
+	const size_t kStripeSize = 64;
+	const uint32_t kStripeLanes = 8;
+	const size_t kStripesPerBlock = 16;
+	const uint64_t kScrambleMultiplier = 0x9e3779b1;
+
+	// Stripe n of a block is keyed with kStripeKeys[n] to kStripeKeys[n + 7].
+	// Accumulators are scrambled with the last eight keys after each block.
+	const uint64_t kStripeKeys[kStripesPerBlock + kStripeLanes] =
+	{
+		0x2cb0f69f4abea221, 0x9417034723148989, 0xdd555950609dfe03, 0xdbafb150deb12800,
+		0x7e789b2e6c442cb6, 0xf41e5636c7e4f8c4, 0x0959d150f8fba7e4, 0xa97316f13cdb9eea,
+		0x74cd8258f9520068, 0x55c74a62e116868b, 0xd2f4c799a2023cbd, 0xdf98cb79a37b51b9,
+		0x396f5885524f3905, 0xaf1d56386ca3b276, 0xa9ffbe6b5104e85a, 0x6bd0c51b9fd533b3,
+		0x980ce91c50ab4b56, 0x28ac395780fe62c5, 0x768912e3a6bcedc7, 0x50b3e8c9332c7c88,
+		0xce3bbfe520bd47da, 0xcba6c8e8e0bb7c4f, 0xbf194db8434a346d, 0x7d8f2a7b60416d7f
+	};
+
+	const uint64_t kInitialAccumulators[kStripeLanes] =
+	{
+		0x00000000c2b2ae3d, 0x9e3779b185ebca87, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9,
+		0x85ebca77c2b2ae63, 0x0000000085ebca77, 0x27d4eb2f165667c5, 0x000000009e3779b1
+	};
+
+	inline uint64_t Read64(const char *data)
+	{
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	inline uint64_t Read32(const char *data)
+	{
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	//------------------------------------------------------------------------
+	// Multiply128 : Replaces a and b with the low and high halves of their
+	// 128-bit product
+	//------------------------------------------------------------------------
+	inline void Multiply128(uint64_t &a, uint64_t &b)
+	{
+#if defined(__SIZEOF_INT128__)
+		__uint128_t product = (__uint128_t)a * b;
+		a = (uint64_t)product;
+		b = (uint64_t)(product >> 64);
+#else
+		uint64_t aHigh = a >> 32, aLow = (uint32_t)a;
+		uint64_t bHigh = b >> 32, bLow = (uint32_t)b;
+		uint64_t highHigh = aHigh * bHigh, highLow = aHigh * bLow;
+		uint64_t lowHigh = aLow * bHigh, lowLow = aLow * bLow;
+		uint64_t middle = (lowLow >> 32) + (uint32_t)highLow + (uint32_t)lowHigh;
+		a = (middle << 32) | (uint32_t)lowLow;
+		b = highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+#endif
+	}
+
+	inline uint64_t Mix(uint64_t a, uint64_t b)
+	{
+		Multiply128(a, b);
+		return a ^ b;
+	}
+
+	//------------------------------------------------------------------------
+	// HashShort : Hashes 16 bytes at a time (48 for longer strings) with
+	// 128-bit multiplies. Strings of 16 bytes or less are read as two
+	// possibly overlapping words without looping.
+	//------------------------------------------------------------------------
+	HashKey HashShort(const char *data, size_t length, uint64_t seed)
+	{
+		seed ^= Mix(seed ^ kShortHashKeys[0], kShortHashKeys[1]);
+
+		uint64_t a;
+		uint64_t b;
+		if (length <= 16)
+		{
+			if (length >= 4)
+			{
+				size_t offset = (length >> 3) << 2;
+				a = (Read32(data) << 32) | Read32(data + offset);
+				b = (Read32(data + length - 4) << 32) | Read32(data + length - 4 - offset);
+			}
+			else if (length > 0)
+			{
+				const unsigned char *bytes = (const unsigned char *)data;
+				a = ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[length >> 1] << 8) | bytes[length - 1];
+				b = 0;
+			}
+			else
+			{
+				a = 0;
+				b = 0;
+			}
+		}
+		else
+		{
+			const char *current = data;
+			size_t remaining = length;
+			if (remaining > 48)
+			{
+				uint64_t seed1 = seed;
+				uint64_t seed2 = seed;
+				do
+				{
+					seed = Mix(Read64(current) ^ kShortHashKeys[1], Read64(current + 8) ^ seed);
+					seed1 = Mix(Read64(current + 16) ^ kShortHashKeys[2], Read64(current + 24) ^ seed1);
+					seed2 = Mix(Read64(current + 32) ^ kShortHashKeys[3], Read64(current + 40) ^ seed2);
+					current += 48;
+					remaining -= 48;
+				} while (remaining > 48);
+				seed ^= seed1 ^ seed2;
+			}
+
+			while (remaining > 16)
+			{
+				seed = Mix(Read64(current) ^ kShortHashKeys[1], Read64(current + 8) ^ seed);
+				current += 16;
+				remaining -= 16;
+			}
+
+			// Last 16 bytes, overlapping bytes already hashed
+			a = Read64(current + remaining - 16);
+			b = Read64(current + remaining - 8);
+		}
+
+		a ^= kShortHashKeys[1];
+		b ^= seed;
+		Multiply128(a, b);
+		return Mix(a ^ kShortHashKeys[0] ^ length, b ^ kShortHashKeys[1]);
+	}
+
+	//========================================================================
+	//
+	//							Stripe implementations
+	//
+	//========================================================================
+
+	// Accumulate adds stripes to the accumulators. Lane i adds the product
+	// of the low and high halves of keyed word i and adds word i ^ 1 itself.
+	// Scramble mixes the high bits of the accumulators into the low bits.
+	typedef void (*AccumulateFunction)(uint64_t *accumulators, const char *data, size_t stripeCount,
+		const uint64_t *keys);
+	typedef void (*ScrambleFunction)(uint64_t *accumulators, const uint64_t *keys);
+
+	struct StripeImplementation
+	{
+		const char *name;
+		AccumulateFunction accumulate;
+		ScrambleFunction scramble;
+	};
+
+	void AccumulateScalar(uint64_t *accumulators, const char *data, size_t stripeCount, const uint64_t *keys)
+	{
+		for (size_t stripe = 0; stripe < stripeCount; stripe++)
+		{
+			const char *stripeData = data + stripe * kStripeSize;
+			for (uint32_t i = 0; i < kStripeLanes; i++)
+			{
+				uint64_t value = Read64(stripeData + i * 8);
+				uint64_t keyed = value ^ keys[stripe + i];
+				accumulators[i ^ 1] += value;
+				accumulators[i] += (keyed & 0xffffffff) * (keyed >> 32);
+			}
+		}
+	}
+
+	void ScrambleScalar(uint64_t *accumulators, const uint64_t *keys)
+	{
+		for (uint32_t i = 0; i < kStripeLanes; i++)
+		{
+			uint64_t value = accumulators[i] ^ (accumulators[i] >> 47) ^ keys[i];
+			accumulators[i] = value * kScrambleMultiplier;
+		}
+	}
+
+	const StripeImplementation kScalarStripes = { "scalar", AccumulateScalar, ScrambleScalar };
+
+#if defined(__SSE2__)
+	void AccumulateSSE2(uint64_t *accumulators, const char *data, size_t stripeCount, const uint64_t *keys)
+	{
+		__m128i lanes[4];
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			lanes[i] = _mm_loadu_si128((const __m128i *)(accumulators + i * 2));
+		}
+
+		for (size_t stripe = 0; stripe < stripeCount; stripe++)
+		{
+			const char *stripeData = data + stripe * kStripeSize;
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				__m128i value = _mm_loadu_si128((const __m128i *)(stripeData + i * 16));
+				__m128i keyed = _mm_xor_si128(value, _mm_loadu_si128((const __m128i *)(keys + stripe + i * 2)));
+				__m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+				__m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+				lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+			}
+		}
+
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			_mm_storeu_si128((__m128i *)(accumulators + i * 2), lanes[i]);
+		}
+	}
+
+	void ScrambleSSE2(uint64_t *accumulators, const uint64_t *keys)
+	{
+		__m128i multiplier = _mm_set1_epi32((int)(uint32_t)kScrambleMultiplier);
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			__m128i value = _mm_loadu_si128((const __m128i *)(accumulators + i * 2));
+			value = _mm_xor_si128(value, _mm_srli_epi64(value, 47));
+			value = _mm_xor_si128(value, _mm_loadu_si128((const __m128i *)(keys + i * 2)));
+
+			__m128i low = _mm_mul_epu32(value, multiplier);
+			__m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), multiplier);
+			_mm_storeu_si128((__m128i *)(accumulators + i * 2), _mm_add_epi64(low, _mm_slli_epi64(high, 32)));
+		}
+	}
+
+	const StripeImplementation kSSE2Stripes = { "sse2", AccumulateSSE2, ScrambleSSE2 };
+#endif
+
+#if defined(LDB_STRINGHASH_AVX2)
+	__attribute__((target("avx2")))
+	void AccumulateAVX2(uint64_t *accumulators, const char *data, size_t stripeCount, const uint64_t *keys)
+	{
+		__m256i lanes[2];
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			lanes[i] = _mm256_loadu_si256((const __m256i *)(accumulators + i * 4));
+		}
+
+		for (size_t stripe = 0; stripe < stripeCount; stripe++)
+		{
+			const char *stripeData = data + stripe * kStripeSize;
+			for (uint32_t i = 0; i < 2; i++)
+			{
+				__m256i value = _mm256_loadu_si256((const __m256i *)(stripeData + i * 32));
+				__m256i keyed = _mm256_xor_si256(value,
+					_mm256_loadu_si256((const __m256i *)(keys + stripe + i * 4)));
+				__m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+				__m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+				lanes[i] = _mm256_add_epi64(lanes[i], _mm256_add_epi64(product, swapped));
+			}
+		}
+
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			_mm256_storeu_si256((__m256i *)(accumulators + i * 4), lanes[i]);
+		}
+	}
+
+	__attribute__((target("avx2")))
+	void ScrambleAVX2(uint64_t *accumulators, const uint64_t *keys)
+	{
+		__m256i multiplier = _mm256_set1_epi32((int)(uint32_t)kScrambleMultiplier);
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			__m256i value = _mm256_loadu_si256((const __m256i *)(accumulators + i * 4));
+			value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+			value = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)(keys + i * 4)));
+
+			__m256i low = _mm256_mul_epu32(value, multiplier);
+			__m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), multiplier);
+			_mm256_storeu_si256((__m256i *)(accumulators + i * 4), _mm256_add_epi64(low, _mm256_slli_epi64(high, 32)));
+		}
+	}
+
+	const StripeImplementation kAVX2Stripes = { "avx2", AccumulateAVX2, ScrambleAVX2 };
+
+	bool CPUSupportsAVX2()
+	{
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+
+	const StripeImplementation &SelectStripeImplementation()
+	{
+#if defined(LDB_STRINGHASH_AVX2)
+		if (CPUSupportsAVX2())
+		{
+			return kAVX2Stripes;
+		}
+#endif
+#if defined(__SSE2__)
+		return kSSE2Stripes;
+#else
+		return kScalarStripes;
+#endif
+	}
+
+	const StripeImplementation &GetStripeImplementation()
+	{
+		static const StripeImplementation &sStripeImplementation = SelectStripeImplementation();
+		return sStripeImplementation;
+	}
+
+	//------------------------------------------------------------------------
+	// HashStripes : Accumulates blocks of kStripesPerBlock stripes, then the
+	// remaining whole stripes and finally the last 64 bytes, which may
+	// overlap stripes already accumulated. Lanes are merged pairwise with
+	// 128-bit multiplies.
+	//------------------------------------------------------------------------
+	HashKey HashStripes(const char *data, size_t length, uint64_t seed, const StripeImplementation &stripes)
+	{
+		ASSERT(length > kStripeSize, "Stripe hash used for short string");
+
+		uint64_t accumulators[kStripeLanes];
+		memcpy(accumulators, kInitialAccumulators, sizeof(accumulators));
+
+		const size_t blockSize = kStripeSize * kStripesPerBlock;
+		const uint64_t *scrambleKeys = kStripeKeys + kStripesPerBlock;
+
+		size_t blockCount = (length - 1) / blockSize;
+		for (size_t block = 0; block < blockCount; block++)
+		{
+			stripes.accumulate(accumulators, data + block * blockSize, kStripesPerBlock, kStripeKeys);
+			stripes.scramble(accumulators, scrambleKeys);
+		}
+
+		size_t stripeCount = (length - blockCount * blockSize - 1) / kStripeSize;
+		stripes.accumulate(accumulators, data + blockCount * blockSize, stripeCount, kStripeKeys);
+		stripes.accumulate(accumulators, data + length - kStripeSize, 1, kStripeKeys + kStripeLanes - 1);
+
+		uint64_t hash = Mix(seed ^ kShortHashKeys[0], (uint64_t)length ^ kShortHashKeys[1]);
+		for (uint32_t i = 0; i < kStripeLanes; i += 2)
+		{
+			hash += Mix(accumulators[i] ^ scrambleKeys[i], accumulators[i + 1] ^ scrambleKeys[i + 1]);
+		}
+
+		hash ^= hash >> 37;
+		hash *= 0x165667919e3779f9;
+		hash ^= hash >> 32;
+		return hash;
+	}
+}
+
+//----------------------------------------------------------------------------
+// StringHash::Hash64 : Hash used for HashKeys
+//----------------------------------------------------------------------------
+HashKey StringHash::Hash64(const char *data, size_t length, uint64_t seed /* = 0 */)
+{
+	if (length < kStripeHashMinLength)
+	{
+		return HashShort(data, length, seed);
+	}
+
+	return HashStripes(data, length, seed, GetStripeImplementation());
+}
+
+HashKey StringHash::Hash64Scalar(const char *data, size_t length, uint64_t seed /* = 0 */)
+{
+	if (length < kStripeHashMinLength)
+	{
+		return HashShort(data, length, seed);
+	}
+
+	return HashStripes(data, length, seed, kScalarStripes);
+}
+
+//----------------------------------------------------------------------------
+// StringHash::Hash64SSE2, StringHash::Hash64AVX2 : Fall back to the scalar
+// implementation if the CPU doesn't support the instructions
+//----------------------------------------------------------------------------
+HashKey StringHash::Hash64SSE2(const char *data, size_t length, uint64_t seed /* = 0 */)
+{
+#if defined(__SSE2__)
+	if (length >= kStripeHashMinLength)
+	{
+		return HashStripes(data, length, seed, kSSE2Stripes);
+	}
+#endif
+
+	return Hash64Scalar(data, length, seed);
+}
+
+HashKey StringHash::Hash64AVX2(const char *data, size_t length, uint64_t seed /* = 0 */)
+{
+#if defined(LDB_STRINGHASH_AVX2)
+	if (length >= kStripeHashMinLength && CPUSupportsAVX2())
+	{
+		return HashStripes(data, length, seed, kAVX2Stripes);
+	}
+#endif
+
+	return Hash64Scalar(data, length, seed);
+}
+
+const char *StringHash::GetStripeImplementationName()
+{
+	return GetStripeImplementation().name;
+}
+
+//----------------------------------------------------------------------------
+// StringHash::MurmurHash64A
+//
+// Uses 64-CRC Murmur public domain hash algorithm taken from
+// https://sites.google.com/site/murmurhash/
+//----------------------------------------------------------------------------
+HashKey StringHash::MurmurHash64A(const char *data, size_t length, uint64_t seed /* = 0 */)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995;
+	const int r = 47;
+
+	uint64_t h = seed ^ (length * m);
+
+	const char *end = data + (length & ~(size_t)7);
+	while (data != end)
+	{
+		uint64_t k = Read64(data);
+		data += 8;
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	const unsigned char * data2 = (const unsigned char*)data;
+
+	switch(length & 7)
+	{
+		case 7: h ^= uint64_t(data2[6]) << 48; [[fallthrough]];
+		case 6: h ^= uint64_t(data2[5]) << 40; [[fallthrough]];
+		case 5: h ^= uint64_t(data2[4]) << 32; [[fallthrough]];
+		case 4: h ^= uint64_t(data2[3]) << 24; [[fallthrough]];
+		case 3: h ^= uint64_t(data2[2]) << 16; [[fallthrough]];
+		case 2: h ^= uint64_t(data2[1]) << 8; [[fallthrough]];
+		case 1: h ^= uint64_t(data2[0]);
+		        h *= m;
+	};
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+void StringHash::GetHashFunctions(vector<StringHashFunctionInfo> &functions)
+{
+	StringHashFunctionInfo info;
+
+	info.name = "murmur64a";
+	info.function = MurmurHash64A;
+	functions.push_back(info);
+
+	info.name = "hash64-scalar";
+	info.function = Hash64Scalar;
+	functions.push_back(info);
+
+#if defined(__SSE2__)
+	info.name = "hash64-sse2";
+	info.function = Hash64SSE2;
+	functions.push_back(info);
+#endif
+
+#if defined(LDB_STRINGHASH_AVX2)
+	if (CPUSupportsAVX2())
+	{
+		info.name = "hash64-avx2";
+		info.function = Hash64AVX2;
+		functions.push_back(info);
+	}
+#endif
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,66 @@
+//
+//  StringHash.h
+//  Jon Edwards Code Sample
+//
+//  String hash functions. All take a pointer and a length so strings don't
+//  have to be NUL terminated or scanned with strlen, and read unaligned
+//  data safely.
+//
+//  Hash64 is the hash used for HashKeys. Strings shorter than
+//  kStripeHashMinLength bytes, which includes all names and likes, are
+//  hashed with 64x64->128 bit multiplies in the style of wyhash. Longer
+//  strings are split into 64 byte stripes accumulated into eight 64-bit
+//  lanes in the style of XXH3. The stripe loop has scalar, SSE2 and AVX2
+//  implementations which give the same result; the fastest one the CPU
+//  supports is picked the first time it's used. MurmurHash64A, the original
+//  HashKey hash, is kept for comparison.
+//
+//  The SIMD stripe loops only run on long strings. Below the threshold the
+//  lane setup and final merge cost more than the multiply path, so the
+//  database's keys never take them; they're for long keys such as joined
+//  likes, which the -b benchmark times.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_STRINGHASH_H
+#define LDB_STRINGHASH_H
+
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const size_t kStripeHashMinLength = 256;
+
+typedef HashKey (*StringHashFunction)(const char *data, size_t length, uint64_t seed);
+
+struct StringHashFunctionInfo
+{
+	const char *name;
+	StringHashFunction function;
+};
+
+namespace StringHash
+{
+	HashKey Hash64(const char *data, size_t length, uint64_t seed = 0);
+	HashKey MurmurHash64A(const char *data, size_t length, uint64_t seed = 0);
+
+	// Hash64 using a specific stripe implementation
+	HashKey Hash64Scalar(const char *data, size_t length, uint64_t seed = 0);
+	HashKey Hash64SSE2(const char *data, size_t length, uint64_t seed = 0);
+	HashKey Hash64AVX2(const char *data, size_t length, uint64_t seed = 0);
+
+	// Name of the stripe implementation Hash64 uses on this CPU
+	const char *GetStripeImplementationName();
+
+	// Gets the hash functions that can run on this CPU
+	void GetHashFunctions(vector<StringHashFunctionInfo> &functions);
+}
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_STRINGHASH_H
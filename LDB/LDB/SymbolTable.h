@@ -0,0 +1,89 @@
+//
+//  SymbolTable.h
+//  Jon Edwards Code Sample
+//
+//  Dense 32-bit ids for registered strings. Ids are handed out in the order
+//  strings are added, starting at 0, so they can index arrays and bitsets.
+//  A table maps hash -> id and id -> (hash, string). Strings aren't copied;
+//  they must stay valid as long as the table uses them.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_SYMBOLTABLE_H
+#define LDB_SYMBOLTABLE_H
+
+#include <string_view>
+#include <vector>
+
+#include "FlatHashMap.h"
+#include "HashManagerInterface.h"
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+class SymbolTable
+{
+public:
+	SymbolTable() { }
+
+	// Returns the id of the hash, adding it if it isn't in the table
+	SymbolId Add(HashKey key, string_view str)
+	{
+		SymbolId &id = m_ids[key];
+		if (m_hashes.size() == m_ids.size() - 1)
+		{
+			// Key was just inserted
+			id = (SymbolId)m_hashes.size();
+			m_hashes.push_back(key);
+			m_strings.push_back(str);
+		}
+		return id;
+	}
+
+	SymbolId Find(HashKey key) const
+	{
+		FlatHashMap<SymbolId>::const_iterator itr = m_ids.find(key);
+		return itr == m_ids.end() ? kInvalidSymbolId : (*itr).second;
+	}
+
+	HashKey GetHash(SymbolId id) const { return id < m_hashes.size() ? m_hashes[id] : kInvalidHashKey; }
+
+	bool GetString(SymbolId id, string_view &str) const
+	{
+		if (id >= m_strings.size())
+		{
+			str = kInvalidString;
+			return false;
+		}
+
+		str = m_strings[id];
+		return true;
+	}
+
+	uint32_t GetCount() const { return (uint32_t)m_hashes.size(); }
+
+	// Hashes by id, used to save the table
+	const vector<HashKey> &GetHashes() const { return m_hashes; }
+
+	void Clear()
+	{
+		m_ids.clear();
+		m_hashes.clear();
+		m_strings.clear();
+	}
+
+private:
+	SymbolTable(const SymbolTable &);				// Not copyable
+	SymbolTable &operator=(const SymbolTable &);
+
+	FlatHashMap<SymbolId> m_ids;		// Hash -> id
+	vector<HashKey> m_hashes;			// Id -> hash
+	vector<string_view> m_strings;		// Id -> string
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_SYMBOLTABLE_H
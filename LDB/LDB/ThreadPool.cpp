@@ -0,0 +1,109 @@
+//
+//  ThreadPool.cpp
+//  Jon Edwards Code Sample
+//
+//  Fixed size pool of worker threads
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include "ThreadPool.h"
+
+BEGIN_NAMESPACE(LDB)
+
+ThreadPool::~ThreadPool()
+{
+	Shutdown();
+}
+
+void ThreadPool::Initialize(uint32_t threadCount)
+{
+	Shutdown();
+
+	m_shutdown = false;
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		m_threads.push_back(thread(&ThreadPool::WorkerMain, this));
+	}
+}
+
+//----------------------------------------------------------------------------
+// ThreadPool::Shutdown : Finishes queued tasks and stops the worker threads
+//----------------------------------------------------------------------------
+void ThreadPool::Shutdown()
+{
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_taskAvailable.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++)
+	{
+		m_threads[i].join();
+	}
+	m_threads.clear();
+}
+
+void ThreadPool::Submit(const Task &task)
+{
+	if (m_threads.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_tasks.push_back(task);
+		m_pendingTasks++;
+	}
+	m_taskAvailable.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	while (m_pendingTasks > 0)
+	{
+		m_tasksDone.wait(lock);
+	}
+}
+
+uint32_t ThreadPool::GetHardwareThreadCount()
+{
+	uint32_t threadCount = thread::hardware_concurrency();
+	return threadCount > 0 ? threadCount : 1;
+}
+
+void ThreadPool::WorkerMain()
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;)
+	{
+		while (m_tasks.empty() && !m_shutdown)
+		{
+			m_taskAvailable.wait(lock);
+		}
+
+		if (m_tasks.empty())
+		{
+			return;
+		}
+
+		Task task = m_tasks.front();
+		m_tasks.pop_front();
+
+		lock.unlock();
+		task();
+		lock.lock();
+
+		m_pendingTasks--;
+		if (m_pendingTasks == 0)
+		{
+			m_tasksDone.notify_all();
+		}
+	}
+}
+
+END_NAMESPACE(LDB)
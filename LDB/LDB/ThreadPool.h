@@ -0,0 +1,63 @@
+//
+//  ThreadPool.h
+//  Jon Edwards Code Sample
+//
+//  Fixed size pool of worker threads. Tasks are run in the order they're
+//  submitted. Wait blocks until every submitted task has finished, so a
+//  pool should only be used by one submitting thread at a time.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_THREADPOOL_H
+#define LDB_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+class ThreadPool
+{
+public:
+	typedef function<void()> Task;
+
+	ThreadPool() : m_pendingTasks(0), m_shutdown(false) { }
+	~ThreadPool();
+
+	// Starts threadCount worker threads. With no worker threads tasks are
+	// run by Submit.
+	void Initialize(uint32_t threadCount);
+	void Shutdown();
+
+	void Submit(const Task &task);
+	void Wait();
+
+	uint32_t GetThreadCount() const { return (uint32_t)m_threads.size(); }
+
+	// Number of threads the hardware can run at once, at least 1
+	static uint32_t GetHardwareThreadCount();
+
+private:
+	void WorkerMain();
+
+	vector<thread> m_threads;
+	mutex m_mutex;
+	condition_variable m_taskAvailable;
+	condition_variable m_tasksDone;
+	deque<Task> m_tasks;
+	uint32_t m_pendingTasks;		// Tasks submitted that haven't finished
+	bool m_shutdown;
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_THREADPOOL_H
@@ -0,0 +1,114 @@
+//
+//  UserRecordIndex.cpp
+//  Jon Edwards Code Sample
+//
+//  Secondary indexes over UserRecord fields
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include "Database.h"
+#include "UserRecordIndex.h"
+
+BEGIN_NAMESPACE(LDB)
+
+//============================================================================
+//
+//							class UserRecordIndex
+//
+//============================================================================
+
+uint32_t UserRecordIndex::Lookup(HashKey value, vector<HashKey> &userKeys) const
+{
+	ValueIndex::const_iterator itr = m_index.find(value);
+	if (itr == m_index.end())
+	{
+		return 0;
+	}
+
+	const UserKeySet &keys = (*itr).second;
+	userKeys.insert(userKeys.end(), keys.begin(), keys.end());
+
+	return (uint32_t)keys.size();
+}
+
+void UserRecordIndex::GetEntries(vector<Entry> &entries) const
+{
+	for (ValueIndex::const_iterator itr = m_index.begin(); itr != m_index.end(); ++itr)
+	{
+		const UserKeySet &keys = (*itr).second;
+		for (UserKeySet::const_iterator keyItr = keys.begin(); keyItr != keys.end(); ++keyItr)
+		{
+			entries.push_back(Entry((*itr).first, *keyItr));
+		}
+	}
+}
+
+void UserRecordIndex::InsertValue(HashKey value, HashKey userKey)
+{
+	if (value == kInvalidHashKey)
+	{
+		return;
+	}
+
+	m_index[value].insert(userKey);
+}
+
+void UserRecordIndex::RemoveValue(HashKey value, HashKey userKey)
+{
+	ValueIndex::iterator itr = m_index.find(value);
+	if (itr == m_index.end())
+	{
+		return;
+	}
+
+	UserKeySet &keys = (*itr).second;
+	keys.erase(userKey);
+	if (keys.empty())
+	{
+		m_index.erase(itr);
+	}
+}
+
+//============================================================================
+//
+//							class UserRecordHashIndex
+//
+//============================================================================
+
+void UserRecordHashIndex::Insert(const UserRecord &record)
+{
+	InsertValue(record.*m_field, record.userNameHash);
+}
+
+void UserRecordHashIndex::Remove(const UserRecord &record)
+{
+	RemoveValue(record.*m_field, record.userNameHash);
+}
+
+void UserRecordHashIndex::Update(const UserRecord &oldRecord, const UserRecord &newRecord)
+{
+	if (oldRecord.*m_field != newRecord.*m_field)
+	{
+		Remove(oldRecord);
+		Insert(newRecord);
+	}
+}
+
+//============================================================================
+//
+//						class UserRecordMultiValueIndex
+//
+//============================================================================
+
+void UserRecordMultiValueIndex::AppendValue(const UserRecord &record, HashKey value)
+{
+	InsertValue(value, record.userNameHash);
+}
+
+void UserRecordMultiValueIndex::RemoveAppendedValue(const UserRecord &record, HashKey value)
+{
+	RemoveValue(value, record.userNameHash);
+}
+
+END_NAMESPACE(LDB)
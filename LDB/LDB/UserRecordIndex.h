@@ -0,0 +1,112 @@
+//
+//  UserRecordIndex.h
+//  Jon Edwards Code Sample
+//
+//  Secondary indexes over UserRecord fields. An index maps the hash value
+//  of a field to the keys (user name hashes) of all records holding that
+//  value so records can be found without scanning the whole database.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_USERRECORDINDEX_H
+#define LDB_USERRECORDINDEX_H
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Types.h"
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+struct UserRecord;
+
+//----------------------------------------------------------------------------
+// UserRecordIndex : Abstract base class for secondary indexes. Derived
+// classes describe which field(s) of a UserRecord are indexed.
+//----------------------------------------------------------------------------
+class UserRecordIndex
+{
+public:
+	virtual ~UserRecordIndex() { }
+
+	// Add or remove all of a record's indexed values
+	virtual void Insert(const UserRecord &record) = 0;
+	virtual void Remove(const UserRecord &record) = 0;
+
+	// Record's contents are changing from oldRecord to newRecord. Only values
+	// that differ between the two are updated.
+	virtual void Update(const UserRecord &oldRecord, const UserRecord &newRecord) = 0;
+
+	// A value has been appended to the record's list field. Single-valued
+	// indexes aren't affected.
+	virtual void AppendValue(const UserRecord & /*record*/, HashKey /*value*/) { }
+
+	// The record's list field no longer contains a value
+	virtual void RemoveAppendedValue(const UserRecord & /*record*/, HashKey /*value*/) { }
+
+	// Adds keys of users that have the specified value to userKeys. Returns
+	// number of keys added.
+	uint32_t Lookup(HashKey value, vector<HashKey> &userKeys) const;
+
+	// Adds a (value, user key) entry for every value of every indexed user,
+	// in no particular order
+	typedef pair<HashKey, HashKey> Entry;
+	void GetEntries(vector<Entry> &entries) const;
+
+	void Clear() { m_index.clear(); }
+
+protected:
+	typedef unordered_set<HashKey> UserKeySet;
+	typedef unordered_map<HashKey, UserKeySet> ValueIndex;
+
+	void InsertValue(HashKey value, HashKey userKey);
+	void RemoveValue(HashKey value, HashKey userKey);
+
+	ValueIndex m_index;
+};
+
+//----------------------------------------------------------------------------
+// UserRecordHashIndex : Index over a single-valued HashKey field, e.g.,
+// phoneNumberHash or genderHash.
+//----------------------------------------------------------------------------
+class UserRecordHashIndex : public UserRecordIndex
+{
+public:
+	typedef HashKey UserRecord::*FieldType;
+
+	UserRecordHashIndex(FieldType field) : m_field(field) { }
+
+	virtual void Insert(const UserRecord &record);
+	virtual void Remove(const UserRecord &record);
+	virtual void Update(const UserRecord &oldRecord, const UserRecord &newRecord);
+
+private:
+	FieldType m_field;
+};
+
+//----------------------------------------------------------------------------
+// UserRecordMultiValueIndex : Index over a list of values owned by Database
+// rather than stored in the UserRecord, e.g., user likes. A record is
+// indexed once under each value in its list. Values are added through
+// AppendValue and removed through RemoveAppendedValue, so changes to the
+// record's own fields don't affect it.
+//----------------------------------------------------------------------------
+class UserRecordMultiValueIndex : public UserRecordIndex
+{
+public:
+	UserRecordMultiValueIndex() { }
+
+	virtual void Insert(const UserRecord & /*record*/) { }
+	virtual void Remove(const UserRecord & /*record*/) { }
+	virtual void Update(const UserRecord & /*oldRecord*/, const UserRecord & /*newRecord*/) { }
+	virtual void AppendValue(const UserRecord &record, HashKey value);
+	virtual void RemoveAppendedValue(const UserRecord &record, HashKey value);
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_USERRECORDINDEX_H
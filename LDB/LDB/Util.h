@@ -12,9 +12,12 @@
 #define LDB_UTIL_H
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <limits>
 #include <iostream>
@@ -170,29 +173,45 @@ inline void TokenizeString(const string str, vector<string> &tokens,
 }
 
 //----------------------------------------------------------------------------
-// Util::GetPosFromString : Get user position coordinate from string
-// representation
+// Util::ParseInteger : Parses a decimal integer with an optional sign and
+// surrounding white space, failing unless the value is exactly in range of
+// Integer. Doesn't allocate or need a terminated string.
 //----------------------------------------------------------------------------
-inline bool GetLocCoordFromString(const string &str, LocCoord &number)
+template <class Integer> inline bool ParseInteger(string_view str, Integer &number)
 {
-	char *end;
-	long longNumber = strtol(str.c_str(), &end, 10);
-
-	ASSERT(longNumber <= numeric_limits<LocCoord>::max()
-		&& longNumber >=numeric_limits<LocCoord>::min(),
-		"Read coord out of range of LocCoord type");
-	
-	if (longNumber > numeric_limits<LocCoord>::max()
-		|| longNumber < numeric_limits<LocCoord>::min()
-		|| end == str || *end != '\0' || errno == ERANGE)
+	const char *whitespace = " \t\r\n\v\f";
+	size_t start = str.find_first_not_of(whitespace);
+	if (start == string_view::npos)
 	{
 		return false;
 	}
-	else
+	const char *first = str.data() + start;
+	const char *last = str.data() + str.find_last_not_of(whitespace) + 1;
+
+	// from_chars takes a '-' sign but not '+'
+	if (*first == '+' && last - first > 1 && first[1] != '-')
 	{
-		number = (LocCoord)longNumber;
-		return true;
+		first++;
+	}
+
+	Integer value;
+	from_chars_result result = from_chars(first, last, value);
+	if (result.ec != errc() || result.ptr != last)
+	{
+		return false;
 	}
+
+	number = value;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Util::GetPosFromString : Get user position coordinate from string
+// representation
+//----------------------------------------------------------------------------
+inline bool GetLocCoordFromString(string_view str, LocCoord &number)
+{
+	return ParseInteger(str, number);
 }
 
 //----------------------------------------------------------------------------
@@ -0,0 +1,335 @@
+//
+//  WriteAheadLog.cpp
+//  Jon Edwards Code Sample
+//
+//  Append-only log of database mutations
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#include <string.h>
+#include <unistd.h>
+
+#include "Snapshot.h"
+#include "WriteAheadLog.h"
+
+BEGIN_NAMESPACE(LDB)
+
+const size_t kLogHeaderSize = 2 * sizeof(uint32_t);
+const size_t kLogRecordHeaderSize = 2 * sizeof(uint32_t);
+
+namespace WriteAheadLogUtil
+{
+	void AppendBytes(vector<char> &data, const void *bytes, size_t size)
+	{
+		data.insert(data.end(), (const char *)bytes, (const char *)bytes + size);
+	}
+
+	void AppendUint32(vector<char> &data, uint32_t value) { AppendBytes(data, &value, sizeof(value)); }
+	void AppendUint64(vector<char> &data, uint64_t value) { AppendBytes(data, &value, sizeof(value)); }
+	void AppendInt32(vector<char> &data, int32_t value) { AppendBytes(data, &value, sizeof(value)); }
+
+	void AppendString(vector<char> &data, const string &str)
+	{
+		AppendUint32(data, (uint32_t)str.size());
+		AppendBytes(data, str.data(), str.size());
+	}
+
+	// Reads from [pos, end), returning false if there isn't enough data
+	bool ReadBytes(const vector<char> &data, size_t &pos, size_t end, void *bytes, size_t size)
+	{
+		if (size > end - pos)
+		{
+			return false;
+		}
+		memcpy(bytes, &data[pos], size);
+		pos += size;
+		return true;
+	}
+
+	bool ReadString(const vector<char> &data, size_t &pos, size_t end, string &str)
+	{
+		uint32_t size;
+		if (!ReadBytes(data, pos, end, &size, sizeof(size)) || size > end - pos)
+		{
+			return false;
+		}
+		str.assign(&data[pos], size);
+		pos += size;
+		return true;
+	}
+}
+
+using namespace WriteAheadLogUtil;
+
+WriteAheadLog::~WriteAheadLog()
+{
+	Close();
+}
+
+//----------------------------------------------------------------------------
+// WriteAheadLog::Open : Reads the records in an existing log, discarding a
+// partially written record left at the end by a crash, and opens the log
+// for appending
+//----------------------------------------------------------------------------
+bool WriteAheadLog::Open(const char *fileName)
+{
+	Close();
+
+	m_fileName = fileName;
+	m_replayData.clear();
+	m_replayPos = kLogHeaderSize;
+	m_pending.clear();
+
+	FILE *file = fopen(fileName, "rb");
+	if (file != NULL)
+	{
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		m_replayData.resize(fileSize > 0 ? (size_t)fileSize : 0);
+		size_t bytesRead = m_replayData.empty() ? 0 : fread(&m_replayData[0], 1, m_replayData.size(), file);
+		fclose(file);
+		if (bytesRead != m_replayData.size())
+		{
+			LogError("Error: WriteAheadLog::Open - could not read log '%s'\n", fileName);
+			return false;
+		}
+	}
+
+	if (m_replayData.empty())
+	{
+		// New log
+		AppendUint32(m_replayData, kLogMagic);
+		AppendUint32(m_replayData, kLogVersion);
+
+		file = fopen(fileName, "wb");
+		bool result = file != NULL
+			&& fwrite(&m_replayData[0], 1, m_replayData.size(), file) == m_replayData.size()
+			&& fflush(file) == 0
+			&& fsync(fileno(file)) == 0;
+		if (file != NULL)
+		{
+			fclose(file);
+		}
+		if (!result)
+		{
+			LogError("Error: WriteAheadLog::Open - could not create log '%s'\n", fileName);
+			return false;
+		}
+	}
+	else
+	{
+		uint32_t magic = 0;
+		uint32_t version = 0;
+		size_t pos = 0;
+		ReadBytes(m_replayData, pos, m_replayData.size(), &magic, sizeof(magic));
+		ReadBytes(m_replayData, pos, m_replayData.size(), &version, sizeof(version));
+		if (magic != kLogMagic || version != kLogVersion)
+		{
+			LogError("Error: WriteAheadLog::Open - '%s' is not a version %d log\n", fileName, kLogVersion);
+			return false;
+		}
+
+		// Find the end of the last complete record
+		LogRecord record;
+		while (pos < m_replayData.size() && ParseRecord(m_replayData, pos, record))
+		{
+		}
+
+		if (pos < m_replayData.size())
+		{
+			LogError("Warning: WriteAheadLog::Open - discarding %d bytes of incomplete records at end of log '%s'\n",
+				(int)(m_replayData.size() - pos), fileName);
+			m_replayData.resize(pos);
+			if (truncate(fileName, (off_t)pos) != 0)
+			{
+				LogError("Error: WriteAheadLog::Open - could not truncate log '%s'\n", fileName);
+				return false;
+			}
+		}
+	}
+
+	m_file = fopen(fileName, "ab");
+	if (m_file == NULL)
+	{
+		LogError("Error: WriteAheadLog::Open - could not open log '%s'\n", fileName);
+		return false;
+	}
+
+	return true;
+}
+
+void WriteAheadLog::Close()
+{
+	if (m_file != NULL)
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	m_replayData.clear();
+	m_replayPos = 0;
+	m_pending.clear();
+}
+
+bool WriteAheadLog::ReadRecord(LogRecord &record)
+{
+	if (m_replayPos >= m_replayData.size() || !ParseRecord(m_replayData, m_replayPos, record))
+	{
+		// Done replaying
+		vector<char>().swap(m_replayData);
+		m_replayPos = 0;
+		return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// WriteAheadLog::ParseRecord : Parses the record at pos, advancing pos past
+// it. Returns false, leaving pos unchanged, if the record is incomplete or
+// fails its checksum.
+//----------------------------------------------------------------------------
+bool WriteAheadLog::ParseRecord(const vector<char> &data, size_t &pos, LogRecord &record)
+{
+	size_t recordPos = pos;
+	uint32_t payloadSize;
+	uint32_t crc;
+	if (!ReadBytes(data, recordPos, data.size(), &payloadSize, sizeof(payloadSize))
+		|| !ReadBytes(data, recordPos, data.size(), &crc, sizeof(crc))
+		|| payloadSize > data.size() - recordPos
+		|| SnapshotUtil::UpdateCRC32(0, &data[recordPos], payloadSize) != crc)
+	{
+		return false;
+	}
+
+	size_t end = recordPos + payloadSize;
+	uint32_t type = LogRecord_Invalid;
+	bool result = ReadBytes(data, recordPos, end, &record.sequence, sizeof(record.sequence))
+		&& ReadBytes(data, recordPos, end, &type, sizeof(type));
+	record.type = (LogRecordType)type;
+
+	switch (record.type)
+	{
+	case LogRecord_AddUser:
+		result = result && ReadString(data, recordPos, end, record.userName)
+			&& ReadString(data, recordPos, end, record.phoneNumber)
+			&& ReadBytes(data, recordPos, end, &record.xLoc, sizeof(record.xLoc))
+			&& ReadBytes(data, recordPos, end, &record.yLoc, sizeof(record.yLoc))
+			&& ReadString(data, recordPos, end, record.gender);
+		break;
+	case LogRecord_MoveUser:
+		result = result && ReadBytes(data, recordPos, end, &record.userKey, sizeof(record.userKey))
+			&& ReadBytes(data, recordPos, end, &record.xLoc, sizeof(record.xLoc))
+			&& ReadBytes(data, recordPos, end, &record.yLoc, sizeof(record.yLoc));
+		break;
+	case LogRecord_AddLike:
+		result = result && ReadBytes(data, recordPos, end, &record.userKey, sizeof(record.userKey))
+			&& ReadString(data, recordPos, end, record.like);
+		break;
+	case LogRecord_RemoveLike:
+		result = result && ReadBytes(data, recordPos, end, &record.userKey, sizeof(record.userKey))
+			&& ReadBytes(data, recordPos, end, &record.likeHash, sizeof(record.likeHash));
+		break;
+	default:
+		result = false;
+		break;
+	}
+
+	if (!result || recordPos != end)
+	{
+		return false;
+	}
+
+	pos = end;
+	return true;
+}
+
+void WriteAheadLog::Append(const LogRecord &record)
+{
+	vector<char> payload;
+	AppendUint64(payload, record.sequence);
+	AppendUint32(payload, (uint32_t)record.type);
+
+	switch (record.type)
+	{
+	case LogRecord_AddUser:
+		AppendString(payload, record.userName);
+		AppendString(payload, record.phoneNumber);
+		AppendInt32(payload, record.xLoc);
+		AppendInt32(payload, record.yLoc);
+		AppendString(payload, record.gender);
+		break;
+	case LogRecord_MoveUser:
+		AppendUint64(payload, record.userKey);
+		AppendInt32(payload, record.xLoc);
+		AppendInt32(payload, record.yLoc);
+		break;
+	case LogRecord_AddLike:
+		AppendUint64(payload, record.userKey);
+		AppendString(payload, record.like);
+		break;
+	case LogRecord_RemoveLike:
+		AppendUint64(payload, record.userKey);
+		AppendUint64(payload, record.likeHash);
+		break;
+	default:
+		ASSERT(false, "Invalid log record type");
+		return;
+	}
+
+	AppendUint32(m_pending, (uint32_t)payload.size());
+	AppendUint32(m_pending, SnapshotUtil::UpdateCRC32(0, &payload[0], payload.size()));
+	AppendBytes(m_pending, &payload[0], payload.size());
+}
+
+//----------------------------------------------------------------------------
+// WriteAheadLog::Commit : Group commit - every buffered record is written
+// and synced with a single fsync
+//----------------------------------------------------------------------------
+bool WriteAheadLog::Commit()
+{
+	if (m_file == NULL)
+	{
+		return false;
+	}
+
+	if (m_pending.empty())
+	{
+		return true;
+	}
+
+	bool result = fwrite(&m_pending[0], 1, m_pending.size(), m_file) == m_pending.size()
+		&& fflush(m_file) == 0
+		&& fsync(fileno(m_file)) == 0;
+	if (!result)
+	{
+		LogError("Error: WriteAheadLog::Commit - failed writing log '%s'\n", m_fileName.c_str());
+		return false;
+	}
+
+	m_pending.clear();
+	return true;
+}
+
+bool WriteAheadLog::Truncate()
+{
+	if (m_file == NULL)
+	{
+		return false;
+	}
+
+	bool result = fflush(m_file) == 0
+		&& ftruncate(fileno(m_file), (off_t)kLogHeaderSize) == 0
+		&& fsync(fileno(m_file)) == 0;
+	if (!result)
+	{
+		LogError("Error: WriteAheadLog::Truncate - could not truncate log '%s'\n", m_fileName.c_str());
+	}
+
+	return result;
+}
+
+END_NAMESPACE(LDB)
@@ -0,0 +1,104 @@
+//
+//  WriteAheadLog.h
+//  Jon Edwards Code Sample
+//
+//  Append-only log of database mutations. A log file is
+//
+//		header:		magic (uint32), version (uint32)
+//		records:	payload size (uint32), CRC-32 of payload (uint32), payload
+//
+//  A payload is the record's sequence number (uint64) and type (uint32)
+//  followed by the fields used by that type. Records are buffered by Append
+//  and written together by Commit, which doesn't return until they're on
+//  disk. A crash can leave a partially written record at the end of the
+//  log; it's detected by its size or checksum and discarded by Open.
+//
+//  Copyright (c) 2017 Jon Edwards. All rights reserved.
+//
+
+#ifndef LDB_WRITEAHEADLOG_H
+#define LDB_WRITEAHEADLOG_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+BEGIN_NAMESPACE(LDB)
+
+const uint32_t kLogMagic = 0x5742444c;			// "LDBW"
+const uint32_t kLogVersion = 2;
+
+enum LogRecordType
+{
+	LogRecord_Invalid = 0,
+	LogRecord_AddUser,			// userName, phoneNumber, xLoc, yLoc, gender
+	LogRecord_MoveUser,			// userKey, xLoc, yLoc
+	LogRecord_AddLike,			// userKey, like
+	LogRecord_RemoveLike		// userKey, likeHash
+};
+
+//----------------------------------------------------------------------------
+// LogRecord : A mutation stored in the log. Only the fields listed for the
+// record's type are written.
+//----------------------------------------------------------------------------
+struct LogRecord
+{
+	LogRecord() : type(LogRecord_Invalid), sequence(0), userKey(0), xLoc(0), yLoc(0), likeHash(0) { }
+
+	LogRecordType type;
+	uint64_t sequence;
+	HashKey userKey;
+	LocCoord xLoc;
+	LocCoord yLoc;
+	HashKey likeHash;
+	string userName;
+	string phoneNumber;
+	string gender;
+	string like;
+};
+
+//----------------------------------------------------------------------------
+// WriteAheadLog : Reads and appends to a log file. Records already in the
+// log are read with ReadRecord after Open, before anything is appended.
+//----------------------------------------------------------------------------
+class WriteAheadLog
+{
+public:
+	WriteAheadLog() : m_file(NULL), m_replayPos(0) { }
+	~WriteAheadLog();
+
+	// Opens the log, creating it if it doesn't exist
+	bool Open(const char *fileName);
+	void Close();
+
+	// Gets the next record in the log. Returns false after the last record.
+	bool ReadRecord(LogRecord &record);
+
+	// Buffers a record to be written by the next Commit
+	void Append(const LogRecord &record);
+
+	// Writes buffered records and waits for them to reach the disk
+	bool Commit();
+
+	// Removes all records from the log, e.g., once they're in a checkpoint
+	bool Truncate();
+
+	size_t GetPendingSize() const { return m_pending.size(); }
+
+private:
+	static bool ParseRecord(const vector<char> &data, size_t &pos, LogRecord &record);
+
+	FILE *m_file;
+	string m_fileName;
+	vector<char> m_replayData;		// Valid records read by Open
+	size_t m_replayPos;
+	vector<char> m_pending;			// Records waiting for Commit
+};
+
+END_NAMESPACE(LDB)
+
+#endif // LDB_WRITEAHEADLOG_H
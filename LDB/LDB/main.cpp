@@ -7,27 +7,62 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <functional>
 #include <getopt.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <zlib.h>
+
+#if defined(LDB_USE_ZSTD)
+#include <zstd.h>
+#endif
 
 #include "Util.h"
+#include "ConcurrentHashManager.h"
+#include "CSVFile.h"
 #include "Database.h"
+#include "FrontCodedDictionary.h"
+#include "MappedDatabase.h"
+#include "ShardedDatabase.h"
+#include "Snapshot.h"
+#include "StringHash.h"
 #include "QueryTargetedLikes.h"
 #include "QueryNearbyGender.h"
+#include "RecordSchema.h"
 
 using namespace LDB;
 using namespace std;
 
 static string sUsersDataFileName = "users.csv";
 static string sLikesDataFileName = "likes.csv";
+static string sSnapshotFileName;
+static string sMappedFileName;
+static string sLogFileName;
+static uint32_t sShardTilesPerAxis = 0;
 
 static void ParseCommandLine(int argc, const char **argv);
 static void ParseCommandLineQuery(int argc, const char **argv);
-static void ExecuteCommandLineQuery(Database &database, Query &query, const string &queryParameters);
-static bool LoadDatabase(Database &database, const string &usersDataFileName, const string &likesDataFileName);
+template <class DatabaseType> static void ExecuteNamedQuery(DatabaseType &database, const string &queryName,
+    const string &queryParameters);
+template <class DatabaseType> static void ExecuteCommandLineQuery(DatabaseType &database, Query &query,
+    const string &queryParameters);
+static bool LoadDatabase(Database &database, const string &usersDataFileName, const string &likesDataFileName,
+    const string &snapshotFileName, const string &mappedFileName, const string &logFileName);
+
+static bool LoadDatabaseFiles(Database &database, const string &usersDataFileName,
+    const string &likesDataFileName, const string &snapshotFileName, const string &mappedFileName);
 
 static void PrintUsage();
 static void RunUnitTest();
+static void RunHashBenchmark();
 
 using fruit::Injector;
 
@@ -52,7 +87,7 @@ static void ParseCommandLine(int argc, const char **argv)
     bool queryFound = false;
 
     char c;
-    while ((c = getopt(argc, (char **)argv, "qu:l:t")) != -1)
+    while ((c = getopt(argc, (char **)argv, "qu:l:s:m:w:p:tb")) != -1)
     {
     	switch (c)
     	{
@@ -62,6 +97,18 @@ static void ParseCommandLine(int argc, const char **argv)
         case 'l':
             sLikesDataFileName = optarg; 
             break;
+        case 's':
+            sSnapshotFileName = optarg;
+            break;
+        case 'm':
+            sMappedFileName = optarg;
+            break;
+        case 'w':
+            sLogFileName = optarg;
+            break;
+        case 'p':
+            sShardTilesPerAxis = (uint32_t)atoi(optarg);
+            break;
     	case 'q':
             if (optind < argc)
             {
@@ -77,6 +124,10 @@ static void ParseCommandLine(int argc, const char **argv)
             queryFound = true;
             RunUnitTest();
 	    	break;
+        case 'b':
+            queryFound = true;
+            RunHashBenchmark();
+            break;
     	default:
 			PrintUsage();
     	}
@@ -91,43 +142,119 @@ static void ParseCommandLine(int argc, const char **argv)
 
 static void PrintUsage()
 {
-	LogMessage("Usage: likedb [-u users.csv] [-l likes.csv] [-t] [-q query_string][\n");
+	LogMessage("Usage: likedb [-u users.csv] [-l likes.csv] [-s snapshot] [-m mapped_file] [-w log_file] [-p tiles] [-t] [-b] [-q query_string][\n");
     LogMessage("\t-u Load user data CSV file [defaults to 'likes.csv']\n");
     LogMessage("\t-l Load like data CSV file [defaults to 'likes.csv']\n");
+    LogMessage("\t   Either file can be '-' to stream it from stdin, or a pipe\n");
+    LogMessage("\t   Files compressed with gzip or zstd are decompressed while loading\n");
+    LogMessage("\t-s Load database from snapshot file. If it can't be loaded, CSV files are\n");
+    LogMessage("\t   loaded and the snapshot is written\n");
+    LogMessage("\t-m Use a read-only memory-mapped database file. If it can't be opened, CSV\n");
+    LogMessage("\t   files are loaded and the mapped file is written\n");
+    LogMessage("\t-w Replay write-ahead log file after loading and log later changes. The\n");
+    LogMessage("\t   snapshot file is used for checkpoints\n");
+    LogMessage("\t-p Split the database into tiles x tiles spatial shards, loaded and queried\n");
+    LogMessage("\t   in parallel. CSV files can be streamed or compressed as above. Snapshot,\n");
+    LogMessage("\t   mapped and log files aren't used with -p\n");
     LogMessage("\t-t Runs application internal unit test\n");
+    LogMessage("\t-b Benchmarks string hash functions on the names and likes in the CSV files\n");
     LogMessage("\t-q Executes a database query using args following -q. Query string can be one of:\n");
 	LogMessage("\t\ttarget_likes distance=num x=num y=num like=like_value\n");
 	LogMessage("\t\tnearby_gender distance=num gender=gender_value\n\n");
 }
 
 //----------------------------------------------------------------------------
-// getDatabaseComponent: Builds database with hash manger
+// getDatabaseComponent: Builds database with hash manger. The thread-safe
+// hash manager is used so strings can be registered by parallel loaders.
 //----------------------------------------------------------------------------
 const fruit::Component<Database>& getDatabaseComponent() {
     static const fruit::Component<Database> databaseComponent = fruit::createComponent()
-    .bind<HashManagerInterface, HashManager>();
+    .bind<HashManagerInterface, ConcurrentHashManager>();
     return databaseComponent;
 }
 
 //----------------------------------------------------------------------------
-// LoadDatabase: Load likes database with users and likes data
+// LoadDatabase: Load likes database with users and likes data. If a
+// snapshot file is specified the database is restored from it when
+// possible, otherwise the snapshot is written after loading the CSV files.
+// Mapped files are handled the same way, except that the database is
+// switched to the mapped file once it's written. Finally any write-ahead log
+// is replayed.
 //----------------------------------------------------------------------------
 static bool LoadDatabase(Database &database, const string &usersDataFileName,
-    const string &likesDataFileName)
+    const string &likesDataFileName, const string &snapshotFileName, const string &mappedFileName,
+    const string &logFileName)
 {
-    bool result = database.LoadUserDataFromCSVFile(usersDataFileName.c_str());
-    if (!result) 
+    bool result = LoadDatabaseFiles(database, usersDataFileName, likesDataFileName, snapshotFileName,
+        mappedFileName);
+    if (!result || logFileName.empty())
+    {
+        return result;
+    }
+
+    result = database.OpenLog(logFileName.c_str(), snapshotFileName.empty() ? NULL : snapshotFileName.c_str());
+    if (!result)
+    {
+        LogMessage("Error: Couldn't open log file '%s'\n", logFileName.c_str());
+    }
+
+    return result;
+}
+
+static bool LoadDatabaseFiles(Database &database, const string &usersDataFileName,
+    const string &likesDataFileName, const string &snapshotFileName, const string &mappedFileName)
+{
+    if (!mappedFileName.empty())
+    {
+        if (database.OpenMapped(mappedFileName.c_str()))
+        {
+            return true;
+        }
+        LogMessage("Mapped file '%s' not opened, loading CSV files\n", mappedFileName.c_str());
+    }
+
+    if (!snapshotFileName.empty())
+    {
+        if (database.LoadSnapshot(snapshotFileName.c_str()))
+        {
+            return true;
+        }
+        LogMessage("Snapshot '%s' not loaded, loading CSV files\n", snapshotFileName.c_str());
+    }
+
+    if (usersDataFileName == "-" && likesDataFileName == "-")
     {
-        LogMessage("Error: Couldn't find user data file '%s'\n", usersDataFileName.c_str());
+        LogMessage("Error: Only one of the user and likes data files can be read from stdin\n");
         return false;
     }
-    result = database.LoadLikesDataFromCSVFile(likesDataFileName.c_str());
+
+    bool result = database.LoadCSVFiles(usersDataFileName.c_str(), likesDataFileName.c_str());
+    database.GetLoadStats().Log();
     if (!result) 
     {
-        LogMessage("Error: Couldn't find likes data file '%s'\n", usersDataFileName.c_str());
+        LogMessage("Error: Couldn't load user data file '%s' and likes data file '%s'\n", usersDataFileName.c_str(),
+            likesDataFileName.c_str());
         return false;
     }
 
+    if (!snapshotFileName.empty())
+    {
+        result = database.SaveSnapshot(snapshotFileName.c_str());
+        if (!result)
+        {
+            LogMessage("Error: Couldn't write snapshot file '%s'\n", snapshotFileName.c_str());
+        }
+    }
+
+    if (!mappedFileName.empty())
+    {
+        result = database.SaveMapped(mappedFileName.c_str()) && database.OpenMapped(mappedFileName.c_str());
+        if (!result)
+        {
+            LogMessage("Error: Couldn't write mapped file '%s'\n", mappedFileName.c_str());
+        }
+    }
+
     return true;
 }
 
@@ -145,35 +272,61 @@ static void ParseCommandLineQuery(int argc, const char **argv)
         return;
     }
     
+    // Construct query string from command line arguments
+    const string queryName = argv[0];
+    string queryParameters;
+    for (int i = 1; i < argc; i++)
+    {
+        queryParameters += argv[i];
+        queryParameters += " "; 
+    }
+
     // Load database
+    if (sShardTilesPerAxis > 0)
+    {
+        ShardedDatabase database;
+        database.Initialize(sShardTilesPerAxis, ThreadPool::GetHardwareThreadCount());
+
+        bool result = database.LoadUserDataFromCSVFile(sUsersDataFileName.c_str())
+            && database.LoadLikesDataFromCSVFile(sLikesDataFileName.c_str());
+        database.GetLoadStats().Log();
+        if (result)
+        {
+            ExecuteNamedQuery(database, queryName, queryParameters);
+        }
+        database.Shutdown();
+        return;
+    }
+
     Injector<Database> injector(getDatabaseComponent());
     Database *database(injector);
-    database->Initialize();
+    database->Initialize(ThreadPool::GetHardwareThreadCount());
 
-    bool result = LoadDatabase(*database, sUsersDataFileName, sLikesDataFileName);
+    bool result = LoadDatabase(*database, sUsersDataFileName, sLikesDataFileName, sSnapshotFileName, sMappedFileName,
+        sLogFileName);
     if (!result) 
     {
         return;
     }
 
-    // Construct query string from command line arguments
-    const string queryName = argv[0];
-    string queryParameters;
-    for (int i = 1; i < argc; i++)
-    {
-        queryParameters += argv[i];
-        queryParameters += " "; 
-    }
+    ExecuteNamedQuery(*database, queryName, queryParameters);
+}
 
+//----------------------------------------------------------------------------
+// ExecuteNamedQuery : Construct the query with the given name and execute it
+//----------------------------------------------------------------------------
+template <class DatabaseType> static void ExecuteNamedQuery(DatabaseType &database, const string &queryName,
+    const string &queryParameters)
+{
     if (queryName == QueryTargetedLikes::GetQueryName())
     {
         QueryTargetedLikes targetedLikesQuery;
-        ExecuteCommandLineQuery(*database, targetedLikesQuery, queryParameters);
+        ExecuteCommandLineQuery(database, targetedLikesQuery, queryParameters);
     }
     else if (queryName == QueryNearbyGender::GetQueryName())
     {
         QueryNearbyGender targetedNearbyGender;
-        ExecuteCommandLineQuery(*database, targetedNearbyGender, queryParameters);
+        ExecuteCommandLineQuery(database, targetedNearbyGender, queryParameters);
     }
     else
     {
@@ -186,7 +339,7 @@ static void ParseCommandLineQuery(int argc, const char **argv)
 // Execute Query String : Execute a query specified by a string on the
 // command line. 
 //----------------------------------------------------------------------------
-static void ExecuteCommandLineQuery(Database &database, Query &query,
+template <class DatabaseType> static void ExecuteCommandLineQuery(DatabaseType &database, Query &query,
     const string &queryParameters)
 {
     // Construct query of type specified, execute it, and write results to
@@ -202,17 +355,189 @@ static void ExecuteCommandLineQuery(Database &database, Query &query,
     }
 }
 
+//============================================================================
+//                                  Benchmarks
+//============================================================================
+
+static volatile uint64_t sHashBenchmarkResult;
+
+const size_t kHashBenchmarkRepeats = 7;
+const double kHashBenchmarkWarmUpSeconds = 0.05;
+
+//----------------------------------------------------------------------------
+// HashStrings: Hashes a set of strings a number of times and returns the
+// elapsed seconds
+//----------------------------------------------------------------------------
+static double HashStrings(StringHashFunction function, const vector<string_view> &strings, size_t passes,
+    uint64_t &result)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < strings.size(); i++)
+        {
+            result += function(strings[i].data(), strings[i].size(), 0);
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//----------------------------------------------------------------------------
+// BenchmarkHashFunctions: Hashes a set of strings with each function. A
+// warm-up pass count covering kHashBenchmarkWarmUpSeconds warms the caches
+// and sets the passes per repeat, and the fastest of kHashBenchmarkRepeats
+// repeats is reported so that scheduling noise doesn't hide differences.
+// Collisions are distinct strings with the same hash.
+//----------------------------------------------------------------------------
+static void BenchmarkHashFunctions(const char *setName, const vector<string_view> &strings,
+    const vector<StringHashFunctionInfo> &functions)
+{
+    size_t totalLength = 0;
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        totalLength += strings[i].size();
+    }
+
+    if (strings.empty())
+    {
+        LogMessage("%s: no strings\n", setName);
+        return;
+    }
+    LogMessage("%s: %zu strings, average length %.1f\n", setName, strings.size(),
+        (double)totalLength / strings.size());
+
+    for (size_t f = 0; f < functions.size(); f++)
+    {
+        StringHashFunction function = functions[f].function;
+
+        // Warm up, doubling the passes until they take long enough to time
+        uint64_t result = 0;
+        size_t passes = 1;
+        while (HashStrings(function, strings, passes, result) < kHashBenchmarkWarmUpSeconds)
+        {
+            passes *= 2;
+        }
+
+        double seconds = HashStrings(function, strings, passes, result);
+        for (size_t repeat = 1; repeat < kHashBenchmarkRepeats; repeat++)
+        {
+            seconds = min(seconds, HashStrings(function, strings, passes, result));
+        }
+        sHashBenchmarkResult = result;
+
+        unordered_set<HashKey> hashes;
+        for (size_t i = 0; i < strings.size(); i++)
+        {
+            hashes.insert(function(strings[i].data(), strings[i].size(), 0));
+        }
+
+        double hashCount = (double)passes * strings.size();
+        LogMessage("\t%-14s %8.2f ns/string %8.2f GB/s  collisions: %zu\n", functions[f].name,
+            seconds * 1e9 / hashCount, (double)passes * totalLength / seconds / 1e9, strings.size() - hashes.size());
+    }
+}
+
+//----------------------------------------------------------------------------
+// RunHashBenchmark: Compares string hash functions on the user names and
+// likes of the CSV files. Strings made by joining likes are included to
+// time the stripe implementations, which names and likes are too short for.
+//----------------------------------------------------------------------------
+static void RunHashBenchmark()
+{
+    HashManager hashManager;
+    Database database(&hashManager);
+    database.Initialize();
+
+    bool result = database.LoadUserDataFromCSVFile(sUsersDataFileName.c_str())
+        && database.LoadLikesDataFromCSVFile(sLikesDataFileName.c_str());
+    if (!result)
+    {
+        database.Shutdown();
+        return;
+    }
+
+    vector<string_view> names;
+    vector<string_view> likes;
+    unordered_set<HashKey> likeKeys;
+    string buffer;  // Unused: strings of a loaded database are owned by its hash manager
+    for (Database::UserRecordIterator itr(database); !itr.IsDone(); ++itr)
+    {
+        const UserRecord &record = database.LookupUserRecordByKey(itr.GetHashKey());
+        string_view name;
+        database.LookupHashString(record.userNameHash, buffer, name);
+        names.push_back(name);
+
+        vector<HashKey> userLikes;
+        database.GetUserLikes(record, userLikes);
+        for (size_t i = 0; i < userLikes.size(); i++)
+        {
+            string_view like;
+            if (likeKeys.insert(userLikes[i]).second && database.LookupHashString(userLikes[i], buffer, like))
+            {
+                likes.push_back(like);
+            }
+        }
+    }
+
+    vector<string> joinedLikes(1);
+    for (size_t i = 0; i < likes.size(); i++)
+    {
+        if (joinedLikes.back().size() >= 4096)
+        {
+            joinedLikes.push_back(string());
+        }
+        joinedLikes.back().append(likes[i].data(), likes[i].size());
+    }
+    vector<string_view> longStrings(joinedLikes.begin(), joinedLikes.end());
+
+    vector<StringHashFunctionInfo> functions;
+    StringHash::GetHashFunctions(functions);
+    LogMessage("Hash64 stripe implementation: %s\n", StringHash::GetStripeImplementationName());
+
+    BenchmarkHashFunctions("User names", names, functions);
+    BenchmarkHashFunctions("Likes", likes, functions);
+    BenchmarkHashFunctions("Joined likes", longStrings, functions);
+
+    database.Shutdown();
+}
+
 //============================================================================
 //                                  Unit Tests
 //============================================================================
 
 static bool RunTokenizeUnitTest();
+static bool RunCSVFileUnitTest();
+static bool RunFlatHashMapUnitTest();
+static bool RunHashManagerUnitTest();
+static bool RunStringHashUnitTest();
+static bool RunConcurrentHashManagerUnitTest();
+static bool RunFrontCodedDictionaryUnitTest();
+static bool RunParallelLoadUnitTest();
+static bool RunStreamCSVFileUnitTest();
+static bool RunCompressedCSVFileUnitTest();
+static bool RunLoadStatsUnitTest();
+static bool RunUserLikesUnitTest();
+static bool RunCompactUnitTest();
+static bool RunNearbyGenderUnitTest();
+static bool RunRecordSchemaUnitTest();
+static bool RunParseIntegerUnitTest();
+static bool RunUserRecordIndexUnitTest(Database &database);
+static bool RunMappedDatabaseUnitTest(Database &database);
+static bool RunSnapshotUnitTest(Database &database);
+static bool RunWriteAheadLogUnitTest();
+static bool RunShardedDatabaseUnitTest(Database &database);
+static bool RunDatabaseVersionUnitTest();
+static bool RunQueryHashUnitTest(const Database &database);
 
 void RunUnitTest()
 {
     bool result = true;
 
-    result = RunTokenizeUnitTest();
+    result = RunTokenizeUnitTest() && RunCSVFileUnitTest() && RunFlatHashMapUnitTest() && RunHashManagerUnitTest()
+        && RunStringHashUnitTest() && RunConcurrentHashManagerUnitTest() && RunFrontCodedDictionaryUnitTest()
+        && RunParallelLoadUnitTest() && RunStreamCSVFileUnitTest() && RunCompressedCSVFileUnitTest()
+        && RunLoadStatsUnitTest() && RunUserLikesUnitTest() && RunCompactUnitTest() && RunNearbyGenderUnitTest()
+        && RunRecordSchemaUnitTest() && RunParseIntegerUnitTest();
     if (!result) 
     {
         LogError("---- UNIT TEST FAILED ----\n");
@@ -221,15 +546,37 @@ void RunUnitTest()
 
     Injector<Database> injector(getDatabaseComponent());
     Database *database(injector);
-    database->Initialize();
+    database->Initialize(ThreadPool::GetHardwareThreadCount());
+    database->EnableLikeIndex();
 
-    result = LoadDatabase(*database, sUsersDataFileName, sLikesDataFileName);
+    result = LoadDatabase(*database, sUsersDataFileName, sLikesDataFileName, sSnapshotFileName, sMappedFileName,
+        sLogFileName);
     if (!result) 
     {
         LogError("---- UNIT TEST FAILED ----\n");
         
     } 
 
+    // Mapped databases are read-only
+    if (!database->IsMapped())
+    {
+        result = RunUserRecordIndexUnitTest(*database) && RunMappedDatabaseUnitTest(*database)
+            && RunSnapshotUnitTest(*database)
+            && RunWriteAheadLogUnitTest() && RunShardedDatabaseUnitTest(*database) && RunDatabaseVersionUnitTest();
+        if (!result)
+        {
+            LogError("---- UNIT TEST FAILED ----\n");
+            return;
+        }
+    }
+
+    result = RunQueryHashUnitTest(*database);
+    if (!result)
+    {
+        LogError("---- UNIT TEST FAILED ----\n");
+        return;
+    }
+
     QueryTargetedLikes targetedLikesQuery;
     string likesParameters = "distance=100 x=27 y=127 like=pizza";
     result = targetedLikesQuery.Construct(likesParameters);
@@ -259,6 +606,101 @@ void RunUnitTest()
     LogMessage("---- UNIT TEST PASSED ----\n");
 }
 
+//----------------------------------------------------------------------------
+// UnitTestDatabase: A database loaded from test files, with the hash manager
+// it uses and the names the files had
+//----------------------------------------------------------------------------
+struct UnitTestDatabase
+{
+    ConcurrentHashManager hashManager;
+    Database database;
+    string usersFileName;
+    string likesFileName;
+
+    UnitTestDatabase() : database(&hashManager) {}
+
+    // Not copyable
+    UnitTestDatabase(const UnitTestDatabase &) = delete;
+    UnitTestDatabase &operator=(const UnitTestDatabase &) = delete;
+};
+
+// Writes the lines of a users and a likes test file
+typedef function<void(FILE *usersFile, FILE *likesFile)> UnitTestFileWriter;
+
+//----------------------------------------------------------------------------
+// CreateUnitTestFile: Creates an empty file with a unique name in the working
+// directory, so tests running at the same time don't share files. Returns
+// an empty name if it couldn't be created.
+//----------------------------------------------------------------------------
+static string CreateUnitTestFile()
+{
+    char fileName[] = "likedb_unittest_XXXXXX";
+    int fd = mkstemp(fileName);
+    if (fd < 0)
+    {
+        LogError("Could not create a unit test file: %s\n", strerror(errno));
+        return string();
+    }
+    close(fd);
+    return fileName;
+}
+
+//----------------------------------------------------------------------------
+// WriteUnitTestCSVFiles: Creates a users and a likes file with unique names
+// and writes them. The caller removes them.
+//----------------------------------------------------------------------------
+static bool WriteUnitTestCSVFiles(const UnitTestFileWriter &writer, string &usersFileName, string &likesFileName)
+{
+    usersFileName = CreateUnitTestFile();
+    likesFileName = CreateUnitTestFile();
+    FILE *usersFile = usersFileName.empty() ? NULL : fopen(usersFileName.c_str(), "w");
+    FILE *likesFile = likesFileName.empty() ? NULL : fopen(likesFileName.c_str(), "w");
+    bool result = usersFile != NULL && likesFile != NULL;
+    if (result)
+    {
+        writer(usersFile, likesFile);
+    }
+    result = (usersFile == NULL || fclose(usersFile) == 0) && (likesFile == NULL || fclose(likesFile) == 0) && result;
+    if (!result)
+    {
+        LogError("Could not write unit test files\n");
+        remove(usersFileName.c_str());
+        remove(likesFileName.c_str());
+    }
+    return result;
+}
+
+//----------------------------------------------------------------------------
+// LoadUnitTestDatabase: Writes test files, loads them into a database with
+// the given number of load threads and removes them. A pipelined load reads
+// both files with LoadCSVFiles, otherwise they're loaded one after the other.
+//----------------------------------------------------------------------------
+static bool LoadUnitTestDatabase(UnitTestDatabase &testDatabase, const UnitTestFileWriter &writer,
+    uint32_t loadThreadCount = 4, bool pipelined = true)
+{
+    if (!WriteUnitTestCSVFiles(writer, testDatabase.usersFileName, testDatabase.likesFileName))
+    {
+        return false;
+    }
+
+    const char *usersFileName = testDatabase.usersFileName.c_str();
+    const char *likesFileName = testDatabase.likesFileName.c_str();
+    Database &database = testDatabase.database;
+    database.Initialize(loadThreadCount);
+    bool result = pipelined ? database.LoadCSVFiles(usersFileName, likesFileName)
+        : database.LoadUserDataFromCSVFile(usersFileName) && database.LoadLikesDataFromCSVFile(likesFileName);
+    remove(usersFileName);
+    remove(likesFileName);
+
+    if (!result)
+    {
+        LogError("Could not load unit test files\n");
+        return false;
+    }
+
+    return true;
+}
+
 static const char *sTokenizeTestStrings[] =
 {
     "\"Cory Virok\", \"pizza\"",
@@ -296,3 +738,1688 @@ static bool RunTokenizeUnitTest()
 
     return true;
 }
+
+//----------------------------------------------------------------------------
+// RunCSVFileUnitTest: Checks both CSVTokenizer implementations give the
+// same tokens as TokenizeString, and that MappedCSVFile reads lines longer
+// than the old line buffer and a last line without a line ending
+//----------------------------------------------------------------------------
+static bool RunCSVFileUnitTest()
+{
+    vector<string> testStrings(sTokenizeTestStrings, sTokenizeTestStrings + sizeof(sTokenizeTestStrings) / sizeof(sTokenizeTestStrings[0]));
+    testStrings.push_back("\\\"Escaped quote\\\", a\\,b, \"in \\\"quote\\\"\" x\\");
+    testStrings.push_back("\\ \\= =\\==");
+
+    // Random strings of special characters spanning several blocks
+    uint64_t random = 0x9e3779b97f4a7c15;
+    const char randomChars[] = "ab ,=\"\\";
+    for (int i = 0; i < 2000; i++)
+    {
+        string str;
+        random = random * 6364136223846793005 + 1442695040888963407;
+        size_t length = (random >> 33) % (kTokenizeBlockSize * 3);
+        for (size_t c = 0; c < length; c++)
+        {
+            random = random * 6364136223846793005 + 1442695040888963407;
+            str.push_back(randomChars[(random >> 33) % (sizeof(randomChars) - 1)]);
+        }
+        testStrings.push_back(str);
+    }
+
+    CSVTokenizer tokenizer(" ,=\t\n", "=");
+    CSVTokenizer multipleQuoteTokenizer(" ,=\t\n", "=", "\"'");
+    if (!tokenizer.IsBlockTokenizing() || multipleQuoteTokenizer.IsBlockTokenizing())
+    {
+        LogError("CSVTokenizer picked the wrong implementation\n");
+        return false;
+    }
+
+    vector<string> expectedTokens;
+    for (size_t i = 0; i < testStrings.size(); i++)
+    {
+        Util::TokenizeString(testStrings[i], expectedTokens, " ,=\t\n", "=");
+        const vector<string_view> &scalarTokens = tokenizer.TokenizeScalar(testStrings[i]);
+        bool scalarEqual = equal(scalarTokens.begin(), scalarTokens.end(), expectedTokens.begin(), expectedTokens.end());
+        const vector<string_view> &blockTokens = tokenizer.TokenizeBlocks(testStrings[i]);
+        bool blockEqual = equal(blockTokens.begin(), blockTokens.end(), expectedTokens.begin(), expectedTokens.end());
+        if (!scalarEqual || !blockEqual)
+        {
+            LogError("CSVTokenizer tokens differ from TokenizeString for '%s'\n", testStrings[i].c_str());
+            return false;
+        }
+    }
+
+    const char *csvFileName = "likedb_unittest.csv";
+    string longField(1000, 'x');
+    FILE *file = fopen(csvFileName, "w");
+    if (file == NULL)
+    {
+        LogError("Could not write '%s'\n", csvFileName);
+        return false;
+    }
+    fprintf(file, "\"%s\", 1\n\n\"last\", 2", longField.c_str());
+    fclose(file);
+
+    MappedCSVFile csvFile;
+    vector<string> lines;
+    string_view line;
+    bool opened = csvFile.Open(csvFileName);
+    while (opened && csvFile.ReadLine(line))
+    {
+        lines.push_back(string(line));
+    }
+    csvFile.Close();
+    remove(csvFileName);
+
+    if (lines.size() != 3 || lines[0] != "\"" + longField + "\", 1" || !lines[1].empty() || lines[2] != "\"last\", 2"
+        || tokenizer.Tokenize(lines[0]).size() != 2)
+    {
+        LogError("MappedCSVFile read wrong lines\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunFlatHashMapUnitTest: Checks FlatHashMap against unordered_map, using
+// random keys and keys that all probe from the same slot
+//----------------------------------------------------------------------------
+static bool RunFlatHashMapUnitTest()
+{
+    FlatHashMap<uint64_t> map;
+    unordered_map<HashKey, uint64_t> expected;
+
+    uint64_t random = 0x9e3779b97f4a7c15;
+    for (int i = 0; i < 50000; i++)
+    {
+        random = random * 6364136223846793005 + 1442695040888963407;
+        map[random] = i;
+        expected[random] = i;
+    }
+
+    for (uint64_t i = 0; i < 2000; i++)
+    {
+        HashKey key = (i << 40) | 3;
+        map[key] = i;
+        expected[key] = i;
+    }
+
+    if (map.size() != expected.size())
+    {
+        LogError("FlatHashMap has wrong number of entries\n");
+        return false;
+    }
+
+    size_t count = 0;
+    for (FlatHashMap<uint64_t>::const_iterator itr = map.begin(); itr != map.end(); ++itr)
+    {
+        unordered_map<HashKey, uint64_t>::const_iterator expectedItr = expected.find((*itr).first);
+        if (expectedItr == expected.end() || (*expectedItr).second != (*itr).second)
+        {
+            LogError("FlatHashMap has wrong entry\n");
+            return false;
+        }
+        count++;
+    }
+
+    for (unordered_map<HashKey, uint64_t>::const_iterator itr = expected.begin(); itr != expected.end(); ++itr)
+    {
+        // Keys differing in one bit are usually missing
+        HashKey otherKey = (*itr).first ^ 0x100;
+        FlatHashMap<uint64_t>::iterator found = map.find((*itr).first);
+        if (found == map.end() || (*found).second != (*itr).second
+            || (map.find(otherKey) != map.end()) != (expected.count(otherKey) != 0))
+        {
+            LogError("FlatHashMap lookup failed\n");
+            return false;
+        }
+    }
+
+    if (count != expected.size())
+    {
+        LogError("FlatHashMap iteration visited wrong number of entries\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunHashManagerUnitTest: Checks looked up strings stay valid while more
+// strings, including ones longer than an arena block, are registered, and
+// that symbol ids are dense in each namespace
+//----------------------------------------------------------------------------
+static bool RunHashManagerUnitTest()
+{
+    HashManager hashManager;
+    vector<string> strings;
+    vector<HashKey> keys;
+    vector<string_view> views;
+
+    strings.push_back(string(kStringArenaBlockSize + 1, 'x'));
+    for (int i = 0; i < 20000; i++)
+    {
+        strings.push_back("user" + to_string(i));
+    }
+
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        keys.push_back(hashManager.GenerateHash(strings[i]));
+        string_view view;
+        if (keys[i] == kInvalidHashKey || !hashManager.LookupHashString(keys[i], view) || view != strings[i])
+        {
+            LogError("HashManager string lookup failed\n");
+            return false;
+        }
+        views.push_back(view);
+    }
+
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        if (views[i] != strings[i] || hashManager.FindHash(strings[i]) != keys[i])
+        {
+            LogError("HashManager string moved after registering more strings\n");
+            return false;
+        }
+    }
+
+    // Namespaces number symbols separately
+    for (size_t i = 0; i < 100; i++)
+    {
+        SymbolNamespace symbolNamespace = i < 50 ? Symbol_UserName : Symbol_Like;
+        SymbolId expectedId = (SymbolId)(i % 50);
+        string_view symbolString;
+        if (hashManager.GenerateSymbolId(symbolNamespace, keys[i]) != expectedId
+            || hashManager.GenerateSymbolId(symbolNamespace, keys[i]) != expectedId
+            || hashManager.LookupSymbolId(symbolNamespace, keys[i]) != expectedId
+            || hashManager.GetSymbolHash(symbolNamespace, expectedId) != keys[i]
+            || !hashManager.LookupSymbolString(symbolNamespace, expectedId, symbolString) || symbolString != strings[i])
+        {
+            LogError("HashManager symbol id lookup failed\n");
+            return false;
+        }
+    }
+
+    if (hashManager.GetSymbolCount(Symbol_Like) != 50 || hashManager.GetSymbolCount(Symbol_Gender) != 0
+        || hashManager.LookupSymbolId(Symbol_Like, keys[0]) != kInvalidSymbolId
+        || hashManager.GenerateSymbolId(Symbol_Gender, keys[0] + 1) != kInvalidSymbolId)
+    {
+        LogError("HashManager has wrong symbols\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunStringHashUnitTest: Checks every Hash64 implementation gives the same
+// hash for unaligned data of lengths around the stripe and block sizes, and
+// that bytes after a NUL are hashed
+//----------------------------------------------------------------------------
+static bool RunStringHashUnitTest()
+{
+    vector<char> data(4096 + 1);
+    uint64_t random = 0x9e3779b97f4a7c15;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        random = random * 6364136223846793005 + 1442695040888963407;
+        data[i] = (char)(random >> 56);
+    }
+
+    vector<StringHashFunctionInfo> functions;
+    StringHash::GetHashFunctions(functions);
+
+    for (size_t length = 0; length <= 4096; length += (length < 300 ? 1 : 61))
+    {
+        const char *str = &data[1];
+        HashKey expected = StringHash::Hash64(str, length);
+        for (size_t i = 0; i < functions.size(); i++)
+        {
+            if (strncmp(functions[i].name, "hash64", 6) == 0 && functions[i].function(str, length, 0) != expected)
+            {
+                LogError("String hash '%s' differs from Hash64 for length %zu\n", functions[i].name, length);
+                return false;
+            }
+        }
+    }
+
+    const char nulString1[] = { 'a', '\0', 'b' };
+    const char nulString2[] = { 'a', '\0', 'c' };
+    if (StringHash::Hash64(nulString1, sizeof(nulString1)) == StringHash::Hash64(nulString2, sizeof(nulString2)))
+    {
+        LogError("String hash ignored bytes after NUL\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunConcurrentHashManagerUnitTest: Registers strings from several threads
+// at once, some shared by every thread, and checks every thread got the
+// same hashes as HashManager
+//----------------------------------------------------------------------------
+static bool RunConcurrentHashManagerUnitTest()
+{
+    const uint32_t threadCount = 4;
+    const uint32_t stringCount = 5000;
+
+    ConcurrentHashManager concurrentHashManager;
+    HashManager hashManager;
+    vector<int> threadResults(threadCount, 1);
+    vector<thread> threads;
+    for (uint32_t t = 0; t < threadCount; t++)
+    {
+        threads.push_back(thread([t, &concurrentHashManager, &hashManager, &threadResults]()
+        {
+            for (uint32_t i = 0; i < stringCount; i++)
+            {
+                string sharedString = "shared" + to_string(i);
+                string threadString = "thread" + to_string(t) + "-" + to_string(i);
+                string_view registered;
+                HashKey key = concurrentHashManager.GenerateHash(sharedString);
+                if (key != hashManager.ComputeHash(sharedString) || !concurrentHashManager.LookupHashString(key, registered)
+                    || registered != sharedString || concurrentHashManager.GenerateHash(threadString) == kInvalidHashKey)
+                {
+                    threadResults[t] = 0;
+                }
+            }
+        }));
+    }
+
+    for (uint32_t t = 0; t < threadCount; t++)
+    {
+        threads[t].join();
+        if (!threadResults[t])
+        {
+            LogError("ConcurrentHashManager registered wrong hash\n");
+            return false;
+        }
+    }
+
+    vector<HashKey> keys;
+    concurrentHashManager.GetHashKeys(keys);
+    if (keys.size() != stringCount * (threadCount + 1))
+    {
+        LogError("ConcurrentHashManager has wrong number of strings\n");
+        return false;
+    }
+
+    for (uint32_t t = 0; t < threadCount; t++)
+    {
+        string threadString = "thread" + to_string(t) + "-0";
+        if (concurrentHashManager.FindHash(threadString) != hashManager.ComputeHash(threadString)
+            || concurrentHashManager.FindHash(threadString + "x") != kInvalidHashKey)
+        {
+            LogError("ConcurrentHashManager FindHash failed\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunFrontCodedDictionaryUnitTest: Builds a dictionary from strings sharing
+// prefixes, including strings that are prefixes of others, and checks
+// every string can be looked up and is visited once in sorted order
+//----------------------------------------------------------------------------
+static bool RunFrontCodedDictionaryUnitTest()
+{
+    HashManager hashManager;
+    vector<string> strings;
+    strings.push_back(string(1000, 'z'));
+    for (int i = 0; i < 1000; i++)
+    {
+        strings.push_back("555-01" + to_string(i));
+        strings.push_back("555-01" + to_string(i) + "0x");
+    }
+
+    vector<FrontCodedDictionary::Entry> entries;
+    unordered_map<HashKey, string> stringsByHash;
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        HashKey key = hashManager.ComputeHash(strings[i]);
+        entries.push_back(make_pair(key, string_view(strings[i])));
+        stringsByHash[key] = strings[i];
+    }
+
+    vector<char> image;
+    FrontCodedDictionary::Build(entries, image);
+
+    FrontCodedDictionary dictionary;
+    if (!dictionary.Open(image.data(), image.size()) || dictionary.GetStringCount() != strings.size()
+        || FrontCodedDictionary().Open(image.data(), sizeof(FrontCodedHeader)))
+    {
+        LogError("FrontCodedDictionary image is invalid\n");
+        return false;
+    }
+
+    string buffer;
+    string_view str;
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        if (!dictionary.Lookup(hashManager.ComputeHash(strings[i]), buffer, str) || str != strings[i])
+        {
+            LogError("FrontCodedDictionary lookup of '%s' failed\n", strings[i].c_str());
+            return false;
+        }
+    }
+
+    // The first string in sorted order starts a block so it isn't decoded
+    if (!dictionary.Lookup(hashManager.ComputeHash(strings[1]), buffer, str)
+        || str.data() < image.data() || str.data() >= image.data() + image.size())
+    {
+        LogError("FrontCodedDictionary decoded a string stored whole\n");
+        return false;
+    }
+
+    if (dictionary.Lookup(hashManager.ComputeHash("555-01"), buffer, str))
+    {
+        LogError("FrontCodedDictionary found string that wasn't added\n");
+        return false;
+    }
+
+    string previousString;
+    size_t visitCount = 0;
+    bool visitsSorted = true;
+    bool decoded = dictionary.ForEachString([&](HashKey key, string_view visitedString)
+    {
+        if (stringsByHash[key] != visitedString || (visitCount > 0 && visitedString <= previousString))
+        {
+            visitsSorted = false;
+        }
+        previousString = string(visitedString);
+        visitCount++;
+    });
+
+    if (!decoded || !visitsSorted || visitCount != strings.size())
+    {
+        LogError("FrontCodedDictionary visited wrong strings\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunParallelLoadUnitTest: Loads files spanning several chunks on one and
+// on several threads, and as a pipeline, and checks the databases have the
+// same users, likes and spatial index, with the first record kept for
+// duplicate users
+//----------------------------------------------------------------------------
+static bool RunParallelLoadUnitTest()
+{
+    const uint32_t userCount = 6000;        // Coprime with 7
+
+    // Long phone numbers and likes make each file span several chunks
+    // without loading many users
+    auto writer = [userCount](FILE *usersFile, FILE *likesFile)
+    {
+        for (uint32_t i = 0; i < userCount; i++)
+        {
+            fprintf(usersFile, "\"user%u\", \"555-%0250u\", %u, %u, \"%s\"\n", i, i, i % 1000, i / 1000,
+                i % 2 ? "male" : "female");
+            fprintf(likesFile, "\"user%u\", \"like%0100u\"\n\"user%u\", \"like%0100u\"\n", i, i % 97,
+                (i * 7) % userCount, i % 13);
+        }
+
+        // Duplicate of a user near the end, which must not replace the first
+        fprintf(usersFile, "\"user1\", \"555-9999\", 999, 999, \"male\"\n");
+    };
+
+    UnitTestDatabase serial;
+    UnitTestDatabase parallel;
+    UnitTestDatabase pipelined;
+    Database &serialDatabase = serial.database;
+    Database &parallelDatabase = parallel.database;
+    Database &pipelinedDatabase = pipelined.database;
+    bool result = LoadUnitTestDatabase(serial, writer, 1, false) && LoadUnitTestDatabase(parallel, writer, 4, false)
+        && LoadUnitTestDatabase(pipelined, writer, 4, true);
+
+    vector<HashKey> serialLikes;
+    vector<HashKey> parallelLikes;
+    vector<HashKey> pipelinedLikes;
+    for (uint32_t i = 0; result && i < userCount; i++)
+    {
+        string userName = "\"user" + to_string(i) + "\"";
+        const UserRecord &serialRecord = serialDatabase.LookupUserRecordByName(userName);
+        const UserRecord &parallelRecord = parallelDatabase.LookupUserRecordByName(userName);
+        const UserRecord &pipelinedRecord = pipelinedDatabase.LookupUserRecordByName(userName);
+        serialDatabase.GetUserLikes(serialRecord, serialLikes);
+        parallelDatabase.GetUserLikes(parallelRecord, parallelLikes);
+        pipelinedDatabase.GetUserLikes(pipelinedRecord, pipelinedLikes);
+
+        result = !parallelDatabase.IsNullUserRecord(parallelRecord) && parallelRecord.xLoc == (LocCoord)(i % 1000)
+            && serialRecord.xLoc == parallelRecord.xLoc && serialRecord.yLoc == parallelRecord.yLoc
+            && serialRecord.phoneNumberHash == parallelRecord.phoneNumberHash && serialLikes == parallelLikes
+            && parallelLikes.size() == 2 && pipelinedRecord.xLoc == serialRecord.xLoc
+            && pipelinedRecord.phoneNumberHash == serialRecord.phoneNumberHash && pipelinedLikes == serialLikes;
+        serialLikes.clear();
+        parallelLikes.clear();
+        pipelinedLikes.clear();
+    }
+
+    // The pipelined load builds the spatial index separately
+    vector<HashKey> serialUsers;
+    vector<HashKey> pipelinedUsers;
+    for (LocCoord x = 0; result && x < 1000; x += 100)
+    {
+        serialDatabase.QueryUsersInRange(x, 2, 50, serialUsers);
+        pipelinedDatabase.QueryUsersInRange(x, 2, 50, pipelinedUsers);
+        sort(serialUsers.begin(), serialUsers.end());
+        sort(pipelinedUsers.begin(), pipelinedUsers.end());
+        result = !serialUsers.empty() && serialUsers == pipelinedUsers;
+        serialUsers.clear();
+        pipelinedUsers.clear();
+    }
+
+    serialDatabase.Shutdown();
+    parallelDatabase.Shutdown();
+    pipelinedDatabase.Shutdown();
+
+    if (!result)
+    {
+        LogError("Parallel load gave different users or likes\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunStreamCSVFileUnitTest: Writes lines to a pipe in small pieces and
+// checks StreamCSVFile hands them back whole through two small buffers,
+// including a line longer than a buffer and a last line without a line
+// ending, then loads users through a pipe into a database and a sharded
+// database
+//----------------------------------------------------------------------------
+static bool RunStreamCSVFileUnitTest()
+{
+    const char *fifoName = "likedb_unittest.fifo";
+    remove(fifoName);
+    if (mkfifo(fifoName, 0600) != 0)
+    {
+        LogError("Could not create '%s'\n", fifoName);
+        return false;
+    }
+
+    string input;
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        input += "line " + to_string(i) + (i == 100 ? string(300, 'x') : string()) + "\n";
+    }
+    input += "last";
+
+    auto writeFifo = [fifoName](const string &data, size_t pieceSize)
+    {
+        FILE *file = fopen(fifoName, "w");
+        for (size_t pos = 0; file != NULL && pos < data.size(); pos += pieceSize)
+        {
+            fwrite(data.data() + pos, 1, min(pieceSize, data.size() - pos), file);
+            fflush(file);
+        }
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+    };
+
+    thread writer(writeFifo, input, 7);
+    StreamCSVFile streamFile;
+    string output;
+    bool result = StreamCSVFile::IsStream(fifoName) && streamFile.Open(fifoName, 64, 2);
+    string_view chunk;
+    while (result && streamFile.ReadChunk(chunk))
+    {
+        // Only the last chunk can end without a line ending
+        result = !chunk.empty() && (output.empty() || output.back() == '\n');
+        output += chunk;
+        streamFile.ReleaseChunks();
+    }
+    result = result && !streamFile.HasError() && output == input;
+    streamFile.Close();
+    writer.join();
+
+    if (!result)
+    {
+        remove(fifoName);
+        LogError("StreamCSVFile read wrong lines\n");
+        return false;
+    }
+
+    string users;
+    const uint32_t userCount = 1000;
+    for (uint32_t i = 0; i < userCount; i++)
+    {
+        users += "\"user" + to_string(i) + "\", \"555-0000\", " + to_string(i) + ", 0, \"male\"\n";
+    }
+
+    thread usersWriter(writeFifo, users, 1000);
+    ConcurrentHashManager hashManager;
+    Database database(&hashManager);
+    database.Initialize(4);
+    result = database.LoadUserDataFromCSVFile(fifoName);
+    usersWriter.join();
+
+    thread shardedUsersWriter(writeFifo, users, 1000);
+    ShardedDatabase shardedDatabase;
+    shardedDatabase.Initialize(2, 4);
+    result = shardedDatabase.LoadUserDataFromCSVFile(fifoName) && result;
+    shardedUsersWriter.join();
+    remove(fifoName);
+
+    for (uint32_t i = 0; result && i < userCount; i++)
+    {
+        string userName = "\"user" + to_string(i) + "\"";
+        const UserRecord &record = database.LookupUserRecordByName(userName);
+        const UserRecord &shardedRecord = shardedDatabase.LookupUserRecordByKey(shardedDatabase.FindHash(userName));
+        result = !database.IsNullUserRecord(record) && record.xLoc == (LocCoord)i
+            && !shardedDatabase.IsNullUserRecord(shardedRecord) && shardedRecord.xLoc == (LocCoord)i;
+    }
+    database.Shutdown();
+    shardedDatabase.Shutdown();
+
+    if (!result)
+    {
+        LogError("Users streamed through a pipe weren't loaded\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunCompressedCSVFileUnitTest: Loads gzip files, including users written
+// as two concatenated members, and checks they match the plain files, also
+// when loaded into a sharded database. A truncated file must fail to load.
+// zstd is checked when it's built in.
+//----------------------------------------------------------------------------
+static bool RunCompressedCSVFileUnitTest()
+{
+    const uint32_t userCount = 3000;
+
+    string users;
+    string likes;
+    for (uint32_t i = 0; i < userCount; i++)
+    {
+        users += "\"user" + to_string(i) + "\", \"555-" + to_string(i) + "\", " + to_string(i % 1000) + ", "
+            + to_string(i / 1000) + ", \"male\"\n";
+        likes += "\"user" + to_string(i) + "\", \"like" + to_string(i % 31) + "\"\n";
+    }
+
+    UnitTestDatabase plain;
+    Database &plainDatabase = plain.database;
+    bool result = LoadUnitTestDatabase(plain, [&users, &likes](FILE *usersFile, FILE *likesFile)
+    {
+        fwrite(users.data(), 1, users.size(), usersFile);
+        fwrite(likes.data(), 1, likes.size(), likesFile);
+    });
+
+    auto writeFile = [](const string &fileName, const string &data)
+    {
+        FILE *file = fopen(fileName.c_str(), "wb");
+        bool result = file != NULL && fwrite(data.data(), 1, data.size(), file) == data.size();
+        return file != NULL && fclose(file) == 0 && result;
+    };
+    auto writeGzipFile = [](const string &fileName, const string &data, const char *mode)
+    {
+        gzFile file = gzopen(fileName.c_str(), mode);
+        bool result = file != NULL && gzwrite(file, data.data(), (unsigned)data.size()) == (int)data.size();
+        return file != NULL && gzclose(file) == Z_OK && result;
+    };
+
+    // Compression is detected from the contents, so the files need no suffix
+    string gzipUsersFileName = CreateUnitTestFile();
+    string gzipLikesFileName = CreateUnitTestFile();
+    string truncatedFileName = CreateUnitTestFile();
+    size_t half = users.find('\n', users.size() / 2) + 1;
+    result = result && !gzipUsersFileName.empty() && !gzipLikesFileName.empty() && !truncatedFileName.empty()
+        && writeGzipFile(gzipUsersFileName, users.substr(0, half), "wb")
+        && writeGzipFile(gzipUsersFileName, users.substr(half), "ab")
+        && writeGzipFile(gzipLikesFileName, likes, "wb");
+
+    string compressed;
+    FILE *gzipFile = result ? fopen(gzipUsersFileName.c_str(), "rb") : NULL;
+    char readBuffer[4096];
+    size_t readSize;
+    while (gzipFile != NULL && (readSize = fread(readBuffer, 1, sizeof(readBuffer), gzipFile)) > 0)
+    {
+        compressed.append(readBuffer, readSize);
+    }
+    if (gzipFile != NULL)
+    {
+        fclose(gzipFile);
+    }
+    result = result && compressed.size() > 100 && writeFile(truncatedFileName, compressed.substr(0, 100));
+
+    ConcurrentHashManager gzipHashManager;
+    ConcurrentHashManager truncatedHashManager;
+    Database gzipDatabase(&gzipHashManager);
+    Database truncatedDatabase(&truncatedHashManager);
+    gzipDatabase.Initialize(4);
+    truncatedDatabase.Initialize(4);
+
+    result = result && gzipDatabase.LoadCSVFiles(gzipUsersFileName.c_str(), gzipLikesFileName.c_str());
+    result = result && !truncatedDatabase.LoadUserDataFromCSVFile(truncatedFileName.c_str());
+
+    ShardedDatabase shardedDatabase;
+    shardedDatabase.Initialize(2, 4);
+    result = result && shardedDatabase.LoadUserDataFromCSVFile(gzipUsersFileName.c_str())
+        && shardedDatabase.LoadLikesDataFromCSVFile(gzipLikesFileName.c_str())
+        && shardedDatabase.GetLoadStats().GetLikeStats().GetAcceptedCount() == userCount;
+
+#if defined(LDB_USE_ZSTD)
+    string zstdUsersFileName = CreateUnitTestFile();
+    ConcurrentHashManager zstdHashManager;
+    Database zstdDatabase(&zstdHashManager);
+    zstdDatabase.Initialize(4);
+
+    string zstdUsers(ZSTD_compressBound(users.size()), '\0');
+    size_t zstdSize = ZSTD_compress(&zstdUsers[0], zstdUsers.size(), users.data(), users.size(), 3);
+    result = result && !zstdUsersFileName.empty() && !ZSTD_isError(zstdSize)
+        && writeFile(zstdUsersFileName, zstdUsers.substr(0, zstdSize))
+        && zstdDatabase.LoadUserDataFromCSVFile(zstdUsersFileName.c_str());
+    remove(zstdUsersFileName.c_str());
+#endif
+
+    remove(gzipUsersFileName.c_str());
+    remove(gzipLikesFileName.c_str());
+    remove(truncatedFileName.c_str());
+
+    vector<HashKey> plainLikes;
+    vector<HashKey> gzipLikes;
+    for (uint32_t i = 0; result && i < userCount; i++)
+    {
+        string userName = "\"user" + to_string(i) + "\"";
+        const UserRecord &plainRecord = plainDatabase.LookupUserRecordByName(userName);
+        const UserRecord &gzipRecord = gzipDatabase.LookupUserRecordByName(userName);
+        plainDatabase.GetUserLikes(plainRecord, plainLikes);
+        gzipDatabase.GetUserLikes(gzipRecord, gzipLikes);
+
+        result = !gzipDatabase.IsNullUserRecord(gzipRecord) && gzipRecord.xLoc == plainRecord.xLoc
+            && gzipRecord.yLoc == plainRecord.yLoc && gzipRecord.phoneNumberHash == plainRecord.phoneNumberHash
+            && gzipLikes == plainLikes && gzipLikes.size() == 1;
+
+        const UserRecord &shardedRecord = shardedDatabase.LookupUserRecordByKey(shardedDatabase.FindHash(userName));
+        result = result && !shardedDatabase.IsNullUserRecord(shardedRecord) && shardedRecord.xLoc == plainRecord.xLoc
+            && shardedRecord.phoneNumberHash == plainRecord.phoneNumberHash;
+#if defined(LDB_USE_ZSTD)
+        const UserRecord &zstdRecord = zstdDatabase.LookupUserRecordByName(userName);
+        result = result && !zstdDatabase.IsNullUserRecord(zstdRecord) && zstdRecord.xLoc == plainRecord.xLoc;
+#endif
+        plainLikes.clear();
+        gzipLikes.clear();
+    }
+
+    plainDatabase.Shutdown();
+    gzipDatabase.Shutdown();
+    truncatedDatabase.Shutdown();
+    shardedDatabase.Shutdown();
+#if defined(LDB_USE_ZSTD)
+    zstdDatabase.Shutdown();
+#endif
+
+    if (!result)
+    {
+        LogError("Compressed files loaded differently from plain files\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunLoadStatsUnitTest: Loads files with known numbers of each kind of bad
+// line and checks they're counted, then checks which errors are sampled
+// for logging
+//----------------------------------------------------------------------------
+static bool RunLoadStatsUnitTest()
+{
+    const uint32_t userCount = 20;
+
+    UnitTestDatabase testDatabase;
+    Database &database = testDatabase.database;
+    bool result = LoadUnitTestDatabase(testDatabase, [userCount](FILE *usersFile, FILE *likesFile)
+    {
+        for (uint32_t i = 0; i < userCount; i++)
+        {
+            fprintf(usersFile, "\"user%u\", \"555-%u\", %u, %u, \"male\"\n", i, i, i, i);
+            fprintf(likesFile, "\"user%u\", \"like%u\"\n", i, i % 3);
+        }
+        fprintf(usersFile, "\n\"user0\", \"555-0\", 0, 0, \"male\"\n");
+        fprintf(usersFile, "\"bad\", \"555-0\", x, 0, \"male\"\n\"short\", \"555-0\", 0, 0\n");
+        fprintf(likesFile, "\"nobody\", \"like0\"\n\"nobody\", \"like1\"\n");
+    });
+
+    const LoadStats &stats = database.GetLoadStats();
+    const CSVLoadStats &userStats = stats.GetUserStats();
+    const CSVLoadStats &likeStats = stats.GetLikeStats();
+    result = result && userStats.GetFileName() == testDatabase.usersFileName && userStats.GetLineCount() == userCount + 4
+        && userStats.GetAcceptedCount() == userCount && userStats.GetErrorCount(LoadError_Duplicate) == 1
+        && userStats.GetErrorCount(LoadError_Parse) == 2 && userStats.GetFieldErrorCount("<xLoc>") == 1
+        && userStats.GetFieldErrorCount("<gender>") == 1 && userStats.GetLoggedErrorCount() == 3
+        && likeStats.GetLineCount() == userCount + 2 && likeStats.GetAcceptedCount() == userCount
+        && likeStats.GetErrorCount(LoadError_UnknownUser) == 2 && likeStats.GetErrorCount(LoadError_Parse) == 0
+        && userStats.GetByteCount() > 0 && stats.GetPhaseTime(LoadPhase_Total) > 0.0;
+    database.Shutdown();
+
+    uint64_t loggedCount = 0;
+    for (uint64_t errorIndex = 1; errorIndex <= 5 * kLoadErrorSampleInterval; errorIndex++)
+    {
+        loggedCount += CSVLoadStats::IsErrorLogged(errorIndex) ? 1 : 0;
+    }
+    result = result && loggedCount == kLoadErrorsLogged + 5;
+
+    if (!result)
+    {
+        LogError("Load statistics were wrong\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunUserLikesUnitTest: Loads a likes file of several chunks with the users'
+// likes interleaved and checks every user has its likes in file order.
+// Then appends a like and checks it follows the loaded ones, before and
+// after compaction.
+//----------------------------------------------------------------------------
+static bool RunUserLikesUnitTest()
+{
+    const uint32_t userCount = 4;
+    const uint32_t likeCount = 100000;
+
+    vector< vector<string> > userLikes(userCount);
+    UnitTestDatabase testDatabase;
+    ConcurrentHashManager &hashManager = testDatabase.hashManager;
+    Database &database = testDatabase.database;
+    bool result = LoadUnitTestDatabase(testDatabase, [&userLikes, userCount, likeCount](FILE *usersFile,
+        FILE *likesFile)
+    {
+        for (uint32_t i = 0; i < userCount; i++)
+        {
+            fprintf(usersFile, "\"user%u\", \"555-%u\", %u, %u, \"male\"\n", i, i, i, i);
+        }
+        for (uint32_t i = 0; i < likeCount; i++)
+        {
+            uint32_t user = (i + i / 3) % userCount;
+            string like = "\"like" + to_string(i % 101) + "\"";
+            fprintf(likesFile, "\"user%u\", %s\n", user, like.c_str());
+            userLikes[user].push_back(like);
+        }
+    }, 4, false);
+
+    vector<HashKey> likes;
+    for (uint32_t i = 0; result && i < userCount; i++)
+    {
+        const UserRecord &record = database.LookupUserRecordByName("\"user" + to_string(i) + "\"");
+        likes.clear();
+        result = !database.IsNullUserRecord(record) && database.GetUserLikes(record, likes) == userLikes[i].size();
+        for (size_t j = 0; result && j < likes.size(); j++)
+        {
+            result = likes[j] == database.FindHash(userLikes[i][j]);
+        }
+    }
+
+    const UserRecord &record = database.LookupUserRecordByName("\"user0\"");
+    HashKey newLike = hashManager.GenerateHash("\"new like\"");
+    likes.clear();
+    result = result && database.AppendUserLike(record.userNameHash, newLike)
+        && !database.AppendUserLike(hashManager.GenerateHash("\"nobody\""), newLike)
+        && database.GetUserLikes(record, likes) == userLikes[0].size() + 1 && likes.back() == newLike;
+
+    vector<HashKey> compactedLikes;
+    database.Compact();
+    database.GetUserLikes(record, compactedLikes);
+    result = result && compactedLikes == likes;
+    database.Shutdown();
+
+    if (!result)
+    {
+        LogError("User likes were wrong after loading\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunCompactUnitTest: Appends likes to users in two rounds, compacting after
+// each, and checks every user's likesOffset and likesCount select its likes
+// in order, and that the users' ranges tile the compacted like array
+//----------------------------------------------------------------------------
+static bool RunCompactUnitTest()
+{
+    const uint32_t userCount = 50;
+
+    HashManager hashManager;
+    Database database(&hashManager);
+    database.Initialize();
+
+    bool result = true;
+    vector<HashKey> userKeys;
+    for (uint32_t i = 0; result && i < userCount; i++)
+    {
+        string userName = "\"user" + to_string(i) + "\"";
+        result = database.AddUser(userName, "\"555-0000\"", i, i, "\"male\"");
+        userKeys.push_back(database.FindHash(userName));
+    }
+
+    vector< vector<HashKey> > userLikes(userCount);
+    for (uint32_t round = 0; result && round < 2; round++)
+    {
+        // Some users get no likes in a round
+        for (uint32_t i = 0; result && i < userCount; i++)
+        {
+            vector<HashKey> likes;
+            for (uint32_t j = 0; j < (i * 7 + round * 3) % 5; j++)
+            {
+                likes.push_back(hashManager.GenerateHash("\"like" + to_string((i + j + round) % 13) + "\""));
+            }
+            result = database.AppendUserLikes(userKeys[i], likes.data(), (uint32_t)likes.size());
+            userLikes[i].insert(userLikes[i].end(), likes.begin(), likes.end());
+        }
+        database.Compact();
+
+        vector< pair<uint32_t, uint32_t> > ranges;
+        for (uint32_t i = 0; result && i < userCount; i++)
+        {
+            const UserRecord &record = database.LookupUserRecordByKey(userKeys[i]);
+            Database::UserLikes likes;
+            database.GetUserLikes(record, likes);
+            result = likes.count == 0 && record.likesCount == userLikes[i].size()
+                && likes.compactCount == record.likesCount;
+            for (uint32_t j = 0; result && j < record.likesCount; j++)
+            {
+                result = database.GetLikeHash(likes.compactLikes[j]) == userLikes[i][j];
+            }
+            ranges.push_back(make_pair(record.likesOffset, record.likesCount));
+        }
+
+        sort(ranges.begin(), ranges.end());
+        uint32_t nextOffset = 0;
+        for (size_t i = 0; result && i < ranges.size(); i++)
+        {
+            result = ranges[i].first == nextOffset;
+            nextOffset += ranges[i].second;
+        }
+    }
+    database.Shutdown();
+
+    if (!result)
+    {
+        LogError("Compacted likes don't match the users' likes\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunNearbyGenderUnitTest: Checks a nearby_gender query only pairs users of
+// the requested gender, even when users of another gender are between
+// them, that a gender no user has finds nothing, and that a user whose
+// gender and location are updated is searched in the new partition
+//----------------------------------------------------------------------------
+static bool RunNearbyGenderUnitTest()
+{
+    HashManager hashManager;
+    Database database(&hashManager);
+    database.Initialize();
+
+    const char *users[][2] = { { "\"f0\"", "\"female\"" }, { "\"m0\"", "\"male\"" }, { "\"m1\"", "\"male\"" },
+        { "\"f1\"", "\"female\"" }, { "\"f2\"", "\"female\"" }, { "\"m2\"", "\"male\"" } };
+    const LocCoord xLocs[] = { 0, 1, 2, 3, 100, 101 };
+    bool result = true;
+    for (uint32_t i = 0; result && i < sizeof(xLocs) / sizeof(xLocs[0]); i++)
+    {
+        result = database.AddUser(users[i][0], "\"555-0000\"", xLocs[i], 0, users[i][1]);
+    }
+
+    QueryNearbyGender femaleQuery;
+    QueryNearbyGender unknownQuery;
+    result = result && femaleQuery.Construct(5, "\"female\"") && femaleQuery.Execute(database)
+        && unknownQuery.Construct(5, "\"other\"") && unknownQuery.Execute(database)
+        && unknownQuery.GetResults().empty();
+
+    HashKey femaleHash = database.FindHash("\"female\"");
+    HashKey f0 = database.FindHash("\"f0\"");
+    HashKey f1 = database.FindHash("\"f1\"");
+    const vector<QueryNearbyGender::NearbyGenderResult> &results = femaleQuery.GetResults();
+    bool foundPair = false;
+    for (size_t i = 0; result && i < results.size(); i++)
+    {
+        result = database.LookupUserRecordByKey(results[i].user1).genderHash == femaleHash
+            && database.LookupUserRecordByKey(results[i].user2).genderHash == femaleHash;
+        foundPair = foundPair || (results[i].user1 == f0 && results[i].user2 == f1)
+            || (results[i].user1 == f1 && results[i].user2 == f0);
+    }
+
+    // f2 becomes male next to m2
+    HashKey maleHash = database.FindHash("\"male\"");
+    UserRecord f2 = database.LookupUserRecordByKey(database.FindHash("\"f2\""));
+    f2.genderHash = maleHash;
+    f2.xLoc = 102;
+    vector<HashKey> femaleUsers;
+    vector<HashKey> nearbyUsers;
+    QueryNearbyGender maleQuery;
+    result = result && database.UpdateUserRecord(f2)
+        && database.QueryUsersInPartition(femaleHash, femaleUsers) == 2
+        && database.QueryUsersInRange(102, 0, 0, maleHash, nearbyUsers) == 1 && nearbyUsers[0] == f2.userNameHash
+        && database.QueryUsersInRange(100, 0, 0, nearbyUsers) == 0
+        && maleQuery.Construct(5, "\"male\"") && maleQuery.Execute(database);
+
+    const vector<QueryNearbyGender::NearbyGenderResult> &maleResults = maleQuery.GetResults();
+    bool foundMovedPair = false;
+    for (size_t i = 0; result && i < maleResults.size(); i++)
+    {
+        result = database.LookupUserRecordByKey(maleResults[i].user1).genderHash == maleHash
+            && database.LookupUserRecordByKey(maleResults[i].user2).genderHash == maleHash;
+        foundMovedPair = foundMovedPair || maleResults[i].user1 == f2.userNameHash
+            || maleResults[i].user2 == f2.userNameHash;
+    }
+    database.Shutdown();
+
+    if (!result || !foundPair || !foundMovedPair)
+    {
+        LogError("Nearby gender query results were wrong\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunRecordSchemaUnitTest: Parses a record type other than UserRecord and
+// checks which field is reported for missing and invalid values
+//----------------------------------------------------------------------------
+static bool RunRecordSchemaUnitTest()
+{
+    struct VenueRecord
+    {
+        HashKey venueNameHash;
+        LocCoord xLoc;
+        uint32_t capacity;
+    };
+
+    static constexpr RecordSchema sVenueRecordSchema(
+        HashedField<&VenueRecord::venueNameHash>{ "<venue name>" },
+        IntegerField<&VenueRecord::xLoc>{ "<xLoc>" },
+        IntegerField<&VenueRecord::capacity>{ "<capacity>" });
+    static_assert(sVenueRecordSchema.kFieldCount == 3, "Wrong schema field count");
+
+    HashManager hashManager;
+    CSVTokenizer tokenizer;
+    VenueRecord record;
+    RecordParseError error;
+
+    bool parsed = sVenueRecordSchema.Parse(hashManager, tokenizer.Tokenize("\"Arena\", -12, 500, extra"), record, error);
+    bool result = parsed && record.venueNameHash == hashManager.FindHash("\"Arena\"") && record.xLoc == -12
+        && record.capacity == 500;
+
+    parsed = sVenueRecordSchema.Parse(hashManager, tokenizer.Tokenize("\"Arena\", 7"), record, error);
+    result = result && !parsed && error.missing && strcmp(error.fieldName, "<capacity>") == 0 && record.xLoc == 7;
+
+    parsed = sVenueRecordSchema.Parse(hashManager, tokenizer.Tokenize("\"Arena\", x, 500"), record, error);
+    result = result && !parsed && !error.missing && strcmp(error.fieldName, "<xLoc>") == 0
+        && strcmp(error.typeName, "integer") == 0;
+
+    if (!result)
+    {
+        LogError("RecordSchema parsed a record wrongly\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunParseIntegerUnitTest: Checks integer parsing at the limits of
+// LocCoord and other types, with signs and white space, and that a stale
+// errno doesn't fail a valid value
+//----------------------------------------------------------------------------
+static bool RunParseIntegerUnitTest()
+{
+    struct LocCoordTest
+    {
+        const char *str;
+        bool valid;
+        LocCoord value;
+    };
+
+    static const LocCoordTest sLocCoordTests[] =
+    {
+        { "0", true, 0 },
+        { "127", true, 127 },
+        { "-2147483648", true, numeric_limits<LocCoord>::min() },
+        { "2147483647", true, numeric_limits<LocCoord>::max() },
+        { "+42", true, 42 },
+        { " 12\r", true, 12 },
+        { "\t-7 ", true, -7 },
+        { "0000000000000000000031", true, 31 },
+        { "2147483648", false, 0 },
+        { "-2147483649", false, 0 },
+        { "99999999999999999999", false, 0 },
+        { "", false, 0 },
+        { " \r", false, 0 },
+        { "+", false, 0 },
+        { "-", false, 0 },
+        { "+-5", false, 0 },
+        { "12a", false, 0 },
+        { "1 2", false, 0 },
+        { "0x10", false, 0 },
+        { "1.5", false, 0 }
+    };
+
+    errno = ERANGE;
+    for (size_t i = 0; i < sizeof(sLocCoordTests) / sizeof(sLocCoordTests[0]); i++)
+    {
+        const LocCoordTest &test = sLocCoordTests[i];
+        LocCoord value = 0;
+        bool valid = Util::GetLocCoordFromString(test.str, value);
+        if (valid != test.valid || (valid && value != test.value))
+        {
+            LogError("GetLocCoordFromString parsed '%s' wrongly\n", test.str);
+            return false;
+        }
+    }
+
+    uint8_t byteValue = 0;
+    uint64_t longValue = 0;
+    if (!Util::ParseInteger("255", byteValue) || byteValue != 255 || Util::ParseInteger("256", byteValue)
+        || Util::ParseInteger("-1", byteValue) || !Util::ParseInteger("18446744073709551615", longValue)
+        || longValue != numeric_limits<uint64_t>::max())
+    {
+        LogError("ParseInteger range checks failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunUserRecordIndexUnitTest: Checks secondary index lookups agree with a
+// scan of all user records
+//----------------------------------------------------------------------------
+static bool RunUserRecordIndexUnitTest(Database &database)
+{
+    for (Database::UserRecordIterator itr(database); !itr.IsDone(); ++itr)
+    {
+        const UserRecord &record = database.LookupUserRecordByKey(itr.GetHashKey());
+
+        vector<HashKey> userKeys;
+        database.LookupUsersByIndex(UserIndex_PhoneNumber, record.phoneNumberHash, userKeys);
+        if (find(userKeys.begin(), userKeys.end(), record.userNameHash) == userKeys.end())
+        {
+            LogError("User not found by phone number index\n");
+            return false;
+        }
+
+        userKeys.clear();
+        database.LookupUsersByIndex(UserIndex_Gender, record.genderHash, userKeys);
+        if (find(userKeys.begin(), userKeys.end(), record.userNameHash) == userKeys.end())
+        {
+            LogError("User not found by gender index\n");
+            return false;
+        }
+
+        vector<HashKey> userLikes;
+        database.GetUserLikes(record, userLikes);
+        for (size_t i = 0; i < userLikes.size(); i++)
+        {
+            userKeys.clear();
+            database.LookupUsersByIndex(UserIndex_Like, userLikes[i], userKeys);
+            if (find(userKeys.begin(), userKeys.end(), record.userNameHash) == userKeys.end())
+            {
+                LogError("User not found by like index\n");
+                return false;
+            }
+        }
+    }
+
+    vector<HashKey> userKeys;
+    uint32_t count = database.LookupUsersByPhoneNumber("\"no such phone number\"", userKeys);
+    if (count != 0)
+    {
+        LogError("Found users for unknown phone number\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunMappedDatabaseUnitTest: Writes the database to a mapped file and checks
+// the mapped database has the same records, likes, range query results and
+// secondary index lookups
+//----------------------------------------------------------------------------
+static bool RunMappedDatabaseUnitTest(Database &database)
+{
+    const char *mappedFileName = "likedb_unittest.mapped";
+
+    Injector<Database> injector(getDatabaseComponent());
+    Database *mappedDatabase(injector);
+    bool result = database.SaveMapped(mappedFileName) && mappedDatabase->OpenMapped(mappedFileName);
+    remove(mappedFileName);
+    if (!result)
+    {
+        LogError("Could not write and open mapped database\n");
+        return false;
+    }
+
+    uint32_t recordCount = 0;
+    for (Database::UserRecordIterator itr(*mappedDatabase); !itr.IsDone(); ++itr)
+    {
+        recordCount++;
+    }
+
+    for (Database::UserRecordIterator itr(database); !itr.IsDone(); ++itr)
+    {
+        const UserRecord &record = database.LookupUserRecordByKey(itr.GetHashKey());
+        const UserRecord &mappedRecord = mappedDatabase->LookupUserRecordByKey(itr.GetHashKey());
+        if (mappedDatabase->IsNullUserRecord(mappedRecord) || record.phoneNumberHash != mappedRecord.phoneNumberHash
+            || record.genderHash != mappedRecord.genderHash || record.xLoc != mappedRecord.xLoc
+            || record.yLoc != mappedRecord.yLoc)
+        {
+            LogError("Mapped user record doesn't match\n");
+            return false;
+        }
+        recordCount--;
+
+        vector<HashKey> userLikes;
+        vector<HashKey> mappedUserLikes;
+        database.GetUserLikes(record, userLikes);
+        mappedDatabase->GetUserLikes(mappedRecord, mappedUserLikes);
+        if (userLikes != mappedUserLikes)
+        {
+            LogError("Mapped user likes don't match\n");
+            return false;
+        }
+
+        string userNameBuffer;
+        string mappedUserNameBuffer;
+        string_view userName;
+        string_view mappedUserName;
+        database.LookupHashString(record.userNameHash, userNameBuffer, userName);
+        mappedDatabase->LookupHashString(record.userNameHash, mappedUserNameBuffer, mappedUserName);
+        if (userName != mappedUserName)
+        {
+            LogError("Mapped user name doesn't match\n");
+            return false;
+        }
+
+        vector<HashKey> usersInRange;
+        vector<HashKey> mappedUsersInRange;
+        database.QueryUsersInRange(record.xLoc, record.yLoc, 10, record.genderHash, usersInRange);
+        mappedDatabase->QueryUsersInRange(record.xLoc, record.yLoc, 10, record.genderHash, mappedUsersInRange);
+        sort(usersInRange.begin(), usersInRange.end());
+        sort(mappedUsersInRange.begin(), mappedUsersInRange.end());
+        if (usersInRange != mappedUsersInRange)
+        {
+            LogError("Mapped range query results don't match\n");
+            return false;
+        }
+    }
+
+    if (recordCount != 0)
+    {
+        LogError("Mapped database has a different number of user records\n");
+        return false;
+    }
+
+    if (!mappedDatabase->IsNullUserRecord(mappedDatabase->LookupUserRecordByName("\"no such user\"")))
+    {
+        LogError("Found mapped record for unknown user\n");
+        return false;
+    }
+
+    // Secondary indexes are stored in the file
+    return RunUserRecordIndexUnitTest(*mappedDatabase);
+}
+
+//----------------------------------------------------------------------------
+// RunSnapshotUnitTest: Saves the database to a snapshot and checks the
+// loaded database has the same records, likes and range query results and
+// kept its load threads. Then reads an R-tree from a snapshot cut off part
+// way through its nodes, with a valid checksum, which must fail and leave
+// an empty tree.
+//----------------------------------------------------------------------------
+static bool RunSnapshotUnitTest(Database &database)
+{
+    const char *snapshotFileName = "likedb_unittest.snap";
+
+    Injector<Database> injector(getDatabaseComponent());
+    Database *loadedDatabase(injector);
+    loadedDatabase->Initialize(4);
+    bool result = database.SaveSnapshot(snapshotFileName) && loadedDatabase->LoadSnapshot(snapshotFileName)
+        && loadedDatabase->GetLoadThreadCount() == 4;
+    remove(snapshotFileName);
+    if (!result)
+    {
+        LogError("Could not save and load snapshot\n");
+        return false;
+    }
+
+    uint32_t recordCount = 0;
+    for (Database::UserRecordIterator itr(*loadedDatabase); !itr.IsDone(); ++itr)
+    {
+        recordCount++;
+    }
+
+    for (Database::UserRecordIterator itr(database); result && !itr.IsDone(); ++itr)
+    {
+        const UserRecord &record = database.LookupUserRecordByKey(itr.GetHashKey());
+        const UserRecord &loadedRecord = loadedDatabase->LookupUserRecordByKey(itr.GetHashKey());
+
+        vector<HashKey> userLikes;
+        vector<HashKey> loadedUserLikes;
+        database.GetUserLikes(record, userLikes);
+        loadedDatabase->GetUserLikes(loadedRecord, loadedUserLikes);
+
+        vector<HashKey> usersInRange;
+        vector<HashKey> loadedUsersInRange;
+        database.QueryUsersInRange(record.xLoc, record.yLoc, 10, record.genderHash, usersInRange);
+        loadedDatabase->QueryUsersInRange(record.xLoc, record.yLoc, 10, record.genderHash, loadedUsersInRange);
+        sort(usersInRange.begin(), usersInRange.end());
+        sort(loadedUsersInRange.begin(), loadedUsersInRange.end());
+
+        string userNameBuffer;
+        string loadedUserNameBuffer;
+        string_view userName;
+        string_view loadedUserName;
+        database.LookupHashString(record.userNameHash, userNameBuffer, userName);
+        loadedDatabase->LookupHashString(record.userNameHash, loadedUserNameBuffer, loadedUserName);
+
+        result = !loadedDatabase->IsNullUserRecord(loadedRecord) && record.phoneNumberHash == loadedRecord.phoneNumberHash
+            && record.genderHash == loadedRecord.genderHash && record.xLoc == loadedRecord.xLoc
+            && record.yLoc == loadedRecord.yLoc && userLikes == loadedUserLikes && userName == loadedUserName
+            && usersInRange == loadedUsersInRange;
+        recordCount--;
+    }
+    loadedDatabase->Shutdown();
+
+    if (!result || recordCount != 0)
+    {
+        LogError("Snapshot database doesn't match\n");
+        return false;
+    }
+
+    // Write a tree deep enough to have index nodes, then keep the header and
+    // half of the tree and recompute the checksum
+    const char *treeFileName = "likedb_unittest_tree.snap";
+    RTree tree;
+    tree.Initialize(0.0f, 1000.0f);
+    for (uint32_t i = 0; i < 500; i++)
+    {
+        BoundBox box;
+        box.min.x = box.max.x = (float)(i * 7 % 1000);
+        box.min.y = box.max.y = (float)(i * 13 % 1000);
+        box.min.z = box.max.z = 0.0f;
+        tree.Insert(box, 0, i);
+    }
+
+    SnapshotWriter writer;
+    result = writer.Open(treeFileName);
+    tree.WriteSnapshot(writer);
+    result = result && writer.Close();
+
+    string data;
+    FILE *treeFile = fopen(treeFileName, "rb");
+    char readBuffer[4096];
+    size_t readSize;
+    while (treeFile != NULL && (readSize = fread(readBuffer, 1, sizeof(readBuffer), treeFile)) > 0)
+    {
+        data.append(readBuffer, readSize);
+    }
+    if (treeFile != NULL)
+    {
+        fclose(treeFile);
+    }
+
+    result = result && data.size() > 1000;
+    if (result)
+    {
+        data.resize(data.size() / 2);
+        uint32_t crc = SnapshotUtil::UpdateCRC32(0, data.data(), data.size());
+        data.append((const char *)&crc, sizeof(crc));
+        treeFile = fopen(treeFileName, "wb");
+        result = treeFile != NULL && fwrite(data.data(), 1, data.size(), treeFile) == data.size();
+        result = treeFile != NULL && fclose(treeFile) == 0 && result;
+    }
+
+    SnapshotReader reader;
+    result = result && reader.Open(treeFileName) && !tree.ReadSnapshot(reader);
+    remove(treeFileName);
+
+    BoundBox allBox;
+    allBox.min.x = allBox.min.y = allBox.min.z = 0.0f;
+    allBox.max.x = allBox.max.y = allBox.max.z = 1000.0f;
+    vector<RTreeObjectCategoryType_t> categories;
+    vector<RTreeObjectIdType_t> ids;
+    result = result && tree.IntersectsQuery(allBox, categories, ids) == 0;
+    tree.Shutdown();
+
+    if (!result)
+    {
+        LogError("Truncated R-tree snapshot wasn't rejected\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunShardedDatabaseUnitTest: Loads the CSV files into a sharded database and
+// checks it has the same users and range query results as the database
+//----------------------------------------------------------------------------
+static bool RunShardedDatabaseUnitTest(Database &database)
+{
+    ShardedDatabase shardedDatabase;
+    shardedDatabase.Initialize(3, 4);
+    bool result = shardedDatabase.LoadUserDataFromCSVFile(sUsersDataFileName.c_str())
+        && shardedDatabase.LoadLikesDataFromCSVFile(sLikesDataFileName.c_str());
+    if (!result)
+    {
+        LogError("Could not load sharded database\n");
+        return false;
+    }
+
+    uint32_t recordCount = 0;
+    for (ShardedDatabase::UserRecordIterator itr(shardedDatabase); !itr.IsDone(); ++itr)
+    {
+        recordCount++;
+    }
+
+    for (Database::UserRecordIterator itr(database); !itr.IsDone(); ++itr)
+    {
+        const UserRecord &record = database.LookupUserRecordByKey(itr.GetHashKey());
+        const UserRecord &shardedRecord = shardedDatabase.LookupUserRecordByKey(itr.GetHashKey());
+        if (shardedDatabase.IsNullUserRecord(shardedRecord) || record.xLoc != shardedRecord.xLoc
+            || record.yLoc != shardedRecord.yLoc)
+        {
+            LogError("Sharded user record doesn't match\n");
+            return false;
+        }
+        recordCount--;
+
+        vector<HashKey> usersInRange;
+        vector<HashKey> shardedUsersInRange;
+        database.QueryUsersInRange(record.xLoc, record.yLoc, 25, usersInRange);
+        shardedDatabase.QueryUsersInRange(record.xLoc, record.yLoc, 25, shardedUsersInRange);
+        sort(usersInRange.begin(), usersInRange.end());
+        sort(shardedUsersInRange.begin(), shardedUsersInRange.end());
+        if (usersInRange != shardedUsersInRange)
+        {
+            LogError("Sharded range query results don't match\n");
+            return false;
+        }
+    }
+
+    if (recordCount != 0)
+    {
+        LogError("Sharded database has a different number of user records\n");
+        return false;
+    }
+
+    QueryTargetedLikes likesQuery;
+    QueryTargetedLikes shardedLikesQuery;
+    likesQuery.Construct("distance=100 x=27 y=127 like=pizza");
+    shardedLikesQuery.Construct("distance=100 x=27 y=127 like=pizza");
+    likesQuery.Execute(database);
+    shardedLikesQuery.Execute(shardedDatabase);
+    vector<HashKey> likesResults = likesQuery.GetResults();
+    vector<HashKey> shardedLikesResults = shardedLikesQuery.GetResults();
+    sort(likesResults.begin(), likesResults.end());
+    sort(shardedLikesResults.begin(), shardedLikesResults.end());
+    if (likesResults != shardedLikesResults)
+    {
+        LogError("Sharded targeted likes query results don't match\n");
+        return false;
+    }
+
+    shardedDatabase.Shutdown();
+
+    // A line that doesn't parse mustn't take its user name from a later
+    // valid line
+    string usersFileName;
+    string likesFileName;
+    result = WriteUnitTestCSVFiles([](FILE *usersFile, FILE *)
+    {
+        fprintf(usersFile, "\"late\", \"555-0\", x, 0, \"male\"\n\"late\", \"555-1\", 1, 1, \"male\"\n");
+        fprintf(usersFile, "\"late\", \"555-2\", 2, 2, \"male\"\n");
+    }, usersFileName, likesFileName);
+    if (!result)
+    {
+        return false;
+    }
+
+    shardedDatabase.Initialize(2, 2);
+    result = shardedDatabase.LoadUserDataFromCSVFile(usersFileName.c_str());
+    remove(usersFileName.c_str());
+    remove(likesFileName.c_str());
+
+    const UserRecord &lateRecord = shardedDatabase.LookupUserRecordByKey(shardedDatabase.FindHash("\"late\""));
+    const CSVLoadStats &userStats = shardedDatabase.GetLoadStats().GetUserStats();
+    if (!result || shardedDatabase.IsNullUserRecord(lateRecord) || lateRecord.xLoc != 1
+        || userStats.GetAcceptedCount() != 1 || userStats.GetErrorCount(LoadError_Parse) != 1
+        || userStats.GetErrorCount(LoadError_Duplicate) != 1)
+    {
+        LogError("Sharded database kept the wrong record for a user\n");
+        return false;
+    }
+
+    shardedDatabase.Shutdown();
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunQueryHashUnitTest: Checks queries for strings that aren't in the
+// database find nothing and don't register the strings
+//----------------------------------------------------------------------------
+static bool RunQueryHashUnitTest(const Database &database)
+{
+    const string unknownLike = "\"no such like\"";
+    const string unknownGender = "\"no such gender\"";
+
+    QueryTargetedLikes likesQuery;
+    QueryNearbyGender nearbyQuery;
+    bool result = likesQuery.Construct(0, 0, 1000000, unknownLike) && likesQuery.Execute(database)
+        && nearbyQuery.Construct(1000000, unknownGender) && nearbyQuery.Execute(database);
+    if (!result || !likesQuery.GetResults().empty())
+    {
+        LogError("Query for unknown strings failed\n");
+        return false;
+    }
+
+    if (database.FindHash(unknownLike) != kInvalidHashKey || database.FindHash(unknownGender) != kInvalidHashKey
+        || !database.IsNullUserRecord(database.LookupUserRecordByName("\"no such user\"")))
+    {
+        LogError("Query registered unknown strings\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunDatabaseVersionUnitTest: Queries a published version on another thread
+// while the database is changed and new versions are published, and checks
+// the version doesn't see the changes and versions share unchanged parts
+//----------------------------------------------------------------------------
+static bool RunDatabaseVersionUnitTest()
+{
+    Injector<Database> injector(getDatabaseComponent());
+    Database *database(injector);
+    database->Initialize();
+
+    HashKey aliceKey = database->GenerateHash("\"Alice\"");
+    HashKey bobKey = database->GenerateHash("\"Bob\"");
+    HashKey carolKey = database->GenerateHash("\"Carol\"");
+
+    bool result = !database->AcquireSnapshot()
+        && database->AddUser("\"Alice\"", "\"555-0100\"", 10, 10, "\"female\"")
+        && database->AddUser("\"Bob\"", "\"555-0101\"", 20, 20, "\"male\"")
+        && database->AddUserLike(aliceKey, "\"pizza\"")
+        && database->PublishSnapshot();
+
+    DatabaseSnapshot snapshot = database->AcquireSnapshot();
+    if (!result || !snapshot)
+    {
+        LogError("Could not publish database version\n");
+        return false;
+    }
+
+    // Two readers share the version
+    bool readerResults[2] = { true, true };
+    vector<thread> readers;
+    for (int reader = 0; reader < 2; reader++)
+    {
+        bool &readerResult = readerResults[reader];
+        readers.push_back(thread([&snapshot, &readerResult, aliceKey, bobKey, carolKey]()
+        {
+            const Database &version = snapshot->GetDatabase();
+            for (int i = 0; i < 1000 && readerResult; i++)
+            {
+                vector<HashKey> users;
+                version.QueryUsersInRange(20, 20, 15, users);
+                const UserRecord &bob = version.LookupUserRecordByKey(bobKey);
+
+                QueryTargetedLikes likesQuery;
+                likesQuery.Construct(10, 10, 30, "\"pizza\"");
+                likesQuery.Execute(version);
+
+                readerResult = users.size() == 2 && bob.xLoc == 20 && bob.yLoc == 20
+                    && likesQuery.GetResults().size() == 1 && likesQuery.GetResults()[0] == aliceKey
+                    && version.IsNullUserRecord(version.LookupUserRecordByKey(carolKey));
+            }
+        }));
+    }
+
+    for (int i = 0; i < 20 && result; i++)
+    {
+        DatabaseSnapshot previous = database->AcquireSnapshot();
+        result = database->MoveUser(bobKey, -500 - i, 300) && database->PublishSnapshot();
+
+        // Moving a user only rebuilds the users and spatial parts
+        DatabaseSnapshot current = database->AcquireSnapshot();
+        const MappedDatabaseImage &previousImage = previous->GetImage();
+        const MappedDatabaseImage &image = current->GetImage();
+        result = result && image.parts[DatabasePart_Likes] == previousImage.parts[DatabasePart_Likes]
+            && image.parts[DatabasePart_Strings] == previousImage.parts[DatabasePart_Strings]
+            && image.parts[DatabasePart_Spatial] != previousImage.parts[DatabasePart_Spatial];
+    }
+    result = result && database->AddUser("\"Carol\"", "\"555-0102\"", 10, 10, "\"female\"")
+        && database->AddUserLike(bobKey, "\"pizza\"") && database->PublishSnapshot();
+    for (size_t i = 0; i < readers.size(); i++)
+    {
+        readers[i].join();
+    }
+
+    if (!result || !readerResults[0] || !readerResults[1])
+    {
+        LogError("Database version changed while it was being read\n");
+        return false;
+    }
+
+    DatabaseSnapshot latest = database->AcquireSnapshot();
+    const Database &version = latest->GetDatabase();
+    const UserRecord &bob = version.LookupUserRecordByKey(bobKey);
+    vector<HashKey> likes;
+    version.GetUserLikes(bob, likes);
+    vector<HashKey> phoneUsers;
+    version.LookupUsersByPhoneNumber("\"555-0102\"", phoneUsers);
+    if (latest->GetVersionNumber() != snapshot->GetVersionNumber() + 21 || bob.xLoc != -519
+        || likes.size() != 1 || version.IsNullUserRecord(version.LookupUserRecordByKey(carolKey))
+        || phoneUsers.size() != 1 || phoneUsers[0] != carolKey)
+    {
+        LogError("Latest database version doesn't have changes\n");
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// RunWriteAheadLogUnitTest: Makes logged changes to an empty database, with
+// a checkpoint part way through, and checks a second database recovers
+// them from the checkpoint and log
+//----------------------------------------------------------------------------
+static bool RunWriteAheadLogUnitTest()
+{
+    const char *logFileName = "likedb_unittest.wal";
+    const char *checkpointFileName = "likedb_unittest.snapshot";
+    remove(logFileName);
+    remove(checkpointFileName);
+
+    Injector<Database> injector(getDatabaseComponent());
+    Database *database(injector);
+    database->Initialize();
+
+    HashKey aliceKey = database->GenerateHash("\"Alice\"");
+    HashKey bobKey = database->GenerateHash("\"Bob\"");
+    HashKey pizzaHash = database->GenerateHash("\"pizza\"");
+
+    bool result = database->OpenLog(logFileName, checkpointFileName)
+        && database->AddUser("\"Alice\"", "\"555-0100\"", 10, 10, "\"female\"")
+        && database->AddUser("\"Bob\"", "\"555-0101\"", 20, 20, "\"male\"")
+        && database->AddUserLike(aliceKey, "\"pizza\"")
+        && database->AddUserLike(aliceKey, "\"tacos\"")
+        && database->CommitLog()
+        && database->Checkpoint()
+        && database->MoveUser(bobKey, -500, 300)
+        && database->AddUserLike(bobKey, "\"pizza\"")
+        && database->RemoveUserLike(aliceKey, pizzaHash)
+        && !database->RemoveUserLike(aliceKey, pizzaHash)
+        && database->CommitLog();
+
+    // Simulate a crash part way through writing a record
+    FILE *file = fopen(logFileName, "ab");
+    if (file != NULL)
+    {
+        fwrite("\x20\x00", 1, 2, file);
+        fclose(file);
+    }
+
+    Injector<Database> recoveredInjector(getDatabaseComponent());
+    Database *recovered(recoveredInjector);
+    recovered->Initialize();
+    result = result && recovered->LoadSnapshot(checkpointFileName)
+        && recovered->OpenLog(logFileName, checkpointFileName);
+
+    // Likes recovered before the like index is enabled are indexed
+    recovered->EnableLikeIndex();
+
+    remove(logFileName);
+    remove(checkpointFileName);
+
+    if (!result)
+    {
+        LogError("Write-ahead log changes failed\n");
+        return false;
+    }
+
+    const UserRecord &bob = recovered->LookupUserRecordByKey(bobKey);
+    vector<HashKey> likes;
+    recovered->GetUserLikes(recovered->LookupUserRecordByKey(aliceKey), likes);
+    if (recovered->IsNullUserRecord(bob) || bob.xLoc != -500 || bob.yLoc != 300
+        || likes.size() != 1 || likes[0] != recovered->GenerateHash("\"tacos\""))
+    {
+        LogError("Write-ahead log changes not recovered\n");
+        return false;
+    }
+
+    vector<HashKey> users;
+    recovered->QueryUsersInRange(20, 20, 5, users);
+    recovered->QueryUsersInRange(-500, 300, 0, bob.genderHash, users);
+    recovered->LookupUsersByLike("\"pizza\"", users);
+    if (users.size() != 2 || users[0] != bobKey || users[1] != bobKey)
+    {
+        LogError("Write-ahead log changes not indexed\n");
+        return false;
+    }
+
+    return true;
+}